@@ -0,0 +1,159 @@
+#version 450 core
+// Culls the terrain leaves against the view frustum and the planet horizon, and appends the visible ones to the
+// instance buffer in the layout of PatchInfo. The instance counts of the terrain and water indirect draws are
+// accumulated in the draw commands, which the CPU resets every frame. The slots of the visible leaves are also
+// appended to the visible leaves, which the CPU reads back a few frames later to acquire their tiles.
+
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+// Must match TerrainLeaf in TerrainRenderer.h
+struct TerrainLeaf {
+	dmat4 quadCorners;
+	mat4 quadNormals;
+	dvec4 boundCorners[8];
+	vec4 textureCoords;
+	ivec4 neighbourDivisions;
+	vec3 debug;
+	int textureIndex;
+	vec2 heightRange;
+	float minHeight;
+	int used;
+};
+
+struct DrawElementsIndirectCommand {
+	uint count;
+	uint instanceCount;
+	uint firstIndex;
+	uint baseVertex;
+	uint baseInstance;
+};
+
+layout (std430, binding = 5) readonly buffer TerrainLeaves
+{
+	TerrainLeaf leaves[];
+};
+
+// PatchInfo is written as raw words, since its C++ layout is tightly packed rather than std430.
+layout (std430, binding = 6) writeonly buffer PatchInstances
+{
+	float instanceData[];
+};
+
+layout (std430, binding = 7) buffer DrawCommands
+{
+	DrawElementsIndirectCommand drawCommands[]; // [0] terrain, [1] water.
+};
+
+layout (std430, binding = 8) buffer VisibleLeaves
+{
+	uint visibleLeafCount;
+	uint visibleLeaves[];
+};
+
+uniform dmat4 localToScreen;
+uniform dvec3 localCameraPosition;
+uniform double invHorizonRadius;
+uniform double scaleFactor;
+uniform int leafCount;
+uniform int instanceStride; // sizeof(PatchInfo) in words.
+
+// Same as Planet::horizonOcclusion
+bool horizonOcclusion(dvec3 localViewer, dvec3 localPoint) {
+	dvec3 v = localViewer * invHorizonRadius;
+	dvec3 t = localPoint * invHorizonRadius;
+	dvec3 vt = t - v;
+	dvec3 vc = -v;
+
+	double vtDotVc = dot(vt, vc);
+	double vtLenSq = dot(vt, vt);
+	double vcLenSq = dot(vc, vc);
+
+	return (vtDotVc * vtDotVc) / vtLenSq > vcLenSq - 1.0 && vtDotVc > vcLenSq - 1.0;
+}
+
+bool isVisible(TerrainLeaf leaf) {
+	// Test the bounds against the side planes in clip space. Each plane is a half-space in homogeneous coordinates,
+	// so this also holds for corners behind the camera.
+	ivec4 outsideCount = ivec4(0); // The number of corners outside the left, right, bottom and top planes.
+
+	for (int i = 0; i < 8; i++) {
+		dvec4 p = localToScreen * dvec4(leaf.boundCorners[i].xyz * scaleFactor, 1.0);
+		outsideCount += ivec4(bvec4(p.x < -p.w, p.x > p.w, p.y < -p.w, p.y > p.w));
+	}
+
+	if (any(equal(outsideCount, ivec4(8)))) {
+		return false;
+	}
+
+	// Only the top of the bounds needs to be behind the horizon, as in Planet::getVisibility
+	return !(horizonOcclusion(localCameraPosition, leaf.boundCorners[4].xyz)
+		&& horizonOcclusion(localCameraPosition, leaf.boundCorners[5].xyz)
+		&& horizonOcclusion(localCameraPosition, leaf.boundCorners[6].xyz)
+		&& horizonOcclusion(localCameraPosition, leaf.boundCorners[7].xyz));
+}
+
+void writeMatrix(uint offset, mat4 m) {
+	for (int i = 0; i < 4; i++) {
+		for (int j = 0; j < 4; j++) {
+			instanceData[offset + i * 4 + j] = m[i][j];
+		}
+	}
+}
+
+// Offsets must match PatchInfo in TerrainRenderer.h
+void writePatch(uint instance, TerrainLeaf leaf, mat4 quadCorners, mat4 quadNormals) {
+	uint offset = instance * uint(instanceStride);
+
+	instanceData[offset + 0] = leaf.debug.x;
+	instanceData[offset + 1] = leaf.debug.y;
+	instanceData[offset + 2] = leaf.debug.z;
+	instanceData[offset + 3] = intBitsToFloat(leaf.textureIndex);
+
+	for (int i = 0; i < 4; i++) {
+		instanceData[offset + 4 + i] = intBitsToFloat(leaf.neighbourDivisions[i]);
+		instanceData[offset + 8 + i] = leaf.textureCoords[i];
+	}
+
+	instanceData[offset + 12] = leaf.heightRange.x;
+	instanceData[offset + 13] = leaf.heightRange.y;
+
+	writeMatrix(offset + 14, quadCorners);
+	writeMatrix(offset + 30, quadNormals);
+}
+
+void main(void) {
+	uint index = gl_GlobalInvocationID.x;
+
+	if (index >= uint(leafCount)) {
+		return;
+	}
+
+	if (leaves[index].used == 0) {
+		return; // An unused slot.
+	}
+
+	TerrainLeaf leaf = leaves[index];
+
+	if (!isVisible(leaf)) {
+		return;
+	}
+
+	visibleLeaves[atomicAdd(visibleLeafCount, 1u)] = index;
+
+	dmat4 corners = leaf.quadCorners;
+	for (int i = 0; i < 4; i++) {
+		corners[i].xyz *= scaleFactor;
+	}
+
+	// Transformed in double precision, as on the CPU, since the local coordinates are large.
+	mat4 quadCorners = mat4(localToScreen * corners);
+	mat4 quadNormals = mat4(localToScreen * dmat4(leaf.quadNormals));
+
+	uint terrainInstance = drawCommands[0].baseInstance + atomicAdd(drawCommands[0].instanceCount, 1u);
+	writePatch(terrainInstance, leaf, quadCorners, quadNormals);
+
+	if (leaf.minHeight <= 0.0) {
+		uint waterInstance = drawCommands[1].baseInstance + atomicAdd(drawCommands[1].instanceCount, 1u);
+		writePatch(waterInstance, leaf, quadCorners, quadNormals);
+	}
+}
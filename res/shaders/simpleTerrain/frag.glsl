@@ -2,6 +2,7 @@
 
 in vec3 fs_debug;
 in flat int fs_textureIndex;
+in flat vec2 fs_heightRange;
 in flat ivec4 fs_neighbourDivisions;
 
 in vec2 fs_vertexPosition;
@@ -24,7 +25,10 @@ uniform float elevationScale;
 uniform float planetRadius;
 uniform float scaleFactor;
 uniform bool renormalizeSphere;
-uniform sampler2DArray heightSampler;
+#include "simpleTerrain/tile.glsl"
+uniform samplerCube climateSampler; // Temperature, moisture and water by local direction, see ClimateMap.
+uniform samplerCube biomeSampler; // Life zone colour by local direction, see ClimateMap.
+uniform bool climateMapEnabled;
 
 uniform bool overlayDebug;
 uniform bool showDebug;
@@ -35,6 +39,10 @@ out vec3 outNormal;
 out vec3 outPosition;
 out vec3 outGlow;
 
+vec4 sampleTile(vec2 texturePosition) {
+    return sampleTile(texturePosition, fs_textureIndex, fs_heightRange);
+}
+
 vec4 getInterp(vec2 pos) {
     vec4 uvUV = vec4(pos.xy, vec2(1.0) - pos.xy);
     return uvUV.xzzx * uvUV.yyww;
@@ -42,7 +50,7 @@ vec4 getInterp(vec2 pos) {
 
 vec4 getHeightmap(vec2 offset) {
     vec2 pos = fs_texturePosition + offset;
-    vec4 heightmap = texture(heightSampler, vec3(pos, fs_textureIndex)) * elevationScale * scaleFactor;
+    vec4 heightmap = sampleTile(pos) * elevationScale * scaleFactor;
     vec4 interp = getInterp(pos);
 
     if (renormalizeSphere) {
@@ -68,14 +76,25 @@ void main(void) {
 
     //vec3 screenNormal = normalize(cross(hm00 - hm10, hm01 - hm00));
 
-    vec3 worldNormal = normalize(texture(heightSampler, vec3(fs_texturePosition, fs_textureIndex)).xyz);
+    vec3 worldNormal = normalize(sampleTile(fs_texturePosition).xyz);
     // vec3 worldPosition = (screenToLocal * fs_quadCorners * fs_interp).xyz;
 
-    float h = texture(heightSampler, vec3(fs_texturePosition, fs_textureIndex)).w;
+    float h = sampleTile(fs_texturePosition).w;
     // vec3 colour = (h >= -1.0 && h <= 1.0) ? (h > 0.0 ? vec3(pow(h, 3.0)) : vec3(0.5, 0.6, 1.0) * (1.0 - abs(h))) : vec3(1.0, 0.3, 0.3);
 
     vec3 colour = h >= 0.0 ? vec3(1.0) : vec3(0.5);
 
+    if (climateMapEnabled && h >= 0.0) {
+        vec3 sphereVector = normalize((screenToLocal * fs_quadNormals * fs_interp).xyz);
+        vec4 climate = texture(climateSampler, sphereVector);
+        vec4 biome = texture(biomeSampler, sphereVector);
+        colour = mix(colour, biome.rgb, biome.a); // Alpha is zero where the map has no life zone.
+
+        // Wet ground is darker than dry ground, and the coldest ground is covered in snow.
+        colour *= mix(1.1, 0.8, climate.y);
+        colour = mix(colour, vec3(0.95), smoothstep(0.15, 0.05, climate.x));
+    }
+
     //vec3 colour = fs_debug;
 
     if (overlayDebug) {
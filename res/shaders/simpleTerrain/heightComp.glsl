@@ -1,4 +1,6 @@
 #version 430 core
+// Any change to the height function in this shader must be mirrored in CpuTileGenerator.cpp, which
+// reproduces it on the CPU.
 
 layout(local_size_x = 16, local_size_y = 16, local_size_z = 1) in;
 
@@ -12,15 +14,43 @@ layout (std430, binding = 2) writeonly buffer PointBufferOutput
 	vec4 pointBufferOutput[];
 };
 
+#define HEIGHT_GRID_SIZE 4
+
+struct TileHeightRange {
+	uvec2 range; // Ordered encoding of the min and max height of the whole tile.
+	uvec2 grid[HEIGHT_GRID_SIZE * HEIGHT_GRID_SIZE]; // Ordered encoding of the min and max height of each cell of a 4x4 grid over the tile, row major.
+};
+
+layout (std430, binding = 3) buffer TileHeightRanges
+{
+	TileHeightRange tileHeightRanges[]; // One per texture array layer.
+};
+
+struct TileGenerationInfo {
+	mat4 quadNormals;
+	mat4 quadCorners;
+	int textureIndex;
+};
+
+layout (std430, binding = 4) readonly buffer TileBatch
+{
+	TileGenerationInfo tileBatch[]; // One tile per work group layer (gl_WorkGroupID.z).
+};
+
 writeonly uniform image2DArray tileTexture;
+writeonly uniform image2DArray scratchTexture; // Packed texels only. Unpacked tiles, packed by packComp.glsl once the height range is known.
+
+shared uint groupMinHeight;
+shared uint groupMaxHeight;
+shared uint cellMinHeight[HEIGHT_GRID_SIZE * HEIGHT_GRID_SIZE];
+shared uint cellMaxHeight[HEIGHT_GRID_SIZE * HEIGHT_GRID_SIZE];
 
 uniform bool computePointBuffers;
+uniform bool packedTexels;
 uniform int pointBufferSize;
-uniform int textureIndex;
+uniform int textureSize;
 uniform float planetRadius;
 uniform float elevationScale;
-uniform mat4 quadNormals;
-uniform mat4 quadCorners;
 
 //	Simplex 3D Noise
 //	by Ian McEwan, Ashima Arts
@@ -161,6 +191,12 @@ float getHeight(vec3 coord) {
     return clamp(height, -1.0, 1.0);
 }
 
+// Map the float bits to an unsigned integer with the same ordering, so that atomicMin/atomicMax can be used.
+uint encodeOrderedHeight(float height) {
+    uint bits = floatBitsToUint(height);
+    return (bits & 0x80000000u) != 0u ? ~bits : (bits | 0x80000000u);
+}
+
 vec3 getSurfacePosition(float height, vec3 n, vec4 interp) {
     return n + n * (elevationScale / planetRadius) * height;
     //return (quadCorners * interp).xyz;
@@ -168,6 +204,9 @@ vec3 getSurfacePosition(float height, vec3 n, vec4 interp) {
 
 void main(void) {
     if (!computePointBuffers) { // Computing regular tile data.
+        mat4 quadNormals = tileBatch[gl_WorkGroupID.z].quadNormals;
+        int textureIndex = tileBatch[gl_WorkGroupID.z].textureIndex;
+
         ivec3 storePos = ivec3(gl_GlobalInvocationID.xy, textureIndex);
         vec2 quadPosition = vec2(gl_GlobalInvocationID.xy) / vec2(gl_WorkGroupSize.xy * gl_NumWorkGroups.xy);
 
@@ -196,7 +235,43 @@ void main(void) {
         //    normal = s00;
         //}
 
-        imageStore(tileTexture, storePos, vec4(normal, n00));
+        // Reduce the height range of the tile and of each grid cell within the work group first, to avoid
+        // contention on the global atomics. A work group may overlap several cells if the tile is small.
+        if (gl_LocalInvocationIndex == 0) {
+            groupMinHeight = 0xFFFFFFFFu;
+            groupMaxHeight = 0u;
+        }
+        if (gl_LocalInvocationIndex < HEIGHT_GRID_SIZE * HEIGHT_GRID_SIZE) {
+            cellMinHeight[gl_LocalInvocationIndex] = 0xFFFFFFFFu;
+            cellMaxHeight[gl_LocalInvocationIndex] = 0u;
+        }
+        barrier();
+
+        if (!isnan(n00) && all(lessThan(gl_GlobalInvocationID.xy, uvec2(textureSize)))) {
+            uvec2 cell = min(gl_GlobalInvocationID.xy * HEIGHT_GRID_SIZE / uint(textureSize), uvec2(HEIGHT_GRID_SIZE - 1));
+            uint cellIndex = cell.y * HEIGHT_GRID_SIZE + cell.x;
+            uint key = encodeOrderedHeight(n00);
+            atomicMin(groupMinHeight, key);
+            atomicMax(groupMaxHeight, key);
+            atomicMin(cellMinHeight[cellIndex], key);
+            atomicMax(cellMaxHeight[cellIndex], key);
+        }
+        barrier();
+
+        if (gl_LocalInvocationIndex == 0 && groupMinHeight <= groupMaxHeight) {
+            atomicMin(tileHeightRanges[textureIndex].range.x, groupMinHeight);
+            atomicMax(tileHeightRanges[textureIndex].range.y, groupMaxHeight);
+        }
+        if (gl_LocalInvocationIndex < HEIGHT_GRID_SIZE * HEIGHT_GRID_SIZE && cellMinHeight[gl_LocalInvocationIndex] <= cellMaxHeight[gl_LocalInvocationIndex]) {
+            atomicMin(tileHeightRanges[textureIndex].grid[gl_LocalInvocationIndex].x, cellMinHeight[gl_LocalInvocationIndex]);
+            atomicMax(tileHeightRanges[textureIndex].grid[gl_LocalInvocationIndex].y, cellMaxHeight[gl_LocalInvocationIndex]);
+        }
+
+        if (packedTexels) {
+            imageStore(scratchTexture, ivec3(gl_GlobalInvocationID.xy, gl_WorkGroupID.z), vec4(normal, n00));
+        } else {
+            imageStore(tileTexture, storePos, vec4(normal, n00));
+        }
     } else { // computing point data in SSBOs
 
         // [63 x 1 x 1] & [16 x 16 x 1]
@@ -0,0 +1,60 @@
+#version 430 core
+// Packs the batch of tiles generated by heightComp.glsl into the texture array. The layout must match TileData::packTexels.
+
+layout(local_size_x = 16, local_size_y = 16, local_size_z = 1) in;
+
+struct TileHeightRange {
+	uvec2 range;
+	uvec2 grid[16];
+};
+
+layout (std430, binding = 3) readonly buffer TileHeightRanges
+{
+	TileHeightRange tileHeightRanges[];
+};
+
+struct TileGenerationInfo {
+	mat4 quadNormals;
+	mat4 quadCorners;
+	int textureIndex;
+};
+
+layout (std430, binding = 4) readonly buffer TileBatch
+{
+	TileGenerationInfo tileBatch[];
+};
+
+layout (rgba32f) readonly uniform image2DArray scratchTexture;
+layout (rgba16) writeonly uniform image2DArray tileTexture;
+
+uniform int textureSize;
+
+float decodeOrderedHeight(uint key) {
+    return uintBitsToFloat((key & 0x80000000u) != 0u ? (key & 0x7FFFFFFFu) : ~key);
+}
+
+vec2 encodeOctahedral(vec3 n) {
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    if (n.z < 0.0) {
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return n.xy * 0.5 + 0.5;
+}
+
+void main(void) {
+    ivec2 pos = ivec2(gl_GlobalInvocationID.xy);
+    if (pos.x >= textureSize || pos.y >= textureSize) {
+        return;
+    }
+
+    int textureIndex = tileBatch[gl_WorkGroupID.z].textureIndex;
+    vec4 texel = imageLoad(scratchTexture, ivec3(pos, gl_WorkGroupID.z));
+    float minHeight = decodeOrderedHeight(tileHeightRanges[textureIndex].range.x);
+    float maxHeight = decodeOrderedHeight(tileHeightRanges[textureIndex].range.y);
+    float heightRange = maxHeight - minHeight;
+
+    float height = (heightRange > 0.0 && !isnan(texel.w)) ? (texel.w - minHeight) / heightRange : 0.0;
+    vec2 normal = any(isnan(texel.xyz)) || dot(texel.xyz, texel.xyz) == 0.0 ? vec2(0.5) : encodeOctahedral(texel.xyz);
+
+    imageStore(tileTexture, ivec3(pos, textureIndex), vec4(height, normal, 1.0));
+}
@@ -0,0 +1,38 @@
+// Sampling of the terrain tile texture array, shared by the terrain and water shaders. Include it before any uniform
+// named textureSize, which would hide the built-in function.
+
+uniform sampler2DArray heightSampler;
+uniform bool packedTexels;
+
+// Decode a packed texel (see TileData::packTexels) to (normal xyz, height w).
+vec4 decodeTileTexel(vec4 texel, vec2 heightRange) {
+    vec2 e = texel.yz * 2.0 - 1.0;
+    vec3 normal = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-normal.z, 0.0);
+    normal.xy += vec2(normal.x >= 0.0 ? -t : t, normal.y >= 0.0 ? -t : t);
+    return vec4(normalize(normal), mix(heightRange.x, heightRange.y, texel.x));
+}
+
+// Sample the tile texture, bilinearly filtered, as (normal xyz, height w).
+vec4 sampleTile(vec2 texturePosition, int textureIndex, vec2 heightRange) {
+    if (!packedTexels) {
+        return texture(heightSampler, vec3(texturePosition, textureIndex));
+    }
+
+    // Octahedral normals fold over at the edges of the encoding, so interpolating the encoded values between texels
+    // on either side of a fold gives a normal unrelated to both. The four texels are decoded first, and filtered after.
+    ivec2 size = textureSize(heightSampler, 0).xy;
+    vec2 position = texturePosition * vec2(size) - 0.5;
+    vec2 f = fract(position);
+    ivec2 i = ivec2(floor(position));
+    ivec2 i0 = clamp(i, ivec2(0), size - 1); // Clamped to the edge, as the sampler is.
+    ivec2 i1 = clamp(i + 1, ivec2(0), size - 1);
+
+    vec4 t00 = decodeTileTexel(texelFetch(heightSampler, ivec3(i0.x, i0.y, textureIndex), 0), heightRange);
+    vec4 t10 = decodeTileTexel(texelFetch(heightSampler, ivec3(i1.x, i0.y, textureIndex), 0), heightRange);
+    vec4 t01 = decodeTileTexel(texelFetch(heightSampler, ivec3(i0.x, i1.y, textureIndex), 0), heightRange);
+    vec4 t11 = decodeTileTexel(texelFetch(heightSampler, ivec3(i1.x, i1.y, textureIndex), 0), heightRange);
+
+    vec4 texel = mix(mix(t00, t10, f.x), mix(t01, t11, f.x), f.y);
+    return vec4(normalize(texel.xyz), texel.w);
+}
@@ -9,6 +9,7 @@ in vec3 vs_debug;
 in int vs_textureIndex;
 in ivec4 vs_neighbourDivisions;
 in vec4 vs_textureCoords;
+in vec2 vs_heightRange;
 
 in mat4 vs_quadCorners;
 in mat4 vs_quadNormals;
@@ -17,7 +18,7 @@ uniform mat4 invViewProjectionMatrix;
 uniform mat4 screenToLocal;
 uniform mat4 localToScreen;
 
-uniform sampler2DArray heightSampler;
+#include "simpleTerrain/tile.glsl"
 uniform int textureSize;
 uniform int texturePadding;
 
@@ -32,6 +33,7 @@ uniform int debugInt;
 out float fs_quadSize;
 out vec3 fs_debug;
 out flat int fs_textureIndex;
+out flat vec2 fs_heightRange;
 
 out vec2 fs_vertexPosition;
 out vec2 fs_texturePosition;
@@ -42,6 +44,10 @@ out vec4 fs_interp;
 
 out float fs_flogz;
 
+vec4 sampleTile(vec2 texturePosition) {
+    return sampleTile(texturePosition, vs_textureIndex, vs_heightRange);
+}
+
 vec4 getInterpolatedEdgeHeight(float u, float v, bool flipped) {
     u = clamp(u, 0.0, 1.0);
     float s = 8.0;
@@ -64,12 +70,12 @@ vec4 getInterpolatedEdgeHeight(float u, float v, bool flipped) {
             tp1 = vec2(b, v);
         }
 
-        vec4 hm0 = texture(heightSampler, vec3(vs_textureCoords.xy + tp0 * vs_textureCoords.zw, vs_textureIndex));
-        vec4 hm1 = texture(heightSampler, vec3(vs_textureCoords.xy + tp1 * vs_textureCoords.zw, vs_textureIndex));
+        vec4 hm0 = sampleTile(vs_textureCoords.xy + tp0 * vs_textureCoords.zw);
+        vec4 hm1 = sampleTile(vs_textureCoords.xy + tp1 * vs_textureCoords.zw);
 
         edgeHeight = interp * hm0 + (1.0 - interp) * hm1;
     } else {
-        edgeHeight = texture(heightSampler, vec3(vs_textureCoords.xy + vs_vertexPosition.xy * vs_textureCoords.zw, vs_textureIndex));
+        edgeHeight = sampleTile(vs_textureCoords.xy + vs_vertexPosition.xy * vs_textureCoords.zw);
     }
 
     return edgeHeight;
@@ -97,7 +103,7 @@ void main(void) {
     //         heightmap = getInterpolatedEdgeHeight(vs_vertexPosition.x, 0.0, true);
     //     }
     // } else {
-        heightmap = texture(heightSampler, vec3(texturePosition, vs_textureIndex));
+        heightmap = sampleTile(texturePosition);
     // }
     
     float height = heightmap.w * elevationScale * scaleFactor; // height is causing cracking
@@ -119,6 +125,7 @@ void main(void) {
     fs_quadSize = vs_quadSize;
     fs_debug = vs_debug;
     fs_textureIndex = vs_textureIndex;
+    fs_heightRange = vs_heightRange;
     fs_texturePosition = texturePosition;
     uvUV = vec4(fs_texturePosition.xy, vec2(1.0) - fs_texturePosition.xy);
     interp = uvUV.xzzx * uvUV.yyww;
@@ -2,6 +2,7 @@
 
 in vec3 fs_debug;
 in flat int fs_textureIndex;
+in flat vec2 fs_heightRange;
 in flat ivec4 fs_neighbourDivisions;
 
 in vec2 fs_vertexPosition;
@@ -24,7 +25,7 @@ uniform float elevationScale;
 uniform float planetRadius;
 uniform float scaleFactor;
 uniform bool renormalizeSphere;
-uniform sampler2DArray heightSampler;
+#include "simpleTerrain/tile.glsl"
 
 uniform bool overlayDebug;
 uniform bool showDebug;
@@ -35,6 +36,10 @@ out vec3 outPosition;
 out vec3 outSpecularEmission;
 out vec3 outGlow;
 
+vec4 sampleTile(vec2 texturePosition) {
+    return sampleTile(texturePosition, fs_textureIndex, fs_heightRange);
+}
+
 vec4 getInterp(vec2 pos) {
     vec4 uvUV = vec4(pos.xy, vec2(1.0) - pos.xy);
     return uvUV.xzzx * uvUV.yyww;
@@ -42,7 +47,7 @@ vec4 getInterp(vec2 pos) {
 
 vec4 getHeightmap(vec2 offset) {
     vec2 pos = fs_texturePosition + offset;
-    vec4 heightmap = texture(heightSampler, vec3(pos, fs_textureIndex)) * elevationScale * scaleFactor;
+    vec4 heightmap = sampleTile(pos) * elevationScale * scaleFactor;
     vec4 interp = getInterp(pos);
 
     if (renormalizeSphere) {
@@ -66,7 +71,7 @@ void main(void) {
     vec3 worldNormal = normalize((screenToLocal * fs_quadNormals * fs_interp).xyz);
     //vec3 worldPosition = (screenToLocal * fs_quadCorners * fs_interp).xyz;
 
-    float depth = pow(min(abs(texture(heightSampler, vec3(fs_texturePosition, fs_textureIndex)).a) * 6.0, 1.0), 1.0);
+    float depth = pow(min(abs(sampleTile(fs_texturePosition).a) * 6.0, 1.0), 1.0);
 
     vec3 colour = vec3(0.2, 0.3, 0.7) * (1.0 - depth * 0.3);
 
@@ -2,6 +2,7 @@
 #include "core/application/Application.h"
 #include "core/engine/renderer/DebugRenderer.h"
 #include "core/engine/renderer/ScreenRenderer.h"
+#include "core/engine/renderer/ReadbackBuffer.h"
 #include "core/engine/scene/SceneGraph.h"
 #include "core/event/EventHandler.h"
 #include "core/util/ResourceHandler.h"
@@ -22,6 +23,7 @@ namespace Application {
 	SceneGraph* sceneGraph = NULL;
 	DebugRenderer* debugRenderer = NULL;
 	ScreenRenderer* screenRenderer = NULL;
+	ReadbackBuffer* readbackBuffer = NULL;
 	Logger* logger = NULL;
 
 	SDL_Window* window = NULL;
@@ -30,6 +32,8 @@ namespace Application {
 	int windowWidth = 800;
 	int windowHeight = 600;
 
+	uint64 frameIndex = 0;
+
 	void(*preRenderCallback)(double, double);
 	void(*postRenderCallback)(double, double);
 	void(*preUpdateCallback)(double);
@@ -42,6 +46,7 @@ namespace Application {
 		sceneGraph = new SceneGraph();
 		debugRenderer = new DebugRenderer();
 		screenRenderer = new ScreenRenderer();
+		readbackBuffer = new ReadbackBuffer(16 * 1024 * 1024);
 		logger = new Logger();
 	}
 
@@ -97,6 +102,7 @@ namespace Application {
 			SCREEN_RENDERER.setResolution(uvec2(windowWidth, windowHeight));
 		});
 
+		READBACK_BUFFER.init();
 		INPUT_HANDLER.init();
 		SCENE_GRAPH.init();
 		DEBUG_RENDERER.init();
@@ -193,6 +199,7 @@ namespace Application {
 			screenRenderer->render(partialTicks, fdt);
 
 			SDL_GL_SwapWindow(window);
+			frameIndex++;
 
 			sleep(1);
 		}
@@ -205,6 +212,7 @@ namespace Application {
 		//delete sceneGraph;
 		//delete debugRenderer;
 		//delete screenRenderer;
+		//delete readbackBuffer;
 		//delete logger;
 
 	}
@@ -237,6 +245,10 @@ namespace Application {
 		return 0;
 	}
 
+	uint64 Application::getFrameIndex() {
+		return frameIndex;
+	}
+
 	void Application::getWindowSize(int32* width, int32* height) {
 		if (width != NULL) {
 			*width = windowWidth;
@@ -308,6 +320,10 @@ namespace Application {
 		return *screenRenderer;
 	}
 
+	ReadbackBuffer& getReadbackBuffer() {
+		return *readbackBuffer;
+	}
+
 	Logger& Application::getLogger() {
 		return *logger;
 	}
@@ -11,6 +11,7 @@ class InputHandler;
 class SceneGraph;
 class DebugRenderer;
 class ScreenRenderer;
+class ReadbackBuffer;
 class Logger;
 
 // Maybe duplicating these definitions isn't a good idea...?
@@ -24,6 +25,7 @@ typedef void* SDL_GLContext;
 #define SCENE_GRAPH Application::getSceneGraph()
 #define DEBUG_RENDERER Application::getDebugRenderer()
 #define SCREEN_RENDERER Application::getScreenRenderer()
+#define READBACK_BUFFER Application::getReadbackBuffer()
 #define LOGGER Application::getLogger()
 
 #define logInfo(str, ...) LOGGER.info(str, ##__VA_ARGS__)
@@ -70,6 +72,11 @@ namespace Application
 
 	int32 getExitCode();
 
+	/**
+	 * The number of frames rendered so far. Does not change while a frame is rendered.
+	 */
+	uint64 getFrameIndex();
+
 	void getWindowSize(int32* width, int32* height);
 
 //	void getMousePosition(int32* x, int32* y);
@@ -104,6 +111,8 @@ namespace Application
 
 	ScreenRenderer& getScreenRenderer();
 
+	ReadbackBuffer& getReadbackBuffer();
+
 	Logger& getLogger();
 };
 
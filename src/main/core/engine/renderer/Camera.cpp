@@ -16,6 +16,14 @@ Camera::Camera(float fov, float aspect, float near, float far):
 	this->setPerspective(fov, aspect, near, far);
 	this->viewChanged = true;
 	this->updateFrustum = true;
+
+	// Scale factor in OpenGL units per kilometer.
+	this->minScaleFactor = 0.001;
+	this->maxScaleFactor = 1000.0;
+	this->scaleFactor = 1.0;
+	this->prevScaleFactor = 1.0;
+	this->currScaleFactor = 1.0;
+	this->requestedScaleFactor = 0.0;
 }
 
 Camera::Camera(float left, float right, float bottom, float top, float near, float far):
@@ -24,6 +32,14 @@ Camera::Camera(float left, float right, float bottom, float top, float near, flo
 	this->setFrustum(left, right, bottom, top, near, far);
 	this->viewChanged = true;
 	this->updateFrustum = true;
+
+	// Scale factor in OpenGL units per kilometer.
+	this->minScaleFactor = 0.001;
+	this->maxScaleFactor = 1000.0;
+	this->scaleFactor = 1.0;
+	this->prevScaleFactor = 1.0;
+	this->currScaleFactor = 1.0;
+	this->requestedScaleFactor = 0.0;
 }
 
 Camera::~Camera() {
@@ -31,6 +47,8 @@ Camera::~Camera() {
 }
 
 void Camera::render(double partialTicks, double dt) {
+	this->scaleFactor = this->prevScaleFactor * (1.0 - partialTicks) + this->currScaleFactor * partialTicks;
+
 	if (this->viewChanged) {
 
 		float lenSq = dot(this->orientation, this->orientation);
@@ -41,7 +59,7 @@ void Camera::render(double partialTicks, double dt) {
 		this->invViewMatrix[0] = dvec4(this->viewAxis[0], 0.0);
 		this->invViewMatrix[1] = dvec4(this->viewAxis[1], 0.0);
 		this->invViewMatrix[2] = dvec4(this->viewAxis[2], 0.0);
-		this->invViewMatrix[3] = dvec4(vec3(0.0)/*this->position * double(Planet::scaleFactor)*/, 1.0);
+		this->invViewMatrix[3] = dvec4(vec3(0.0)/*this->position * this->scaleFactor*/, 1.0);
 		this->viewMatrix = inverse(this->invViewMatrix);
 		this->viewProjectionMatrix = this->projectionMatrix * this->viewMatrix;
 		this->invViewProjectionMatrix = inverse(this->viewProjectionMatrix);
@@ -106,6 +124,17 @@ void Camera::render(double partialTicks, double dt) {
 	}
 }
 
+void Camera::update(double dt) {
+	double scaleRate = 0.1;
+
+	this->prevScaleFactor = this->currScaleFactor;
+
+	if (this->requestedScaleFactor > 0.0) {
+		this->currScaleFactor = this->prevScaleFactor * (1.0 - scaleRate) + this->requestedScaleFactor * scaleRate;
+		this->requestedScaleFactor = 0.0;
+	}
+}
+
 void Camera::applyUniforms(ShaderProgram* shader) const {
 	if (shader != NULL) {
 		float fp = this->getFarPlane();
@@ -278,3 +307,11 @@ dmat4 Camera::getInvViewProjectionMatrix() const {
 Frustum* Camera::getFrustum() const {
 	return this->frustum;
 }
+
+double Camera::getScaleFactor() const {
+	return this->scaleFactor;
+}
+
+void Camera::requestScaleFactor(double scaleFactor) {
+	this->requestedScaleFactor = glm::max(this->requestedScaleFactor, glm::clamp(scaleFactor, this->minScaleFactor, this->maxScaleFactor));
+}
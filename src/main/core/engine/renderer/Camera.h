@@ -34,6 +34,13 @@ private:
 
 	Frustum* frustum;
 
+	double scaleFactor; // OpenGL units per kilometer for the frame being rendered. Interpolated between the last two updates.
+	double prevScaleFactor; // The scale factor of the previous update.
+	double currScaleFactor; // The scale factor of the latest update.
+	double requestedScaleFactor; // The largest scale factor requested since the last update, or zero if none was.
+	double minScaleFactor;
+	double maxScaleFactor;
+
 public:
 	// TODO: find closest and furthest parts of the scene, and position near/far plane accordingle.
 	// Maybe find distance to nearest and furthest pixels in postprocessing shader, and use these distances next frame
@@ -45,6 +52,11 @@ public:
 
 	void render(double partialTicks, double dt);
 
+	/**
+	 * Move the scale factor towards the largest one requested since the last update.
+	 */
+	void update(double dt);
+
 	void applyUniforms(ShaderProgram* shader) const;
 
 	dvec3 getPosition(bool ignoreFrustum = false) const;
@@ -102,5 +114,17 @@ public:
 	dmat4 getInvViewProjectionMatrix() const;
 
 	Frustum* getFrustum() const;
+
+	/**
+	 * The number of OpenGL units per kilometer that everything seen by this camera is rendered at this frame. Shared
+	 * by every object in the view, so that their positions are comparable in the depth and position buffers.
+	 */
+	double getScaleFactor() const;
+
+	/**
+	 * Ask for the scale factor to move towards the specified scale. Every body in the view requests the scale it
+	 * needs each update, and the largest, which is the closest body, wins.
+	 */
+	void requestScaleFactor(double scaleFactor);
 };
 
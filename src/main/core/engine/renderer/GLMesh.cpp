@@ -5,7 +5,8 @@
 
 
 InstanceBuffer::InstanceBuffer(int32 instanceSizeBytes, int32 instanceCount, int32 divisor, std::vector<InstanceAttribute> attributes):
-	instanceSizeBytes(instanceSizeBytes), instanceCount(instanceCount), divisor(divisor), attributes(attributes) {
+	instanceSizeBytes(instanceSizeBytes), instanceCount(instanceCount), divisor(divisor), attributes(attributes),
+	frameCount(0), currentFrame(0), frameInstancesUsed(0), mappedData(NULL), frameSync(NULL) {
 
 	glGenBuffers(1, &this->instanceBuffer);
 	glBindBuffer(GL_ARRAY_BUFFER, this->instanceBuffer);
@@ -13,6 +14,104 @@ InstanceBuffer::InstanceBuffer(int32 instanceSizeBytes, int32 instanceCount, int
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
+InstanceBuffer::InstanceBuffer(int32 instanceSizeBytes, int32 instanceCount, int32 divisor, std::vector<InstanceAttribute> attributes, int32 frameCount):
+	instanceSizeBytes(instanceSizeBytes), instanceCount(instanceCount), divisor(divisor), attributes(attributes),
+	frameCount(frameCount), currentFrame(0), frameInstancesUsed(0), mappedData(NULL), frameSync(NULL) {
+
+	assert(frameCount > 0);
+
+	this->frameSync = new GLsync[frameCount]();
+	this->allocate();
+}
+
+InstanceBuffer::~InstanceBuffer() {
+	if (this->frameCount > 0) {
+		this->release();
+		delete[] this->frameSync;
+	} else {
+		glDeleteBuffers(1, &this->instanceBuffer);
+	}
+}
+
+void InstanceBuffer::allocate() {
+	const uint32 flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	const int64 size = (int64) this->instanceSizeBytes * this->instanceCount * this->frameCount;
+
+	glCreateBuffers(1, &this->instanceBuffer);
+	glNamedBufferStorage(this->instanceBuffer, size, NULL, flags);
+	this->mappedData = static_cast<uint8*>(glMapNamedBufferRange(this->instanceBuffer, 0, size, flags));
+
+	if (this->mappedData == NULL) {
+		logError("Failed to persistently map instance buffer of %d instances", this->instanceCount * this->frameCount);
+	}
+}
+
+void InstanceBuffer::release() {
+	for (int i = 0; i < this->frameCount; i++) {
+		if (this->frameSync[i] != NULL) {
+			glClientWaitSync(this->frameSync[i], GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+			glDeleteSync(this->frameSync[i]);
+			this->frameSync[i] = NULL;
+		}
+	}
+
+	glUnmapNamedBuffer(this->instanceBuffer);
+	glDeleteBuffers(1, &this->instanceBuffer);
+	this->mappedData = NULL;
+}
+
+void InstanceBuffer::beginFrame() {
+	assert(this->frameCount > 0);
+
+	this->currentFrame = (this->currentFrame + 1) % this->frameCount;
+	this->frameInstancesUsed = 0;
+
+	GLsync& sync = this->frameSync[this->currentFrame];
+	if (sync != NULL) {
+		// Normally signalled long ago, unless the CPU is more than frameCount frames ahead of the GPU.
+		glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+		glDeleteSync(sync);
+		sync = NULL;
+	}
+}
+
+uint8* InstanceBuffer::reserveInstances(int32 instanceCount, int32* baseInstance) {
+	assert(this->frameCount > 0);
+
+	if (this->frameInstancesUsed + instanceCount > this->instanceCount) {
+		// Immutable storage can't be resized, so every frame is reallocated. Grow geometrically to make this rare.
+		// Waits for the draws already issued from this frame, so the reallocated frame starts out empty.
+		this->release();
+		this->instanceCount = glm::max(this->frameInstancesUsed + instanceCount, this->instanceCount * 2);
+		this->frameInstancesUsed = 0;
+		this->allocate();
+	}
+
+	*baseInstance = this->currentFrame * this->instanceCount + this->frameInstancesUsed;
+	this->frameInstancesUsed += instanceCount;
+
+	return this->mappedData + (int64) (*baseInstance) * this->instanceSizeBytes;
+}
+
+void InstanceBuffer::endFrame() {
+	assert(this->frameCount > 0);
+
+	GLsync& sync = this->frameSync[this->currentFrame];
+	if (sync != NULL) {
+		glDeleteSync(sync); // Signalled no later than the new fence.
+	}
+
+	sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+int32 InstanceBuffer::getInstanceCount() const {
+	return this->instanceCount;
+}
+
+uint32 InstanceBuffer::getBuffer() const {
+	return this->instanceBuffer;
+}
+
 void InstanceBuffer::uploadInstanceData(uint32 offset, uint32 size, void* data) {
 	glBindBuffer(GL_ARRAY_BUFFER, this->instanceBuffer);
 	glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
@@ -124,7 +223,7 @@ void GLMesh::reserveBuffers(int32 vertexBufferSize, int32 indexBufferSize) {
 
 }
 
-void GLMesh::draw(int32 instances, int32 offset, int32 count, InstanceBuffer* instanceBuffer) {
+void GLMesh::draw(int32 instances, int32 offset, int32 count, InstanceBuffer* instanceBuffer, int32 baseInstance) {
 
 	//glBindVertexArray(this->vertexArray);
 	//glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->indexBuffer);
@@ -149,7 +248,12 @@ void GLMesh::draw(int32 instances, int32 offset, int32 count, InstanceBuffer* in
 
 			if (this->indexCount > 0) { // If there is an index buffer, we want to draw elements
 				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->indexBuffer);
-				if (instances == 1) {   // If there is only one instance to draw
+				if (baseInstance > 0) { // If the instances start part way through the instance buffer
+					if (count > 0)
+						glDrawElementsInstancedBaseInstance(this->primitive, count, GL_UNSIGNED_INT, (void*)offset, instances, baseInstance);
+					else
+						glDrawElementsInstancedBaseInstance(this->primitive, this->indexCount, GL_UNSIGNED_INT, (void*)0, instances, baseInstance);
+				} else if (instances == 1) {   // If there is only one instance to draw
 					if (count > 0)      // draw 1 instance of the indices between "offset" and "offset + count" in the index array
 						glDrawElements(this->primitive, count, GL_UNSIGNED_INT, (void*)offset);
 					else                // draw 1 instance of the whole index buffer
@@ -162,7 +266,12 @@ void GLMesh::draw(int32 instances, int32 offset, int32 count, InstanceBuffer* in
 				}
 				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 			} else {                    // If there is no index buffer we want to draw arrays
-				if (instances == 1) {   // If there is only one instance to draw
+				if (baseInstance > 0) { // If the instances start part way through the instance buffer
+					if (count > 0)
+						glDrawArraysInstancedBaseInstance(this->primitive, offset, count, instances, baseInstance);
+					else
+						glDrawArraysInstancedBaseInstance(this->primitive, 0, this->vertexCount, instances, baseInstance);
+				} else if (instances == 1) {   // If there is only one instance to draw
 					if (count > 0)      // draw 1 instance of the vertices between "offset" and "offset + count" in the vertex array
 						glDrawArrays(this->primitive, offset, count);
 					else                // draw 1 instance of the whole vertex buffer
@@ -185,6 +294,27 @@ void GLMesh::draw(int32 instances, int32 offset, int32 count, InstanceBuffer* in
 	glBindVertexArray(0);
 }
 
+void GLMesh::drawIndirect(uint32 indirectBuffer, int32 offset, int32 drawCount, InstanceBuffer* instanceBuffer) {
+	if (drawCount <= 0 || this->vertexCount <= 0 || this->indexCount <= 0) {
+		return;
+	}
+
+	glBindVertexArray(vertexArray);
+	enableVertexAttribLayout(this->attributes, true);
+
+	if (instanceBuffer != NULL)
+		instanceBuffer->bind(true);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->indexBuffer);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+	glMultiDrawElementsIndirect(this->primitive, GL_UNSIGNED_INT, BUFFER_OFFSET(offset), drawCount, 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	enableVertexAttribLayout(this->attributes, false);
+	glBindVertexArray(0);
+}
+
 void GLMesh::setPrimitive(uint32 primitive) {
 	this->primitive = primitive;
 }
@@ -205,6 +335,10 @@ uint32 GLMesh::getPrimitive() const {
 	return this->primitive;
 }
 
+int32 GLMesh::getIndexCount() const {
+	return this->indexCount;
+}
+
 void GLMesh::bindVertexAttribLayout(VertexLayout layout) {
 	for (int i = 0; i < layout.attributes.size(); i++) {
 		VertexAttribute attrib = layout.attributes[i];
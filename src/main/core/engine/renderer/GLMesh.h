@@ -4,6 +4,8 @@
 
 #define BUFFER_OFFSET(i) ((char*)NULL + (i))
 
+typedef struct __GLsync* GLsync;
+
 class GLMesh;
 class InstanceBuffer;
 struct InstanceAttribute;
@@ -14,20 +16,71 @@ class InstanceBuffer {
 private:
 	uint32 instanceBuffer;
 	int32 instanceSizeBytes;
-	int32 instanceCount;
+	int32 instanceCount; // The number of instances per frame.
 	int32 divisor;
 	std::vector<InstanceAttribute> attributes;
 
+	int32 frameCount; // The number of frames the persistent buffer is split into. Zero if the buffer is not persistent.
+	int32 currentFrame; // The frame written to since the last beginFrame.
+	int32 frameInstancesUsed; // The number of instances of the current frame reserved since the last beginFrame.
+	uint8* mappedData; // Persistent mapping of the whole buffer. NULL if the buffer is not persistent.
+	GLsync* frameSync; // The fence after the last draw using each frame. NULL if the frame is not in use by the GPU.
+
+	void allocate();
+
+	void release();
+
 public:
 	InstanceBuffer(int32 instanceSizeBytes, int32 instanceCount, int32 divisor, std::vector<InstanceAttribute> attributes);
 
+	/**
+	 * Create a persistently mapped instance buffer, split into frameCount frames of instanceCount instances. Each frame
+	 * the instances are written directly to the mapping returned by reserveInstances, while the GPU may still be reading
+	 * the previous frames.
+	 */
+	InstanceBuffer(int32 instanceSizeBytes, int32 instanceCount, int32 divisor, std::vector<InstanceAttribute> attributes, int32 frameCount);
+
+	~InstanceBuffer();
+
 	void uploadInstanceData(uint32 offset, uint32 size, void* data);
 
+	/**
+	 * Persistent buffers only. Advance to the next frame, and wait for the GPU if it is still reading it. Called once
+	 * per frame, however many times instances are reserved in it.
+	 */
+	void beginFrame();
+
+	/**
+	 * Persistent buffers only. Reserve the next instanceCount instances of the current frame, and return their mapping.
+	 * The index of the first is written to baseInstance, to be passed as the base instance when drawing. If the frame
+	 * is full, every frame is grown, which waits for the GPU.
+	 */
+	uint8* reserveInstances(int32 instanceCount, int32* baseInstance);
+
+	/**
+	 * Persistent buffers only. Fence the draws using the current frame so far, so that it is not overwritten while in
+	 * use. May be called after each group of draws in a frame, since the last fence covers every draw before it.
+	 */
+	void endFrame();
+
+	int32 getInstanceCount() const;
+
+	uint32 getBuffer() const;
+
 	void bind(bool bind);
 
 	void enableAttributes(bool enabled);
 };
 
+// The layout of the commands read by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+	uint32 count;
+	uint32 instanceCount;
+	uint32 firstIndex;
+	uint32 baseVertex;
+	uint32 baseInstance;
+};
+
 struct InstanceAttribute {
 	int32 index;
 	int32 size;
@@ -63,7 +116,13 @@ public:
 
 	void reserveBuffers(int32 vertexBufferSize, int32 indexBufferSize);
 
-	void draw(int32 instances = 1, int32 offset = 0, int32 count = 0, InstanceBuffer* instanceBuffer = NULL);
+	void draw(int32 instances = 1, int32 offset = 0, int32 count = 0, InstanceBuffer* instanceBuffer = NULL, int32 baseInstance = 0);
+
+	/**
+	 * Draw the indexed mesh with the DrawElementsIndirectCommands starting at the byte offset into the indirect buffer,
+	 * which may have been written on the GPU. The commands must be tightly packed.
+	 */
+	void drawIndirect(uint32 indirectBuffer, int32 offset = 0, int32 drawCount = 1, InstanceBuffer* instanceBuffer = NULL);
 
 	void setPrimitive(uint32 primitive);
 
@@ -75,6 +134,8 @@ public:
 
 	uint32 getPrimitive() const;
 
+	int32 getIndexCount() const;
+
 	static void bindVertexAttribLayout(VertexLayout layout);
 
 	static void enableVertexAttribLayout(VertexLayout layout, bool enabled);
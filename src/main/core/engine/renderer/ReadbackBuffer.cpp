@@ -0,0 +1,187 @@
+#include "ReadbackBuffer.h"
+#include "core/application/Application.h"
+#include <GL/glew.h>
+
+#define READBACK_ALIGNMENT 16 // Enough for any pixel type, and for buffer copies.
+
+ReadbackBuffer::ReadbackBuffer(uint64 capacity) {
+	this->buffer = 0;
+	this->mappedData = NULL;
+	this->capacity = capacity;
+	this->head = 0;
+	this->numAllocations = 0;
+	this->numFailedAllocations = 0;
+}
+
+ReadbackBuffer::~ReadbackBuffer() {
+	for (int i = 0; i < this->regions.size(); i++) {
+		ReadbackRegion* region = this->regions[i];
+
+		if (region->sync != NULL && (i + 1 == this->regions.size() || this->regions[i + 1]->sync != region->sync)) {
+			glDeleteSync(region->sync); // Regions sharing a fence are contiguous, delete it with the last of them.
+		}
+
+		delete region;
+	}
+
+	this->regions.clear();
+
+	if (this->buffer != 0) {
+		glUnmapNamedBuffer(this->buffer);
+		glDeleteBuffers(1, &this->buffer);
+	}
+}
+
+void ReadbackBuffer::init() {
+	const uint32 flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+	glCreateBuffers(1, &this->buffer);
+	glNamedBufferStorage(this->buffer, this->capacity, NULL, flags | GL_CLIENT_STORAGE_BIT);
+	this->mappedData = static_cast<const uint8*>(glMapNamedBufferRange(this->buffer, 0, this->capacity, flags));
+
+	if (this->mappedData == NULL) {
+		logError("Failed to persistently map %.2f MiB readback buffer", this->capacity / (1024.0 * 1024.0));
+	} else {
+		logInfo("Created %.2f MiB persistently mapped readback buffer", this->capacity / (1024.0 * 1024.0));
+	}
+}
+
+ReadbackRegion* ReadbackBuffer::allocate(uint64 size) {
+	size = (size + READBACK_ALIGNMENT - 1) & ~(uint64) (READBACK_ALIGNMENT - 1);
+
+	this->reclaim();
+
+	uint64 offset;
+
+	if (this->mappedData == NULL || size > this->capacity) {
+		this->numFailedAllocations++;
+		return NULL;
+	}
+
+	if (this->regions.empty()) {
+		offset = 0; // Nothing is live, start again from the beginning so the largest possible region fits.
+	} else {
+		const uint64 tail = this->regions.front()->offset;
+
+		if (this->head > tail) { // Free space is after the head, and before the tail.
+			if (this->head + size <= this->capacity) {
+				offset = this->head;
+			} else if (size <= tail) {
+				offset = 0; // Wrap around
+			} else {
+				this->numFailedAllocations++;
+				return NULL;
+			}
+		} else { // Wrapped, free space is between the head and the tail.
+			if (this->head + size <= tail) {
+				offset = this->head;
+			} else {
+				this->numFailedAllocations++;
+				return NULL;
+			}
+		}
+	}
+
+	ReadbackRegion* region = new ReadbackRegion();
+	region->offset = offset;
+	region->size = size;
+	region->sync = NULL;
+	region->signalled = false;
+	region->released = false;
+
+	this->regions.push_back(region);
+	this->head = offset + size;
+	this->numAllocations++;
+	return region;
+}
+
+void ReadbackBuffer::submit() {
+	GLsync sync = NULL;
+
+	// Unsubmitted regions are always the newest ones.
+	for (auto it = this->regions.rbegin(); it != this->regions.rend() && (*it)->sync == NULL; it++) {
+		if (sync == NULL) {
+			sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		}
+
+		(*it)->sync = sync;
+	}
+}
+
+bool ReadbackBuffer::isReady(ReadbackRegion* region) {
+	if (region->signalled) {
+		return true;
+	}
+
+	if (region->sync == NULL) {
+		return false; // Not submitted yet.
+	}
+
+	int32 result;
+	glGetSynciv(region->sync, GL_SYNC_STATUS, sizeof(result), NULL, &result);
+
+	if (result == GL_SIGNALED) {
+		// Mark every region sharing the fence, to avoid querying it again.
+		for (int i = 0; i < this->regions.size(); i++) {
+			if (this->regions[i]->sync == region->sync) {
+				this->regions[i]->signalled = true;
+			}
+		}
+	}
+
+	return region->signalled;
+}
+
+const uint8* ReadbackBuffer::getData(const ReadbackRegion* region) const {
+	assert(region->signalled);
+	return this->mappedData + region->offset;
+}
+
+void ReadbackBuffer::release(ReadbackRegion* region) {
+	if (region != NULL) {
+		region->released = true;
+		this->reclaim();
+	}
+}
+
+void ReadbackBuffer::reclaim() {
+	while (!this->regions.empty() && this->regions.front()->released) {
+		ReadbackRegion* region = this->regions.front();
+		this->regions.pop_front();
+
+		if (region->sync != NULL && (this->regions.empty() || this->regions.front()->sync != region->sync)) {
+			glDeleteSync(region->sync); // No remaining region shares the fence.
+		}
+
+		delete region;
+	}
+}
+
+uint32 ReadbackBuffer::getBuffer() const {
+	return this->buffer;
+}
+
+uint64 ReadbackBuffer::getCapacity() const {
+	return this->capacity;
+}
+
+uint64 ReadbackBuffer::getUsedSize() const {
+	if (this->regions.empty()) {
+		return 0;
+	}
+
+	const uint64 tail = this->regions.front()->offset;
+	return this->head > tail ? this->head - tail : this->capacity - tail + this->head;
+}
+
+uint32 ReadbackBuffer::getNumRegions() const {
+	return this->regions.size();
+}
+
+uint64 ReadbackBuffer::getNumAllocations() const {
+	return this->numAllocations;
+}
+
+uint64 ReadbackBuffer::getNumFailedAllocations() const {
+	return this->numFailedAllocations;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "core/Core.h"
+
+typedef struct __GLsync* GLsync;
+
+struct ReadbackRegion {
+	uint64 offset; // The byte offset of the region within the buffer. Readback commands should write here.
+	uint64 size; // The number of bytes reserved for the region.
+	GLsync sync; // The fence signalled once the commands writing to this region complete. NULL until submitted. May be shared with other regions.
+	bool signalled; // True once the fence was seen signalled, so it doesn't need to be queried again.
+	bool released; // True once the owner is finished with the region. The space is reused once every older region is released.
+};
+
+/**
+ * Ring buffer for asynchronous transfers from video memory to system memory. The buffer is persistently
+ * and coherently mapped, so once a region's fence is signalled, its data can be read in place through
+ * getData, without mapping, unmapping or copying. The pointer stays valid until the region is released,
+ * so it may be handed to another thread, as long as the region is only released on the main thread.
+ *
+ * Usage: allocate a region, bind getBuffer() as GL_PIXEL_PACK_BUFFER (or copy into it) and write to the
+ * region's offset, then submit. Poll isReady, read getData, and release.
+ */
+class ReadbackBuffer {
+private:
+	uint32 buffer; // The OpenGL buffer handle.
+	const uint8* mappedData; // The persistent mapping of the whole buffer.
+	uint64 capacity; // The size of the buffer in bytes.
+	uint64 head; // The offset at which the next region is allocated, unless it needs to wrap around.
+	std::deque<ReadbackRegion*> regions; // The live regions in allocation order. The front is the oldest.
+
+	uint64 numAllocations; // Debug info
+	uint64 numFailedAllocations; // Debug info
+
+	/**
+	 * Free the released regions at the front of the ring.
+	 */
+	void reclaim();
+
+public:
+	ReadbackBuffer(uint64 capacity);
+
+	~ReadbackBuffer();
+
+	// Deleted copy constructor and assignment function
+	ReadbackBuffer(const ReadbackBuffer&) = delete;
+	ReadbackBuffer& operator=(const ReadbackBuffer&) = delete;
+
+	/**
+	 * Create and map the OpenGL buffer. Must be called after the OpenGL context is created.
+	 */
+	void init();
+
+	/**
+	 * Reserve a contiguous region of the specified number of bytes. Returns NULL if the ring does not
+	 * currently have enough free space, in which case the caller should try again in a later frame.
+	 */
+	ReadbackRegion* allocate(uint64 size);
+
+	/**
+	 * Insert a single fence after the readback commands for every region allocated since the last submit.
+	 */
+	void submit();
+
+	/**
+	 * Returns true if the commands writing to the region have completed, and its data may be read.
+	 */
+	bool isReady(ReadbackRegion* region);
+
+	/**
+	 * Get a pointer to the region's data within the persistent mapping. Only valid once isReady returns true,
+	 * and until the region is released.
+	 */
+	const uint8* getData(const ReadbackRegion* region) const;
+
+	/**
+	 * Return the region to the ring. The region must not be used after this. Regions may be released
+	 * in any order, including before they are ready, for example to cancel a request.
+	 */
+	void release(ReadbackRegion* region);
+
+	uint32 getBuffer() const;
+
+	uint64 getCapacity() const;
+
+	/**
+	 * The number of bytes between the oldest live region and the head, including released regions
+	 * that can't be reused yet.
+	 */
+	uint64 getUsedSize() const;
+
+	uint32 getNumRegions() const;
+
+	uint64 getNumAllocations() const;
+
+	uint64 getNumFailedAllocations() const;
+};
@@ -3,6 +3,7 @@
 #include "core/engine/renderer/ShaderProgram.h"
 #include "core/engine/renderer/GLMesh.h"
 #include "core/engine/renderer/FrameBuffer.h"
+#include "core/engine/renderer/ReadbackBuffer.h"
 #include "core/engine/renderer/ScreenRenderer.h"
 #include "core/engine/scene/SceneGraph.h"
 #include "core/util/Time.h"
@@ -15,8 +16,7 @@ HistogramRenderer::HistogramRenderer(ScreenRenderer* screenRenderer):
 	this->binCount = 256;
 	this->histogramDownsample = 4;
 	this->brightnessRange = 4.0; // x brighter than a pixel.
-	this->transferBufferCount = 1;
-	this->transferSync = new GLsync[this->transferBufferCount]();
+	this->transferRegion = NULL;
 
 	this->histogramShader = new ShaderProgram();
 	this->histogramShader->addShader(GL_VERTEX_SHADER, "histogram/vert.glsl");
@@ -30,6 +30,7 @@ HistogramRenderer::HistogramRenderer(ScreenRenderer* screenRenderer):
 
 HistogramRenderer::~HistogramRenderer()
 {
+	READBACK_BUFFER.release(this->transferRegion);
 }
 
 bool HistogramRenderer::render(double partialTicks, double dt) {
@@ -63,98 +64,88 @@ bool HistogramRenderer::render(double partialTicks, double dt) {
 
 	// Histogram pixel readback request
 
-	for (int i = 0; i < this->transferBufferCount; i++) {
-		uint32 readSize = this->binCount * sizeof(fvec4);
-		uint32 readOffset = i * readSize;
+	if (this->transferRegion == NULL) {
+		// Make a readback request into the shared readback buffer.
+		this->transferRegion = READBACK_BUFFER.allocate(this->binCount * sizeof(fvec4));
 
-		if (this->transferSync[i] == NULL) {
-			// Make a readback request in the first available buffer.
-			glBindBuffer(GL_PIXEL_PACK_BUFFER, this->transferBuffer);
+		if (this->transferRegion != NULL) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, READBACK_BUFFER.getBuffer());
 			glBindTexture(GL_TEXTURE_2D, this->graphTexture);
-			glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, (void*)readOffset);
+			glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, (void*)this->transferRegion->offset);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 
-			this->transferSync[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			READBACK_BUFFER.submit();
 		}
-		else {
-			// Check if any readbacks have been signalled.
-			int32 result;
-			glGetSynciv(this->transferSync[i], GL_SYNC_STATUS, sizeof(result), NULL, &result);
-
-			if (result == GL_SIGNALED) {
-				// Read the data back and copy it.
-				glBindBuffer(GL_PIXEL_PACK_BUFFER, this->transferBuffer);
-				vec4* data = static_cast<vec4*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, readOffset, readSize, GL_MAP_READ_BIT));
-				std::memcpy(this->graphData, data, readSize);
-
-				glDeleteSync(this->transferSync[i]);
-				this->transferSync[i] = NULL;
-
-				glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
-
-				// Build the normalized cumulative distribution function
-				for (int i = 0; i < this->binCount; i++) {
-					// Normalized CDF
-					fvec4 data = this->graphData[i] / (float)(this->histogramResolution.x * this->histogramResolution.y);
-
-					if (i == 0) {
-						this->cumulativeData[i] = data;
-					}
-					else {
-						this->cumulativeData[i] = data + this->cumulativeData[i - 1];
-					}
-				}
-
-				// Update CDF texture GPU-side
-				glBindTexture(GL_TEXTURE_2D, this->cumulativeTexture);
-				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, this->binCount, 1, GL_RGBA, GL_FLOAT, (void*)this->cumulativeData);
-
-				// Calculate average screen luminance and exposure
-				float k = 0.69314718055994530941723212145818;
-				float lowPercent = 0.62;
-				float highPercent = 0.94;
-				float logMin = -14.0;
-				float logMax = 13.0;
-				float scale = 1.0 / (logMax - logMin);
-				float offset = -logMin * scale;
-				float minLum = exp(-5.0 * k);
-				float maxLum = exp(+5.0 * k);
-
-				float maxHistogramValue = 0.0;
-				for (int i = 0; i < this->binCount; i++) {
-					maxHistogramValue = glm::max(maxHistogramValue, this->graphData[i].a);
-				}
-				float invMaxHistogramValue = 1.0F / maxHistogramValue;
-
-				float sumLuminance = 0.0;
-				for (int i = 0; i < this->binCount; i++) {
-					sumLuminance += this->graphData[i].a * invMaxHistogramValue;
-				}
-
-				fvec4 filter = fvec4(0.0, 0.0, sumLuminance * lowPercent, sumLuminance * highPercent);
-
-				for (int i = 0; i < this->binCount; i++) {
-					float t = (float)i / (float)this->binCount;
-					float binVal = this->graphData[i].a * invMaxHistogramValue;
-					float offset = glm::min(filter.z, binVal);
-
-					binVal -= offset;
-					filter.z -= offset;
-					filter.w -= offset;
-					binVal = glm::min(filter.w, binVal);
-					filter.w -= binVal;
-
-					float binLum = exp2((t - offset) / scale);
-					filter.x += binLum * binVal;
-					filter.y += binVal;
-				}
-
-				float avgLuminance = glm::clamp(filter.x / glm::max(filter.y, 1e-4F), minLum, maxLum);
-
-				float keyValue = 1.03 - (2.0 / (2.0 + glm::log2(avgLuminance + 1.0)));
-				this->expectedScreenExposure = glm::clamp((keyValue / avgLuminance) / 0.09, 0.25, 4.0);
-				//logInfo("Average luminance = %f, exposure = %f, scale = %f", avgLuminance, exposure);
+	}
+	else if (READBACK_BUFFER.isReady(this->transferRegion)) {
+		// The histogram data read back from the VRAM, read in place from the persistent mapping. This may be a few frames behind.
+		const fvec4* graphData = reinterpret_cast<const fvec4*>(READBACK_BUFFER.getData(this->transferRegion));
+
+		// Build the normalized cumulative distribution function
+		for (int i = 0; i < this->binCount; i++) {
+			// Normalized CDF
+			fvec4 binData = graphData[i] / (float)(this->histogramResolution.x * this->histogramResolution.y);
+
+			if (i == 0) {
+				this->cumulativeData[i] = binData;
+			}
+			else {
+				this->cumulativeData[i] = binData + this->cumulativeData[i - 1];
 			}
 		}
+
+		// Update CDF texture GPU-side
+		glBindTexture(GL_TEXTURE_2D, this->cumulativeTexture);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, this->binCount, 1, GL_RGBA, GL_FLOAT, (void*)this->cumulativeData);
+
+		// Calculate average screen luminance and exposure
+		float k = 0.69314718055994530941723212145818;
+		float lowPercent = 0.62;
+		float highPercent = 0.94;
+		float logMin = -14.0;
+		float logMax = 13.0;
+		float scale = 1.0 / (logMax - logMin);
+		float offset = -logMin * scale;
+		float minLum = exp(-5.0 * k);
+		float maxLum = exp(+5.0 * k);
+
+		float maxHistogramValue = 0.0;
+		for (int i = 0; i < this->binCount; i++) {
+			maxHistogramValue = glm::max(maxHistogramValue, graphData[i].a);
+		}
+		float invMaxHistogramValue = 1.0F / maxHistogramValue;
+
+		float sumLuminance = 0.0;
+		for (int i = 0; i < this->binCount; i++) {
+			sumLuminance += graphData[i].a * invMaxHistogramValue;
+		}
+
+		fvec4 filter = fvec4(0.0, 0.0, sumLuminance * lowPercent, sumLuminance * highPercent);
+
+		for (int i = 0; i < this->binCount; i++) {
+			float t = (float)i / (float)this->binCount;
+			float binVal = graphData[i].a * invMaxHistogramValue;
+			float offset = glm::min(filter.z, binVal);
+
+			binVal -= offset;
+			filter.z -= offset;
+			filter.w -= offset;
+			binVal = glm::min(filter.w, binVal);
+			filter.w -= binVal;
+
+			float binLum = exp2((t - offset) / scale);
+			filter.x += binLum * binVal;
+			filter.y += binVal;
+		}
+
+		float avgLuminance = glm::clamp(filter.x / glm::max(filter.y, 1e-4F), minLum, maxLum);
+
+		float keyValue = 1.03 - (2.0 / (2.0 + glm::log2(avgLuminance + 1.0)));
+		this->expectedScreenExposure = glm::clamp((keyValue / avgLuminance) / 0.09, 0.25, 4.0);
+		//logInfo("Average luminance = %f, exposure = %f, scale = %f", avgLuminance, exposure);
+
+		READBACK_BUFFER.release(this->transferRegion);
+		this->transferRegion = NULL;
 	}
 
 	return true;
@@ -235,15 +226,11 @@ void HistogramRenderer::setBinCount(uint32 binCount) {
 	this->histogramFrameBuffer->checkStatus(true);
 
 
-	glGenBuffers(1, &this->transferBuffer);
-	glBindBuffer(GL_PIXEL_PACK_BUFFER, this->transferBuffer);
-	glBufferData(GL_PIXEL_PACK_BUFFER, this->transferBufferCount * this->binCount * sizeof(fvec4), NULL, GL_STREAM_COPY);
-
-	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	// A pending readback has the old bin count.
+	READBACK_BUFFER.release(this->transferRegion);
+	this->transferRegion = NULL;
 
-	delete[] this->graphData;
 	delete[] this->cumulativeData;
-	this->graphData = new fvec4[this->binCount]();
 	this->cumulativeData = new fvec4[this->binCount]();
 }
 
@@ -6,8 +6,7 @@ class FrameBuffer;
 class ShaderProgram;
 class GLMesh;
 class ScreenRenderer;
-
-typedef struct __GLsync* GLsync;
+struct ReadbackRegion;
 
 class HistogramRenderer
 {
@@ -18,12 +17,9 @@ private:
 	ShaderProgram* histogramShader;
 	FrameBuffer* histogramFrameBuffer;
 
-	uint32 transferBufferCount; // The number of histogram sync buffers.
 	uint32 graphTexture; // The histogram texture.
 	uint32 cumulativeTexture; // The cumulative distribution function texture.
-	uint32 transferBuffer; // pixel buffer for asynchronous histoghram transfer from vram.
-	GLsync* transferSync; // Array of sync objects for each buffer.
-	vec4* graphData; // The histogram data read back from the VRAM. this may be a few frames behind.
+	ReadbackRegion* transferRegion; // The region of the shared readback buffer for the pending asynchronous histogram transfer from vram. NULL if none is pending.
 	vec4* cumulativeData; // The histogram cumulative distribution calculated from the current histogramData array.
 
 	uvec2 screenResolution;
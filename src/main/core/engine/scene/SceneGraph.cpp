@@ -47,6 +47,7 @@ void SceneGraph::render(double partialTicks, double dt) {
 
 void SceneGraph::update(double dt) {
 	this->root->update(this, dt);
+	this->camera->update(dt); // After every body has requested its scale factor.
 }
 
 //void SceneGraph::renderDebug(uint32 mode, uint32 count, Vertex vertices[], int indices[], dmat4 matrix) {
@@ -70,9 +71,9 @@ void SceneGraph::update(double dt) {
 //		glVertexAttrib2f(2, v.texture.x, v.texture.y);
 //		glVertexAttrib3f(1, v.normal.x, v.normal.y, v.normal.z);
 //		glVertexAttrib3f(0, 
-//			(v.position.x - cp.x) * Planet::scaleFactor,
-//			(v.position.y - cp.y) * Planet::scaleFactor,
-//			(v.position.z - cp.z) * Planet::scaleFactor
+//			(v.position.x - cp.x) * this->camera->getScaleFactor(),
+//			(v.position.y - cp.y) * this->camera->getScaleFactor(),
+//			(v.position.z - cp.z) * this->camera->getScaleFactor()
 //		);
 //	}
 //
@@ -110,7 +111,7 @@ void SceneGraph::applyUniforms(ShaderProgram* program) {
 	if (program != NULL) {
 		program->setUniform("modelMatrix", this->currModelMatrix);
 		program->setUniform("normalMatrix", mat4(1.0F));
-		program->setUniform("scaleFactor", float(Planet::scaleFactor));
+		program->setUniform("scaleFactor", float(this->camera->getScaleFactor()));
 		program->setUniform("enableLighting", this->enableLighting);
 		this->camera->applyUniforms(program);
 	}
@@ -0,0 +1,239 @@
+#include "ClimateMap.h"
+#include "core/application/Application.h"
+#include "core/engine/terrain/MapGenerator.h"
+#include "core/engine/terrain/MapNodeIndex.h"
+#include "core/engine/renderer/ShaderProgram.h"
+#include "core/util/ThreadPool.h"
+#include "core/util/Time.h"
+#include <GL/glew.h>
+
+ClimateMap::ClimateMap(ThreadPool* threadPool, uint32 size) :
+	threadPool(threadPool), size(size) {
+
+	this->climateTexture = 0;
+	this->biomeTexture = 0;
+	this->bakedTexels = NULL;
+	this->bakedVersion = 0;
+	this->uploadedVersion = 0;
+	this->nextVersion = 1;
+	this->pendingBakes = 0;
+	this->numFaceUploads = 0;
+}
+
+ClimateMap::~ClimateMap() {
+	while (this->pendingBakes.load() > 0) {
+		this->threadPool->waitIdle();
+	}
+
+	if (this->climateTexture != 0) {
+		glDeleteTextures(1, &this->climateTexture);
+	}
+
+	if (this->biomeTexture != 0) {
+		glDeleteTextures(1, &this->biomeTexture);
+	}
+}
+
+void ClimateMap::createTextures() {
+	glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS); // Filter across the cube edges.
+
+	uint32 textures[2];
+	glCreateTextures(GL_TEXTURE_CUBE_MAP, 2, textures);
+
+	for (int i = 0; i < 2; i++) {
+		glTextureStorage2D(textures[i], 1, GL_RGBA8, this->size, this->size);
+		glTextureParameteri(textures[i], GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTextureParameteri(textures[i], GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTextureParameteri(textures[i], GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTextureParameteri(textures[i], GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTextureParameteri(textures[i], GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	}
+
+	this->climateTexture = textures[0];
+	this->biomeTexture = textures[1];
+}
+
+uint32 ClimateMap::getFaceBytes() const {
+	return this->size * this->size * 4;
+}
+
+void ClimateMap::bake(const MapGraph& graph, std::shared_ptr<const MapNodeIndex> nodeIndex, const std::vector<LifeZone*>& lifeZones) {
+	const int32 count = graph.getNodeCount();
+
+	if (count == 0 || nodeIndex == NULL) {
+		return;
+	}
+
+	// Copy out what the texels are made of, so the bake does not read the graph while it changes.
+	std::shared_ptr<std::vector<fvec3>> nodePositions = std::make_shared<std::vector<fvec3>>(graph.position);
+	std::shared_ptr<std::vector<fvec4>> nodeClimate = std::make_shared<std::vector<fvec4>>(count);
+	std::shared_ptr<std::vector<fvec4>> nodeBiome = std::make_shared<std::vector<fvec4>>(count);
+
+	for (int i = 0; i < count; i++) {
+		(*nodeClimate)[i] = fvec4(glm::clamp(graph.temperature[i], 0.0F, 1.0F), glm::clamp(graph.moisture[i], 0.0F, 1.0F), graph.water[i] ? 1.0F : 0.0F, 1.0F);
+		(*nodeBiome)[i] = graph.lifeZone[i] >= 0 ? fvec4(lifeZones[graph.lifeZone[i]]->colour, 1.0F) : fvec4(0.0F);
+	}
+
+	const uint64 version = this->nextVersion++;
+	const uint32 size = this->size;
+	const uint32 faceBytes = this->getFaceBytes();
+
+	this->pendingBakes++;
+
+	this->threadPool->submit([this, version, size, faceBytes, nodeIndex, nodePositions, nodeClimate, nodeBiome]() {
+		uint64 a = Time::now();
+
+		std::shared_ptr<std::vector<uint8>> texels = std::make_shared<std::vector<uint8>>(faceBytes * 12);
+
+		// One row of one face per task. The directions follow the OpenGL cube map face layout, so the maps can be
+		// sampled with a direction in local planet space.
+		this->threadPool->parallelFor(6 * size, [&](uint32 row) {
+			const int32 face = row / size;
+			const int32 y = row % size;
+			const int32 k = 3;
+
+			std::vector<dvec3> directions(size);
+			std::vector<int32> nodes(size * k);
+
+			for (int x = 0; x < size; x++) {
+				const double s = (x + 0.5) / size * 2.0 - 1.0;
+				const double t = (y + 0.5) / size * 2.0 - 1.0;
+
+				switch (face) {
+				case 0: directions[x] = dvec3(+1.0, -t, -s); break; // GL_TEXTURE_CUBE_MAP_POSITIVE_X
+				case 1: directions[x] = dvec3(-1.0, -t, +s); break; // GL_TEXTURE_CUBE_MAP_NEGATIVE_X
+				case 2: directions[x] = dvec3(+s, +1.0, +t); break; // GL_TEXTURE_CUBE_MAP_POSITIVE_Y
+				case 3: directions[x] = dvec3(+s, -1.0, -t); break; // GL_TEXTURE_CUBE_MAP_NEGATIVE_Y
+				case 4: directions[x] = dvec3(+s, -t, +1.0); break; // GL_TEXTURE_CUBE_MAP_POSITIVE_Z
+				case 5: directions[x] = dvec3(-s, -t, -1.0); break; // GL_TEXTURE_CUBE_MAP_NEGATIVE_Z
+				}
+			}
+
+			nodeIndex->findNearest(size, directions.data(), k, nodes.data());
+
+			uint8* climateRow = &(*texels)[(face * size + y) * size * 4];
+			uint8* biomeRow = &(*texels)[faceBytes * 6 + (face * size + y) * size * 4];
+
+			for (int x = 0; x < size; x++) {
+				const dvec3 direction = normalize(directions[x]);
+
+				// Inverse distance weighting between the nearest nodes, so the maps do not show the node cells.
+				fvec4 climate = fvec4(0.0F);
+				fvec4 biome = fvec4(0.0F);
+				float totalWeight = 0.0F;
+
+				for (int i = 0; i < k; i++) {
+					const int32 node = nodes[x * k + i];
+					if (node < 0) {
+						continue;
+					}
+
+					const float weight = 1.0F / glm::max(1e-9F, (float) glm::distance2(direction, dvec3((*nodePositions)[node])));
+					climate += (*nodeClimate)[node] * weight;
+					biome += (*nodeBiome)[node] * weight;
+					totalWeight += weight;
+				}
+
+				if (totalWeight > 0.0F) {
+					climate /= totalWeight;
+					biome /= totalWeight;
+				}
+
+				for (int i = 0; i < 4; i++) {
+					climateRow[x * 4 + i] = (uint8) glm::round(glm::clamp(climate[i], 0.0F, 1.0F) * 255.0F);
+					biomeRow[x * 4 + i] = (uint8) glm::round(glm::clamp(biome[i], 0.0F, 1.0F) * 255.0F);
+				}
+			}
+		}, 1);
+
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			if (version > this->bakedVersion) { // Bakes may finish out of order. Only the newest is kept.
+				this->bakedTexels = texels;
+				this->bakedVersion = version;
+			}
+		}
+
+		uint64 b = Time::now();
+		logInfo("Baked %dx%d climate map in %f ms", size, size, (b - a) / 1000000.0);
+
+		this->pendingBakes--;
+	});
+}
+
+void ClimateMap::update() {
+	std::shared_ptr<std::vector<uint8>> texels = NULL;
+	uint64 version;
+
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+		if (this->bakedTexels == NULL || this->bakedVersion == this->uploadedVersion) {
+			return;
+		}
+
+		texels = this->bakedTexels;
+		version = this->bakedVersion;
+		this->bakedTexels = NULL; // Owned by this thread from here on.
+	}
+
+	if (this->climateTexture == 0) {
+		this->createTextures();
+	}
+
+	const uint32 faceBytes = this->getFaceBytes();
+	const bool firstUpload = this->uploadedTexels.empty();
+
+	if (firstUpload) {
+		this->uploadedTexels.resize(faceBytes * 12);
+	}
+
+	int32 facesUploaded = 0;
+
+	for (int i = 0; i < 12; i++) {
+		const uint8* faceTexels = &(*texels)[faceBytes * i];
+		uint8* uploadedFaceTexels = &this->uploadedTexels[faceBytes * i];
+
+		if (!firstUpload && memcmp(faceTexels, uploadedFaceTexels, faceBytes) == 0) {
+			continue; // The simulation did not change anything on this face.
+		}
+
+		const uint32 texture = i < 6 ? this->climateTexture : this->biomeTexture;
+		glTextureSubImage3D(texture, 0, 0, 0, i % 6, this->size, this->size, 1, GL_RGBA, GL_UNSIGNED_BYTE, faceTexels);
+		memcpy(uploadedFaceTexels, faceTexels, faceBytes);
+		facesUploaded++;
+	}
+
+	this->uploadedVersion = version;
+	this->numFaceUploads += facesUploaded;
+
+	logInfo("Uploaded %d/12 changed climate map faces", facesUploaded);
+}
+
+void ClimateMap::applyUniforms(ShaderProgram* program, int32 textureUnit) {
+	const bool available = this->isAvailable();
+
+	if (available) {
+		glBindTextureUnit(textureUnit + 0, this->climateTexture);
+		glBindTextureUnit(textureUnit + 1, this->biomeTexture);
+	}
+
+	program->setUniform("climateSampler", textureUnit + 0);
+	program->setUniform("biomeSampler", textureUnit + 1);
+	program->setUniform("climateMapEnabled", available);
+}
+
+bool ClimateMap::isBaking() const {
+	return this->pendingBakes.load() > 0;
+}
+
+bool ClimateMap::isAvailable() const {
+	return this->uploadedVersion != 0;
+}
+
+uint32 ClimateMap::getSize() const {
+	return this->size;
+}
+
+uint64 ClimateMap::getNumFaceUploads() const {
+	return this->numFaceUploads;
+}
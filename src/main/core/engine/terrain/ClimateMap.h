@@ -0,0 +1,78 @@
+#pragma once
+
+#include "core/Core.h"
+#include <atomic>
+
+class ThreadPool;
+class ShaderProgram;
+class MapNodeIndex;
+struct MapGraph;
+struct LifeZone;
+
+/**
+ * The climate of a map, rasterized into two low resolution cube maps so that shaders can look it up by direction at no
+ * CPU cost. The climate map holds the temperature, moisture and water of each texel, and the biome map holds the life
+ * zone colour, with an alpha of zero where there is no life zone. Each texel blends the nearest few map nodes.
+ *
+ * Baking runs on worker threads from a copy of the node fields, so the map may change while a bake is in flight. The
+ * result is uploaded on the render thread, and only the cube faces whose texels changed are uploaded again.
+ */
+class ClimateMap {
+private:
+	ThreadPool* threadPool; // The workers that bake the texels. Not owned.
+	uint32 size; // The width and height of each cube face.
+
+	uint32 climateTexture;
+	uint32 biomeTexture;
+
+	std::mutex mutex; // Guards the baked texels and version.
+	std::shared_ptr<std::vector<uint8>> bakedTexels; // The latest finished bake, waiting to be uploaded. [texture][face][y][x] RGBA8.
+	std::vector<uint8> uploadedTexels; // The texels on the GPU, in the same layout. Empty until the first upload.
+	uint64 bakedVersion; // The version of the bake in bakedTexels.
+	uint64 uploadedVersion; // The version of the bake on the GPU.
+	uint64 nextVersion;
+
+	std::atomic<int32> pendingBakes; // The number of bakes queued or running.
+	uint64 numFaceUploads; // The number of cube faces uploaded, for debugging.
+
+	void createTextures();
+
+	uint32 getFaceBytes() const;
+
+public:
+	ClimateMap(ThreadPool* threadPool, uint32 size = 128);
+
+	/**
+	 * Waits for any bake that is still running.
+	 */
+	~ClimateMap();
+
+	// Deleted copy constructor and assignment function
+	ClimateMap(const ClimateMap&) = delete;
+	ClimateMap& operator=(const ClimateMap&) = delete;
+
+	/**
+	 * Start baking the climate of the graph on the worker threads. The node fields are copied, and the index is kept
+	 * alive by the bake, so the graph may be changed or rebuilt straight away.
+	 */
+	void bake(const MapGraph& graph, std::shared_ptr<const MapNodeIndex> nodeIndex, const std::vector<LifeZone*>& lifeZones);
+
+	/**
+	 * Upload the latest finished bake, if there is one. Only faces that changed are uploaded. This must be called on
+	 * the render thread.
+	 */
+	void update();
+
+	/**
+	 * Bind the climate and biome maps to the two texture units starting at the specified unit.
+	 */
+	void applyUniforms(ShaderProgram* program, int32 textureUnit = 4);
+
+	bool isBaking() const;
+
+	bool isAvailable() const;
+
+	uint32 getSize() const;
+
+	uint64 getNumFaceUploads() const;
+};
@@ -0,0 +1,423 @@
+#include "CpuTileGenerator.h"
+#include "core/engine/terrain/TileSupplier.h"
+#include "core/util/ThreadPool.h"
+#include "core/util/Time.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_WIDTH 8
+#else
+#include <smmintrin.h>
+#define SIMD_WIDTH 4
+#endif
+
+// Thin wrappers over the SSE4.1 / AVX2 intrinsics, so that the noise functions below read like the GLSL they were ported from.
+namespace Simd {
+#if defined(__AVX2__)
+	typedef __m256 vfloat;
+
+	inline vfloat set(float f) { return _mm256_set1_ps(f); }
+	inline vfloat load(const float* p) { return _mm256_loadu_ps(p); }
+	inline void store(float* p, vfloat a) { _mm256_storeu_ps(p, a); }
+	inline vfloat add(vfloat a, vfloat b) { return _mm256_add_ps(a, b); }
+	inline vfloat sub(vfloat a, vfloat b) { return _mm256_sub_ps(a, b); }
+	inline vfloat mul(vfloat a, vfloat b) { return _mm256_mul_ps(a, b); }
+	inline vfloat div(vfloat a, vfloat b) { return _mm256_div_ps(a, b); }
+	inline vfloat min(vfloat a, vfloat b) { return _mm256_min_ps(a, b); }
+	inline vfloat max(vfloat a, vfloat b) { return _mm256_max_ps(a, b); }
+	inline vfloat floor(vfloat a) { return _mm256_floor_ps(a); }
+	inline vfloat abs(vfloat a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0F), a); }
+	inline vfloat bitAnd(vfloat a, vfloat b) { return _mm256_and_ps(a, b); }
+	inline vfloat greater(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+	inline vfloat greaterEqual(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+	inline vfloat less(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+	inline vfloat lessEqual(vfloat a, vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+	inline vfloat select(vfloat mask, vfloat a, vfloat b) { return _mm256_blendv_ps(b, a, mask); } // mask ? a : b
+#else
+	typedef __m128 vfloat;
+
+	inline vfloat set(float f) { return _mm_set1_ps(f); }
+	inline vfloat load(const float* p) { return _mm_loadu_ps(p); }
+	inline void store(float* p, vfloat a) { _mm_storeu_ps(p, a); }
+	inline vfloat add(vfloat a, vfloat b) { return _mm_add_ps(a, b); }
+	inline vfloat sub(vfloat a, vfloat b) { return _mm_sub_ps(a, b); }
+	inline vfloat mul(vfloat a, vfloat b) { return _mm_mul_ps(a, b); }
+	inline vfloat div(vfloat a, vfloat b) { return _mm_div_ps(a, b); }
+	inline vfloat min(vfloat a, vfloat b) { return _mm_min_ps(a, b); }
+	inline vfloat max(vfloat a, vfloat b) { return _mm_max_ps(a, b); }
+	inline vfloat floor(vfloat a) { return _mm_floor_ps(a); }
+	inline vfloat abs(vfloat a) { return _mm_andnot_ps(_mm_set1_ps(-0.0F), a); }
+	inline vfloat bitAnd(vfloat a, vfloat b) { return _mm_and_ps(a, b); }
+	inline vfloat greater(vfloat a, vfloat b) { return _mm_cmpgt_ps(a, b); }
+	inline vfloat greaterEqual(vfloat a, vfloat b) { return _mm_cmpge_ps(a, b); }
+	inline vfloat less(vfloat a, vfloat b) { return _mm_cmplt_ps(a, b); }
+	inline vfloat lessEqual(vfloat a, vfloat b) { return _mm_cmple_ps(a, b); }
+	inline vfloat select(vfloat mask, vfloat a, vfloat b) { return _mm_blendv_ps(b, a, mask); } // mask ? a : b
+#endif
+
+	inline vfloat step(vfloat edge, vfloat x) { return bitAnd(greaterEqual(x, edge), set(1.0F)); } // GLSL step(edge, x)
+	inline vfloat fract(vfloat a) { return sub(a, floor(a)); }
+	inline vfloat clamp(vfloat a, float lo, float hi) { return min(max(a, set(lo)), set(hi)); }
+
+	inline vfloat pow(vfloat a, float exponent) { // Non-integer exponents have no SIMD instruction, so go through the lanes one by one.
+		alignas(32) float lanes[SIMD_WIDTH];
+		store(lanes, a);
+		for (int i = 0; i < SIMD_WIDTH; i++) {
+			lanes[i] = powf(lanes[i], exponent);
+		}
+		return load(lanes);
+	}
+}
+
+using namespace Simd;
+
+////////////////// heightComp.glsl port \\\\\\\\\\\\\\\\\\
+
+//	Simplex 3D Noise
+//	by Ian McEwan, Ashima Arts
+//
+static inline vfloat mod289(vfloat x) {
+	return sub(x, mul(floor(div(x, set(289.0F))), set(289.0F)));
+}
+
+static inline vfloat permute(vfloat x) {
+	return mod289(mul(add(mul(x, set(34.0F)), set(1.0F)), x));
+}
+
+static inline vfloat taylorInvSqrt(vfloat r) {
+	return sub(set(1.79284291400159F), mul(set(0.85373472095314F), r));
+}
+
+static vfloat snoise(vfloat vx, vfloat vy, vfloat vz) {
+	const vfloat zero = set(0.0F);
+	const vfloat one = set(1.0F);
+	const vfloat Cx = set(1.0F / 6.0F);
+	const vfloat Cy = set(1.0F / 3.0F);
+
+	// First corner
+	vfloat s = add(add(mul(vx, Cy), mul(vy, Cy)), mul(vz, Cy));
+	vfloat ix = floor(add(vx, s));
+	vfloat iy = floor(add(vy, s));
+	vfloat iz = floor(add(vz, s));
+	vfloat t = add(add(mul(ix, Cx), mul(iy, Cx)), mul(iz, Cx));
+	vfloat x0[3] = { add(sub(vx, ix), t), add(sub(vy, iy), t), add(sub(vz, iz), t) };
+
+	// Other corners
+	vfloat gx = step(x0[1], x0[0]);
+	vfloat gy = step(x0[2], x0[1]);
+	vfloat gz = step(x0[0], x0[2]);
+	vfloat lx = sub(one, gx);
+	vfloat ly = sub(one, gy);
+	vfloat lz = sub(one, gz);
+	vfloat i1[3] = { min(gx, lz), min(gy, lx), min(gz, ly) };
+	vfloat i2[3] = { max(gx, lz), max(gy, lx), max(gz, ly) };
+
+	vfloat xc[4][3]; // x0, x1, x2, x3
+	for (int k = 0; k < 3; k++) {
+		xc[0][k] = x0[k];
+		xc[1][k] = add(sub(x0[k], i1[k]), set(1.0F * (1.0F / 6.0F)));
+		xc[2][k] = add(sub(x0[k], i2[k]), set(2.0F * (1.0F / 6.0F)));
+		xc[3][k] = add(sub(x0[k], one), set(3.0F * (1.0F / 6.0F)));
+	}
+
+	// Permutations
+	ix = mod289(ix);
+	iy = mod289(iy);
+	iz = mod289(iz);
+
+	const vfloat ox[4] = { zero, i1[0], i2[0], one };
+	const vfloat oy[4] = { zero, i1[1], i2[1], one };
+	const vfloat oz[4] = { zero, i1[2], i2[2], one };
+
+	// Gradients
+	// ( N*N points uniformly over a square, mapped onto an octahedron.)
+	const float n_ = 1.0F / 7.0F; // N=7
+	const vfloat nsx = set(n_ * 2.0F);
+	const vfloat nsy = set(n_ * 0.5F - 1.0F);
+	const vfloat nsz = set(n_ * 1.0F - 0.0F);
+
+	vfloat result = zero;
+
+	for (int k = 0; k < 4; k++) {
+		vfloat p = permute(add(iz, oz[k]));
+		p = permute(add(add(p, iy), oy[k]));
+		p = permute(add(add(p, ix), ox[k]));
+
+		vfloat j = sub(p, mul(set(49.0F), floor(mul(mul(p, nsz), nsz)))); //  mod(p,N*N)
+
+		vfloat x_ = floor(mul(j, nsz));
+		vfloat y_ = floor(sub(j, mul(set(7.0F), x_))); // mod(j,N)
+
+		vfloat x = add(mul(x_, nsx), nsy);
+		vfloat y = add(mul(y_, nsx), nsy);
+		vfloat h = sub(sub(one, abs(x)), abs(y));
+
+		vfloat sx = add(mul(floor(x), set(2.0F)), one);
+		vfloat sy = add(mul(floor(y), set(2.0F)), one);
+		vfloat sh = sub(zero, step(h, zero));
+
+		vfloat g[3] = { add(x, mul(sx, sh)), add(y, mul(sy, sh)), h };
+
+		// Normalise gradients
+		vfloat norm = taylorInvSqrt(add(add(mul(g[0], g[0]), mul(g[1], g[1])), mul(g[2], g[2])));
+
+		// Mix final noise value
+		vfloat m = max(sub(set(0.6F), add(add(mul(xc[k][0], xc[k][0]), mul(xc[k][1], xc[k][1])), mul(xc[k][2], xc[k][2]))), zero);
+		m = mul(m, m);
+
+		vfloat d = add(add(mul(mul(g[0], norm), xc[k][0]), mul(mul(g[1], norm), xc[k][1])), mul(mul(g[2], norm), xc[k][2]));
+		result = add(result, mul(mul(m, m), d));
+	}
+
+	return mul(set(42.0F), result);
+}
+
+static vfloat getNoise(vfloat x, vfloat y, vfloat z, float frequency, float lacunarity, float gain, float amplitude, int octaves) {
+	int i = 0;
+
+	vfloat f = set(frequency);
+	x = mul(x, f);
+	y = mul(y, f);
+	z = mul(z, f);
+
+	const vfloat l = set(lacunarity);
+	vfloat noiseSum = set(0.0F);
+	while (++i < octaves) {
+		x = mul(x, l);
+		y = mul(y, l);
+		z = mul(z, l);
+		amplitude *= gain;
+
+		noiseSum = add(noiseSum, mul(snoise(x, y, z), set(amplitude)));
+	}
+
+	return noiseSum;
+}
+
+static vfloat getHeight(vfloat x, vfloat y, vfloat z) {
+	const vfloat zero = set(0.0F);
+	const vfloat one = set(1.0F);
+	const vfloat two = set(2.0F);
+
+	vfloat largeFeatures = getNoise(x, y, z, 0.4F, 2.0F, 0.5F, 1.0F, 12);
+	vfloat smallFeatures = getNoise(x, y, z, 5.2F, 2.1F, 0.33F, 0.2F, 22);
+	vfloat tinyFeatures = getNoise(x, y, z, 18.0F, 1.8F, 0.6F, 0.03F, 22);
+	vfloat mountainFeatures = getNoise(x, y, z, 4.0F, 2.0F, 0.5F, 0.5F, 11);
+	vfloat canyonFeatures = getNoise(x, y, z, 1.0F, 2.0F, 0.5F, 1.0F, 12);
+
+	vfloat t = sub(mul(sub(one, abs(mountainFeatures)), two), one);
+	t = mul(t, t);
+	mountainFeatures = mul(mul(t, t), t); // pow(t, 6.0)
+
+	t = abs(sub(mul(sub(one, abs(canyonFeatures)), two), one));
+	t = mul(t, t);
+	canyonFeatures = clamp(sub(one, mul(t, t)), 0.0F, 1.0F); // 1.0 - pow(t, 4.0)
+
+	const vfloat canyonUpperFlat = set(0.29F);
+	const vfloat canyonLowerFlat = set(0.11F);
+	canyonFeatures = Simd::pow(canyonFeatures, 0.8F);
+
+	vfloat upper = add(canyonUpperFlat, mul(sub(canyonFeatures, canyonUpperFlat), set(0.4F)));
+	vfloat lower = sub(canyonLowerFlat, mul(abs(sub(canyonFeatures, canyonLowerFlat)), set(0.8F)));
+	t = div(sub(canyonFeatures, canyonLowerFlat), sub(canyonUpperFlat, canyonLowerFlat));
+	t = mul(t, t);
+	vfloat middle = add(canyonLowerFlat, mul(mul(t, t), sub(canyonUpperFlat, canyonLowerFlat)));
+	canyonFeatures = select(greater(canyonFeatures, canyonUpperFlat), upper, select(less(canyonFeatures, canyonLowerFlat), lower, middle));
+
+	largeFeatures = div(sub(largeFeatures, set(0.2F)), set(1.2F));
+
+	t = add(largeFeatures, set(0.5F));
+	vfloat mountainMultiplier = sub(mul(fract(max(zero, mul(t, t))), two), one);
+	mountainMultiplier = mul(min(one, mul(max(zero, sub(mul(abs(mountainMultiplier), set(1.6F)), set(0.7F))), set(1.2F))), largeFeatures);
+	mountainMultiplier = select(greater(largeFeatures, zero), mountainMultiplier, zero);
+
+	t = sub(one, abs(clamp(sub(largeFeatures, mountainMultiplier), -1.0F, 1.0F)));
+	t = mul(t, t);
+	t = mul(t, t);
+	vfloat canyonMultiplier = mul(mul(t, t), min(mul(abs(largeFeatures), set(10.0F)), one)); // pow(t, 8.0) * ...
+
+	vfloat height = add(add(add(add(largeFeatures, smallFeatures), tinyFeatures), mul(mountainMultiplier, mountainFeatures)), mul(canyonMultiplier, canyonFeatures));
+	height = select(greaterEqual(height, one), sub(one, sub(height, one)), height);
+
+	return clamp(height, -1.0F, 1.0F);
+}
+
+static fvec3 getSphereVector(const fmat4& quadNormals, fvec2 pos) {
+	fvec4 uvUV = fvec4(pos.x, pos.y, 1.0F - pos.x, 1.0F - pos.y);
+	fvec4 interp = fvec4(uvUV.x, uvUV.z, uvUV.z, uvUV.x) * fvec4(uvUV.y, uvUV.y, uvUV.w, uvUV.w); // uvUV.xzzx * uvUV.yyww
+	return normalize(fvec3(quadNormals * interp));
+}
+
+////////////////// CpuTileGenerator \\\\\\\\\\\\\\\\\\
+
+CpuTileGenerator::CpuTileGenerator(uint32 threadCount) {
+	this->threadPool = new ThreadPool(threadCount);
+	this->numTilesGenerated = 0;
+	this->totalGenerationTime = 0;
+}
+
+CpuTileGenerator::~CpuTileGenerator() {
+	delete this->threadPool; // Finishes any submitted requests before returning.
+}
+
+void CpuTileGenerator::generateTile(CpuTileRequest* request) {
+	uint64 start = Time::now();
+
+	const uint32 tileSize = request->tileSize;
+	const uint32 gridSize = ((tileSize + 15) / 16) * 16; // gl_WorkGroupSize * gl_NumWorkGroups in the shader.
+	const fmat4 quadNormals = fmat4(request->quadNormals); // The shader receives the normals as a single precision uniform.
+	const float elevationFactor = request->elevationScale / request->planetRadius;
+	const float f = 1.0F / 64.0F; // Finite difference offset for the normal, as in the shader.
+
+	// When the finite difference offset is a whole number of texels, the neighbouring samples of one texel are the
+	// centre samples of another, so the heights are evaluated once on a slightly larger grid instead of three times
+	// per texel. Both paths sample the same positions, up to rounding of the position when gridSize is not a power of two.
+	const uint32 offset = (gridSize % 64 == 0) ? gridSize / 64 : 0;
+	const uint32 sharedSize = tileSize + offset;
+
+	std::vector<fvec3> points;
+
+	if (offset != 0) {
+		points.resize(sharedSize * sharedSize);
+		for (int y = 0; y < sharedSize; y++) {
+			for (int x = 0; x < sharedSize; x++) {
+				points[x + y * sharedSize] = getSphereVector(quadNormals, fvec2(x, y) / fvec2(gridSize));
+			}
+		}
+	} else {
+		points.resize(tileSize * tileSize * 3);
+		for (int y = 0; y < tileSize; y++) {
+			for (int x = 0; x < tileSize; x++) {
+				fvec2 quadPosition = fvec2(x, y) / fvec2(gridSize);
+				uint32 index = (x + y * tileSize) * 3;
+				points[index + 0] = getSphereVector(quadNormals, quadPosition);
+				points[index + 1] = getSphereVector(quadNormals, quadPosition + fvec2(f, 0.0F));
+				points[index + 2] = getSphereVector(quadNormals, quadPosition + fvec2(0.0F, f));
+			}
+		}
+	}
+
+	std::vector<float> heights(points.size());
+	CpuTileGenerator::getHeights(points.size(), points.data(), heights.data());
+
+	std::vector<float> unpackedData;
+	float* textureData = reinterpret_cast<float*>(request->textureData);
+
+	if (request->packedTexels) { // Generate unpacked first, the height range is needed to pack the heights.
+		unpackedData.resize(tileSize * tileSize * 4);
+		textureData = unpackedData.data();
+	}
+
+	double minHeight = +INFINITY;
+	double maxHeight = -INFINITY;
+
+	for (int y = 0; y < tileSize; y++) {
+		for (int x = 0; x < tileSize; x++) {
+			uint32 i00, i10, i01;
+
+			if (offset != 0) {
+				i00 = (x + 0) + (y + 0) * sharedSize;
+				i10 = (x + offset) + (y + 0) * sharedSize;
+				i01 = (x + 0) + (y + offset) * sharedSize;
+			} else {
+				i00 = (x + y * tileSize) * 3;
+				i10 = i00 + 1;
+				i01 = i00 + 2;
+			}
+
+			const fvec3 s00 = points[i00], s10 = points[i10], s01 = points[i01];
+			const float n00 = heights[i00], n10 = heights[i10], n01 = heights[i01];
+
+			fvec3 h00 = s00 + s00 * elevationFactor * n00;
+			fvec3 h10 = s10 + s10 * elevationFactor * n10;
+			fvec3 h01 = s01 + s01 * elevationFactor * n01;
+
+			fvec3 normal = cross(normalize(h10 - h00), normalize(h00 - h01));
+
+			float* texel = &textureData[(x + y * tileSize) * 4];
+			texel[0] = normal.x;
+			texel[1] = normal.y;
+			texel[2] = normal.z;
+			texel[3] = n00;
+
+			if (!isnan(n00)) {
+				minHeight = glm::min(minHeight, (double) n00);
+				maxHeight = glm::max(maxHeight, (double) n00);
+			}
+		}
+	}
+
+	if (request->packedTexels) {
+		// Single precision range, as used by the renderer and stored in the tile cache, so that decoding matches exactly.
+		minHeight = (float) minHeight;
+		maxHeight = (float) maxHeight;
+		TileData::packTexels(tileSize * tileSize, textureData, minHeight, maxHeight, reinterpret_cast<uint16*>(request->textureData));
+	}
+
+	request->minHeight = minHeight;
+	request->maxHeight = maxHeight;
+	request->generationTime = Time::now() - start;
+
+	this->numTilesGenerated++;
+	this->totalGenerationTime += request->generationTime;
+
+	request->completed = true;
+}
+
+void CpuTileGenerator::submit(CpuTileRequest* request) {
+	request->completed = false;
+	this->threadPool->submit([this, request]() {
+		this->generateTile(request);
+	});
+}
+
+void CpuTileGenerator::getHeights(int32 count, const fvec3* points, float* heights) {
+	alignas(32) float x[SIMD_WIDTH];
+	alignas(32) float y[SIMD_WIDTH];
+	alignas(32) float z[SIMD_WIDTH];
+	alignas(32) float h[SIMD_WIDTH];
+
+	for (int i = 0; i < count; i += SIMD_WIDTH) {
+		const int32 lanes = glm::min(count - i, SIMD_WIDTH);
+
+		for (int j = 0; j < SIMD_WIDTH; j++) {
+			const fvec3& point = points[i + glm::min(j, lanes - 1)]; // Pad the last batch by repeating the final point.
+			x[j] = point.x;
+			y[j] = point.y;
+			z[j] = point.z;
+		}
+
+		store(h, ::getHeight(load(x), load(y), load(z)));
+
+		for (int j = 0; j < lanes; j++) {
+			heights[i + j] = h[j];
+		}
+	}
+}
+
+float CpuTileGenerator::getHeight(fvec3 point) {
+	float height;
+	CpuTileGenerator::getHeights(1, &point, &height);
+	return height;
+}
+
+uint32 CpuTileGenerator::getSimdWidth() {
+	return SIMD_WIDTH;
+}
+
+uint32 CpuTileGenerator::getThreadCount() const {
+	return this->threadPool->getThreadCount();
+}
+
+uint64 CpuTileGenerator::getNumTilesGenerated() const {
+	return this->numTilesGenerated;
+}
+
+double CpuTileGenerator::getAverageGenerationTime() const {
+	uint64 count = this->numTilesGenerated;
+	if (count == 0) {
+		return 0.0;
+	}
+
+	return Time::time_cast<Time::time_unit, Time::milliseconds, double>((double) this->totalGenerationTime / count);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "core/Core.h"
+#include <atomic>
+
+class ThreadPool;
+class TileData;
+
+struct CpuTileRequest {
+	TileData* tile; // The tile that requested generation. Only dereferenced by the TileSupplier on the main thread.
+	uvec3 id; // The id of the tile at the time of the request. The result is discarded if the tile was reallocated in the meantime.
+	dmat4 quadNormals; // The four corner vectors of the tile on the surface of a sphere.
+	uint32 tileSize; // The width and height of the generated texture.
+	float planetRadius;
+	float elevationScale;
+
+	bool packedTexels; // True if the texture is stored as packed texels (see TileData::packTexels) instead of RGBA32F.
+	uint8* textureData; // The generated texture, tileSize * tileSize texels, with the same layout as the GPU readback.
+	double minHeight; // The minimum elevation value within the generated texture.
+	double maxHeight; // The maximum elevation value within the generated texture.
+
+	uint64 requestTime; // The time that the request was submitted.
+	uint64 generationTime; // The time in nanoseconds spent generating the texture on the worker thread.
+	std::atomic<bool> completed; // Set by the worker thread once all of the above results are written.
+};
+
+/**
+ * CPU implementation of the terrain tile generator in res/shaders/simpleTerrain/heightComp.glsl. The
+ * noise functions (snoise, getNoise, getHeight) are evaluated with SSE4.1 for 4 sample points per call,
+ * or AVX2 for 8 points if the compiler targets it (/arch:AVX2). Any change to the shader must be mirrored
+ * here, and vice versa.
+ *
+ * The arithmetic follows the shader operation for operation in single precision, so results match the
+ * GPU to within the following tolerance:
+ *  - height: 1e-4 absolute (out of [-1, 1]). Differences come from FMA contraction and approximate
+ *    transcendentals in the driver, and from pow() with a negative base, which GLSL leaves undefined.
+ *    Integer exponents are evaluated as repeated multiplication here, as most compilers do for constants.
+ *  - normal: 1e-3 per component. The normal is a finite difference of heights 1/64 of a tile apart, which
+ *    amplifies height differences in flat areas.
+ */
+class CpuTileGenerator {
+private:
+	ThreadPool* threadPool; // The worker threads that requests are executed on.
+
+	std::atomic<uint64> numTilesGenerated; // Debug info
+	std::atomic<uint64> totalGenerationTime; // Debug info, nanoseconds spent generating tiles across all workers.
+
+public:
+	CpuTileGenerator(uint32 threadCount = 0);
+
+	~CpuTileGenerator();
+
+	/**
+	 * Generate the texture described by the request on the calling thread. The request's textureData must
+	 * be allocated with tileSize * tileSize * 4 floats, or tileSize * tileSize * 3 uint16 for packed texels.
+	 * The completed flag is set before this function returns.
+	 */
+	void generateTile(CpuTileRequest* request);
+
+	/**
+	 * Queue the request to be generated on a worker thread. The request must not be modified or deleted
+	 * until its completed flag becomes true.
+	 */
+	void submit(CpuTileRequest* request);
+
+	/**
+	 * Evaluate the terrain height function for each of the points (which should be normalized sphere vectors).
+	 * The points are processed in SIMD batches. This is thread safe.
+	 */
+	static void getHeights(int32 count, const fvec3* points, float* heights);
+
+	static float getHeight(fvec3 point);
+
+	/**
+	 * The number of sample points evaluated per SIMD call. 4 for SSE4.1, 8 for AVX2.
+	 */
+	static uint32 getSimdWidth();
+
+	uint32 getThreadCount() const;
+
+	uint64 getNumTilesGenerated() const;
+
+	/**
+	 * The average time in milliseconds that a single worker thread spends generating one tile.
+	 */
+	double getAverageGenerationTime() const;
+};
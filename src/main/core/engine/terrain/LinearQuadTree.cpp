@@ -0,0 +1,290 @@
+#include "LinearQuadTree.h"
+#include "core/application/Application.h"
+#include "core/engine/terrain/Planet.h"
+
+static uint64 spreadBits(uint64 x) {
+	x &= 0x00000000FFFFFFFFull;
+	x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+	x = (x | (x << 8)) & 0x00FF00FF00FF00FFull;
+	x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0Full;
+	x = (x | (x << 2)) & 0x3333333333333333ull;
+	x = (x | (x << 1)) & 0x5555555555555555ull;
+	return x;
+}
+
+static uvec2 getAncestorPosition(uvec2 treePosition, int32 levels) {
+	return uvec2(treePosition.x >> levels, treePosition.y >> levels);
+}
+
+static uint64 hashKey(uint64 key) {
+	// splitmix64 finalizer. Morton codes of nearby quads only differ in their low bits.
+	key ^= key >> 30;
+	key *= 0xBF58476D1CE4E5B9ull;
+	key ^= key >> 27;
+	key *= 0x94D049BB133111EBull;
+	key ^= key >> 31;
+	return key;
+}
+
+LinearQuadTree::LinearQuadTree(Planet* planet, int32 maxDepth, uint32 initialCapacity):
+	capacity(16), count(0), maxDepth(maxDepth) {
+	assert(maxDepth >= 0 && maxDepth <= MAX_DEPTH);
+
+	while (this->capacity < initialCapacity) {
+		this->capacity <<= 1;
+	}
+
+	this->entries = new Entry[this->capacity];
+	for (int i = 0; i < this->capacity; i++) {
+		this->entries[i].key = EMPTY_KEY;
+		this->entries[i].terrainQuad = NULL;
+	}
+
+	this->initEdgeRemaps(planet);
+}
+
+LinearQuadTree::~LinearQuadTree() {
+	if (this->count > 0) {
+		logError("Linear quad tree deleted while %d quads are still indexed", this->count);
+	}
+
+	delete[] this->entries;
+}
+
+void LinearQuadTree::initEdgeRemaps(Planet* planet) {
+	for (int i = 0; i < 6; i++) {
+		const dmat3 r = planet->getFaceOrientation((CubeFace)i);
+
+		for (int j = 0; j < 4; j++) {
+			// The face is folded over the edge onto its neighbour. A point a distance t past the edge in face space is
+			// a distance t down the neighbouring face from the edge, on the unit cube.
+			const bool horizontal = j == LEFT || j == RIGHT;
+			const double sign = (j == LEFT || j == TOP) ? -1.0 : +1.0;
+			const dvec3 across = horizontal ? r[0] : r[2];
+			const dvec3 along = horizontal ? r[2] : r[0];
+
+			auto fold = [&](dvec2 p) -> dvec3 {
+				const double w = horizontal ? p.x : p.y; // The coordinate crossing the edge.
+				const double v = horizontal ? p.y : p.x; // The coordinate along the edge.
+				return across * sign + r[1] * (2.0 - sign * w) + along * v;
+			};
+
+			EdgeRemap& remap = this->edgeRemaps[i][j];
+			remap.face = (CubeFace)i;
+
+			const dvec3 normal = across * sign;
+			for (int k = 0; k < 6; k++) {
+				if (dot(dvec3(planet->getFaceOrientation((CubeFace)k)[1]), normal) > 0.5) {
+					remap.face = (CubeFace)k;
+				}
+			}
+
+			assert(remap.face != (CubeFace)i);
+
+			const dmat3 n = planet->getFaceOrientation(remap.face);
+			auto project = [&](dvec3 p) -> dvec2 {
+				return dvec2(dot(p, n[0]), dot(p, n[2]));
+			};
+
+			remap.offset = project(fold(dvec2(0.0, 0.0)));
+			remap.transform[0] = project(fold(dvec2(1.0, 0.0))) - remap.offset;
+			remap.transform[1] = project(fold(dvec2(0.0, 1.0))) - remap.offset;
+		}
+	}
+
+	// Every edge is joined to the edge of the adjacent face that maps back onto this face.
+	for (int i = 0; i < 6; i++) {
+		for (int j = 0; j < 4; j++) {
+			EdgeRemap& remap = this->edgeRemaps[i][j];
+			remap.edge = (NeighbourIndex)((j + 2) % 4);
+
+			for (int k = 0; k < 4; k++) {
+				if (this->edgeRemaps[remap.face][k].face == (CubeFace)i) {
+					remap.edge = (NeighbourIndex)k;
+				}
+			}
+		}
+	}
+}
+
+uint32 LinearQuadTree::findSlot(uint64 key) const {
+	const uint32 mask = this->capacity - 1;
+	uint32 slot = (uint32)hashKey(key) & mask;
+
+	while (this->entries[slot].key != key && this->entries[slot].key != EMPTY_KEY) {
+		slot = (slot + 1) & mask;
+	}
+
+	return slot;
+}
+
+void LinearQuadTree::grow() {
+	Entry* oldEntries = this->entries;
+	uint32 oldCapacity = this->capacity;
+
+	this->capacity *= 2;
+	this->entries = new Entry[this->capacity];
+	for (int i = 0; i < this->capacity; i++) {
+		this->entries[i].key = EMPTY_KEY;
+		this->entries[i].terrainQuad = NULL;
+	}
+
+	for (int i = 0; i < oldCapacity; i++) {
+		if (oldEntries[i].key != EMPTY_KEY) {
+			this->entries[this->findSlot(oldEntries[i].key)] = oldEntries[i];
+		}
+	}
+
+	delete[] oldEntries;
+}
+
+void LinearQuadTree::insert(TerrainQuad* terrainQuad) {
+	assert(terrainQuad != NULL && terrainQuad->getDepth() <= MAX_DEPTH);
+
+	if ((this->count + 1) * 2 > this->capacity) {
+		this->grow(); // Keep the load factor under one half, so probe sequences stay short.
+	}
+
+	const uvec3 treePosition = terrainQuad->getTreePosition();
+	const uint64 key = getKey(terrainQuad->getCubeFace(), treePosition.z, uvec2(treePosition));
+	const uint32 slot = this->findSlot(key);
+
+	if (this->entries[slot].key == EMPTY_KEY) {
+		this->entries[slot].key = key;
+		this->count++;
+	} else {
+		logWarn("Terrain quad was inserted into the linear quad tree twice");
+	}
+
+	this->entries[slot].terrainQuad = terrainQuad;
+}
+
+void LinearQuadTree::remove(TerrainQuad* terrainQuad) {
+	const uvec3 treePosition = terrainQuad->getTreePosition();
+	const uint64 key = getKey(terrainQuad->getCubeFace(), treePosition.z, uvec2(treePosition));
+	const uint32 mask = this->capacity - 1;
+	uint32 slot = this->findSlot(key);
+
+	if (this->entries[slot].key == EMPTY_KEY || this->entries[slot].terrainQuad != terrainQuad) {
+		return;
+	}
+
+	// Shift the following entries of the probe sequence back, rather than leaving a tombstone, so lookups never
+	// slow down as quads are split and merged.
+	uint32 next = (slot + 1) & mask;
+	while (this->entries[next].key != EMPTY_KEY) {
+		const uint32 home = (uint32)hashKey(this->entries[next].key) & mask;
+
+		// Move the entry into the hole if the hole lies cyclically between its home slot and its current slot.
+		if (((next - home) & mask) >= ((next - slot) & mask)) {
+			this->entries[slot] = this->entries[next];
+			slot = next;
+		}
+
+		next = (next + 1) & mask;
+	}
+
+	this->entries[slot].key = EMPTY_KEY;
+	this->entries[slot].terrainQuad = NULL;
+	this->count--;
+}
+
+TerrainQuad* LinearQuadTree::find(CubeFace face, int32 depth, uvec2 treePosition) const {
+	return this->entries[this->findSlot(getKey(face, depth, treePosition))].terrainQuad;
+}
+
+TerrainQuad* LinearQuadTree::findNeighbour(const TerrainQuad* terrainQuad, NeighbourIndex direction) const {
+	static const ivec2 offsets[4] = { ivec2(-1, 0), ivec2(0, -1), ivec2(+1, 0), ivec2(0, +1) }; // LEFT, TOP, RIGHT, BOTTOM
+
+	const uvec3 treePosition = terrainQuad->getTreePosition();
+	const int32 depth = treePosition.z;
+	const int32 n = 1 << depth;
+
+	CubeFace face = terrainQuad->getCubeFace();
+	ivec2 cell = ivec2(uvec2(treePosition)) + offsets[direction];
+
+	if (cell.x < 0 || cell.y < 0 || cell.x >= n || cell.y >= n) {
+		const EdgeRemap& remap = this->edgeRemaps[face][direction];
+		const dvec2 center = (dvec2(cell) * 2.0 + 1.0) / double(n) - 1.0;
+		const dvec2 remapped = remap.transform * center + remap.offset;
+
+		face = remap.face;
+		cell = glm::clamp(ivec2(glm::floor((remapped + 1.0) * 0.5 * double(n))), ivec2(0), ivec2(n - 1));
+	}
+
+	// Coarser quads cover the neighbouring cell if the tree is not split as deep there.
+	for (int32 i = depth; i >= 0; i--) {
+		TerrainQuad* neighbour = this->find(face, i, getAncestorPosition(uvec2(cell), depth - i));
+
+		if (neighbour != NULL) {
+			return neighbour;
+		}
+	}
+
+	return NULL;
+}
+
+NeighbourIndex LinearQuadTree::getReverseEdge(const TerrainQuad* terrainQuad, const TerrainQuad* neighbour, NeighbourIndex direction) const {
+	const CubeFace face = terrainQuad->getCubeFace();
+
+	if (neighbour->getCubeFace() == face) {
+		return (NeighbourIndex)((direction + 2) % 4);
+	}
+
+	return this->edgeRemaps[face][direction].edge;
+}
+
+TerrainQuad* LinearQuadTree::findDeepest(const TerrainQuad* terrainQuad, dvec2 position, dvec2* leafPosition) const {
+	const uvec3 treePosition = terrainQuad->getTreePosition();
+	const CubeFace face = terrainQuad->getCubeFace();
+	const int32 minDepth = treePosition.z;
+	const int32 levels = this->maxDepth - minDepth;
+
+	if (levels <= 0) {
+		if (leafPosition != NULL) *leafPosition = position;
+		return const_cast<TerrainQuad*>(terrainQuad);
+	}
+
+	// The cell containing the position at the maximum depth. Every quad containing it is one of its ancestors.
+	const uint32 n = uint32(1) << levels;
+	const uvec2 sub = uvec2(glm::clamp(ivec2(glm::floor(position * double(n))), ivec2(0), ivec2(n - 1)));
+	const uvec2 cell = uvec2(treePosition) * n + sub;
+
+	int32 lo = minDepth;
+	int32 hi = this->maxDepth;
+	while (lo < hi) {
+		const int32 mid = (lo + hi + 1) / 2;
+
+		if (this->find(face, mid, getAncestorPosition(cell, this->maxDepth - mid)) != NULL) {
+			lo = mid;
+		} else {
+			hi = mid - 1;
+		}
+	}
+
+	TerrainQuad* deepest = lo == minDepth ? const_cast<TerrainQuad*>(terrainQuad) : this->find(face, lo, getAncestorPosition(cell, this->maxDepth - lo));
+
+	if (leafPosition != NULL) {
+		const uint32 scale = uint32(1) << (lo - minDepth);
+		const dvec2 origin = dvec2(uvec2(deepest->getTreePosition()) - uvec2(treePosition) * scale);
+		*leafPosition = position * double(scale) - origin;
+	}
+
+	return deepest;
+}
+
+uint32 LinearQuadTree::getCount() const {
+	return this->count;
+}
+
+uint32 LinearQuadTree::getCapacity() const {
+	return this->capacity;
+}
+
+uint64 LinearQuadTree::getMortonCode(uvec2 treePosition) {
+	return spreadBits(treePosition.x) | (spreadBits(treePosition.y) << 1);
+}
+
+uint64 LinearQuadTree::getKey(CubeFace face, int32 depth, uvec2 treePosition) {
+	return (uint64(face) << 61) | (uint64(depth) << 56) | getMortonCode(treePosition);
+}
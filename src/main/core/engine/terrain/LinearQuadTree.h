@@ -0,0 +1,93 @@
+#pragma once
+
+#include "core/Core.h"
+#include "core/engine/terrain/TerrainQuad.h"
+
+class Planet;
+enum CubeFace;
+
+/**
+ * A hashed linear quadtree, indexing every terrain quad of a planet by its cube face, depth and the Morton code of
+ * its tree position. It is kept alongside the pointer tree, so that any quad can be found from its address with a
+ * single hash probe instead of walking parent and child pointers. Neighbours on the same face are found with
+ * arithmetic on the tree position. Neighbours across a cube edge go through a precomputed remap of the tree position
+ * into the adjacent face.
+ */
+class LinearQuadTree {
+private:
+	static constexpr uint64 EMPTY_KEY = ~uint64(0); // Face 7 is never used, so this never collides with a real key.
+	static constexpr int32 MAX_DEPTH = 28; // The Morton code of a tree position must fit in 56 bits of the key.
+
+	// Maps a tree position just outside an edge of a face onto the adjacent face. Positions are transformed as the
+	// centers of their cells, normalized to [-1, 1] across the face.
+	struct EdgeRemap {
+		CubeFace face;
+		NeighbourIndex edge; // The edge of the adjacent face that is joined to this one.
+		dmat2 transform;
+		dvec2 offset;
+	};
+
+	struct Entry {
+		uint64 key;
+		TerrainQuad* terrainQuad;
+	};
+
+	Entry* entries; // Open addressed with linear probing. The capacity is always a power of two.
+	uint32 capacity;
+	uint32 count;
+
+	EdgeRemap edgeRemaps[6][4]; // [face][NeighbourIndex]
+
+	int32 maxDepth;
+
+	uint32 findSlot(uint64 key) const;
+
+	void grow();
+
+	void initEdgeRemaps(Planet* planet);
+
+public:
+	LinearQuadTree(Planet* planet, int32 maxDepth, uint32 initialCapacity = 4096);
+
+	~LinearQuadTree();
+
+	// Deleted copy constructor and assignment function
+	LinearQuadTree(const LinearQuadTree&) = delete;
+	LinearQuadTree& operator=(const LinearQuadTree&) = delete;
+
+	void insert(TerrainQuad* terrainQuad);
+
+	void remove(TerrainQuad* terrainQuad);
+
+	/**
+	 * The quad at the tree position and depth on the face, or NULL if the tree is not split that far there.
+	 */
+	TerrainQuad* find(CubeFace face, int32 depth, uvec2 treePosition) const;
+
+	/**
+	 * The quad adjacent to the specified edge of the quad, at the same depth if it exists, otherwise the deepest quad
+	 * covering that area. Crosses onto the adjacent cube face at the edge of a face.
+	 */
+	TerrainQuad* findNeighbour(const TerrainQuad* terrainQuad, NeighbourIndex direction) const;
+
+	/**
+	 * The edge of a neighbour returned by findNeighbour that faces back towards the quad. This is the opposite edge if
+	 * the neighbour is on the same face, otherwise the edge of the adjacent face joined to the edge of the quad's face.
+	 */
+	NeighbourIndex getReverseEdge(const TerrainQuad* terrainQuad, const TerrainQuad* neighbour, NeighbourIndex direction) const;
+
+	/**
+	 * The deepest quad below the specified quad that contains the position, which is normalized to [0, 1] over the
+	 * quad. This is a binary search over depth, since every ancestor of a quad is also in the tree. If leafPosition is
+	 * not NULL, it receives the position normalized over the returned quad.
+	 */
+	TerrainQuad* findDeepest(const TerrainQuad* terrainQuad, dvec2 position, dvec2* leafPosition = NULL) const;
+
+	uint32 getCount() const;
+
+	uint32 getCapacity() const;
+
+	static uint64 getMortonCode(uvec2 treePosition);
+
+	static uint64 getKey(CubeFace face, int32 depth, uvec2 treePosition);
+};
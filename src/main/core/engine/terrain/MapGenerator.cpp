@@ -7,326 +7,334 @@
 #include "core/engine/terrain/TileSupplier.h"
 #include "core/engine/terrain/Planet.h"
 #include "core/util/Time.h"
+#include "core/util/ThreadPool.h"
+#include "core/engine/terrain/MapNodeIndex.h"
+#include "core/engine/terrain/ClimateMap.h"
+#include "core/engine/terrain/MapSnapshot.h"
+
+// The number of nodes each task of the climate simulation processes. The simulation splits its work and its sums
+// at these fixed boundaries, so the results do not depend on how many threads run it.
+static const int32 CLIMATE_BLOCK_SIZE = 1024;
 
 
 
 MapGenerator::MapGenerator(Planet* planet, uint32 resolution) {
 	this->planet = planet;
 	this->resolution = resolution;
+	this->seed = planet->getTileSupplier()->getSeed();
 	this->renderDebugCurrents = false;
 	this->renderDebugSurface = false;
+	this->debugSurfaceRenderMode = 0;
+	this->debugSurfaceTriangleMesh = NULL;
+	this->debugSurfaceLineMesh = NULL;
+	this->debugCurrentTriangleMesh = NULL;
+	this->debugCurrentLineMesh = NULL;
+	this->debugClosestWalkMesh = NULL;
+	this->threadPool = new ThreadPool();
+	this->nodeIndex = NULL;
+	this->climateMap = new ClimateMap(this->threadPool);
+
+	this->initializeLifeZones();
+
+	// Run here, on the render thread, since the terrain under the nodes is sampled and the debug meshes are uploaded
+	// with the GL context. Only the first run for a planet simulates, later runs load the snapshot it writes.
+	this->generate();
+	//this->benchmarkClosestMapNode(100000);
+
+}
 
+MapGenerator::~MapGenerator() {
+	delete this->climateMap; // Waits for its bake, which runs on the thread pool.
+	delete this->threadPool;
+
+	delete this->debugSurfaceTriangleMesh;
+	delete this->debugSurfaceLineMesh;
+	delete this->debugCurrentTriangleMesh;
+	delete this->debugCurrentLineMesh;
+	delete this->debugClosestWalkMesh;
+}
+
+void MapGenerator::generate() {
 	uint64 a, b;
 
-	//a = Time::now();
-	//this->generateIcosohedron();
-	//b = Time::now();
-	//logInfo("Took %f ms to generate map geometry with %d nodes", (b - a) / 1000000.0, this->nodes.size());
-	//
-	//a = Time::now();
-	//this->generateAirCurrents();
-	//b = Time::now();
-	//logInfo("Took %f ms to generate air currents", (b - a) / 1000000.0);
-	//
-	//a = Time::now();
-	//this->initializeHeat();
-	//b = Time::now();
-	//logInfo("Took %f ms to initialize node temperature", (b - a) / 1000000.0);
-	//
-	//a = Time::now();
-	//this->initializeMoisture();
-	//b = Time::now();
-	//logInfo("Took %f ms to initialize node moisture", (b - a) / 1000000.0);
-	//
-	//a = Time::now();
-	//this->initializeBiomes();
-	//b = Time::now();
-	//logInfo("Took %f ms to initialize node biomes", (b - a) / 1000000.0);
-	//
-	//a = Time::now();
-	//this->generateDebugMeshes();
-	//b = Time::now();
-	//logInfo("Took %f ms to generate debug geometry", (b - a) / 1000000.0);
+	if (!this->loadSnapshot()) {
+		this->simulate();
+	}
 
+	a = Time::now();
+	this->generateDebugMeshes();
+	b = Time::now();
+	logInfo("Took %f ms to generate debug geometry", (b - a) / 1000000.0);
+
+	this->climateMap->bake(this->graph, this->nodeIndex, this->lifeZones);
 }
 
-MapGenerator::~MapGenerator() {
+MapSnapshot MapGenerator::getSnapshot() const {
+	TileSupplier* tileSupplier = this->planet->getTileSupplier();
 
+	// The same parameters as the tile generator, which the node heights are sampled from.
+	return MapSnapshot("cache", this->seed, tileSupplier->getPlanetIdentity(this->planet), (float) this->planet->getRadius(),
+		(float) this->planet->getElevationScale(), this->resolution, MAP_GENERATOR_VERSION, TILE_GENERATOR_VERSION);
 }
 
-void MapGenerator::generateIcosohedron() {
-	const double a = 0.525731112119133606;
-	const double b = 0.850650808352039932;
-	const double c = 0.0;
-
-	std::vector<MapNode*> icoNodes = {
-		new MapNode(fvec3(c, +b, +a)), new MapNode(fvec3(c, +b, -a)), new MapNode(fvec3(c, -b, +a)), new MapNode(fvec3(c, -b, -a)),
-		new MapNode(fvec3(+a, c, +b)), new MapNode(fvec3(-a, c, +b)), new MapNode(fvec3(+a, c, -b)), new MapNode(fvec3(-a, c, -b)),
-		new MapNode(fvec3(+b, +a, c)), new MapNode(fvec3(+b, -a, c)), new MapNode(fvec3(-b, +a, c)), new MapNode(fvec3(-b, -a, c)),
-	};
+bool MapGenerator::loadSnapshot() {
+	uint64 a, b;
 
-	std::vector<MapEdge*> icoEdges = {
-		new MapEdge({ 0, 1, }), new MapEdge({ 0, 4, }), new MapEdge({ 0, 5, }),
-		new MapEdge({ 0, 8, }), new MapEdge({ 0, 10, }), new  MapEdge({ 1, 6, }),
-		new MapEdge({ 1, 7, }), new MapEdge({ 1, 8, }), new MapEdge({ 1, 10, }),
-		new MapEdge({ 2, 3, }), new MapEdge({ 2, 4, }), new MapEdge({ 2, 5, }),
-		new MapEdge({ 2, 9, }), new MapEdge({ 2, 11, }), new  MapEdge({ 3, 6, }),
-		new MapEdge({ 3, 7, }), new MapEdge({ 3, 9, }), new MapEdge({ 3, 11, }),
-		new MapEdge({ 4, 5, }), new MapEdge({ 4, 8, }), new MapEdge({ 4, 9, }),
-		new MapEdge({ 5, 10, }), new  MapEdge({ 5, 11, }), new MapEdge({ 6, 7, }),
-		new MapEdge({ 6, 8, }), new MapEdge({ 6, 9, }), new MapEdge({ 7, 10, }),
-		new MapEdge({ 7, 11, }), new  MapEdge({ 8, 9, }), new MapEdge({ 10, 11, }),
-	};
+	a = Time::now();
+	MapSnapshot snapshot = this->getSnapshot();
 
-	std::vector<MapFace*> icoFaces = {
-		new MapFace({ 0, 1, 8 }, { 0, 7, 3 }),
-		new MapFace({ 0, 4, 5 }, { 1, 18, 2 }),
-		new MapFace({ 0, 5, 10 }, { 2, 21, 4 }),
-		new MapFace({ 0, 8, 4 }, { 3, 19, 1 }),
-		new MapFace({ 0, 10, 1 }, { 4, 8, 0 }),
-		new MapFace({ 1, 6, 8 }, { 5, 24, 7 }),
-		new MapFace({ 1, 7, 6 }, { 6, 23, 5 }),
-		new MapFace({ 1, 10, 7 }, { 8, 26, 6 }),
-		new MapFace({ 2, 3, 11 }, { 9, 17, 13 }),
-		new MapFace({ 2, 4, 9 }, { 10, 20, 12 }),
-		new MapFace({ 2, 5, 4 }, { 11, 18, 10 }),
-		new MapFace({ 2, 9, 3 }, { 12, 16, 9 }),
-		new MapFace({ 2, 11, 5 }, { 13, 22, 11 }),
-		new MapFace({ 3, 6, 7 }, { 14, 23, 15 }),
-		new MapFace({ 3, 7, 11 }, { 15, 27, 17 }),
-		new MapFace({ 3, 9, 6 }, { 16, 25, 14 }),
-		new MapFace({ 4, 8, 9 }, { 19, 28, 20 }),
-		new MapFace({ 5, 11, 10 }, { 22, 29, 21 }),
-		new MapFace({ 6, 9, 8 }, { 25, 28, 24 }),
-		new MapFace({ 7, 10, 11 }, { 26, 29, 27 }),
-	};
+	if (!snapshot.read(&this->graph, this->lifeZones.size())) {
+		return false;
+	}
 
-	int i, j, k, s, t;
+	this->buildNodeIndex();
+	b = Time::now();
+	logInfo("Took %f ms to load map with %d nodes", (b - a) / 1000000.0, this->graph.getNodeCount());
+	return true;
+}
 
-	for (i = 0; i < icoEdges.size(); i++) {
-		for (j = 0; j < icoEdges[i]->n.size(); j++) {
-			icoNodes[j]->e.push_back(i);
-		}
-	}
+void MapGenerator::simulate() {
+	uint64 a, b;
 
-	for (i = 0; i < icoFaces.size(); i++) {
-		for (j = 0; j < icoFaces[i]->n.size(); j++) {
-			icoNodes[j]->f.push_back(i);
-		}
-	}
+	a = Time::now();
+	this->generateIcosohedron();
+	b = Time::now();
+	logInfo("Took %f ms to generate map geometry with %d nodes", (b - a) / 1000000.0, this->graph.getNodeCount());
 
-	for (i = 0; i < icoFaces.size(); i++) {
-		for (j = 0; j < icoFaces[i]->e.size(); j++) {
-			icoEdges[j]->f.push_back(i);
-		}
-	}
+	a = Time::now();
+	this->generateAirCurrents();
+	b = Time::now();
+	logInfo("Took %f ms to generate air currents", (b - a) / 1000000.0);
 
-	std::vector<MapNode*> nodes;
-	std::vector<MapEdge*> edges;
-	std::vector<MapFace*> faces;
-	std::vector<int32> faceNodes;
-	std::vector<int32> faceEdges0;
-	std::vector<int32> faceEdges1;
-	std::vector<int32> faceEdges2;
+	a = Time::now();
+	this->initializeHeat();
+	b = Time::now();
+	logInfo("Took %f ms to initialize node temperature", (b - a) / 1000000.0);
 
-	for (i = 0; i < icoNodes.size(); i++) {
-		nodes.push_back(new MapNode(icoNodes[i]->p));
-	}
+	a = Time::now();
+	this->initializeMoisture();
+	b = Time::now();
+	logInfo("Took %f ms to initialize node moisture", (b - a) / 1000000.0);
 
-	for (i = 0; i < icoEdges.size(); i++) {
-		MapEdge* edge = icoEdges[i];
+	a = Time::now();
+	this->initializeBiomes();
+	b = Time::now();
+	logInfo("Took %f ms to initialize node biomes", (b - a) / 1000000.0);
 
-		MapNode* n0 = icoNodes[edge->n[0]];
-		MapNode* n1 = icoNodes[edge->n[1]];
+	MapSnapshot snapshot = this->getSnapshot();
+	snapshot.write(this->graph);
+}
 
-		nodes[edge->n[0]]->e.push_back(edges.size());
-		int32 pi = edge->n[0];
+void MapGenerator::generateIcosohedron() {
+	struct IcosahedronFace {
+		int32 n[3]; // The corners of the face. Every face is wound the same way.
+		int32 e[3]; // The edges from n[0] to n[1], n[1] to n[2] and n[2] to n[0].
+	};
 
-		for (j = 1; j < this->resolution; j++) {
-			int32 ei = edges.size();
-			int32 ni = nodes.size();
-			edge->se.push_back(ei);
-			edge->sn.push_back(ni);
-			edges.push_back(new MapEdge({ pi, ni }));
-			pi = ni;
-			nodes.push_back(new MapNode(slerp(n0->p, n1->p, double(j) / this->resolution), { ei, ei + 1 }));
-		}
+	const float a = 0.525731112119133606;
+	const float b = 0.850650808352039932;
+	const float c = 0.0;
 
-		edge->se.push_back(edges.size());
-		nodes[edge->n[1]]->e.push_back(edges.size());
-		edges.push_back(new MapEdge({ pi, edge->n[1] }));
-	}
+	const fvec3 icoNodes[12] = {
+		fvec3(c, +b, +a), fvec3(c, +b, -a), fvec3(c, -b, +a), fvec3(c, -b, -a),
+		fvec3(+a, c, +b), fvec3(-a, c, +b), fvec3(+a, c, -b), fvec3(-a, c, -b),
+		fvec3(+b, +a, c), fvec3(+b, -a, c), fvec3(-b, +a, c), fvec3(-b, -a, c),
+	};
+
+	const int32 icoEdges[30][2] = {
+		{ 0, 1 }, { 0, 4 }, { 0, 5 }, { 0, 8 }, { 0, 10 }, { 1, 6 },
+		{ 1, 7 }, { 1, 8 }, { 1, 10 }, { 2, 3 }, { 2, 4 }, { 2, 5 },
+		{ 2, 9 }, { 2, 11 }, { 3, 6 }, { 3, 7 }, { 3, 9 }, { 3, 11 },
+		{ 4, 5 }, { 4, 8 }, { 4, 9 }, { 5, 10 }, { 5, 11 }, { 6, 7 },
+		{ 6, 8 }, { 6, 9 }, { 7, 10 }, { 7, 11 }, { 8, 9 }, { 10, 11 },
+	};
 
-	for (i = 0; i < icoFaces.size(); i++) {
-		MapFace* face = icoFaces[i];
-		MapEdge* e0 = icoEdges[face->e[0]];
-		MapEdge* e1 = icoEdges[face->e[1]];
-		MapEdge* e2 = icoEdges[face->e[2]];
-		fvec3 p0 = icoNodes[face->n[0]]->p;
-		fvec3 p1 = icoNodes[face->n[1]]->p;
-		fvec3 p2 = icoNodes[face->n[2]]->p;
+	const IcosahedronFace icoFaces[20] = {
+		{ { 0, 1, 8 }, { 0, 7, 3 } },
+		{ { 0, 4, 5 }, { 1, 18, 2 } },
+		{ { 0, 5, 10 }, { 2, 21, 4 } },
+		{ { 0, 8, 4 }, { 3, 19, 1 } },
+		{ { 0, 10, 1 }, { 4, 8, 0 } },
+		{ { 1, 6, 8 }, { 5, 24, 7 } },
+		{ { 1, 7, 6 }, { 6, 23, 5 } },
+		{ { 1, 10, 7 }, { 8, 26, 6 } },
+		{ { 2, 3, 11 }, { 9, 17, 13 } },
+		{ { 2, 4, 9 }, { 10, 20, 12 } },
+		{ { 2, 5, 4 }, { 11, 18, 10 } },
+		{ { 2, 9, 3 }, { 12, 16, 9 } },
+		{ { 2, 11, 5 }, { 13, 22, 11 } },
+		{ { 3, 6, 7 }, { 14, 23, 15 } },
+		{ { 3, 7, 11 }, { 15, 27, 17 } },
+		{ { 3, 9, 6 }, { 16, 25, 14 } },
+		{ { 4, 8, 9 }, { 19, 28, 20 } },
+		{ { 5, 11, 10 }, { 22, 29, 21 } },
+		{ { 6, 9, 8 }, { 25, 28, 24 } },
+		{ { 7, 10, 11 }, { 26, 29, 27 } },
+	};
 
-		fvec3 d = p1 - p0;
+	assert(this->resolution >= 1);
+
+	// Every icosahedron edge is split into R segments, and every face into R * R triangles. The nodes are stored as
+	// the 12 corners, then the R - 1 nodes inside each edge, then the nodes inside each face, so every node has exactly
+	// one index, whichever faces it is shared by.
+	const int32 R = this->resolution;
+	const int32 edgeNodeCount = R - 1; // The nodes inside each icosahedron edge.
+	const int32 faceNodeCount = (R - 1) * (R - 2) / 2; // The nodes inside each icosahedron face.
+	const int32 edgeNodeStart = 12;
+	const int32 faceNodeStart = edgeNodeStart + 30 * edgeNodeCount;
+	const int32 count = 10 * R * R + 2;
+	const int32 triangleCount = 20 * R * R;
+
+	// The node k segments along the edge from the corner, for 0 < k < R.
+	auto getEdgeNode = [&](int32 edge, int32 from, int32 k) {
+		return edgeNodeStart + edge * edgeNodeCount + (icoEdges[edge][0] == from ? k : R - k) - 1;
+	};
 
+	// The node in row s and column t of the face. Row 0 runs from n[0] to n[1], and the rows get shorter towards n[2],
+	// so that column 0 runs from n[0] to n[2] and the last column of each row runs from n[1] to n[2].
+	auto getFaceNode = [&](int32 face, int32 s, int32 t) {
+		const IcosahedronFace& f = icoFaces[face];
+		if (s == R) return f.n[2];
+		if (s == 0 && t == 0) return f.n[0];
+		if (s == 0 && t == R) return f.n[1];
+		if (s == 0) return getEdgeNode(f.e[0], f.n[0], t);
+		if (t == 0) return getEdgeNode(f.e[2], f.n[0], s);
+		if (t == R - s) return getEdgeNode(f.e[1], f.n[1], s);
+		return faceNodeStart + face * faceNodeCount + (s - 1) * (R - 1) - (s - 1) * s / 2 + (t - 1);
+	};
 
-		bool reverseEdge0, reverseEdge1, reverseEdge2;
+	MapGraph& g = this->graph;
+	g.position.resize(count);
 
-		reverseEdge0 = face->n[0] != e0->n[0];
-		auto getEdgeNode0 = [&](int32 k) { return e0->sn[reverseEdge0 ? (this->resolution - 2 - k) : k]; };
-		reverseEdge1 = face->n[1] != e1->n[0];
-		auto getEdgeNode1 = [&](int32 k) { return e1->sn[reverseEdge1 ? (this->resolution - 2 - k) : k]; };
-		reverseEdge2 = face->n[0] != e2->n[0];
-		auto getEdgeNode2 = [&](int32 k) { return e2->sn[reverseEdge2 ? (this->resolution - 2 - k) : k]; };
+	for (int i = 0; i < 12; i++) {
+		g.position[i] = icoNodes[i];
+	}
 
-		faceNodes.clear();
-		faceNodes.push_back(face->n[0]);
+	this->threadPool->parallelFor(30, [&](uint32 edge) {
+		const fvec3 p0 = icoNodes[icoEdges[edge][0]];
+		const fvec3 p1 = icoNodes[icoEdges[edge][1]];
 
-		for (j = 0; j < e0->sn.size(); j++) {
-			faceNodes.push_back(getEdgeNode0(j));
+		for (int k = 1; k < R; k++) {
+			g.position[getEdgeNode(edge, icoEdges[edge][0], k)] = slerp(p0, p1, float(k) / R);
 		}
+	}, 1);
 
-		faceNodes.push_back(face->n[1]);
+	this->threadPool->parallelFor(20, [&](uint32 face) {
+		for (int s = 1; s < R - 1; s++) {
+			const fvec3 p0 = g.position[getFaceNode(face, s, 0)];
+			const fvec3 p1 = g.position[getFaceNode(face, s, R - s)];
 
-		for (s = 1; s < this->resolution; s++) {
-			faceNodes.push_back(getEdgeNode2(s - 1));
-			fvec3 p0 = nodes[getEdgeNode2(s - 1)]->p;
-			fvec3 p1 = nodes[getEdgeNode1(s - 1)]->p;
-			for (t = 1; t < this->resolution - s; t++) {
-				faceNodes.push_back(nodes.size());
-				nodes.push_back(new MapNode(slerp(p0, p1, float(t) / (this->resolution - s))));
+			for (int t = 1; t < R - s; t++) {
+				g.position[getFaceNode(face, s, t)] = slerp(p0, p1, float(t) / (R - s));
 			}
-			faceNodes.push_back(getEdgeNode1(s - 1));
 		}
+	}, 1);
+
+	// The terrain is sampled on the GPU while the rest of the graph is built.
+	PointDataRequest* pointData = this->planet->getTileSupplier()->beginPointData(this->planet, count, g.position.data());
+
+	g.heightmapData.resize(count);
+	g.area.resize(count);
+	g.water.resize(count);
+	g.windVector.assign(count, fvec3(0.0F));
+	g.windStrength.assign(count, 0.0F);
+	g.normalizedWindStrength.assign(count, 0.0F);
+	g.temperature.assign(count, 0.0F);
+	g.moisture.assign(count, 0.0F);
+	g.lifeZone.assign(count, -1);
+
+	// The corners have five neighbours and every other node has six.
+	g.neighbourOffsets.resize(count + 1);
+	for (int i = 0; i <= count; i++) {
+		g.neighbourOffsets[i] = i < 12 ? i * 5 : 60 + (i - 12) * 6;
+	}
 
-		faceNodes.push_back(face->n[2]);
+	g.neighbours.resize(g.neighbourOffsets[count]);
+	g.currents.assign(g.neighbourOffsets[count], 0.0F);
+	g.triangles.resize(triangleCount * 3);
 
-		reverseEdge0 = face->n[0] != e0->n[0];
-		auto getEdgeEdge0 = [&](int32 k) { return e0->se[reverseEdge0 ? (this->resolution - 1 - k) : k];  };
-		reverseEdge1 = face->n[1] != e1->n[0];
-		auto getEdgeEdge1 = [&](int32 k) { return e1->se[reverseEdge1 ? (this->resolution - 1 - k) : k];  };
-		reverseEdge2 = face->n[0] != e2->n[0];
-		auto getEdgeEdge2 = [&](int32 k) { return e2->se[reverseEdge2 ? (this->resolution - 1 - k) : k];  };
+	// Each face fills in its own nodes and triangles. The neighbours of a node inside an edge are stored as the two
+	// along the edge, then two inside each of the faces either side. Those faces go around the edge in opposite
+	// directions, so the direction decides which of the two faces writes which pair.
+	this->threadPool->parallelFor(20, [&](uint32 face) {
+		const IcosahedronFace& f = icoFaces[face];
 
-		int32 nodeIndex, edgeIndex;
+		const int32 steps[6][2] = { { 0, -1 }, { 0, +1 }, { -1, 0 }, { -1, +1 }, { +1, 0 }, { +1, -1 } };
 
-		faceEdges0.clear();
-		for (j = 0; j < this->resolution; ++j) {
-			faceEdges0.push_back(getEdgeEdge0(j));
-		}
-		nodeIndex = this->resolution + 1;
-		for (s = 1; s < this->resolution; s++) {
-			for (t = 0; t < this->resolution - s; t++) {
-				faceEdges0.push_back(edges.size());
-				MapEdge* edge = new MapEdge({ faceNodes[nodeIndex], faceNodes[nodeIndex + 1] });
-				nodes[edge->n[0]]->e.push_back(edges.size());
-				nodes[edge->n[1]]->e.push_back(edges.size());
-				edges.push_back(edge);
-				nodeIndex++;
-			}
-			nodeIndex++;
-		}
+		for (int s = 1; s < R - 1; s++) {
+			for (int t = 1; t < R - s; t++) {
+				int32* neighbours = &g.neighbours[g.neighbourOffsets[getFaceNode(face, s, t)]];
 
-		faceEdges1.clear();
-		nodeIndex = 1;
-		for (s = 0; s < this->resolution; s++) {
-			for (t = 1; t < this->resolution - s; t++) {
-				faceEdges1.push_back(edges.size());
-				MapEdge* edge = new MapEdge({ faceNodes[nodeIndex], faceNodes[nodeIndex + this->resolution - s] });
-				nodes[edge->n[0]]->e.push_back(edges.size());
-				nodes[edge->n[1]]->e.push_back(edges.size());
-				edges.push_back(edge);
-				nodeIndex++;
+				for (int i = 0; i < 6; i++) {
+					neighbours[i] = getFaceNode(face, s + steps[i][0], t + steps[i][1]);
+				}
 			}
-			faceEdges1.push_back(getEdgeEdge1(s));
-			nodeIndex += 2;
 		}
 
-		faceEdges2.clear();
-		nodeIndex = 1;
-		for (s = 0; s < this->resolution; s++) {
-			faceEdges2.push_back(getEdgeEdge2(s));
-			for (t = 1; t < this->resolution - s; t++) {
-				faceEdges2.push_back(edges.size());
-				MapEdge* edge = new MapEdge({ faceNodes[nodeIndex], faceNodes[nodeIndex + this->resolution - s + 1] });
-				nodes[edge->n[0]]->e.push_back(edges.size());
-				nodes[edge->n[1]]->e.push_back(edges.size());
-				edges.push_back(edge);
-				nodeIndex++;
-			}
-			nodeIndex += 2;
-		}
+		auto setEdgeNeighbours = [&](int32 side, int32 node, int32 n0, int32 n1) {
+			int32* neighbours = &g.neighbours[g.neighbourOffsets[node] + (icoEdges[f.e[side]][0] == f.n[side] ? 2 : 4)];
+			neighbours[0] = n0;
+			neighbours[1] = n1;
+		};
 
-		nodeIndex = 0;
-		edgeIndex = 0;
-		for (s = 0; s < this->resolution; s++) {
-			for (t = 1; t < this->resolution - s + 1; t++) {
-				MapFace* subFace = new MapFace(
-					{ faceNodes[nodeIndex], faceNodes[nodeIndex + 1], faceNodes[nodeIndex + this->resolution - s + 1] },
-					{ faceEdges0[edgeIndex], faceEdges1[edgeIndex], faceEdges2[edgeIndex] }
-				);
-
-				nodes[subFace->n[0]]->f.push_back(faces.size());
-				nodes[subFace->n[1]]->f.push_back(faces.size());
-				nodes[subFace->n[2]]->f.push_back(faces.size());
-				edges[subFace->e[0]]->f.push_back(faces.size());
-				edges[subFace->e[1]]->f.push_back(faces.size());
-				edges[subFace->e[2]]->f.push_back(faces.size());
-				faces.push_back(subFace);
-				nodeIndex++;
-				edgeIndex++;
-			}
-			nodeIndex++;
+		for (int k = 1; k < R; k++) {
+			setEdgeNeighbours(0, getFaceNode(face, 0, k), getFaceNode(face, 1, k - 1), getFaceNode(face, 1, k));
+			setEdgeNeighbours(1, getFaceNode(face, k, R - k), getFaceNode(face, k, R - k - 1), getFaceNode(face, k - 1, R - k));
+			setEdgeNeighbours(2, getFaceNode(face, k, 0), getFaceNode(face, k, 1), getFaceNode(face, k - 1, 1));
 		}
 
-		nodeIndex = 1;
-		edgeIndex = 0;
-		for (s = 1; s < this->resolution; s++) {
-			for (t = 1; t < this->resolution - s + 1; t++) {
-				MapFace* subFace = new MapFace(
-					{ faceNodes[nodeIndex], faceNodes[nodeIndex + this->resolution - s + 2], faceNodes[nodeIndex + this->resolution - s + 1] },
-					{ faceEdges2[edgeIndex + 1], faceEdges0[edgeIndex + this->resolution - s + 1], faceEdges1[edgeIndex] }
-				);
-
-				nodes[subFace->n[0]]->f.push_back(faces.size());
-				nodes[subFace->n[1]]->f.push_back(faces.size());
-				nodes[subFace->n[2]]->f.push_back(faces.size());
-				edges[subFace->e[0]]->f.push_back(faces.size());
-				edges[subFace->e[1]]->f.push_back(faces.size());
-				edges[subFace->e[2]]->f.push_back(faces.size());
-				faces.push_back(subFace);
-				nodeIndex++;
-				edgeIndex++;
+		int32* triangles = &g.triangles[face * R * R * 3];
+
+		for (int s = 0; s < R; s++) {
+			for (int t = 0; t < R - s; t++) {
+				*triangles++ = getFaceNode(face, s, t);
+				*triangles++ = getFaceNode(face, s, t + 1);
+				*triangles++ = getFaceNode(face, s + 1, t);
+
+				if (t < R - s - 1) {
+					*triangles++ = getFaceNode(face, s, t + 1);
+					*triangles++ = getFaceNode(face, s + 1, t + 1);
+					*triangles++ = getFaceNode(face, s + 1, t);
+				}
 			}
-			nodeIndex += 2;
-			edgeIndex += 1;
 		}
-	}
+	}, 1);
 
-	fvec4* data = new fvec4[nodes.size()]();
-	fvec3* points = new fvec3[nodes.size()]();
+	// The neighbours along each edge, including those of the corners.
+	int32 cornerNeighbourCount[12] = {};
 
-	for (int i = 0; i < nodes.size(); i++) points[i] = nodes[i]->p;
+	for (int edge = 0; edge < 30; edge++) {
+		const int32 n0 = icoEdges[edge][0];
+		const int32 n1 = icoEdges[edge][1];
 
-	planet->getTileSupplier()->computePointData(nodes.size(), points, data);
+		for (int k = 1; k < R; k++) {
+			int32* neighbours = &g.neighbours[g.neighbourOffsets[getEdgeNode(edge, n0, k)]];
+			neighbours[0] = k == 1 ? n0 : getEdgeNode(edge, n0, k - 1);
+			neighbours[1] = k == R - 1 ? n1 : getEdgeNode(edge, n0, k + 1);
+		}
 
-	for (int i = 0; i < nodes.size(); i++) {
-		MapNode* n = nodes[i];
-		n->index = i;
+		g.neighbours[g.neighbourOffsets[n0] + cornerNeighbourCount[n0]++] = R > 1 ? getEdgeNode(edge, n0, 1) : n1;
+		g.neighbours[g.neighbourOffsets[n1] + cornerNeighbourCount[n1]++] = R > 1 ? getEdgeNode(edge, n1, 1) : n0;
+	}
 
-		// Area = planet surface area / number of nodes. Fairly crude approximation.
-		n->area = (4.0 * PI * this->planet->getRadius() * this->planet->getRadius()) / nodes.size();
-		n->heightmapData = fvec4(data[i]);
-		if (data[i].w <= 0.0) {
-			n->water = true;
-		}
+	this->planet->getTileSupplier()->finishPointData(pointData, g.heightmapData.data());
+
+	// Area = planet surface area / number of nodes. Fairly crude approximation.
+	const float area = (4.0 * PI * this->planet->getRadius() * this->planet->getRadius()) / count;
+
+	for (int i = 0; i < count; i++) {
+		g.area[i] = area;
+		g.water[i] = g.heightmapData[i].w <= 0.0;
 	}
 
-	//delete[] data;
-	//delete[] points;
+	logInfo("Built map graph with %d nodes, %d neighbour links and %d triangles in %.2f MiB", count, g.neighbours.size(), triangleCount, g.getMemoryUsage() / (1024.0 * 1024.0));
 
-	this->nodes = nodes;
-	this->edges = edges;
-	this->faces = faces;
+	this->buildNodeIndex();
+}
+
+void MapGenerator::buildNodeIndex() {
+	this->nodeIndex = std::make_shared<MapNodeIndex>(this->graph.getNodeCount(), this->graph.position.data()); // Climate map bakes may still hold the previous index.
+	logInfo("Built map node index with %d cells in %.2f MiB", this->nodeIndex->getCellCount(), this->nodeIndex->getMemoryUsage() / (1024.0 * 1024.0));
 }
 
 void MapGenerator::generateAirCurrents() {
@@ -339,6 +347,8 @@ void MapGenerator::generateAirCurrents() {
 	const int32 currentCount = 60;
 	CircularCurrent currents[currentCount];
 
+	srand(this->seed); // The currents are part of the map, so the same seed must always give the same currents.
+
 	for (int i = 0; i < currentCount; i++) {
 		CircularCurrent c;
 		c.p = glm::sphericalRand(1.0);
@@ -348,10 +358,11 @@ void MapGenerator::generateAirCurrents() {
 		currents[i] = c;
 	}
 
-	float maxWindStrength = 0.0;
+	MapGraph& g = this->graph;
+	const int32 count = g.getNodeCount();
 
-	for (int i = 0; i < this->nodes.size(); i++) {
-		MapNode* n = this->nodes[i];
+	this->threadPool->parallelFor(count, [&](uint32 i) {
+		const fvec3 p = g.position[i];
 
 		fvec3 w = fvec3(0.0);
 
@@ -361,13 +372,13 @@ void MapGenerator::generateAirCurrents() {
 		for (int j = 0; j < currentCount; j++) {
 			CircularCurrent c = currents[j];
 
-			float angle = glm::angle(c.p, n->p);
+			float angle = glm::angle(c.p, p);
 
 			if (angle < c.r) {
 				float dist = angle / c.r;
 				float weight = 1.0 - dist;
 				float strength = c.s * weight * dist;
-				w += normalize(cross(c.p, n->p)) * strength;
+				w += normalize(cross(c.p, p)) * strength;
 				weight += 1.0F;
 			}
 		}
@@ -376,320 +387,241 @@ void MapGenerator::generateAirCurrents() {
 			w /= weight;
 		}
 
-		n->windStrength = length(w);
-		n->windVector = (n->windStrength > 1e-8) ? (w / n->windStrength) : fvec3(0.0);
-
-		maxWindStrength = glm::max(maxWindStrength, n->windStrength);
+		g.windStrength[i] = length(w);
+		g.windVector[i] = (g.windStrength[i] > 1e-8) ? (w / g.windStrength[i]) : fvec3(0.0);
 
-		n->c.resize(n->e.size());
-		for (int j = 0; j < n->e.size(); j++) {
-			MapEdge* e = this->edges[n->e[j]];
-			MapNode* m = this->nodes[(n == this->nodes[e->n[0]]) ? e->n[1] : e->n[0]];
+		const int32 begin = g.neighbourOffsets[i];
+		const int32 end = g.neighbourOffsets[i + 1];
 
-			fvec3 v = normalize(m->p - n->p);
+		for (int j = begin; j < end; j++) {
+			fvec3 v = normalize(g.position[g.neighbours[j]] - p);
 			float d = dot(v, w);
 
 			if (d > 0.0) {
-				n->c[j] = d;
+				g.currents[j] = d;
 				outflow += d;
 			} else {
-				n->c[j] = 0.0;
+				g.currents[j] = 0.0;
 			}
 		}
 
 		if (outflow > 0.0) {
-			for (int j = 0; j < n->e.size(); j++) {
-				n->c[j] /= outflow;
+			for (int j = begin; j < end; j++) {
+				g.currents[j] /= outflow;
 			}
 		}
-	}
+	}, CLIMATE_BLOCK_SIZE);
 
-	for (int i = 0; i < this->nodes.size(); i++) {
-		MapNode* n = this->nodes[i];
+	float maxWindStrength = 0.0;
 
-		n->normalizedWindStrength = n->windStrength / maxWindStrength;
+	for (int i = 0; i < count; i++) {
+		maxWindStrength = glm::max(maxWindStrength, g.windStrength[i]);
 	}
-}
-
-void MapGenerator::initializeHeat() {
 
-	float totalHeat = 0.0;
-	std::vector<MapNode*> activeNodes;
+	for (int i = 0; i < count; i++) {
+		g.normalizedWindStrength[i] = g.windStrength[i] / maxWindStrength;
+	}
 
-	uint64 a, b;
-	a = Time::now();
-	for (int i = 0; i < this->nodes.size(); i++) {
-		MapNode* n = this->nodes[i];
+	this->buildInflowGraph();
+}
 
-		float latitudeTemperature = 1.0 - abs(n->p.y);
-		float altitudeTemperature = 1.0 - glm::max(0.0F, n->heightmapData.w);
+void MapGenerator::buildInflowGraph() {
+	MapGraph& g = this->graph;
+	const int32 count = g.getNodeCount();
 
-		float latContrib = 0.7 * (latitudeTemperature * 0.23 + 0.77);
-		float altContrib = 1.0 - latContrib;
-
-		n->heatAbsorbsion = 0.08F * n->area / glm::clamp(n->normalizedWindStrength, 0.1F, 1.0F);
+	// Count the currents flowing into each node, then place them, so each node's inflows are contiguous.
+	g.inflowOffsets.assign(count + 1, 0);
 
-		if (n->water) {
-			altitudeTemperature *= 1.0 - glm::min(0.9F, abs(n->heightmapData.w));
-		} else {
-			altitudeTemperature = glm::min(altitudeTemperature * 1.3, 1.0);
-			n->heatAbsorbsion *= 1.5;
+	for (int i = 0; i < g.neighbours.size(); i++) {
+		if (g.currents[i] > 0.0) {
+			g.inflowOffsets[g.neighbours[i] + 1]++;
 		}
+	}
 
-		n->temperature = 0.0;
-		n->airHeat = n->area * (latitudeTemperature * latContrib + altitudeTemperature * altContrib);
-		n->nextHeat = 0.0;
-		totalHeat += n->airHeat;
-
-		activeNodes.push_back(n);
+	for (int i = 0; i < count; i++) {
+		g.inflowOffsets[i + 1] += g.inflowOffsets[i];
 	}
-	b = Time::now();
 
-	logInfo("Generated %f heat for %d nodes in %f ms", totalHeat, activeNodes.size(), (b - a) / 1000000.0);
+	g.inflowSources.resize(g.inflowOffsets[count]);
+	g.inflowWeights.resize(g.inflowOffsets[count]);
 
-	// 6400 ms single threaded
+	std::vector<int32> cursor(g.inflowOffsets.begin(), g.inflowOffsets.end() - 1);
 
-	float remainingHeat = totalHeat;
-	int32 heatIterations = 0;
-	do {
-		float consumedHeat = 0.0;
-		float lossRate = 0.02;
+	for (int i = 0; i < count; i++) {
+		for (int j = g.neighbourOffsets[i]; j < g.neighbourOffsets[i + 1]; j++) {
+			if (g.currents[j] > 0.0) {
+				const int32 index = cursor[g.neighbours[j]]++;
+				g.inflowSources[index] = i;
+				g.inflowWeights[index] = g.currents[j];
+			}
+		}
+	}
+}
 
-		const int count = activeNodes.size();
-		const int workerCount = glm::min(count, 8);
+int32 MapGenerator::simulateAirflow(float* air, float* settled, const float* absorbsion, const float* capacity, float total, int32 maxIterations, const char* name) {
+	const MapGraph& g = this->graph;
+	const int32 count = g.getNodeCount();
+	const int32 blockCount = (count + CLIMATE_BLOCK_SIZE - 1) / CLIMATE_BLOCK_SIZE;
+	const float lossRate = 0.02F;
 
-		std::vector<MapNode*> nextActiveNodes;
-		nextActiveNodes.reserve(count);
+	std::vector<float> outflow(count); // The air leaving each node this iteration, before it is split between the currents.
+	std::vector<float> blockConsumed(blockCount); // The air settled by each block this iteration.
 
-		uint64 timeLocked = 0;
+	float remaining = total;
+	int32 iterations = 0;
 
-		std::mutex lock;
-		std::thread workers[8];
+	uint64 a = Time::now();
 
-		for (int threadId = 0; threadId < workerCount; threadId++) {
-			workers[threadId] = std::thread([&](int threadId) {
-				int workerSize = (int)glm::ceil(count / 8.0);
-				int startIndex = glm::min(workerSize * (threadId + 0), count);
-				int endIndex = glm::min(workerSize * (threadId + 1), count);
+	do {
+		// Each node settles some of its own air, and the rest leaves on the wind. Nothing is written to other nodes.
+		this->threadPool->parallelFor(blockCount, [&](uint32 block) {
+			const int32 begin = block * CLIMATE_BLOCK_SIZE;
+			const int32 end = glm::min(begin + CLIMATE_BLOCK_SIZE, count);
 
-				std::vector<MapNode*> localNextActiveNodes;
-				localNextActiveNodes.reserve(workerSize);
+			float consumed = 0.0F;
 
-				float localConsumedHeat = 0.0;
+			for (int i = begin; i < end; i++) {
+				if (air[i] <= 0.0) {
+					outflow[i] = 0.0F;
+					continue;
+				}
 
-				for (int i = startIndex; i < endIndex; i++) {
-					MapNode* n = activeNodes[i];
+				float change = glm::max(0.0F, glm::min(air[i], absorbsion[i] * (1.0F - settled[i] / capacity[i])));
+				settled[i] += change;
+				consumed += change;
+				change = glm::min(air[i], change + (g.area[i] * (settled[i] / capacity[i]) * lossRate));
 
-					if (n->airHeat <= 0.0) {
-						continue;
-					}
+				outflow[i] = air[i] - change;
+			}
 
-					float change = glm::max(0.0F, glm::min(n->airHeat, n->heatAbsorbsion * (1.0F - n->temperature / n->area)));
-					n->temperature += change;
-					localConsumedHeat += change;
-					change = glm::min(n->airHeat, change + (n->area * (n->temperature / n->area) * lossRate));
+			blockConsumed[block] = consumed;
+		}, 1);
 
-					float movingHeat = n->airHeat - change;
-					n->airHeat = 0.0;
+		// Each node gathers the air flowing in from its upwind neighbours, always summed in the same order.
+		this->threadPool->parallelFor(blockCount, [&](uint32 block) {
+			const int32 begin = block * CLIMATE_BLOCK_SIZE;
+			const int32 end = glm::min(begin + CLIMATE_BLOCK_SIZE, count);
 
-					for (int j = 0; j < n->e.size(); j++) {
-						if (n->c[j] > 0.0) {
-							MapEdge* e = this->edges[n->e[j]];
-							MapNode* m = this->nodes[(n == this->nodes[e->n[0]]) ? e->n[1] : e->n[0]];
+			for (int i = begin; i < end; i++) {
+				float inflow = 0.0F;
 
-							m->nextHeat += movingHeat * n->c[j];
-							localNextActiveNodes.push_back(m);
-						}
-					}
+				for (int j = g.inflowOffsets[i]; j < g.inflowOffsets[i + 1]; j++) {
+					inflow += outflow[g.inflowSources[j]] * g.inflowWeights[j];
 				}
 
-				std::sort(localNextActiveNodes.begin(), localNextActiveNodes.end());
-				localNextActiveNodes.erase(std::unique(localNextActiveNodes.begin(), localNextActiveNodes.end()), localNextActiveNodes.end());
-
-				uint64 a0 = Time::now();
-				lock.lock();
-				consumedHeat += localConsumedHeat;
-				nextActiveNodes.insert(nextActiveNodes.end(), localNextActiveNodes.begin(), localNextActiveNodes.end());
-				uint64 b0 = Time::now();
+				air[i] = inflow;
+			}
+		}, 1);
 
-				timeLocked += b0 - a0;
-				lock.unlock();
-			}, threadId);
+		float consumed = 0.0F;
+		for (int i = 0; i < blockCount; i++) {
+			consumed += blockConsumed[i];
 		}
 
-		for (int threadId = 0; threadId < workerCount; threadId++) {
-			workers[threadId].join();
-		}
+		remaining -= consumed;
 
-		std::sort(nextActiveNodes.begin(), nextActiveNodes.end());
-		nextActiveNodes.erase(std::unique(nextActiveNodes.begin(), nextActiveNodes.end()), nextActiveNodes.end());
-
-		remainingHeat -= consumedHeat;
-	
-		logInfo("consumedHeat %f / %f (%f%%), remainingHeat %f over %d active nodes, %d next active, spent %f ms locked", 
-			consumedHeat / 1000.0, totalHeat / 1000.0, consumedHeat / totalHeat * 100.0, remainingHeat / 1000.0, activeNodes.size(), nextActiveNodes.size(), timeLocked / 1000000.0);
-	
-		activeNodes = std::vector<MapNode*>(nextActiveNodes.begin(), nextActiveNodes.end());
-		
-		for (int i = 0; i < activeNodes.size(); i++) {
-			MapNode* n = activeNodes[i];
-			n->airHeat = n->nextHeat;
-			n->nextHeat = 0.0;
-		}
-	
-		heatIterations++;
-		if (remainingHeat <= 0.0 || consumedHeat < 1e-5 || heatIterations > 25) {// || consumedHeat < 1e-5) {
+		iterations++;
+		if (remaining <= 0.0 || consumed < 1e-5 || iterations > maxIterations) {
 			break;
 		}
 	} while (true);
 
-	for (int i = 0; i < this->nodes.size(); i++) {
-		MapNode* n = this->nodes[i];
-		n->temperature = (n->temperature + n->airHeat) / n->area;
-	}
-	
-	logInfo("Simulated heat wind distribution in %d iterations", heatIterations);
+	uint64 b = Time::now();
+
+	// Logged once, rather than every iteration, which would slow the simulation down.
+	logInfo("Simulated %s wind distribution in %d iterations (%f ms), %f / %f (%f%%) of the %s settled",
+		name, iterations, (b - a) / 1000000.0, (total - remaining) / 1000.0, total / 1000.0, (total - remaining) / total * 100.0, name);
+
+	return iterations;
 }
 
-void MapGenerator::initializeMoisture() {
-	float totalMoisture = 0.0;
-	std::vector<MapNode*> activeNodes;
+void MapGenerator::initializeHeat() {
+	MapGraph& g = this->graph;
+	const int32 count = g.getNodeCount();
 
-	uint64 a, b;
+	std::vector<float> airHeat(count); // The heat being moved around by wind.
+	std::vector<float> heatAbsorbsion(count); // The amount of heat each node can absorb, determined by air speed and if it is water.
+
+	float totalHeat = 0.0;
 
+	uint64 a, b;
 	a = Time::now();
-	for (int i = 0; i < this->nodes.size(); i++) {
-		MapNode* n = this->nodes[i];
+	for (int i = 0; i < count; i++) {
+		const fvec4 heightmapData = g.heightmapData[i];
 
-		n->moisture = 0.0;
-		n->nextMoisture = 0.0;
-		n->moistureAbsorbsion = (0.0058F * (1.0F + (1.0F - glm::clamp(n->temperature, 0.0F, 1.0F)))) * n->area / glm::clamp(n->normalizedWindStrength, 0.1F, 1.0F);
+		float latitudeTemperature = 1.0 - abs(g.position[i].y);
+		float altitudeTemperature = 1.0 - glm::max(0.0F, heightmapData.w);
 
-		if (n->water) {
-			n->airMoisture = n->area * glm::clamp(0.5 + n->temperature * 0.5, 0.0, 1.0); // Hotter water evaporates more moisture.
-			n->maxMoisture = n->area * 0.25;
+		float latContrib = 0.7 * (latitudeTemperature * 0.23 + 0.77);
+		float altContrib = 1.0 - latContrib;
+
+		heatAbsorbsion[i] = 0.08F * g.area[i] / glm::clamp(g.normalizedWindStrength[i], 0.1F, 1.0F);
+
+		if (g.water[i]) {
+			altitudeTemperature *= 1.0 - glm::min(0.9F, abs(heightmapData.w));
 		} else {
-			n->airMoisture = 0.0;
-			float h = glm::clamp(n->heightmapData.w, 0.0F, 1.0F);
-			n->maxMoisture = n->area * (h * 0.25 + 0.25);
-			n->moistureAbsorbsion *= 1.0 + h * 0.5; // Higher altitudes encourage more precipitation
+			altitudeTemperature = glm::min(altitudeTemperature * 1.3, 1.0);
+			heatAbsorbsion[i] *= 1.5;
 		}
 
-		totalMoisture += n->airMoisture;
-
-		activeNodes.push_back(n);
+		g.temperature[i] = 0.0;
+		airHeat[i] = g.area[i] * (latitudeTemperature * latContrib + altitudeTemperature * altContrib);
+		totalHeat += airHeat[i];
 	}
 	b = Time::now();
 
-	logInfo("Generated %f moisture for %d nodes in %f ms", totalMoisture, activeNodes.size(), (b - a) / 1000000.0);
-
-	float remainingMoisture = totalMoisture;
-	int32 moistureIterations = 0;
-
-
-	// Single threaded, 13,000 ms in 99 iterations
-	// Multithreaded, 2,500 ms in 99 iterations
-	do {
-		float consumedMoisture = 0.0;
-		float lossRate = 0.02;
-
-		const int count = activeNodes.size();
-		const int workerCount = glm::min(count, 8);
-
-		std::vector<MapNode*> nextActiveNodes;
-		nextActiveNodes.reserve(count);
-
-		uint64 timeLocked = 0;
-
-		std::mutex lock;
-		std::thread workers[8];
+	logInfo("Generated %f heat for %d nodes in %f ms", totalHeat, count, (b - a) / 1000000.0);
 
-		for (int threadId = 0; threadId < workerCount; threadId++) {
-			workers[threadId] = std::thread([&](int threadId) {
-				int workerSize = (int)glm::ceil(count / 8.0);
-				int startIndex = glm::min(workerSize * (threadId + 0), count);
-				int endIndex = glm::min(workerSize * (threadId + 1), count);
+	this->simulateAirflow(airHeat.data(), g.temperature.data(), heatAbsorbsion.data(), g.area.data(), totalHeat, 25, "heat");
 
-				std::vector<MapNode*> localNextActiveNodes;
-				localNextActiveNodes.reserve(workerSize);
-
-				float localConsumedMoisture = 0.0;
-
-				for (int i = startIndex; i < endIndex; i++) {
-					MapNode* n = activeNodes[i];
+	for (int i = 0; i < count; i++) {
+		g.temperature[i] = (g.temperature[i] + airHeat[i]) / g.area[i];
+	}
+}
 
-					if (n->airMoisture <= 0.0) {
-						continue;
-					}
+void MapGenerator::initializeMoisture() {
+	MapGraph& g = this->graph;
+	const int32 count = g.getNodeCount();
 
-					float change = glm::max(0.0F, glm::min(n->airMoisture, n->moistureAbsorbsion * (1.0F - n->moisture / n->maxMoisture)));
-					n->moisture += change;
-					localConsumedMoisture += change;
-					change = glm::min(n->airMoisture, change + (n->area * (n->moisture / n->maxMoisture) * lossRate));
+	std::vector<float> airMoisture(count); // The moisture being moved around by wind.
+	std::vector<float> moistureAbsorbsion(count);
+	std::vector<float> maxMoisture(count);
 
-					float movingMoisture = n->airMoisture - change;
-					n->airMoisture = 0.0;
+	float totalMoisture = 0.0;
 
-					for (int j = 0; j < n->e.size(); j++) {
-						if (n->c[j] > 0.0) {
-							MapEdge* e = this->edges[n->e[j]];
-							MapNode* m = this->nodes[(n == this->nodes[e->n[0]]) ? e->n[1] : e->n[0]];
+	uint64 a, b;
 
-							m->nextMoisture += movingMoisture * n->c[j];
-							localNextActiveNodes.push_back(m);
-						}
-					}
-				}
+	a = Time::now();
+	for (int i = 0; i < count; i++) {
+		const float temperature = g.temperature[i];
 
-				std::sort(localNextActiveNodes.begin(), localNextActiveNodes.end());
-				localNextActiveNodes.erase(std::unique(localNextActiveNodes.begin(), localNextActiveNodes.end()), localNextActiveNodes.end());
-				
-				uint64 a0 = Time::now();
-				lock.lock();
-				consumedMoisture += localConsumedMoisture;
-				nextActiveNodes.insert(nextActiveNodes.end(), localNextActiveNodes.begin(), localNextActiveNodes.end());
-				uint64 b0 = Time::now();
-
-				timeLocked += b0 - a0;
-				lock.unlock();
-			}, threadId);
-		}
+		g.moisture[i] = 0.0;
+		moistureAbsorbsion[i] = (0.0058F * (1.0F + (1.0F - glm::clamp(temperature, 0.0F, 1.0F)))) * g.area[i] / glm::clamp(g.normalizedWindStrength[i], 0.1F, 1.0F);
 
-		for (int threadId = 0; threadId < workerCount; threadId++) {
-			workers[threadId].join();
+		if (g.water[i]) {
+			airMoisture[i] = g.area[i] * glm::clamp(0.5 + temperature * 0.5, 0.0, 1.0); // Hotter water evaporates more moisture.
+			maxMoisture[i] = g.area[i] * 0.25;
+		} else {
+			airMoisture[i] = 0.0;
+			float h = glm::clamp(g.heightmapData[i].w, 0.0F, 1.0F);
+			maxMoisture[i] = g.area[i] * (h * 0.25 + 0.25);
+			moistureAbsorbsion[i] *= 1.0 + h * 0.5; // Higher altitudes encourage more precipitation
 		}
 
-		remainingMoisture -= consumedMoisture;
-
-		logInfo("consumedMoisture %f / %f (%f%%), remainingMoisture %f over %d active nodes, %d next active, spent %f ms locked",
-			consumedMoisture / 1000.0, totalMoisture / 1000.0, consumedMoisture / totalMoisture * 100.0, remainingMoisture / 1000.0, activeNodes.size(), nextActiveNodes.size(), timeLocked / 1000000.0);
-
-		std::sort(nextActiveNodes.begin(), nextActiveNodes.end());
-		nextActiveNodes.erase(std::unique(nextActiveNodes.begin(), nextActiveNodes.end()), nextActiveNodes.end());
-
-		activeNodes = nextActiveNodes;// std::vector<MapNode*>(nextActiveNodes.begin(), nextActiveNodes.end());
+		totalMoisture += airMoisture[i];
+	}
+	b = Time::now();
 
-		for (int i = 0; i < activeNodes.size(); i++) {
-			MapNode* n = activeNodes[i];
-			n->airMoisture = n->nextMoisture;
-			n->nextMoisture = 0.0;
-		}
+	logInfo("Generated %f moisture for %d nodes in %f ms", totalMoisture, count, (b - a) / 1000000.0);
 
-		moistureIterations++;
-		if (remainingMoisture <= 0.0 || consumedMoisture < 1e-5 || moistureIterations > 200) {
-			break;
-		}
-	} while (true);
+	this->simulateAirflow(airMoisture.data(), g.moisture.data(), moistureAbsorbsion.data(), maxMoisture.data(), totalMoisture, 200, "moisture");
 
-	for (int i = 0; i < this->nodes.size(); i++) {
-		MapNode* n = this->nodes[i];
-		n->moisture = (n->moisture + n->airMoisture) / n->maxMoisture;
+	for (int i = 0; i < count; i++) {
+		g.moisture[i] = (g.moisture[i] + airMoisture[i]) / maxMoisture[i];
 	}
-
-	logInfo("Simulated moisture wind distribution in %d iterations", moistureIterations);
 }
 
-void MapGenerator::initializeBiomes() {
+void MapGenerator::initializeLifeZones() {
 	this->lifeZones.push_back(new LifeZone("Tropical Desert",				5.0 / 6.0, 6.0 / 6.0, 0.0 / 8.0, 1.0 / 8.0, fvec3(1.000, 1.000, 0.502))); // FFFF80, 
 	this->lifeZones.push_back(new LifeZone("Tropical Desert Scrub",			5.0 / 6.0, 6.0 / 6.0, 1.0 / 8.0, 2.0 / 8.0, fvec3(0.878, 1.000, 0.502))); // E0FF80, 
 	this->lifeZones.push_back(new LifeZone("Tropical Thorn Woodland",		5.0 / 6.0, 6.0 / 6.0, 2.0 / 8.0, 3.0 / 8.0, fvec3(0.753, 1.000, 0.502))); // C0FF80, 
@@ -736,17 +668,20 @@ void MapGenerator::initializeBiomes() {
 	this->lifeZones.push_back(new LifeZone("Polar Desert",					0.0 / 6.0, 1.0 / 6.0, 0.0 / 3.0, 1.0 / 3.0, fvec3(0.753, 0.753, 0.753))); // C0C0C0, 
 	this->lifeZones.push_back(new LifeZone("Polar Ice",						0.0 / 6.0, 1.0 / 6.0, 1.0 / 3.0, 2.0 / 3.0, fvec3(1.000, 1.000, 1.000))); // FFFFFF, 
 	this->lifeZones.push_back(new LifeZone("Polar Ice",						0.0 / 6.0, 1.0 / 6.0, 2.0 / 3.0, 3.0 / 3.0, fvec3(1.000, 1.000, 1.000))); // FFFFFF, 
+}
+
+void MapGenerator::initializeBiomes() {
+	MapGraph& g = this->graph;
 
-	for (int i = 0; i < this->nodes.size(); i++) {
-		MapNode* n = this->nodes[i];
-		float temperature = glm::clamp(n->temperature * 1.7F - 0.7F, 0.0F, 1.0F);
-		float moisture = glm::clamp(n->moisture, 0.0F, 1.0F);
+	for (int i = 0; i < g.getNodeCount(); i++) {
+		float temperature = glm::clamp(g.temperature[i] * 1.7F - 0.7F, 0.0F, 1.0F);
+		float moisture = glm::clamp(g.moisture[i], 0.0F, 1.0F);
 
-		if (n->water) {
+		if (g.water[i]) {
 			if (temperature <= 0.0) {
-				n->lifeZone = this->lifeZones[this->lifeZones.size() - 1];
+				g.lifeZone[i] = this->lifeZones.size() - 1;
 			} else {
-				n->lifeZone = NULL;
+				g.lifeZone[i] = -1;
 			}
 		} else {
 
@@ -758,20 +693,23 @@ void MapGenerator::initializeBiomes() {
 				if (moisture < zone->minMoisture) continue;
 				if (moisture > zone->maxMoisture) continue;
 
-				n->lifeZone = zone;
+				g.lifeZone[i] = j;
 			}
 		}
 	}
 }
 
 void MapGenerator::generateDebugMeshes() {
-	std::vector<Vertex> surfaceVertices; surfaceVertices.reserve(this->nodes.size() * 1);
-	std::vector<Vertex> currentArrowVertices; currentArrowVertices.reserve(this->nodes.size() * 3);
+	const MapGraph& g = this->graph;
+	const int32 count = g.getNodeCount();
 
-	std::vector<uint32> surfaceTriangleIndices; surfaceTriangleIndices.reserve(this->faces.size() * 3);
-	std::vector<uint32> surfaceLineIndices; surfaceLineIndices.reserve(this->edges.size() * 2);
-	std::vector<uint32> currentTriangleIndices; currentTriangleIndices.reserve(this->nodes.size() * 3);
-	std::vector<uint32> currentLineIndices; currentLineIndices.reserve(this->nodes.size() * 6);
+	std::vector<Vertex> surfaceVertices; surfaceVertices.reserve(count * 1);
+	std::vector<Vertex> currentArrowVertices; currentArrowVertices.reserve(count * 3);
+
+	std::vector<uint32> surfaceTriangleIndices; surfaceTriangleIndices.reserve(g.triangles.size());
+	std::vector<uint32> surfaceLineIndices; surfaceLineIndices.reserve(g.neighbours.size());
+	std::vector<uint32> currentTriangleIndices; currentTriangleIndices.reserve(count * 3);
+	std::vector<uint32> currentLineIndices; currentLineIndices.reserve(count * 6);
 
 	const int32 tgc = 6;
 	fvec3 tg[tgc] = {
@@ -786,8 +724,8 @@ void MapGenerator::generateDebugMeshes() {
 	uint64 a, b, c;
 
 	a = Time::now();
-	for (int i = 0; i < this->nodes.size(); i++) {
-		MapNode* n = this->nodes[i];
+	for (int i = 0; i < count; i++) {
+		const fvec3 p = g.position[i];
 
 		//float f = n->moisture * (tgc - 1);
 		//int32 i0 = glm::clamp<int32>(f - 1.0F, 0, tgc - 1);
@@ -796,22 +734,22 @@ void MapGenerator::generateDebugMeshes() {
 		//int32 i3 = glm::clamp<int32>(f + 2.0F, 0, tgc - 1);
 
 		//fvec3 colour = glm::catmullRom(tg[i0], tg[i1], tg[i2], tg[i3], glm::fract(f));
-		fvec3 colour = n->lifeZone != NULL ? n->lifeZone->colour : fvec3(0.2, 0.3, 0.9);// fvec3(n->temperature, n->moisture, 0.0);
+		fvec3 colour = g.lifeZone[i] >= 0 ? this->lifeZones[g.lifeZone[i]]->colour : fvec3(0.2, 0.3, 0.9);// fvec3(g.temperature[i], g.moisture[i], 0.0);
 
-		surfaceVertices.push_back(Vertex(n->p * float(planet->getRadius()), fvec3(0.0), fvec2(0.0), colour));
+		surfaceVertices.push_back(Vertex(p * float(planet->getRadius()), fvec3(0.0), fvec2(0.0), colour));
 
 		// current arrows
 
-		if (true || dot(n->windVector, n->windVector) > 1e-12) {
+		if (true || dot(g.windVector[i], g.windVector[i]) > 1e-12) {
 
-			float magnitude = n->windStrength;
-			fvec3 direction = n->windVector;
-			fvec3 side = normalize(cross(direction, n->p));
+			float magnitude = g.windStrength[i];
+			fvec3 direction = g.windVector[i];
+			fvec3 side = normalize(cross(direction, p));
 			int32 baseIndex = currentArrowVertices.size();
 			float size = glm::min(sqrt(magnitude), 8.0F);
-			currentArrowVertices.push_back(Vertex(n->p * float(planet->getRadius()) * 1.0001F + side * 3.0F * size));
-			currentArrowVertices.push_back(Vertex(n->p * float(planet->getRadius()) * 1.0001F - side * 3.0F * size));
-			currentArrowVertices.push_back(Vertex(n->p * float(planet->getRadius()) * 1.0001F + direction * 20.0F * size));
+			currentArrowVertices.push_back(Vertex(p * float(planet->getRadius()) * 1.0001F + side * 3.0F * size));
+			currentArrowVertices.push_back(Vertex(p * float(planet->getRadius()) * 1.0001F - side * 3.0F * size));
+			currentArrowVertices.push_back(Vertex(p * float(planet->getRadius()) * 1.0001F + direction * 20.0F * size));
 
 			currentTriangleIndices.push_back(baseIndex + 0);
 			currentTriangleIndices.push_back(baseIndex + 1);
@@ -829,21 +767,19 @@ void MapGenerator::generateDebugMeshes() {
 	logInfo("Took %f ms to create debug mesh vertices", (b - a) / 1000000.0);
 
 	a = Time::now();
-	for (int i = 0; i < this->edges.size(); i++) {
-		MapEdge* e = this->edges[i];
-		surfaceLineIndices.push_back(e->n[0]);
-		surfaceLineIndices.push_back(e->n[1]);
+	for (int i = 0; i < count; i++) {
+		for (int j = g.neighbourOffsets[i]; j < g.neighbourOffsets[i + 1]; j++) {
+			if (g.neighbours[j] > i) { // Every edge is linked from both ends.
+				surfaceLineIndices.push_back(i);
+				surfaceLineIndices.push_back(g.neighbours[j]);
+			}
+		}
 	}
 	b = Time::now();
 	logInfo("Took %f ms to create debug mesh edge indices", (b - a) / 1000000.0);
 
 	a = Time::now();
-	for (int i = 0; i < this->faces.size(); i++) {
-		MapFace* f = this->faces[i];
-		surfaceTriangleIndices.push_back(f->n[0]);
-		surfaceTriangleIndices.push_back(f->n[1]);
-		surfaceTriangleIndices.push_back(f->n[2]);
-	}
+	surfaceTriangleIndices.insert(surfaceTriangleIndices.end(), g.triangles.begin(), g.triangles.end());
 	b = Time::now();
 	logInfo("Took %f ms to create debug mesh face indices", (b - a) / 1000000.0);
 
@@ -899,6 +835,8 @@ void MapGenerator::generateDebugMeshes() {
 }
 
 void MapGenerator::render(double partialTicks, double dt) {
+	this->climateMap->update();
+
 	if (this->renderDebugSurface) {
 		DEBUG_RENDERER.setLightingEnabled(false);
 		DEBUG_RENDERER.setColour(fvec4(1.0F, 1.0F, 1.0F, 1.0F));
@@ -923,31 +861,30 @@ void MapGenerator::render(double partialTicks, double dt) {
 	}
 }
 
-MapNode* MapGenerator::getClosestMapNode(dvec3 point, int startPoint) {
+int32 MapGenerator::walkClosestMapNode(dvec3 point, int startPoint) {
 	// choose a random point on the sphere, and walk in the direction of the point to find, until no direction yields a closer vertex.
 	// This should avoid iterating every single vertex.
 
-	int32 currIndex = (startPoint < 0 || startPoint >= this->nodes.size()) ? (rand() % this->nodes.size()) : startPoint; // random start point if none is specified
-	MapNode* currNode = this->nodes[currIndex];
-	double currDist = glm::distance2(dvec3(currNode->p), point);
+	const MapGraph& g = this->graph;
+	const int32 count = g.getNodeCount();
 
-	while (true) {
-		if (currNode == NULL) {
-			break;
-		}
+	if (count == 0) {
+		return -1;
+	}
+
+	int32 currIndex = (startPoint < 0 || startPoint >= count) ? (rand() % count) : startPoint; // random start point if none is specified
+	double currDist = glm::distance2(dvec3(g.position[currIndex]), point);
 
+	while (true) {
 		bool flag = false;
 
-		for (int i = 0; i < currNode->e.size(); i++) {
-			MapEdge* edge = this->edges[currNode->e[i]];
-			int32 neighbourIndex = (currNode == this->nodes[edge->n[0]]) ? edge->n[1] : edge->n[0];
-			MapNode* neighbourNode = this->nodes[neighbourIndex];
+		for (int i = g.neighbourOffsets[currIndex]; i < g.neighbourOffsets[currIndex + 1]; i++) {
+			int32 neighbourIndex = g.neighbours[i];
 
-			double neighbourDist = glm::distance2(dvec3(neighbourNode->p), point);
+			double neighbourDist = glm::distance2(dvec3(g.position[neighbourIndex]), point);
 
 			if (neighbourDist < currDist) {
 				currDist = neighbourDist;
-				currNode = neighbourNode;
 				currIndex = neighbourIndex;
 				flag = true;
 			}
@@ -958,7 +895,107 @@ MapNode* MapGenerator::getClosestMapNode(dvec3 point, int startPoint) {
 		}
 	}
 
-	return currNode;
+	return currIndex;
+}
+
+int32 MapGenerator::getClosestMapNode(dvec3 point) {
+	return this->nodeIndex != NULL ? this->nodeIndex->findNearest(point) : -1;
+}
+
+int32 MapGenerator::getClosestMapNodes(dvec3 point, int32 k, int32* nodes) {
+	if (this->nodeIndex == NULL) {
+		for (int i = 0; i < k; i++) {
+			nodes[i] = -1;
+		}
+		return 0;
+	}
+
+	return this->nodeIndex->findNearest(point, k, nodes);
+}
+
+void MapGenerator::getClosestMapNodes(int32 count, const dvec3* points, int32* nodes) {
+	this->getClosestMapNodes(count, points, 1, nodes);
+}
+
+void MapGenerator::getClosestMapNodes(int32 count, const dvec3* points, int32 k, int32* nodes) {
+	if (this->nodeIndex == NULL) {
+		for (int i = 0; i < count * k; i++) {
+			nodes[i] = -1;
+		}
+		return;
+	}
+
+	const int32 blockCount = (count + CLIMATE_BLOCK_SIZE - 1) / CLIMATE_BLOCK_SIZE;
+
+	this->threadPool->parallelFor(blockCount, [&](uint32 block) {
+		const int32 begin = block * CLIMATE_BLOCK_SIZE;
+		const int32 end = glm::min(begin + CLIMATE_BLOCK_SIZE, count);
+		this->nodeIndex->findNearest(end - begin, &points[begin], k, &nodes[begin * k]);
+	}, 1);
+}
+
+void MapGenerator::benchmarkClosestMapNode(int32 queryCount) {
+	const MapGraph& g = this->graph;
+
+	if (this->nodeIndex == NULL || queryCount <= 0) {
+		return;
+	}
+
+	std::vector<dvec3> points(queryCount);
+	for (int i = 0; i < queryCount; i++) {
+		points[i] = glm::sphericalRand(1.0);
+	}
+
+	std::vector<int32> walkNodes(queryCount);
+	std::vector<int32> indexNodes(queryCount);
+	std::vector<int32> batchNodes(queryCount);
+
+	uint64 a = Time::now();
+	for (int i = 0; i < queryCount; i++) {
+		walkNodes[i] = this->walkClosestMapNode(points[i]);
+	}
+	uint64 b = Time::now();
+	for (int i = 0; i < queryCount; i++) {
+		indexNodes[i] = this->nodeIndex->findNearest(points[i]);
+	}
+	uint64 c = Time::now();
+	this->getClosestMapNodes(queryCount, points.data(), batchNodes.data());
+	uint64 d = Time::now();
+
+	int32 walkMisses = 0;
+	int32 batchMismatches = 0;
+	for (int i = 0; i < queryCount; i++) {
+		const double walkDist = glm::distance2(dvec3(g.position[walkNodes[i]]), points[i]);
+		const double indexDist = glm::distance2(dvec3(g.position[indexNodes[i]]), points[i]);
+		if (walkDist > indexDist) walkMisses++;
+		if (batchNodes[i] != indexNodes[i]) batchMismatches++;
+	}
+
+	// Check the index against every node for a few of the points.
+	const int32 bruteCount = glm::min(queryCount, 256);
+	int32 indexMisses = 0;
+	for (int i = 0; i < bruteCount; i++) {
+		double closestDist = INFINITY;
+		for (int j = 0; j < g.getNodeCount(); j++) {
+			closestDist = glm::min(closestDist, glm::distance2(dvec3(g.position[j]), points[i]));
+		}
+		if (glm::distance2(dvec3(g.position[indexNodes[i]]), points[i]) > closestDist) indexMisses++;
+	}
+
+	logInfo("Closest map node over %d nodes, %d queries: walk %.3f us/query (%d not closest), index %.3f us/query (%d/%d not closest), batched %.3f us/query (%d differ)",
+		g.getNodeCount(), queryCount,
+		(b - a) / 1000.0 / queryCount, walkMisses,
+		(c - b) / 1000.0 / queryCount, indexMisses, bruteCount,
+		(d - c) / 1000.0 / queryCount, batchMismatches
+	);
+}
+
+ClimateMap* MapGenerator::getClimateMap() const {
+	return this->climateMap;
+}
+
+const MapGraph& MapGenerator::getGraph() const {
+	return this->graph;
 }
 
 void MapGenerator::setRenderDebugCurrents(bool renderDebugCurrents) {
@@ -984,3 +1021,19 @@ void MapGenerator::setDebugSurfaceRenderMode(int renderMode) {
 int MapGenerator::getDebugSurfaceRenderMode() const {
 	return this->debugSurfaceRenderMode;
 }
+
+int32 MapGraph::getNodeCount() const {
+	return this->position.size();
+}
+
+uint64 MapGraph::getMemoryUsage() const {
+	const uint64 count = this->position.size();
+	uint64 bytes = 0;
+	bytes += count * (sizeof(fvec3) + sizeof(fvec4) + sizeof(float) + sizeof(uint8)); // position, heightmapData, area, water
+	bytes += count * (sizeof(fvec3) + sizeof(float) * 4 + sizeof(int32)); // wind, temperature, moisture, lifeZone
+	bytes += (this->neighbourOffsets.size() + this->inflowOffsets.size()) * sizeof(int32);
+	bytes += this->neighbours.size() * (sizeof(int32) + sizeof(float));
+	bytes += this->inflowSources.size() * (sizeof(int32) + sizeof(float));
+	bytes += this->triangles.size() * sizeof(int32);
+	return bytes;
+}
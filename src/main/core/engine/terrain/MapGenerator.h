@@ -4,6 +4,14 @@
 
 class Planet;
 class GLMesh;
+class ThreadPool;
+class MapNodeIndex;
+class ClimateMap;
+class MapSnapshot;
+
+// Increment whenever the output of the map generation changes, so that maps stored in snapshots by an older version
+// are regenerated.
+#define MAP_GENERATOR_VERSION 2
 
 class MapGenerator;
 class MapMesh;
@@ -12,17 +20,47 @@ struct MapVertex;
 struct MapTriangle;
 struct MapCell;
 
-struct MapNode;
-struct MapEdge;
-struct MapFace;
 struct LifeZone;
 
+/**
+ * The map nodes and their climate, as one array per field, with the neighbours of every node in compressed sparse
+ * row order. The neighbours of node i are neighbours[neighbourOffsets[i]] up to neighbours[neighbourOffsets[i + 1]].
+ */
+struct MapGraph {
+	std::vector<fvec3> position; // The position of each node on the unit sphere.
+	std::vector<fvec4> heightmapData; // The terrain normal and height under each node.
+	std::vector<float> area; // The surface area each node covers.
+	std::vector<uint8> water; // 1 if the node is below sea level.
+
+	std::vector<fvec3> windVector; // The normalized direction of the wind at each node.
+	std::vector<float> windStrength;
+	std::vector<float> normalizedWindStrength; // The wind strength relative to the strongest wind on the map.
+	std::vector<float> temperature; // The heat that has settled on each node.
+	std::vector<float> moisture; // The moisture that has settled on each node.
+	std::vector<int32> lifeZone; // The index of the life zone of each node, or -1 if it has none.
+
+	std::vector<int32> neighbourOffsets; // The range of each node's neighbours. One more than the node count.
+	std::vector<int32> neighbours; // The neighbouring nodes.
+	std::vector<float> currents; // The fraction of a node's moving air that flows to each neighbour.
+
+	std::vector<int32> inflowOffsets; // The range of each node's inflows. One more than the node count.
+	std::vector<int32> inflowSources; // The upwind node of each inflow, in ascending order for each node.
+	std::vector<float> inflowWeights; // The fraction of the upwind node's moving air that follows each inflow.
+
+	std::vector<int32> triangles; // Three nodes for every face of the map, for the debug mesh.
+
+	int32 getNodeCount() const;
+
+	uint64 getMemoryUsage() const;
+};
+
 class MapGenerator
 {
 private:
 	Planet* planet;
 
 	uint32 resolution;
+	uint32 seed; // The seed of the terrain, which also seeds the air currents.
 
 	GLMesh* debugSurfaceTriangleMesh;
 	GLMesh* debugSurfaceLineMesh;
@@ -30,136 +68,129 @@ private:
 	GLMesh* debugCurrentLineMesh;
 	GLMesh* debugClosestWalkMesh;
 
-	std::vector<MapNode*> nodes;
-	std::vector<MapEdge*> edges;
-	std::vector<MapFace*> faces;
+	MapGraph graph; // The generated map. Empty until the generation pipeline runs.
+	std::shared_ptr<MapNodeIndex> nodeIndex; // Finds the nodes nearest to a point. NULL until the graph is built.
+	ClimateMap* climateMap; // The climate rasterized into cube maps for the shaders.
 
 	std::vector<LifeZone*> lifeZones; // List of all lifezones.
 
 	std::vector<int32> debugClosestWalk;
 
+	ThreadPool* threadPool; // Persistent workers for the climate simulation.
+
 	bool renderDebugCurrents;
 	bool renderDebugSurface;
 	int debugSurfaceRenderMode;
 
+	/**
+	 * The snapshot of the map for this planet, seed and resolution.
+	 */
+	MapSnapshot getSnapshot() const;
+
+	/**
+	 * Load the map from its snapshot. Returns false if there is no valid snapshot for this planet, seed and resolution.
+	 */
+	bool loadSnapshot();
+
+	/**
+	 * Run the generation pipeline from the start, and store the result in a snapshot.
+	 */
+	void simulate();
+
+	/**
+	 * Subdivide an icosahedron straight into the graph, and sample the terrain under every node. The node, neighbour
+	 * and triangle counts follow from the resolution, so the arrays are sized up front, and every icosahedron face is
+	 * filled in by its own worker.
+	 */
 	void generateIcosohedron();
 
+	void buildNodeIndex();
+
 	void generateAirCurrents();
 
+	/**
+	 * Build the inflows of every node from the air currents, in compressed sparse row order.
+	 */
+	void buildInflowGraph();
+
+	/**
+	 * Move the air around by the currents until it has settled. Each iteration, every node settles some of its air
+	 * against its capacity, and then gathers what its upwind neighbours let go. Every node is only written by the task
+	 * that owns it, and the sums are taken in a fixed order, so the result is the same for any number of threads.
+	 * Returns the number of iterations.
+	 */
+	int32 simulateAirflow(float* air, float* settled, const float* absorbsion, const float* capacity, float total, int32 maxIterations, const char* name);
+
 	void initializeHeat();
 
 	void initializeMoisture();
 
+	void initializeLifeZones();
+
 	void initializeBiomes();
 
 	void generateDebugMeshes();
 
+	/**
+	 * Find the closest node by walking the graph from the start node towards the point, until no neighbour is closer.
+	 * This may stop at a node that is not the closest.
+	 */
+	int32 walkClosestMapNode(dvec3 point, int startPoint = -1);
+
 public:
 	MapGenerator(Planet* planet, uint32 resolution = 100);
 
 	~MapGenerator();
 
-	void render(double partialTicks, double dt);
-
-	MapNode* getClosestMapNode(dvec3 point, int startPoint = -1);
-
-	void setRenderDebugCurrents(bool renderDebugCurrents);
-
-	bool doRenderDebugCurrents() const;
-
-	void setRenderDebugSurface(bool renderDebugSurface);
-
-	bool doRenderDebugSurface() const;
-
-	void setDebugSurfaceRenderMode(int renderMode);
-
-	int getDebugSurfaceRenderMode() const;
-};
-
-struct MapNode {
-	fvec3 p; // The position of this node.
-	std::vector<int32> e; // The edges connected to this node.
-	std::vector<int32> f; // The faces connected to this node.
-	std::vector<float> c; // The air current strengths to each connected node.
-	int32 index;
-
-	LifeZone* lifeZone;
-
-	fvec4 heightmapData;
-
-	float area = 1.0;
-
-	bool water;
+	/**
+	 * Load the map from its snapshot, or generate it if there is none, then build the debug meshes and start baking
+	 * the climate map.
+	 */
+	void generate();
 
-	float heatAbsorbsion; // The amount of heat that this node can absorb, determined by air speed and if it is water.
-	float nextHeat; // The air heat for the next iteration
-	float airHeat; // The heat being moved around by wind
-	float temperature; // The heat that has settled on (been absorbed by) this node.
-
-	float maxMoisture;
-	float moistureAbsorbsion;
-	float nextMoisture; // The air moisture for the next iteration
-	float airMoisture; // The moisture being moved around by wind
-	float moisture; // The moisture that has settled on (been absorbed by) this node.
-
-	float windStrength;
-	float normalizedWindStrength;
-	fvec3 windVector;
+	void render(double partialTicks, double dt);
 
-	MapNode(fvec3 p, std::vector<int32> e = {}, std::vector<int32> f = {}) :
-		p(p), e(e), f(f), lifeZone(NULL), water(false), temperature(0.0), moisture(0.0), windStrength(0.0), windVector(0.0) {}
+	/**
+	 * The index of the node closest to the point, or -1 if the map has not been generated.
+	 */
+	int32 getClosestMapNode(dvec3 point);
 
-	inline bool operator==(const MapNode& node) {
-		constexpr double eps = 1e-12;
+	/**
+	 * The indices of the k nodes closest to the point, nearest first. Returns the number found.
+	 */
+	int32 getClosestMapNodes(dvec3 point, int32 k, int32* nodes);
 
-		if (glm::length2(this->p - node.p) >= eps * eps) return false;
-		if (this->e != node.e) return false;
-		if (this->f != node.f) return false;
-		return true;
-	}
+	/**
+	 * The index of the node closest to each of the points. The queries are split between the worker threads.
+	 */
+	void getClosestMapNodes(int32 count, const dvec3* points, int32* nodes);
 
-	inline bool operator!=(const MapNode& node) {
-		return !(*this == node);
-	}
-};
+	/**
+	 * The k nodes closest to each of the points, nearest first, written k at a time.
+	 */
+	void getClosestMapNodes(int32 count, const dvec3* points, int32 k, int32* nodes);
 
-struct MapEdge {
-	std::vector<int32> n; // The nodes that make up this edge.
-	std::vector<int32> f; // The faces connected to this edge.
+	/**
+	 * Time the node index against the graph walk over random points, and log the results and how often the walk
+	 * missed the closest node.
+	 */
+	void benchmarkClosestMapNode(int32 queryCount);
 
-	std::vector<int32> sn;
-	std::vector<int32> se;
+	const MapGraph& getGraph() const;
 
-	MapEdge(std::vector<int32> n, std::vector<int32> f = {}) :
-		n(n), f(f) {}
+	ClimateMap* getClimateMap() const;
 
-	inline bool operator==(const MapEdge& node) {
-		if (this->n != node.n) return false;
-		if (this->f != node.f) return false;
-		return true;
-	}
+	void setRenderDebugCurrents(bool renderDebugCurrents);
 
-	inline bool operator!=(const MapEdge& node) {
-		return !(*this == node);
-	}
-};
+	bool doRenderDebugCurrents() const;
 
-struct MapFace {
-	std::vector<int32> n; // The nodes that make up this face.
-	std::vector<int32> e; // The edges that make up this face.
+	void setRenderDebugSurface(bool renderDebugSurface);
 
-	MapFace(std::vector<int32> n, std::vector<int32> e) :
-		n(n), e(e) {}
+	bool doRenderDebugSurface() const;
 
-	inline bool operator==(const MapFace& node) {
-		if (this->n != node.n) return false;
-		if (this->e != node.e) return false;
-		return true;
-	}
+	void setDebugSurfaceRenderMode(int renderMode);
 
-	inline bool operator!=(const MapFace& node) {
-		return !(*this == node);
-	}
+	int getDebugSurfaceRenderMode() const;
 };
 
 struct LifeZone {
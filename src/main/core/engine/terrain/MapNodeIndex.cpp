@@ -0,0 +1,245 @@
+#include "MapNodeIndex.h"
+
+MapNodeIndex::MapNodeIndex(int32 count, const fvec3* positions, double nodesPerCell) {
+	this->resolution = glm::max(1, (int32) glm::ceil(glm::sqrt(count / (6.0 * nodesPerCell))));
+
+	const int32 r = this->resolution;
+	const int32 cellCount = 6 * r * r;
+
+	this->cells.resize(cellCount);
+
+	for (int face = 0; face < 6; face++) {
+		for (int y = 0; y < r; y++) {
+			for (int x = 0; x < r; x++) {
+				const dvec2 c0 = dvec2(x, y) / double(r) * 2.0 - 1.0;
+				const dvec2 c1 = dvec2(x + 1, y + 1) / double(r) * 2.0 - 1.0;
+
+				Cell& cell = this->cells[(face * r + y) * r + x];
+				cell.center = getFaceDirection(face, (c0 + c1) * 0.5);
+
+				// The cell edges are great circle arcs, so the direction furthest from the center is one of the corners.
+				cell.radius = 0.0;
+				const dvec2 corners[4] = { dvec2(c0.x, c0.y), dvec2(c1.x, c0.y), dvec2(c1.x, c1.y), dvec2(c0.x, c1.y) };
+				for (int i = 0; i < 4; i++) {
+					const double d = dot(cell.center, getFaceDirection(face, corners[i]));
+					cell.radius = glm::max(cell.radius, glm::acos(glm::clamp(d, -1.0, 1.0)));
+				}
+				cell.radius += 1e-6; // Nodes on an edge may be binned into either cell.
+			}
+		}
+	}
+
+	std::vector<int32> nodeCells(count);
+	this->cellOffsets.assign(cellCount + 1, 0);
+
+	for (int i = 0; i < count; i++) {
+		nodeCells[i] = this->getCellIndex(dvec3(positions[i]));
+		this->cellOffsets[nodeCells[i] + 1]++;
+	}
+
+	for (int i = 0; i < cellCount; i++) {
+		this->cellOffsets[i + 1] += this->cellOffsets[i];
+	}
+
+	this->cellNodes.resize(count);
+	this->cellPositions.resize(count);
+
+	std::vector<int32> cursor(this->cellOffsets.begin(), this->cellOffsets.end() - 1);
+
+	for (int i = 0; i < count; i++) {
+		const int32 index = cursor[nodeCells[i]]++;
+		this->cellNodes[index] = i;
+		this->cellPositions[index] = positions[i];
+	}
+}
+
+MapNodeIndex::~MapNodeIndex() {
+
+}
+
+dvec3 MapNodeIndex::getFaceDirection(int32 face, dvec2 faceCoord) {
+	const int32 axis = face >> 1;
+	dvec3 direction;
+	direction[axis] = (face & 1) ? +1.0 : -1.0;
+	direction[(axis + 1) % 3] = faceCoord.x;
+	direction[(axis + 2) % 3] = faceCoord.y;
+	return normalize(direction);
+}
+
+int32 MapNodeIndex::getFace(dvec3 direction, dvec2* faceCoord) {
+	const dvec3 a = glm::abs(direction);
+	const int32 axis = (a.x >= a.y && a.x >= a.z) ? 0 : (a.y >= a.z ? 1 : 2);
+
+	*faceCoord = dvec2(direction[(axis + 1) % 3], direction[(axis + 2) % 3]) / a[axis];
+	return axis * 2 + (direction[axis] > 0.0 ? 1 : 0);
+}
+
+int32 MapNodeIndex::getCellIndex(dvec3 direction) const {
+	dvec2 faceCoord;
+	const int32 face = getFace(direction, &faceCoord);
+
+	const int32 r = this->resolution;
+	const ivec2 cell = glm::clamp(ivec2(glm::floor((faceCoord * 0.5 + 0.5) * double(r))), ivec2(0), ivec2(r - 1));
+	return (face * r + cell.y) * r + cell.x;
+}
+
+int32 MapNodeIndex::search(dvec3 direction, int32 startCell, int32 k, int32* nodes) const {
+	typedef std::pair<double, int32> Entry; // The lower bound angle to a cell, or the dot product with a node.
+
+	auto closer = [](const Entry& a, const Entry& b) {
+		return a.first > b.first || (a.first == b.first && a.second < b.second); // Ties go to the lower node index.
+	};
+
+	// A heap of the best nodes so far, with the furthest at the front.
+	std::vector<Entry> best;
+	best.reserve(k + 1);
+	double maxAngle = INFINITY; // The angle to the furthest of the best nodes, once there are k of them.
+
+	// A heap of the cells to visit, with the closest lower bound at the front.
+	std::vector<Entry> queue;
+	std::vector<int32> visited; // Few cells are ever visited, so a linear search is faster than a set.
+
+	queue.push_back(std::make_pair(0.0, startCell));
+	visited.push_back(startCell);
+
+	const int32 r = this->resolution;
+
+	while (!queue.empty()) {
+		std::pop_heap(queue.begin(), queue.end(), std::greater<Entry>());
+		const Entry next = queue.back();
+		queue.pop_back();
+
+		if (next.first >= maxAngle) {
+			break; // No node in this or any remaining cell can be closer than the ones found.
+		}
+
+		const int32 cellIndex = next.second;
+
+		for (int i = this->cellOffsets[cellIndex]; i < this->cellOffsets[cellIndex + 1]; i++) {
+			const Entry node = std::make_pair(dot(direction, dvec3(this->cellPositions[i])), this->cellNodes[i]);
+
+			if (best.size() < k) {
+				best.push_back(node);
+				std::push_heap(best.begin(), best.end(), closer);
+			} else if (closer(node, best.front())) {
+				std::pop_heap(best.begin(), best.end(), closer);
+				best.back() = node;
+				std::push_heap(best.begin(), best.end(), closer);
+			} else {
+				continue;
+			}
+
+			if (best.size() == k) {
+				maxAngle = glm::acos(glm::clamp(best.front().first, -1.0, 1.0));
+			}
+		}
+
+		// Queue the surrounding cells. Cells past the edge of the face are found through the direction of their
+		// center, which lands on the neighbouring face.
+		const int32 face = cellIndex / (r * r);
+		const int32 y = (cellIndex / r) % r;
+		const int32 x = cellIndex % r;
+
+		for (int dy = -1; dy <= 1; dy++) {
+			for (int dx = -1; dx <= 1; dx++) {
+				const int32 nx = x + dx;
+				const int32 ny = y + dy;
+
+				int32 neighbour;
+				if (nx >= 0 && nx < r && ny >= 0 && ny < r) {
+					neighbour = (face * r + ny) * r + nx;
+				} else {
+					neighbour = this->getCellIndex(getFaceDirection(face, (dvec2(nx, ny) + 0.5) / double(r) * 2.0 - 1.0));
+				}
+
+				if (std::find(visited.begin(), visited.end(), neighbour) != visited.end()) {
+					continue;
+				}
+
+				const Cell& cell = this->cells[neighbour];
+				const double bound = glm::max(0.0, glm::acos(glm::clamp(dot(direction, cell.center), -1.0, 1.0)) - cell.radius);
+
+				if (bound < maxAngle) {
+					visited.push_back(neighbour);
+					queue.push_back(std::make_pair(bound, neighbour));
+					std::push_heap(queue.begin(), queue.end(), std::greater<Entry>());
+				}
+			}
+		}
+	}
+
+	std::sort_heap(best.begin(), best.end(), closer);
+
+	for (int i = 0; i < k; i++) {
+		nodes[i] = i < best.size() ? best[i].second : -1;
+	}
+
+	return best.size();
+}
+
+int32 MapNodeIndex::findNearest(dvec3 point) const {
+	int32 node = -1;
+	this->findNearest(point, 1, &node);
+	return node;
+}
+
+int32 MapNodeIndex::findNearest(dvec3 point, int32 k, int32* nodes) const {
+	if (this->cellNodes.empty() || k <= 0 || dot(point, point) < 1e-24) {
+		for (int i = 0; i < k; i++) {
+			nodes[i] = -1;
+		}
+		return 0;
+	}
+
+	const dvec3 direction = normalize(point);
+	return this->search(direction, this->getCellIndex(direction), k, nodes);
+}
+
+void MapNodeIndex::findNearest(int32 count, const dvec3* points, int32* nodes) const {
+	this->findNearest(count, points, 1, nodes);
+}
+
+void MapNodeIndex::findNearest(int32 count, const dvec3* points, int32 k, int32* nodes) const {
+	struct Query {
+		int32 cell;
+		int32 index;
+	};
+
+	std::vector<Query> queries;
+	queries.reserve(count);
+
+	for (int i = 0; i < count; i++) {
+		if (this->cellNodes.empty() || dot(points[i], points[i]) < 1e-24) {
+			for (int j = 0; j < k; j++) {
+				nodes[i * k + j] = -1;
+			}
+			continue;
+		}
+
+		Query query;
+		query.cell = this->getCellIndex(points[i]);
+		query.index = i;
+		queries.push_back(query);
+	}
+
+	std::sort(queries.begin(), queries.end(), [](const Query& a, const Query& b) {
+		return a.cell < b.cell;
+	});
+
+	for (int i = 0; i < queries.size(); i++) {
+		const Query& query = queries[i];
+		this->search(normalize(points[query.index]), query.cell, k, &nodes[query.index * k]);
+	}
+}
+
+int32 MapNodeIndex::getResolution() const {
+	return this->resolution;
+}
+
+int32 MapNodeIndex::getCellCount() const {
+	return this->cells.size();
+}
+
+uint64 MapNodeIndex::getMemoryUsage() const {
+	return this->cells.size() * sizeof(Cell) + this->cellOffsets.size() * sizeof(int32) + this->cellNodes.size() * (sizeof(int32) + sizeof(fvec3));
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "core/Core.h"
+
+/**
+ * Finds the map nodes nearest to a point. The unit sphere is divided into a grid of cells on each face of a cube, and
+ * each cell lists the nodes whose directions fall inside it. A query visits the cells in order of their angular
+ * distance from the point, starting from the cell containing it, and stops once no unvisited cell could hold a closer
+ * node, so the result is always exact. Only a handful of cells are visited, whatever the node count. This is thread
+ * safe once built.
+ */
+class MapNodeIndex {
+private:
+	struct Cell {
+		dvec3 center; // The direction through the center of the cell.
+		double radius; // The largest angle between the center and any direction inside the cell.
+	};
+
+	int32 resolution; // The number of cells along each edge of a cube face.
+	std::vector<Cell> cells; // [face][y][x]
+	std::vector<int32> cellOffsets; // The range of each cell's nodes. One more than the cell count.
+	std::vector<int32> cellNodes; // The nodes in each cell.
+	std::vector<fvec3> cellPositions; // The positions of the nodes in each cell, in the same order as cellNodes.
+
+	/**
+	 * The direction through the face coordinate, where [-1, 1] spans the face. Coordinates outside the face give
+	 * directions on the neighbouring faces.
+	 */
+	static dvec3 getFaceDirection(int32 face, dvec2 faceCoord);
+
+	/**
+	 * The face that the direction points at most directly, and the coordinate of the direction on it.
+	 */
+	static int32 getFace(dvec3 direction, dvec2* faceCoord);
+
+	int32 getCellIndex(dvec3 direction) const;
+
+	/**
+	 * Find the k nearest nodes to the normalized direction. Returns the number of nodes found, which is less than k
+	 * only if there are fewer than k nodes.
+	 */
+	int32 search(dvec3 direction, int32 startCell, int32 k, int32* nodes) const;
+
+public:
+	/**
+	 * Build the index over the node positions, which must be on the unit sphere. The grid is sized so that each cell
+	 * holds about the requested number of nodes.
+	 */
+	MapNodeIndex(int32 count, const fvec3* positions, double nodesPerCell = 2.0);
+
+	~MapNodeIndex();
+
+	/**
+	 * The node closest to the point, or -1 if there are no nodes. Since the nodes are on the unit sphere, this is the
+	 * node closest in direction for any point other than the origin.
+	 */
+	int32 findNearest(dvec3 point) const;
+
+	/**
+	 * The k nodes closest to the point, nearest first. Returns the number found. Unused entries are set to -1.
+	 */
+	int32 findNearest(dvec3 point, int32 k, int32* nodes) const;
+
+	/**
+	 * The node closest to each of the points. The points are looked up in the order of the cells they fall in, so
+	 * that consecutive queries read the same nodes.
+	 */
+	void findNearest(int32 count, const dvec3* points, int32* nodes) const;
+
+	/**
+	 * The k nodes closest to each of the points, nearest first, written k at a time.
+	 */
+	void findNearest(int32 count, const dvec3* points, int32 k, int32* nodes) const;
+
+	int32 getResolution() const;
+
+	int32 getCellCount() const;
+
+	uint64 getMemoryUsage() const;
+};
@@ -0,0 +1,258 @@
+#include "MapSnapshot.h"
+#include "core/application/Application.h"
+#include "core/engine/terrain/MapGenerator.h"
+#include "core/util/MappedFile.h"
+#include <iomanip>
+
+#define MAP_SNAPSHOT_MAGIC 0x3153504D // "MPS1"
+#define MAP_SNAPSHOT_FORMAT_VERSION 2
+#define MAP_SNAPSHOT_SECTION_COUNT 17
+#define MAP_SNAPSHOT_ALIGNMENT 16 // Sections start on this boundary, so every array is aligned in the mapping.
+
+/**
+ * True if every offset is no less than the one before it, starting from zero.
+ */
+static bool isAscending(const int32* offsets, uint64 count) {
+	if (offsets[0] != 0) {
+		return false;
+	}
+
+	for (uint64 i = 1; i < count; i++) {
+		if (offsets[i] < offsets[i - 1]) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * True if every value is in [min, max).
+ */
+static bool isInRange(const int32* values, uint64 count, int32 min, int32 max) {
+	for (uint64 i = 0; i < count; i++) {
+		if (values[i] < min || values[i] >= max) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Call visit(field, array, count) for every array of the graph, in the order they are stored, where count is the
+ * number of elements the array must have for the counts in the header.
+ */
+template<typename Graph, typename Visitor>
+static void visitSections(Graph& g, const MapSnapshotHeader& header, Visitor visit) {
+	const uint64 nodeCount = header.nodeCount;
+
+	visit(0, g.position, nodeCount);
+	visit(1, g.heightmapData, nodeCount);
+	visit(2, g.area, nodeCount);
+	visit(3, g.water, nodeCount);
+	visit(4, g.windVector, nodeCount);
+	visit(5, g.windStrength, nodeCount);
+	visit(6, g.normalizedWindStrength, nodeCount);
+	visit(7, g.temperature, nodeCount);
+	visit(8, g.moisture, nodeCount);
+	visit(9, g.lifeZone, nodeCount);
+	visit(10, g.neighbourOffsets, nodeCount + 1);
+	visit(11, g.neighbours, header.neighbourCount);
+	visit(12, g.currents, header.neighbourCount);
+	visit(13, g.inflowOffsets, nodeCount + 1);
+	visit(14, g.inflowSources, header.inflowCount);
+	visit(15, g.inflowWeights, header.inflowCount);
+	visit(16, g.triangles, header.triangleIndexCount);
+}
+
+MapSnapshot::MapSnapshot(std::string directory, uint32 seed, uint32 planetIdentity, float radius, float elevationScale, uint32 resolution, uint32 generatorVersion, uint32 tileGeneratorVersion) {
+	std::error_code error;
+	std::filesystem::create_directories(directory, error);
+
+	std::stringstream name;
+	name << "map_" << seed << "_" << std::hex << std::setw(8) << std::setfill('0') << planetIdentity << std::dec << "_" << resolution << "_v" << generatorVersion << ".snapshot";
+	this->path = (std::filesystem::path(directory) / name.str()).string();
+
+	this->key = {};
+	this->key.magic = MAP_SNAPSHOT_MAGIC;
+	this->key.formatVersion = MAP_SNAPSHOT_FORMAT_VERSION;
+	this->key.seed = seed;
+	this->key.planetIdentity = planetIdentity;
+	this->key.radius = radius;
+	this->key.elevationScale = elevationScale;
+	this->key.resolution = resolution;
+	this->key.generatorVersion = generatorVersion;
+	this->key.tileGeneratorVersion = tileGeneratorVersion;
+	this->key.sectionCount = MAP_SNAPSHOT_SECTION_COUNT;
+}
+
+MapSnapshot::~MapSnapshot() {
+
+}
+
+bool MapSnapshot::read(MapGraph* graph, int32 lifeZoneCount) const {
+	MappedFile file;
+
+	if (!file.open(this->path, false)) {
+		return false;
+	}
+
+	const uint64 size = file.getSize();
+	const uint8* data = file.map(size);
+
+	MapSnapshotHeader header = {};
+
+	if (data != NULL && size >= sizeof(MapSnapshotHeader)) {
+		memcpy(&header, data, sizeof(MapSnapshotHeader));
+	}
+
+	if (header.magic != this->key.magic || header.formatVersion != this->key.formatVersion || header.sectionCount != this->key.sectionCount) {
+		logWarn("Map snapshot \"%s\" has an invalid header, the map will be regenerated", this->path.c_str());
+		return false;
+	}
+
+	if (header.seed != this->key.seed || header.planetIdentity != this->key.planetIdentity || header.radius != this->key.radius || header.elevationScale != this->key.elevationScale ||
+		header.resolution != this->key.resolution || header.generatorVersion != this->key.generatorVersion || header.tileGeneratorVersion != this->key.tileGeneratorVersion) {
+		logInfo("Map snapshot \"%s\" was generated with a different terrain, the map will be regenerated", this->path.c_str());
+		return false;
+	}
+
+	const uint64 headerSize = sizeof(MapSnapshotHeader) + sizeof(MapSnapshotSection) * header.sectionCount;
+	if (size < headerSize) {
+		logWarn("Map snapshot \"%s\" is truncated, the map will be regenerated", this->path.c_str());
+		return false;
+	}
+
+	MapSnapshotSection sections[MAP_SNAPSHOT_SECTION_COUNT];
+	memcpy(sections, data + sizeof(MapSnapshotHeader), sizeof(sections));
+
+	// Check every section before anything is copied, so that a bad file leaves the graph as it was.
+	bool valid = true;
+
+	visitSections(*graph, header, [&](uint32 field, auto& array, uint64 count) {
+		typedef typename std::decay<decltype(array)>::type::value_type Element;
+
+		const MapSnapshotSection& section = sections[field];
+		valid = valid &&
+			section.field == field &&
+			section.elementSize == sizeof(Element) &&
+			section.count == count &&
+			section.offset % MAP_SNAPSHOT_ALIGNMENT == 0 &&
+			section.offset >= headerSize &&
+			section.offset + section.count * section.elementSize <= size;
+	});
+
+	if (valid) {
+		// The graph is walked through these without bounds checks, so every offset and index is checked in one pass
+		// over the mapping before anything is copied.
+		const int32 nodeCount = header.nodeCount;
+		const int32* lifeZone = reinterpret_cast<const int32*>(data + sections[9].offset);
+		const int32* neighbourOffsets = reinterpret_cast<const int32*>(data + sections[10].offset);
+		const int32* neighbours = reinterpret_cast<const int32*>(data + sections[11].offset);
+		const int32* inflowOffsets = reinterpret_cast<const int32*>(data + sections[13].offset);
+		const int32* inflowSources = reinterpret_cast<const int32*>(data + sections[14].offset);
+		const int32* triangles = reinterpret_cast<const int32*>(data + sections[16].offset);
+
+		valid = nodeCount >= 0 &&
+			neighbourOffsets[nodeCount] == header.neighbourCount && inflowOffsets[nodeCount] == header.inflowCount &&
+			isAscending(neighbourOffsets, nodeCount + 1) &&
+			isAscending(inflowOffsets, nodeCount + 1) &&
+			isInRange(neighbours, header.neighbourCount, 0, nodeCount) &&
+			isInRange(inflowSources, header.inflowCount, 0, nodeCount) &&
+			isInRange(triangles, header.triangleIndexCount, 0, nodeCount) &&
+			isInRange(lifeZone, nodeCount, -1, lifeZoneCount); // -1 for a node with no life zone.
+	}
+
+	if (!valid) {
+		logWarn("Map snapshot \"%s\" has invalid sections, the map will be regenerated", this->path.c_str());
+		return false;
+	}
+
+	visitSections(*graph, header, [&](uint32 field, auto& array, uint64 count) {
+		typedef typename std::decay<decltype(array)>::type::value_type Element;
+
+		const Element* elements = reinterpret_cast<const Element*>(data + sections[field].offset);
+		array.assign(elements, elements + count);
+	});
+
+	logInfo("Loaded map snapshot \"%s\" with %d nodes (%.2f MiB)", this->path.c_str(), header.nodeCount, size / (1024.0 * 1024.0));
+	return true;
+}
+
+bool MapSnapshot::write(const MapGraph& graph) const {
+	MapSnapshotHeader header = this->key;
+	header.nodeCount = graph.getNodeCount();
+	header.neighbourCount = graph.neighbours.size();
+	header.inflowCount = graph.inflowSources.size();
+	header.triangleIndexCount = graph.triangles.size();
+
+	MapSnapshotSection sections[MAP_SNAPSHOT_SECTION_COUNT];
+	uint64 offset = sizeof(MapSnapshotHeader) + sizeof(sections);
+	bool valid = true;
+
+	visitSections(graph, header, [&](uint32 field, const auto& array, uint64 count) {
+		typedef typename std::decay<decltype(array)>::type::value_type Element;
+
+		offset = (offset + MAP_SNAPSHOT_ALIGNMENT - 1) / MAP_SNAPSHOT_ALIGNMENT * MAP_SNAPSHOT_ALIGNMENT;
+
+		MapSnapshotSection& section = sections[field];
+		section.field = field;
+		section.elementSize = sizeof(Element);
+		section.offset = offset;
+		section.count = array.size();
+
+		offset += section.count * section.elementSize;
+		valid = valid && array.size() == count;
+	});
+
+	if (!valid) {
+		logError("Unable to write map snapshot, the graph arrays do not match its node count");
+		return false;
+	}
+
+	// Written beside the snapshot and moved over it once complete, so a failed write never replaces a good snapshot.
+	const std::string tempPath = this->path + ".tmp";
+
+	MappedFile file;
+	bool written = file.open(tempPath, true) && file.truncate(0);
+
+	written = written && file.append(&header, sizeof(MapSnapshotHeader));
+	written = written && file.append(sections, sizeof(sections));
+
+	visitSections(graph, header, [&](uint32 field, const auto& array, uint64 count) {
+		const uint8 padding[MAP_SNAPSHOT_ALIGNMENT] = {};
+		const uint64 paddingSize = sections[field].offset - file.getSize();
+		const uint64 dataSize = sections[field].count * sections[field].elementSize;
+
+		written = written && (paddingSize == 0 || file.append(padding, paddingSize));
+		written = written && (dataSize == 0 || file.append(array.data(), dataSize));
+	});
+
+	const uint64 size = file.getSize();
+	file.close();
+
+	std::error_code error;
+
+	if (written) {
+		std::filesystem::rename(tempPath, this->path, error);
+	}
+
+	if (!written || error) {
+		logWarn("Failed to write map snapshot \"%s\"", this->path.c_str());
+		std::filesystem::remove(tempPath, error);
+		return false;
+	}
+
+	logInfo("Wrote map snapshot \"%s\" with %d nodes (%.2f MiB)", this->path.c_str(), header.nodeCount, size / (1024.0 * 1024.0));
+	return true;
+}
+
+bool MapSnapshot::exists() const {
+	std::error_code error;
+	return std::filesystem::exists(this->path, error);
+}
+
+std::string MapSnapshot::getPath() const {
+	return this->path;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "core/Core.h"
+
+struct MapGraph;
+
+struct MapSnapshotHeader {
+	uint32 magic; // Identifies the file as a map snapshot.
+	uint32 formatVersion; // The layout of this header and the sections.
+	uint32 seed; // The seed of the terrain that the map was generated on.
+	uint32 planetIdentity; // The hash of the planet parameters below, which is also part of the file name.
+	float radius; // The radius of the planet, as passed to the tile generator.
+	float elevationScale; // The elevation scale of the planet, as passed to the tile generator.
+	uint32 resolution; // The subdivision resolution of the map.
+	uint32 generatorVersion; // The version of the map generator that produced the map.
+	uint32 tileGeneratorVersion; // The version of the tile generator that the node heights were sampled from.
+	uint32 nodeCount;
+	uint32 neighbourCount; // The number of entries in the neighbour and current arrays.
+	uint32 inflowCount; // The number of entries in the inflow source and weight arrays.
+	uint32 triangleIndexCount; // Three for every face of the map.
+	uint32 sectionCount; // The number of MapSnapshotSections following this header.
+	uint32 padding[2];
+};
+
+struct MapSnapshotSection {
+	uint32 field; // The MapGraph array stored in this section.
+	uint32 elementSize; // The size of one element, to catch a changed field type.
+	uint64 offset; // The offset of the array from the start of the file.
+	uint64 count; // The number of elements in the array.
+};
+
+/**
+ * A binary snapshot of a generated map, with every MapGraph array stored as one contiguous section, keyed by terrain
+ * seed, planet radius and elevation scale, resolution and generator versions. Every combination is a separate file in the snapshot directory, so a map
+ * only has to be simulated once, and maps can be generated ahead of time. Snapshots are read through a memory mapping,
+ * and each array is copied out in one block, so loading takes time proportional to the file size.
+ *
+ * Snapshots are written to a temporary file which then replaces the old one, so a snapshot is never left incomplete.
+ */
+class MapSnapshot {
+private:
+	std::string path; // The path of the snapshot file.
+	MapSnapshotHeader key; // The header that a matching snapshot starts with. The counts are not part of the key.
+
+public:
+	/**
+	 * The planet identity is a hash of the radius and elevation scale, such as TileSupplier::getPlanetIdentity, which
+	 * keeps the file name short.
+	 */
+	MapSnapshot(std::string directory, uint32 seed, uint32 planetIdentity, float radius, float elevationScale, uint32 resolution, uint32 generatorVersion, uint32 tileGeneratorVersion);
+
+	~MapSnapshot();
+
+	/**
+	 * Replace the contents of the graph with the snapshot. Returns false, leaving the graph unchanged, if there is no
+	 * snapshot for this key, or if the file is invalid, including any node index or life zone index out of range.
+	 */
+	bool read(MapGraph* graph, int32 lifeZoneCount) const;
+
+	/**
+	 * Store the graph, replacing any previous snapshot for this key. Returns false if the file could not be written.
+	 */
+	bool write(const MapGraph& graph) const;
+
+	bool exists() const;
+
+	std::string getPath() const;
+};
@@ -7,27 +7,28 @@
 #include "core/engine/renderer/DebugRenderer.h"
 #include "core/engine/renderer/postprocess/AtmosphereRenderer.h"
 #include "core/engine/terrain/TerrainQuad.h"
+#include "core/engine/terrain/TerrainQuadPool.h"
+#include "core/engine/terrain/LinearQuadTree.h"
+#include "core/engine/terrain/TerrainSnapshot.h"
+#include "core/engine/terrain/TerrainRayCaster.h"
+#include "core/engine/terrain/TerrainLodMetric.h"
 #include "core/engine/terrain/TerrainRenderer.h"
 #include "core/engine/terrain/Atmosphere.h"
 #include "core/engine/terrain/MapGenerator.h"
+#include "core/engine/terrain/ClimateMap.h"
 #include "core/engine/terrain/TileSupplier.h"
 #include "core/engine/scene/bounding/BoundingVolume.h"
 #include "core/util/InputHandler.h"
 #include "core/util/Time.h"
 #include <GL/glew.h>
 
-// Scale factor in kilometers per OpenGL unit
-double Planet::minScaleFactor = 0.001;
-double Planet::maxScaleFactor = 1000.0;
-double Planet::scaleFactor = 1.0;
-double Planet::currScaleFactor = 1.0;
-double Planet::prevScaleFactor = 1.0;
-
-Planet::Planet(dvec3 center, double radius, double splitThreshold, int32 maxSplitDepth) :
+Planet::Planet(dvec3 center, double radius, double splitThreshold, int32 maxSplitDepth, TileSupplier* tileSupplier, TerrainRenderer* terrainRenderer) :
 	GameObject(), center(center), radius(radius), invRadius(1.0 / radius), splitThreshold(splitThreshold), maxSplitDepth(maxSplitDepth) {
 
-	this->tileSupplier = new TileSupplier(this);
-	this->terrainRenderer = new TerrainRenderer(16);
+	this->ownsTileSupplier = tileSupplier == NULL;
+	this->ownsTerrainRenderer = terrainRenderer == NULL;
+	this->tileSupplier = this->ownsTileSupplier ? new TileSupplier() : tileSupplier;
+	this->terrainRenderer = this->ownsTerrainRenderer ? new TerrainRenderer(16) : terrainRenderer;
 	this->atmosphere = new Atmosphere(this);
 
 	this->faceOrientations[X_NEG][0] = fvec3(0, 0, +1);
@@ -54,6 +55,9 @@ Planet::Planet(dvec3 center, double radius, double splitThreshold, int32 maxSpli
 	this->faceOrientations[Z_POS][1] = fvec3(0, 0, +1);
 	this->faceOrientations[Z_POS][2] = fvec3(0, -1, 0);
 
+	this->quadPool = new TerrainQuadPool();
+	this->linearQuadTree = new LinearQuadTree(this, this->maxSplitDepth);
+
 	this->faces[X_NEG] = new TerrainQuad(this, X_NEG);
 	this->faces[X_POS] = new TerrainQuad(this, X_POS);
 	this->faces[Y_NEG] = new TerrainQuad(this, Y_NEG);
@@ -75,6 +79,18 @@ Planet::Planet(dvec3 center, double radius, double splitThreshold, int32 maxSpli
 	// this->faces[Z_NEG]->setNeighbours(this->faces[X_NEG], this->faces[Y_POS], this->faces[X_POS], this->faces[Y_NEG]);
 	// this->faces[Z_POS]->setNeighbours(this->faces[X_POS], this->faces[Y_POS], this->faces[X_NEG], this->faces[Y_NEG]);
 
+	this->lodMetric = new ScreenSpaceErrorLodMetric(this->splitThreshold);
+	this->maxSplitsPerUpdate = 32;
+	this->mergeHysteresis = 1.25;
+	this->mergeDelay = 0.25;
+	this->maxMergeDelay = 2.0;
+
+	this->snapshotTileStateVersion = 0;
+
+	this->localCameraPosition = dvec3(0.0);
+	this->localCameraVelocity = dvec3(0.0);
+	this->prevUpdateCameraPosition = dvec3(NAN);
+
 	this->renderDebugQuadBounds = false;
 	this->tileSupplierDebugState = 0;
 
@@ -83,16 +99,32 @@ Planet::Planet(dvec3 center, double radius, double splitThreshold, int32 maxSpli
 	this->horizonRadius = this->radius - this->elevationScale;
 	this->invHorizonRadius = 1.0 / this->horizonRadius;
 
+	// Added once the elevation scale is set, since the supplier keys the planet's cached tiles by it.
+	this->tileSupplier->addPlanet(this);
+
 	this->mapGenerator = new MapGenerator(this);
 }
 
 Planet::~Planet() {
-	delete this->terrainRenderer;
-	delete this->tileSupplier;
-
+	// The quads release their tiles, so they are deleted before the tile supplier.
 	for (int i = 0; i < 6; i++) {
 		delete this->faces[i];
 	}
+
+	delete this->quadPool;
+	delete this->linearQuadTree;
+	delete this->lodMetric;
+
+	this->tileSupplier->removePlanet(this);
+	this->terrainRenderer->removePlanet(this);
+
+	if (this->ownsTerrainRenderer) {
+		delete this->terrainRenderer;
+	}
+
+	if (this->ownsTileSupplier) {
+		delete this->tileSupplier;
+	}
 	delete[] this->faces;
 
 }
@@ -102,8 +134,6 @@ void Planet::render(SceneGraph * sceneGraph, double partialTicks, double dt) {
 
 	uint64 a = Time::now();
 
-	Planet::scaleFactor = Planet::prevScaleFactor * (1.0 - partialTicks) + Planet::currScaleFactor * partialTicks;
-
 	dvec3 cameraPosition = SCENE_GRAPH.getCamera()->getPosition();
 	this->localCameraPosition = this->worldToLocalPoint(cameraPosition);
 	this->closestCameraFace = this->getClosestFaceLocal(this->localCameraPosition);
@@ -122,12 +152,7 @@ void Planet::render(SceneGraph * sceneGraph, double partialTicks, double dt) {
 		SCREEN_RENDERER.setExposureEnabled(true);
 		SCREEN_RENDERER.setGammaCorrectionEnabled(true);
 
-		this->terrainRenderer->render(this, X_NEG, this->faces[X_NEG], partialTicks, dt);
-		this->terrainRenderer->render(this, X_POS, this->faces[X_POS], partialTicks, dt);
-		this->terrainRenderer->render(this, Y_NEG, this->faces[Y_NEG], partialTicks, dt);
-		this->terrainRenderer->render(this, Y_POS, this->faces[Y_POS], partialTicks, dt);
-		this->terrainRenderer->render(this, Z_NEG, this->faces[Z_NEG], partialTicks, dt);
-		this->terrainRenderer->render(this, Z_POS, this->faces[Z_POS], partialTicks, dt);
+		this->terrainRenderer->render(this, partialTicks, dt);
 		this->tileSupplier->update();
 
 		SCREEN_RENDERER.getAtmosphereRenderer()->addAtmosphere(this->atmosphere);
@@ -161,11 +186,34 @@ void Planet::update(SceneGraph * sceneGraph, double dt) {
 	this->closestCameraDistance = INFINITY;
 	this->closestCameraTerrainQuad = NULL;
 
+	this->lodMetric->update(this);
+
 	for (int i = 0; i < 6; i++) {
 		this->faces[i]->update(dt);
 		changed |= this->faces[i]->didChange();
 	}
 
+	// No quad is deleted after it requests a split, since merges only remove quads that are not visited afterwards.
+	const uint32 numSplits = glm::min((uint32) this->splitRequests.size(), this->maxSplitsPerUpdate);
+	std::partial_sort(this->splitRequests.begin(), this->splitRequests.begin() + numSplits, this->splitRequests.end());
+
+	for (int i = 0; i < numSplits; i++) {
+		changed |= this->splitRequests[i].second->split();
+	}
+
+	this->splitRequests.clear();
+
+	// The velocity is smoothed, so that a single uneven update does not prefetch tiles in the wrong direction.
+	const dvec3 updateCameraPosition = this->worldToLocalPoint(sceneGraph->getCamera()->getPosition());
+	if (!isnan(this->prevUpdateCameraPosition.x) && dt > 0.0) {
+		this->localCameraVelocity = glm::mix(this->localCameraVelocity, (updateCameraPosition - this->prevUpdateCameraPosition) / dt, 0.5);
+	}
+	this->prevUpdateCameraPosition = updateCameraPosition;
+
+	this->tileSupplier->prefetch(this);
+
+	this->updateTerrainSnapshot(changed);
+
 	this->closestCameraDistance = sqrt(this->closestCameraDistance);
 
 	// TODO: Update this elsewhere
@@ -175,11 +223,7 @@ void Planet::update(SceneGraph * sceneGraph, double dt) {
 	double base = 3.0F;
 	double logDist = glm::log(glm::max(altitude, 0.000001)) / glm::log(base);
 
-	double nextScaleFactor = glm::clamp(glm::pow(base, base - logDist), Planet::minScaleFactor, Planet::maxScaleFactor);
-	double scaleRate = 0.1;
-
-	Planet::prevScaleFactor = currScaleFactor;
-	Planet::currScaleFactor = prevScaleFactor * (1.0 - scaleRate) + nextScaleFactor * scaleRate;
+	sceneGraph->getCamera()->requestScaleFactor(glm::pow(base, base - logDist));
 	uint64 b = Time::now();
 	//logInfo("Took %f ms to update terrain", (b - a) / 1000000.0);
 
@@ -204,6 +248,39 @@ void Planet::update(SceneGraph * sceneGraph, double dt) {
 		this->renderDebugQuadBounds = !this->renderDebugQuadBounds;
 	}
 
+	if (INPUT_HANDLER.keyPressed(KEY_F7)) {
+		this->tileSupplier->setCpuGenerationEnabled(!this->tileSupplier->isCpuGenerationEnabled());
+		logInfo("Terrain tiles are now generated on the %s", this->tileSupplier->isCpuGenerationEnabled() ? "CPU" : "GPU");
+	}
+
+	if (INPUT_HANDLER.keyPressed(KEY_F9)) {
+		logInfo("Terrain quad pool: %d quads in %d/%d blocks (peak %d), %.2f/%.2f MiB, %llu splits, %llu merges",
+			this->quadPool->getNumNodes(), this->quadPool->getNumUsedBlocks(), this->quadPool->getNumUsedBlocks() + this->quadPool->getNumFreeBlocks(), this->quadPool->getPeakUsedBlocks(),
+			this->quadPool->getUsedMemory() / (1024.0 * 1024.0), this->quadPool->getReservedMemory() / (1024.0 * 1024.0),
+			this->quadPool->getNumAllocations(), this->quadPool->getNumReleases()
+		);
+		logInfo("Linear quad tree: %d quads indexed, capacity %d", this->linearQuadTree->getCount(), this->linearQuadTree->getCapacity());
+		logInfo("Tile prefetch: %llu prefetched, %llu hits, %llu late, %llu wasted (%.1f%% hit rate)",
+			this->tileSupplier->getNumPrefetched(), this->tileSupplier->getNumPrefetchHits(), this->tileSupplier->getNumPrefetchLate(),
+			this->tileSupplier->getNumPrefetchWasted(), this->tileSupplier->getPrefetchHitRate() * 100.0
+		);
+	}
+
+	if (INPUT_HANDLER.keyPressed(KEY_F10)) {
+		if (dynamic_cast<ScreenSpaceErrorLodMetric*>(this->lodMetric) != NULL) {
+			this->setLodMetric(new DistanceLodMetric());
+			logInfo("Terrain quads now split by distance");
+		} else {
+			this->setLodMetric(new ScreenSpaceErrorLodMetric(this->splitThreshold));
+			logInfo("Terrain quads now split by screen-space error (%.2f pixels)", this->splitThreshold);
+		}
+	}
+
+	if (INPUT_HANDLER.keyPressed(KEY_F8)) {
+		this->terrainRenderer->setGpuCullingEnabled(!this->terrainRenderer->isGpuCullingEnabled());
+		logInfo("Terrain quads are now culled on the %s", this->terrainRenderer->isGpuCullingEnabled() ? "GPU" : "CPU");
+	}
+
 
 	//double intersectDist;
 	//int32 w, h; Application::getWindowSize(&w, &h);
@@ -222,7 +299,8 @@ void Planet::applyUniforms(ShaderProgram * program) {
 	program->setUniform("localCameraPosition", this->localCameraPosition);
 	program->setUniform("elevationScale", (float)this->elevationScale);
 	program->setUniform("planetRadius", (float)this->radius);
-	program->setUniform("renormalizeSphere", Planet::scaleFactor < 1.0);
+	program->setUniform("renormalizeSphere", SCENE_GRAPH.getCamera()->getScaleFactor() < 1.0);
+	this->mapGenerator->getClimateMap()->applyUniforms(program);
 }
 
 IntersectionType Planet::getVisibility(CubeFace face, BoundingVolume * bound, bool horizonTest) {
@@ -368,6 +446,50 @@ bool Planet::horizonOcclusion(CubeFace face, BoundingVolume * bound) {
 	return false;
 }
 
+void Planet::onTileChanged(uvec3 treePosition) {
+	const uint32 levels = this->maxSplitDepth + 1;
+	const uint32 face = treePosition.z / levels;
+
+	if (face >= 6) {
+		return;
+	}
+
+	TerrainQuad* terrainQuad = this->linearQuadTree->find((CubeFace) face, treePosition.z % levels, uvec2(treePosition));
+
+	if (terrainQuad == NULL) {
+		return;
+	}
+
+	this->terrainRenderer->onLeafChanged(terrainQuad);
+
+	if (terrainQuad->children != NULL) {
+		for (int i = 0; i < 4; i++) {
+			this->terrainRenderer->onLeafChanged(&terrainQuad->children[i]);
+		}
+	}
+}
+
+void Planet::requestSplit(TerrainQuad* terrainQuad, double priority) {
+	this->splitRequests.push_back(std::make_pair(priority, terrainQuad));
+}
+
+void Planet::updateTerrainSnapshot(bool changed) {
+	const std::shared_ptr<const TerrainSnapshot> previous = std::atomic_load(&this->terrainSnapshot);
+	const uint64 tileStateVersion = this->tileSupplier->getTileStateVersion(this); // Not changed by the tiles of other planets sharing the supplier.
+
+	if (previous != NULL && !changed && tileStateVersion == this->snapshotTileStateVersion) {
+		double age = Time::time_cast<Time::time_unit, Time::seconds, double>(Time::now() - previous->getTimeCreated());
+
+		if (age < 0.25) {
+			return;
+		}
+	}
+
+	std::shared_ptr<const TerrainSnapshot> snapshot(new TerrainSnapshot(this, previous.get()));
+	std::atomic_store(&this->terrainSnapshot, snapshot);
+	this->snapshotTileStateVersion = tileStateVersion;
+}
+
 //TileData* Planet::getTileData(TerrainQuad* terrainQuad) {
 //	return this->tileSupplier->consumeTileData(terrainQuad);
 //}
@@ -547,10 +669,12 @@ dmat4 Planet::getFaceTransformation(CubeFace face) {
 }
 
 dmat4 Planet::getViewerTransformation(dvec3 viewerWorldPosition) {
+	const double scaleFactor = SCENE_GRAPH.getCamera()->getScaleFactor();
+
 	dmat4 m(1.0);
-	m[3][0] = this->center.x - viewerWorldPosition.x * Planet::scaleFactor;
-	m[3][1] = this->center.y - viewerWorldPosition.y * Planet::scaleFactor;
-	m[3][2] = this->center.z - viewerWorldPosition.z * Planet::scaleFactor;
+	m[3][0] = this->center.x - viewerWorldPosition.x * scaleFactor;
+	m[3][1] = this->center.y - viewerWorldPosition.y * scaleFactor;
+	m[3][2] = this->center.z - viewerWorldPosition.z * scaleFactor;
 
 	return m;
 }
@@ -563,6 +687,10 @@ dvec3 Planet::getLocalCameraPosition() const {
 	return this->localCameraPosition;
 }
 
+dvec3 Planet::getLocalCameraVelocity() const {
+	return this->localCameraVelocity;
+}
+
 dvec2 Planet::getFaceCameraPosition() const {
 	return this->faceCameraPosition;
 }
@@ -576,6 +704,19 @@ TerrainQuad* Planet::getClosestCameraTerrainQuad() const {
 }
 
 TerrainQuad* Planet::getRayPickTerrainQuad(Ray localRay, double* distance) {
+	if (this->getTerrainSnapshot() != NULL) {
+		TerrainRayHit hit;
+
+		if (this->castRay(localRay, &hit)) {
+			if (distance != NULL) {
+				*distance = hit.distance;
+			}
+
+			return this->linearQuadTree->findDeepest(this->faces[hit.face], hit.facePosition);
+		}
+
+		return NULL;
+	}
 
 	double intersectDist;
 
@@ -652,3 +793,78 @@ double Planet::getDiameter() const {
 int32 Planet::getMaxSplitDepth() const {
 	return this->maxSplitDepth;
 }
+
+LinearQuadTree* Planet::getLinearQuadTree() const {
+	return this->linearQuadTree;
+}
+
+std::shared_ptr<const TerrainSnapshot> Planet::getTerrainSnapshot() const {
+	return std::atomic_load(&this->terrainSnapshot);
+}
+
+void Planet::sampleSurface(int32 count, const dvec3* sphereVectors, TerrainSample* samples) const {
+	const std::shared_ptr<const TerrainSnapshot> snapshot = this->getTerrainSnapshot();
+
+	if (snapshot == NULL) {
+		for (int i = 0; i < count; i++) {
+			samples[i].normal = fvec3(normalize(sphereVectors[i]));
+			samples[i].elevation = 0.0F;
+			samples[i].depth = -1;
+			samples[i].valid = false;
+		}
+		return;
+	}
+
+	snapshot->sampleSphereVectors(count, sphereVectors, samples);
+}
+
+bool Planet::castRay(Ray localRay, TerrainRayHit* hit, double maxDistance) const {
+	const std::shared_ptr<const TerrainSnapshot> snapshot = this->getTerrainSnapshot();
+
+	if (snapshot == NULL) {
+		hit->hit = false;
+		return false;
+	}
+
+	return TerrainRayCaster(snapshot).castRay(localRay, hit, maxDistance);
+}
+
+void Planet::castRays(int32 count, const Ray* localRays, TerrainRayHit* hits, double maxDistance) const {
+	const std::shared_ptr<const TerrainSnapshot> snapshot = this->getTerrainSnapshot();
+
+	if (snapshot == NULL) {
+		for (int i = 0; i < count; i++) {
+			hits[i].hit = false;
+		}
+		return;
+	}
+
+	TerrainRayCaster(snapshot).castRays(count, localRays, hits, maxDistance);
+}
+
+void Planet::sampleSurfaceLocal(int32 count, const dvec3* localPoints, TerrainSample* samples) const {
+	std::vector<dvec3> sphereVectors(count);
+
+	for (int i = 0; i < count; i++) {
+		sphereVectors[i] = normalize(localPoints[i]);
+	}
+
+	this->sampleSurface(count, sphereVectors.data(), samples);
+}
+
+TerrainRenderer* Planet::getTerrainRenderer() const {
+	return this->terrainRenderer;
+}
+
+TerrainLodMetric* Planet::getLodMetric() const {
+	return this->lodMetric;
+}
+
+void Planet::setLodMetric(TerrainLodMetric* lodMetric) {
+	assert(lodMetric != NULL);
+
+	if (lodMetric != this->lodMetric) {
+		delete this->lodMetric;
+		this->lodMetric = lodMetric;
+	}
+}
@@ -3,6 +3,7 @@
 #include "core/Core.h"
 #include "core/engine/scene/SceneGraph.h"
 #include "core/engine/scene/GameObject.h"
+#include <memory>
 
 class TileSupplier;
 class TerrainRenderer;
@@ -10,6 +11,12 @@ class Atmosphere;
 class MapGenerator;
 class ShaderProgram;
 class TerrainQuad;
+class TerrainQuadPool;
+class LinearQuadTree;
+class TerrainSnapshot;
+struct TerrainSample;
+struct TerrainRayHit;
+class TerrainLodMetric;
 class TileData;
 class BoundingVolume;
 struct Ray;
@@ -26,15 +33,23 @@ private:
 	friend class TerrainRenderer;
 	friend class TerrainQuad;
 
-	TileSupplier* tileSupplier;
-	TerrainRenderer* terrainRenderer;
+	TileSupplier* tileSupplier; // May be shared with other planets.
+	TerrainRenderer* terrainRenderer; // May be shared with other planets.
+	bool ownsTileSupplier; // True if the tile supplier was created for this planet, and is deleted with it.
+	bool ownsTerrainRenderer; // True if the terrain renderer was created for this planet, and is deleted with it.
 	Atmosphere* atmosphere;
 	MapGenerator* mapGenerator;
 
+	TerrainQuadPool* quadPool; // Allocates the children of every quad on every face.
+	LinearQuadTree* linearQuadTree; // Indexes every quad on every face by its address, for neighbour and point lookups.
+	std::shared_ptr<const TerrainSnapshot> terrainSnapshot; // The latest read-only copy of the quad tree for surface queries. Swapped atomically.
+	uint64 snapshotTileStateVersion; // The state of this planet's tiles that the latest snapshot was built from.
 	TerrainQuad* faces[6]; // cube faces.
 	mat3 faceOrientations[6]; // face orientations.
 
 	dvec3 localCameraPosition; // The position of the camera in local space.
+	dvec3 localCameraVelocity; // The smoothed velocity of the camera in local space, per second.
+	dvec3 prevUpdateCameraPosition; // The local camera position at the previous update, for the velocity.
 	dvec3 faceCameraPosition; // The position of the camera in undeformed face space, for the closest face.
 	CubeFace closestCameraFace; // The closest cube face to the camera.
 
@@ -51,21 +66,28 @@ private:
 
 	double elevationUnderCamera;
 	double elevationScale; // Elevation scale in kilometers.
-	double splitThreshold;
+	double splitThreshold; // The screen-space error tolerance in pixels.
 	int32 maxSplitDepth;
 
+	TerrainLodMetric* lodMetric; // Decides which quads split and merge.
+
+	std::vector<std::pair<double, TerrainQuad*>> splitRequests; // The quads that want to split this update, with their priority. Lower is more urgent.
+	uint32 maxSplitsPerUpdate; // The maximum number of quads split in one update.
+	double mergeHysteresis; // The merge threshold as a multiple of the split threshold.
+	double mergeDelay; // The number of seconds a quad must remain outside the merge threshold before it merges.
+	double maxMergeDelay; // The number of seconds after which a quad merges even if its tiles are still busy.
+
 	bool renderDebugQuadBounds;
 	int tileSupplierDebugState;
 
 
 public:
-	static double minScaleFactor;
-	static double maxScaleFactor;
-	static double scaleFactor;
-	static double currScaleFactor;
-	static double prevScaleFactor;
-
-	Planet(dvec3 center, double radius, double splitThreshold, int32 maxSplitDepth);
+	/**
+	 * Create a planet. A tile supplier and terrain renderer already used by other planets may be passed in, so that
+	 * several bodies share one set of GPU resources. They must outlive every planet using them. Otherwise the planet
+	 * creates and owns its own.
+	 */
+	Planet(dvec3 center, double radius, double splitThreshold, int32 maxSplitDepth, TileSupplier* tileSupplier = NULL, TerrainRenderer* terrainRenderer = NULL);
 	~Planet();
 
 	void render(SceneGraph* sceneGraph, double partialTicks, double dt) override;
@@ -80,6 +102,24 @@ public:
 
 	bool horizonOcclusion(CubeFace face, BoundingVolume* bound);
 
+	/**
+	 * Called by the tile supplier when the tile at the planetary unique tree position is generated, resized or
+	 * released, so the quad drawn with it, and its children drawn with it in place of their own, are updated.
+	 */
+	void onTileChanged(uvec3 treePosition);
+
+	/**
+	 * Queue the terrain quad to be split at the end of the update. Only the most urgent requests, up to the split
+	 * budget, are carried out. The rest request again in later updates if they still need to split.
+	 */
+	void requestSplit(TerrainQuad* terrainQuad, double priority);
+
+	/**
+	 * Rebuild the terrain snapshot if the quad tree or its tiles changed since it was built, or it is getting old,
+	 * since texture data read back on demand does not change the tile state.
+	 */
+	void updateTerrainSnapshot(bool changed);
+
 	//TileData* getTileData(TerrainQuad* terrainQuad);
 
 	TileSupplier* getTileSupplier() const;
@@ -122,12 +162,20 @@ public:
 
 	dvec3 getLocalCameraPosition() const;
 
+	/**
+	 * The velocity of the camera in local space, in units per second, smoothed over recent updates.
+	 */
+	dvec3 getLocalCameraVelocity() const;
+
 	dvec2 getFaceCameraPosition() const;
 
 	CubeFace getClosestCameraFace() const;
 
 	TerrainQuad* getClosestCameraTerrainQuad() const;
 
+	/**
+	 * The deepest quad under the point where the ray, in local planet space, hits the terrain heightfield.
+	 */
 	TerrainQuad* getRayPickTerrainQuad(Ray localRay, double* distance = NULL);
 
 	double getClosestCameraDistance() const;
@@ -147,5 +195,44 @@ public:
 	double getDiameter() const;
 
 	int32 getMaxSplitDepth() const;
+
+	LinearQuadTree* getLinearQuadTree() const;
+
+	/**
+	 * The latest snapshot of the terrain. Callers that make several queries should hold on to one snapshot, so they
+	 * all see the same terrain. This is thread safe.
+	 */
+	std::shared_ptr<const TerrainSnapshot> getTerrainSnapshot() const;
+
+	/**
+	 * Sample the height and normal of the terrain at each of the sphere vectors, from the latest terrain snapshot.
+	 * Samples whose tile data is not on the CPU are marked invalid, and the data is read back for a later snapshot.
+	 * This is thread safe.
+	 */
+	void sampleSurface(int32 count, const dvec3* sphereVectors, TerrainSample* samples) const;
+
+	/**
+	 * Sample the terrain directly below or above each of the points in local planet space. This is thread safe.
+	 */
+	void sampleSurfaceLocal(int32 count, const dvec3* localPoints, TerrainSample* samples) const;
+
+	/**
+	 * Cast the ray, in local planet space, against the terrain of the latest snapshot. This is thread safe.
+	 */
+	bool castRay(Ray localRay, TerrainRayHit* hit, double maxDistance = INFINITY) const;
+
+	/**
+	 * Cast a batch of rays, in local planet space, against the terrain of the latest snapshot. This is thread safe.
+	 */
+	void castRays(int32 count, const Ray* localRays, TerrainRayHit* hits, double maxDistance = INFINITY) const;
+
+	TerrainRenderer* getTerrainRenderer() const;
+
+	TerrainLodMetric* getLodMetric() const;
+
+	/**
+	 * Replace the LOD metric, which the planet takes ownership of. The quad tree adapts over the following updates.
+	 */
+	void setLodMetric(TerrainLodMetric* lodMetric);
 };
 
@@ -0,0 +1,53 @@
+#include "TerrainLodMetric.h"
+#include "core/application/Application.h"
+#include "core/engine/scene/SceneGraph.h"
+#include "core/engine/renderer/Camera.h"
+#include "core/engine/terrain/Planet.h"
+#include "core/engine/terrain/TerrainQuad.h"
+#include "core/engine/terrain/TerrainRenderer.h"
+
+TerrainLodMetric::~TerrainLodMetric() {}
+
+void TerrainLodMetric::update(Planet* planet) {}
+
+DistanceLodMetric::DistanceLodMetric(double distanceFactor):
+	distanceFactor(distanceFactor) {}
+
+double DistanceLodMetric::getRelativeError(const TerrainQuad* terrainQuad, double distanceSq) const {
+	const double threshold = terrainQuad->getSize() * this->distanceFactor;
+	return threshold / glm::max(sqrt(distanceSq), 1e-9);
+}
+
+ScreenSpaceErrorLodMetric::ScreenSpaceErrorLodMetric(double pixelTolerance, double minRelativeError):
+	pixelTolerance(pixelTolerance), minRelativeError(minRelativeError), projectionScale(1.0), elevationScale(1.0), patchResolution(1) {
+	assert(pixelTolerance > 0.0);
+}
+
+void ScreenSpaceErrorLodMetric::update(Planet* planet) {
+	int32 w, h; Application::getWindowSize(&w, &h);
+
+	// projection[1][1] is the cotangent of half the vertical field of view, so a length l at a distance d covers
+	// l * projection[1][1] / d in NDC, which is half the viewport height in pixels.
+	const dmat4 projection = SCENE_GRAPH.getCamera()->getProjectionMatrix();
+	this->projectionScale = projection[1][1] * h * 0.5;
+
+	this->elevationScale = planet->getElevationScale();
+	this->patchResolution = glm::max(planet->getTerrainRenderer()->getTerrainResolution(), 1);
+}
+
+double ScreenSpaceErrorLodMetric::getRelativeError(const TerrainQuad* terrainQuad, double distanceSq) const {
+	const double heightRange = (terrainQuad->getMaxHeight() - terrainQuad->getMinHeight()) * this->elevationScale;
+	const double geometricError = (heightRange + terrainQuad->getSize() * this->minRelativeError) / this->patchResolution;
+
+	const double screenError = geometricError * this->projectionScale / glm::max(sqrt(distanceSq), 1e-9);
+	return screenError / this->pixelTolerance;
+}
+
+double ScreenSpaceErrorLodMetric::getPixelTolerance() const {
+	return this->pixelTolerance;
+}
+
+void ScreenSpaceErrorLodMetric::setPixelTolerance(double pixelTolerance) {
+	assert(pixelTolerance > 0.0);
+	this->pixelTolerance = pixelTolerance;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "core/Core.h"
+
+class Planet;
+class TerrainQuad;
+
+/**
+ * Decides how finely the terrain of a planet is subdivided. Every update, each quad is given an error relative to the
+ * tolerated error. Leaves split while their error is greater than one, and quads merge once the error of their
+ * children has fallen far enough below one.
+ */
+class TerrainLodMetric {
+public:
+	virtual ~TerrainLodMetric();
+
+	/**
+	 * Called once per update, before any quad is evaluated, to cache values that only depend on the view.
+	 */
+	virtual void update(Planet* planet);
+
+	/**
+	 * The error of drawing the quad at its own level of detail, relative to the tolerated error. distanceSq is the
+	 * squared distance in local planet space from the camera to the closest corner of the quad's deformed bounds.
+	 */
+	virtual double getRelativeError(const TerrainQuad* terrainQuad, double distanceSq) const = 0;
+};
+
+/**
+ * Splits quads closer to the camera than a fixed multiple of their size, regardless of the view or the terrain.
+ */
+class DistanceLodMetric : public TerrainLodMetric {
+private:
+	double distanceFactor; // Quads split within this many times their size from the camera.
+
+public:
+	DistanceLodMetric(double distanceFactor = 0.75);
+
+	virtual double getRelativeError(const TerrainQuad* terrainQuad, double distanceSq) const override;
+};
+
+/**
+ * Splits quads where the geometric error of their patch, projected onto the screen, is larger than a number of pixels.
+ * The geometric error is estimated from the height range of the quad's tile spread over the cells of the patch, so
+ * flat terrain such as the ocean stays coarse while rough terrain is refined. A small error proportional to the quad
+ * size is always added, so that the surface detail of flat tiles still increases towards the camera.
+ */
+class ScreenSpaceErrorLodMetric : public TerrainLodMetric {
+private:
+	double pixelTolerance; // The largest on-screen error, in pixels, that does not split a quad.
+	double minRelativeError; // The geometric error of a completely flat quad, relative to its size.
+
+	double projectionScale; // The number of pixels covered by one unit of length at a distance of one unit.
+	double elevationScale; // The planet's elevation scale, converting tile heights to local units.
+	int32 patchResolution; // The number of cells along the side of a terrain patch.
+
+public:
+	ScreenSpaceErrorLodMetric(double pixelTolerance, double minRelativeError = 0.025);
+
+	virtual void update(Planet* planet) override;
+
+	virtual double getRelativeError(const TerrainQuad* terrainQuad, double distanceSq) const override;
+
+	double getPixelTolerance() const;
+
+	void setPixelTolerance(double pixelTolerance);
+};
@@ -4,6 +4,10 @@
 #include "core/engine/renderer/Camera.h"
 #include "core/engine/terrain/Planet.h"
 #include "core/engine/terrain/TileSupplier.h"
+#include "core/engine/terrain/TerrainQuadPool.h"
+#include "core/engine/terrain/LinearQuadTree.h"
+#include "core/engine/terrain/TerrainLodMetric.h"
+#include "core/engine/terrain/TerrainRenderer.h"
 #include "core/engine/scene/bounding/BoundingVolume.h"
 #include "core/util/Time.h"
 
@@ -12,10 +16,10 @@ TerrainQuad::TerrainQuad(Planet* planet, CubeFace face, TerrainQuad* parent, Qua
 	face(face),
 	parent(parent),
 	children(NULL),
-	neighbours(NULL),
+	neighbours{ NULL, NULL, NULL, NULL },
 	quadIndex(quadIndex),
-	faceBounds(),
-	deformedBounds(),
+	faceBounds(dvec3(0.0), dvec3(0.0)),
+	deformedBounds(dmat4(1.0)),
 	worldNormals(0.0),
 	faceTransformation(1.0),
 	facePosition(facePosition),
@@ -24,10 +28,13 @@ TerrainQuad::TerrainQuad(Planet* planet, CubeFace face, TerrainQuad* parent, Qua
 	minHeight(minHeight),
 	maxHeight(maxHeight),
 	occluded(occluded),
-	changed(true) {
+	changed(true),
+	mergeTime(0.0),
+	leafSlot(-1) {
 	this->size = parent->size * 0.5;
 	this->depth = parent->depth + 1;
 	this->init();
+	this->planet->linearQuadTree->insert(this);
 }
 
 TerrainQuad::TerrainQuad(Planet* planet, CubeFace face):
@@ -35,10 +42,10 @@ TerrainQuad::TerrainQuad(Planet* planet, CubeFace face):
 	face(face),
 	parent(NULL),
 	children(NULL),
-	neighbours(NULL),
+	neighbours{ NULL, NULL, NULL, NULL },
 	quadIndex(),
-	faceBounds(),
-	deformedBounds(),
+	faceBounds(dvec3(0.0), dvec3(0.0)),
+	deformedBounds(dmat4(1.0)),
 	worldNormals(0.0),
 	faceTransformation(1.0),
 	facePosition(0.0F, 0.0F),
@@ -49,8 +56,11 @@ TerrainQuad::TerrainQuad(Planet* planet, CubeFace face):
 	size(planet->getDiameter()),
 	depth(0),
 	occluded(false),
-	changed(true) {
+	changed(true),
+	mergeTime(0.0),
+	leafSlot(-1) {
 	this->init();
+	this->planet->linearQuadTree->insert(this);
 }
 
 TerrainQuad::~TerrainQuad() {
@@ -59,8 +69,8 @@ TerrainQuad::~TerrainQuad() {
 	}
 
 	this->merge();
-	delete this->faceBounds;
-	delete this->deformedBounds;
+	this->planet->terrainRenderer->onLeafRemoved(this);
+	this->planet->linearQuadTree->remove(this);
 }
 
 void TerrainQuad::setNeighbours(TerrainQuad* left, TerrainQuad* top, TerrainQuad* right, TerrainQuad* bottom) {
@@ -91,13 +101,7 @@ void TerrainQuad::init() {
 	const double ymin = this->facePosition.y - this->size * 0.5;
 	const double ymax = this->facePosition.y + this->size * 0.5;
 
-	this->neighbours = new TerrainQuad*[4]{ NULL, NULL, NULL, NULL };
-
-	if (this->faceBounds == NULL) {
-		this->faceBounds = new AxisAlignedBB(dvec3(xmin, 0.0, ymin), dvec3(xmax, 0.0, ymax));
-	} else {
-		this->faceBounds->setMinMax(dvec3(xmin, 0.0, ymin), dvec3(xmax, 0.0, ymax));
-	}
+	this->faceBounds.setMinMax(dvec3(xmin, 0.0, ymin), dvec3(xmax, 0.0, ymax));
 
 	double hmin = this->minHeight;
 	double hmax = glm::max(0.0, this->maxHeight);
@@ -112,19 +116,26 @@ void TerrainQuad::init() {
 	const dvec3 rbf = this->planet->cubeFaceToLocalPoint(this->face, dvec3(xmax, this->planet->elevationScale * hmax + d, ymax));
 	const dvec3 lbf = this->planet->cubeFaceToLocalPoint(this->face, dvec3(xmin, this->planet->elevationScale * hmax + d, ymax));
 
-	if (this->deformedBounds == NULL) {
-		this->deformedBounds = new Frustum(ltn, rtn, rbn, lbn, ltf, rtf, rbf, lbf);
-	} else {
-		this->deformedBounds->set(ltn, rtn, rbn, lbn, ltf, rtf, rbf, lbf);
-	}
+	this->deformedBounds.set(ltn, rtn, rbn, lbn, ltf, rtf, rbf, lbf);
 
 	const dvec2 p = this->getFacePosition();
 	const double r = this->planet->getRadius();
 
 	this->faceTransformation = this->planet->getFaceTransformation(this->face);
-	this->localPosition = this->deformedBounds->getCenter();// this->planet->cubeFaceToLocalPoint(this->face, dvec3(this->facePosition.x, 0.0, this->facePosition.y));
+	this->localPosition = this->deformedBounds.getCenter();// this->planet->cubeFaceToLocalPoint(this->face, dvec3(this->facePosition.x, 0.0, this->facePosition.y));
 
-	const double is = 0.5 * this->getSize();// *1.02;
+	this->distortion = dvec2(1.0);
+	this->worldNormals = this->getSphereNormals(p, this->getSize());
+	this->worldCorners = this->worldNormals * r;
+	this->worldCorners[0][3] = 1.0;
+	this->worldCorners[1][3] = 1.0;
+	this->worldCorners[2][3] = 1.0;
+	this->worldCorners[3][3] = 1.0;
+}
+
+dmat4 TerrainQuad::getSphereNormals(dvec2 facePosition, double size) const {
+	const dvec2 p = facePosition;
+	const double is = 0.5 * size;// *1.02;
 
 	dvec3 n0, n1, n2, n3;
 
@@ -133,14 +144,7 @@ void TerrainQuad::init() {
 	n2 = normalize(dvec3(this->faceTransformation * dvec4(p.x + is, 0.0, p.y + is, 1.0)));
 	n3 = normalize(dvec3(this->faceTransformation * dvec4(p.x - is, 0.0, p.y + is, 1.0)));
 
-	dvec3 c0 = n0 * this->planet->getRadius();
-	dvec3 c1 = n1 * this->planet->getRadius();
-	dvec3 c2 = n2 * this->planet->getRadius();
-	dvec3 c3 = n3 * this->planet->getRadius();
-
-	this->distortion = dvec2(1.0);
-	this->worldNormals = dmat4(dvec4(n0, 0.0), dvec4(n1, 0.0), dvec4(n2, 0.0), dvec4(n3, 0.0));
-	this->worldCorners = dmat4(dvec4(c0, 1.0), dvec4(c1, 1.0), dvec4(c2, 1.0), dvec4(c3, 1.0));
+	return dmat4(dvec4(n0, 0.0), dvec4(n1, 0.0), dvec4(n2, 0.0), dvec4(n3, 0.0));
 }
 
 void TerrainQuad::update(double dt) {
@@ -149,14 +153,16 @@ void TerrainQuad::update(double dt) {
 	double distanceSq = INFINITY;
 
 	for (int i = 0; i < 8; i++) {
-		distanceSq = glm::min(distanceSq, glm::distance2(this->deformedBounds->getCorner((FrustumCorner)i), cameraPosition));
+		distanceSq = glm::min(distanceSq, glm::distance2(this->deformedBounds.getCorner((FrustumCorner)i), cameraPosition));
 	}
 
 	double dynamicFactorMin = 0.1;
 	double dynamicFactorMax = 0.3;
 	double dynamicFactor = 0.5;// ((Planet::maxScaleFactor - Planet::scaleFactor) / (Planet::maxScaleFactor - Planet::minScaleFactor));
 
-	double threshold = (this->size * 3.0) * 0.25;
+	// Quads split when their error exceeds the tolerance, but only merge once it has fallen well below it, so moving
+	// along the boundary doesn't split and merge the same quads back and forth.
+	const double error = this->planet->lodMetric->getRelativeError(this, distanceSq);
 
 	if (this->face == this->planet->closestCameraFace) {
 		if (distanceSq < this->planet->closestCameraDistance) {
@@ -170,33 +176,45 @@ void TerrainQuad::update(double dt) {
 	}
 
 	this->changed = false;
-	if (distanceSq < threshold * threshold) {
-		this->split();
+	if (error > 1.0) {
+		this->cancelMerge();
+
+		if (this->children == NULL && this->depth < this->planet->getMaxSplitDepth()) {
+			this->planet->requestSplit(this, 1.0 / error); // Largest error first.
+		}
+	} else if (error * this->planet->mergeHysteresis < 1.0 && this->children != NULL) {
+		this->mergeTime += dt;
+
+		if (this->mergeTime >= this->planet->mergeDelay && (this->canMerge() || this->mergeTime >= this->planet->maxMergeDelay)) {
+			this->merge();
+		}
 	} else {
-		this->merge();
+		this->cancelMerge();
 	}
 
 	if (this->children != NULL) {
 		QuadIndex order[4];
 
 		this->getNearFarOrdering(this->planet->getFaceCameraPosition(), order);
-		this->children[order[0]]->update(dt);
-		this->children[order[1]]->update(dt);
-		this->children[order[2]]->update(dt);
-		this->children[order[3]]->update(dt);
-
-		this->changed |= this->children[TOP_LEFT]->changed;
-		this->changed |= this->children[TOP_RIGHT]->changed;
-		this->changed |= this->children[BOTTOM_LEFT]->changed;
-		this->changed |= this->children[BOTTOM_RIGHT]->changed;
+		this->children[order[0]].update(dt);
+		this->children[order[1]].update(dt);
+		this->children[order[2]].update(dt);
+		this->children[order[3]].update(dt);
+
+		this->changed |= this->children[TOP_LEFT].changed;
+		this->changed |= this->children[TOP_RIGHT].changed;
+		this->changed |= this->children[BOTTOM_LEFT].changed;
+		this->changed |= this->children[BOTTOM_RIGHT].changed;
 	}
 
-	if (this->tileData != NULL) {
+	if (this->tileData != NULL && this->tileData->isGenerated() && !this->tileData->isAwaitingHeightRange()) {
 		// If the maximum or minimum height of the tile data does not match the current saved values, reinitialize the bounds.
 		if (glm::max(abs(this->tileData->getMaxHeight() - this->maxHeight), abs(this->tileData->getMinHeight() - this->minHeight)) > 1e-12) {
 			this->maxHeight = tileData->getMaxHeight();
 			this->minHeight = tileData->getMinHeight();
 			this->init();
+			this->changed = true; // The bounds changed, so any render data cached from them is stale.
+			this->planet->terrainRenderer->onLeafChanged(this);
 		}
 	}
 
@@ -210,25 +228,47 @@ void TerrainQuad::update(double dt) {
 
 bool TerrainQuad::split() {
 	if (this->depth < this->planet->getMaxSplitDepth() && this->children == NULL) {
+		// Start the children with the height range of their quarter of this tile, from its height grid, so their bounds
+		// are tight before their own tiles are generated. Texture coordinates are flipped relative to the face position.
+		dvec2 childHeights[4];
+		for (int i = 0; i < 4; i++) {
+			childHeights[i] = dvec2(this->minHeight, this->maxHeight);
+		}
+
+		if (this->tileData != NULL && this->tileData->isGenerated() && !this->tileData->isAwaitingHeightRange()) {
+			childHeights[TOP_LEFT] = this->tileData->getHeightRange(dvec2(0.5, 0.5), dvec2(0.5));
+			childHeights[TOP_RIGHT] = this->tileData->getHeightRange(dvec2(0.0, 0.5), dvec2(0.5));
+			childHeights[BOTTOM_LEFT] = this->tileData->getHeightRange(dvec2(0.5, 0.0), dvec2(0.5));
+			childHeights[BOTTOM_RIGHT] = this->tileData->getHeightRange(dvec2(0.0, 0.0), dvec2(0.5));
+		}
 		
 		if (this->tileData != NULL && !this->planet->tileSupplier->putTileData(&this->tileData)) {
 			logError("Failed to release reference to tile data when quad was subdivided");
 		}
 
-		this->children = new TerrainQuad*[4];
+		// The four children are constructed in one pooled block, rather than allocated separately.
+		TerrainQuad* children = this->planet->quadPool->allocate();
 		double h = this->size * 0.25;
 		uvec3 p = this->getTreePosition();
 
-		this->children[TOP_LEFT] = new TerrainQuad(this->planet, this->face, this, TOP_LEFT, this->facePosition + dvec2(-h, -h), (uint32(2) * this->treePosition) + uvec2(0, 0), this->minHeight, this->maxHeight, this->occluded);
-		this->children[TOP_RIGHT] = new TerrainQuad(this->planet, this->face, this, TOP_RIGHT, this->facePosition + dvec2(+h, -h), (uint32(2) * this->treePosition) + uvec2(1, 0), this->minHeight, this->maxHeight, this->occluded);
-		this->children[BOTTOM_LEFT] = new TerrainQuad(this->planet, this->face, this, BOTTOM_LEFT, this->facePosition + dvec2(-h, +h), (uint32(2) * this->treePosition) + uvec2(0, 1), this->minHeight, this->maxHeight, this->occluded);
-		this->children[BOTTOM_RIGHT] = new TerrainQuad(this->planet, this->face, this, BOTTOM_RIGHT, this->facePosition + dvec2(+h, +h), (uint32(2) * this->treePosition) + uvec2(1, 1), this->minHeight, this->maxHeight, this->occluded);
+		new (&children[TOP_LEFT]) TerrainQuad(this->planet, this->face, this, TOP_LEFT, this->facePosition + dvec2(-h, -h), (uint32(2) * this->treePosition) + uvec2(0, 0), childHeights[TOP_LEFT].x, childHeights[TOP_LEFT].y, this->occluded);
+		new (&children[TOP_RIGHT]) TerrainQuad(this->planet, this->face, this, TOP_RIGHT, this->facePosition + dvec2(+h, -h), (uint32(2) * this->treePosition) + uvec2(1, 0), childHeights[TOP_RIGHT].x, childHeights[TOP_RIGHT].y, this->occluded);
+		new (&children[BOTTOM_LEFT]) TerrainQuad(this->planet, this->face, this, BOTTOM_LEFT, this->facePosition + dvec2(-h, +h), (uint32(2) * this->treePosition) + uvec2(0, 1), childHeights[BOTTOM_LEFT].x, childHeights[BOTTOM_LEFT].y, this->occluded);
+		new (&children[BOTTOM_RIGHT]) TerrainQuad(this->planet, this->face, this, BOTTOM_RIGHT, this->facePosition + dvec2(+h, +h), (uint32(2) * this->treePosition) + uvec2(1, 1), childHeights[BOTTOM_RIGHT].x, childHeights[BOTTOM_RIGHT].y, this->occluded);
+
+		this->children = children;
 
 		this->notifyNeighbours();
-		this->children[TOP_LEFT]->updateNeighbours();
-		this->children[TOP_RIGHT]->updateNeighbours();
-		this->children[BOTTOM_LEFT]->updateNeighbours();
-		this->children[BOTTOM_RIGHT]->updateNeighbours();
+		this->children[TOP_LEFT].updateNeighbours();
+		this->children[TOP_RIGHT].updateNeighbours();
+		this->children[BOTTOM_LEFT].updateNeighbours();
+		this->children[BOTTOM_RIGHT].updateNeighbours();
+
+		this->planet->terrainRenderer->onLeafRemoved(this);
+		this->planet->terrainRenderer->onLeafAdded(&this->children[TOP_LEFT]);
+		this->planet->terrainRenderer->onLeafAdded(&this->children[TOP_RIGHT]);
+		this->planet->terrainRenderer->onLeafAdded(&this->children[BOTTOM_LEFT]);
+		this->planet->terrainRenderer->onLeafAdded(&this->children[BOTTOM_RIGHT]);
 
 		this->changed = true;
 
@@ -237,291 +277,130 @@ bool TerrainQuad::split() {
 	return false;
 }
 
-void TerrainQuad::merge() {
-	if (this->children != NULL) {
-		this->children[TOP_LEFT]->merge();
-		this->children[TOP_RIGHT]->merge();
-		this->children[BOTTOM_LEFT]->merge();
-		this->children[BOTTOM_RIGHT]->merge();
-
-		delete this->children[TOP_LEFT];
-		delete this->children[TOP_RIGHT];
-		delete this->children[BOTTOM_LEFT];
-		delete this->children[BOTTOM_RIGHT];
-		delete[] this->children;
-		this->children = NULL;
+bool TerrainQuad::canMerge() {
+	// The tile is requested ahead of the merge, so that it is generated while the children are still drawn. The
+	// supplier may have no tile to give, in which case this waits for the maximum merge delay.
+	if (this->tileData == NULL) {
+		this->planet->tileSupplier->getTileData(this, &this->tileData);
+	}
 
-		this->notifyNeighbours();
+	if (this->tileData != NULL) {
+		this->tileData->onUsed();
+	}
 
-		this->changed = true;
+	// This quad must be drawable in place of its children, otherwise merging would fall back to an even coarser tile.
+	if (!this->isRenderable()) {
+		return false;
 	}
-}
 
-void TerrainQuad::updateNeighbours() {
-	static const QuadIndex faceRotations[6][4][4] = {
-		{
-			{ TOP_LEFT, TOP_RIGHT, BOTTOM_LEFT, BOTTOM_RIGHT }, // [X_NEG][LEFT]
-			{ TOP_RIGHT, BOTTOM_RIGHT, TOP_LEFT, BOTTOM_LEFT }, // [X_NEG][TOP]
-			{ TOP_LEFT, TOP_RIGHT, BOTTOM_LEFT, BOTTOM_RIGHT }, // [X_NEG][RIGHT]
-			{ BOTTOM_LEFT, TOP_LEFT, BOTTOM_RIGHT, TOP_RIGHT }, // [X_NEG][BOTTOM]
-		}, {
-			{ TOP_LEFT, TOP_RIGHT, BOTTOM_LEFT, BOTTOM_RIGHT }, // [X_POS][LEFT]
-			{ TOP_LEFT, BOTTOM_LEFT, BOTTOM_RIGHT, TOP_RIGHT }, // [X_POS][TOP]
-			{ TOP_LEFT, TOP_RIGHT, BOTTOM_LEFT, BOTTOM_RIGHT }, // [X_POS][RIGHT]
-			{ TOP_RIGHT, BOTTOM_RIGHT, BOTTOM_LEFT, TOP_LEFT }, // [X_POS][BOTTOM]
-		}, {
-			{ TOP_RIGHT, BOTTOM_RIGHT, TOP_LEFT, BOTTOM_LEFT }, // [Y_NEG][LEFT]
-			{ TOP_LEFT, TOP_RIGHT, BOTTOM_LEFT, BOTTOM_RIGHT }, // [Y_NEG][TOP]
-			{ BOTTOM_LEFT, TOP_LEFT, BOTTOM_RIGHT, TOP_RIGHT }, // [Y_NEG][RIGHT]
-			{ BOTTOM_RIGHT, BOTTOM_LEFT, TOP_RIGHT, TOP_LEFT }, // [Y_NEG][BOTTOM]
-		}, {
-			{ BOTTOM_LEFT, TOP_LEFT, BOTTOM_RIGHT, TOP_RIGHT }, // [Y_POS][LEFT]
-			{ BOTTOM_RIGHT, BOTTOM_LEFT, TOP_RIGHT, TOP_LEFT }, // [Y_POS][TOP]
-			{ TOP_RIGHT, BOTTOM_RIGHT, TOP_LEFT, BOTTOM_LEFT }, // [Y_POS][RIGHT]
-			{ TOP_LEFT, TOP_RIGHT, BOTTOM_LEFT, BOTTOM_RIGHT }, // [Y_POS][BOTTOM]
-		}, {
-			{ TOP_LEFT, TOP_RIGHT, BOTTOM_LEFT, BOTTOM_RIGHT }, // [Z_NEG][LEFT]
-			{ BOTTOM_RIGHT, BOTTOM_LEFT, TOP_RIGHT, TOP_LEFT }, // [Z_NEG][TOP]
-			{ TOP_LEFT, TOP_RIGHT, BOTTOM_LEFT, BOTTOM_RIGHT }, // [Z_NEG][RIGHT]
-			{ BOTTOM_RIGHT, BOTTOM_LEFT, TOP_RIGHT, TOP_LEFT }, // [Z_NEG][BOTTOM]
-		}, {
-			{ TOP_LEFT, TOP_RIGHT, BOTTOM_LEFT, BOTTOM_RIGHT }, // [Z_POS][LEFT]
-			{ TOP_LEFT, TOP_RIGHT, BOTTOM_LEFT, BOTTOM_RIGHT }, // [Z_POS][TOP]
-			{ TOP_LEFT, TOP_RIGHT, BOTTOM_LEFT, BOTTOM_RIGHT }, // [Z_POS][RIGHT]
-			{ TOP_LEFT, TOP_RIGHT, BOTTOM_LEFT, BOTTOM_RIGHT }, // [Z_POS][BOTTOM]
-		},
-	};
-
-	struct Neighbour {
-		TerrainQuad* terrainQuad;
-		QuadIndex rotation[4];
-
-		Neighbour(TerrainQuad* terrainQuad, int face = -1, int dir = -1) :
-			terrainQuad(terrainQuad) {
-
-			if (face == -1 || dir == -1) {
-				this->rotation[0] = TOP_LEFT;
-				this->rotation[1] = TOP_RIGHT;
-				this->rotation[2] = BOTTOM_LEFT;
-				this->rotation[3] = BOTTOM_RIGHT;
-			}
-			else {
-				this->rotation[0] = faceRotations[face][dir][0];
-				this->rotation[1] = faceRotations[face][dir][1];
-				this->rotation[2] = faceRotations[face][dir][2];
-				this->rotation[3] = faceRotations[face][dir][3];
-			}
-		}
+	return this->isSubtreeIdle();
+}
 
-		TerrainQuad* getTerrainQuad(int treeDepth) {
-			//TerrainQuad* quad = this->terrainQuad;
-			//
-			//if (quad != NULL) {
-			//	while (quad->getParent() != NULL && quad->getDepth() > treeDepth + 1) {
-			//		quad = quad->getParent();
-			//	}
-			//}
-			//
-			//return quad;
-			return this->terrainQuad;
-		}
+void TerrainQuad::cancelMerge() {
+	this->mergeTime = 0.0;
 
-		static Neighbour getNeighbour(TerrainQuad* quad, NeighbourIndex index) {
-			TerrainQuad* parent = quad->getParent();
-			CubeFace face = quad->getCubeFace();
-			Planet* planet = quad->getPlanet();
-
-			if (parent == NULL) {
-				if (face == X_NEG) {
-					TerrainQuad* cubeNeighbour = NULL;
-					if (index == LEFT) cubeNeighbour = planet->getCubeFace(Z_NEG);
-					else if (index == TOP) cubeNeighbour = planet->getCubeFace(Y_POS);
-					else if (index == RIGHT) cubeNeighbour = planet->getCubeFace(Z_POS);
-					else if (index == BOTTOM) cubeNeighbour = planet->getCubeFace(Y_NEG);
-					return Neighbour(cubeNeighbour, X_NEG, index);
-				}
-				else if (face == X_POS) {
-					TerrainQuad* cubeNeighbour = NULL;
-					if (index == LEFT) cubeNeighbour = planet->getCubeFace(Z_POS);
-					else if (index == TOP) cubeNeighbour = planet->getCubeFace(Y_POS);
-					else if (index == RIGHT) cubeNeighbour = planet->getCubeFace(Z_NEG);
-					else if (index == BOTTOM) cubeNeighbour = planet->getCubeFace(Y_NEG);
-					return Neighbour(cubeNeighbour, X_POS, index);
-				}
-				else if (face == Y_NEG) {
-					TerrainQuad* cubeNeighbour = NULL;
-					if (index == LEFT) cubeNeighbour = planet->getCubeFace(X_NEG);
-					else if (index == TOP) cubeNeighbour = planet->getCubeFace(Z_POS);
-					else if (index == RIGHT) cubeNeighbour = planet->getCubeFace(X_POS);
-					else if (index == BOTTOM) cubeNeighbour = planet->getCubeFace(Z_NEG);
-					return Neighbour(cubeNeighbour, Y_NEG, index);
-				}
-				else if (face == Y_POS) {
-					TerrainQuad* cubeNeighbour = NULL;
-					if (index == LEFT) cubeNeighbour = planet->getCubeFace(X_NEG);
-					else if (index == TOP) cubeNeighbour = planet->getCubeFace(Z_NEG);
-					else if (index == RIGHT) cubeNeighbour = planet->getCubeFace(X_POS);
-					else if (index == BOTTOM) cubeNeighbour = planet->getCubeFace(Z_POS);
-					return Neighbour(cubeNeighbour, Y_POS, index);
-				}
-				else if (face == Z_NEG) {
-					TerrainQuad* cubeNeighbour = NULL;
-					if (index == LEFT) cubeNeighbour = planet->getCubeFace(X_POS);
-					else if (index == TOP) cubeNeighbour = planet->getCubeFace(Y_POS);
-					else if (index == RIGHT) cubeNeighbour = planet->getCubeFace(X_NEG);
-					else if (index == BOTTOM) cubeNeighbour = planet->getCubeFace(Y_NEG);
-					return Neighbour(cubeNeighbour, Z_NEG, index);
-				}
-				else if (face == Z_POS) {
-					TerrainQuad* cubeNeighbour = NULL;
-					if (index == LEFT) cubeNeighbour = planet->getCubeFace(X_NEG);
-					else if (index == TOP) cubeNeighbour = planet->getCubeFace(Y_POS);
-					else if (index == RIGHT) cubeNeighbour = planet->getCubeFace(X_POS);
-					else if (index == BOTTOM) cubeNeighbour = planet->getCubeFace(Y_NEG);
-					return Neighbour(cubeNeighbour, Z_POS, index);
-				}
-
-				return Neighbour(NULL); // invalid
-			}
+	// Only a tile requested by canMerge is held while this quad has children. Keeping it would take it from the leaves.
+	if (this->children != NULL && this->tileData != NULL && !this->planet->tileSupplier->putTileData(&this->tileData)) {
+		logError("Failed to release reference to tile data when quad merge was cancelled");
+	}
+}
 
-			QuadIndex qi = quad->getQuadIndex();
+bool TerrainQuad::isSubtreeIdle() const {
+	if (this->children == NULL) {
+		return true;
+	}
 
-			if (index == LEFT) {
-				// If the requested neighbour is within the same parent as this node...
-				if (qi == TOP_RIGHT) return Neighbour(parent->getChild(TOP_LEFT));
-				if (qi == BOTTOM_RIGHT) return Neighbour(parent->getChild(BOTTOM_LEFT));
+	for (int i = 0; i < 4; i++) {
+		const TerrainQuad& child = this->children[i];
 
-				// Else, the requested neighbour is outside this parent node, traverse up the tree.
-				Neighbour node = Neighbour::getNeighbour(parent, LEFT);
-				// If the parents neighbour is a leaf node, it is also the neighbour of this node.
-				if (node.terrainQuad == NULL || node.terrainQuad->isLeaf()) {
-					return node;
-				}
+		if (child.tileData != NULL && (!child.tileData->isGenerated() || child.tileData->isAwaitingHeightRange())) {
+			return false; // Still being generated, the work would be discarded.
+		}
 
-				// Move back down the tree to the appropriate neighbour. TODO: traverse back down to the same level as the original node?
-				if (qi == TOP_LEFT) node.terrainQuad = node.terrainQuad->getChild(node.rotation[TOP_RIGHT]);
-				if (qi == BOTTOM_LEFT) node.terrainQuad = node.terrainQuad->getChild(node.rotation[BOTTOM_RIGHT]);
-				return node;
-			}
-			else if (index == RIGHT) {
-				if (qi == TOP_LEFT) return Neighbour(parent->getChild(TOP_RIGHT));
-				if (qi == BOTTOM_LEFT) return Neighbour(parent->getChild(BOTTOM_RIGHT));
-
-				Neighbour node = Neighbour::getNeighbour(parent, RIGHT);
-				if (node.terrainQuad == NULL || node.terrainQuad->isLeaf()) {
-					return node;
-				}
-
-				if (qi == TOP_RIGHT) node.terrainQuad = node.terrainQuad->getChild(node.rotation[TOP_LEFT]);
-				if (qi == BOTTOM_RIGHT) node.terrainQuad = node.terrainQuad->getChild(node.rotation[BOTTOM_LEFT]);
-				return node;
-			}
-			else if (index == BOTTOM) {
-				if (qi == TOP_LEFT) return Neighbour(parent->getChild(BOTTOM_LEFT));
-				if (qi == TOP_RIGHT) return Neighbour(parent->getChild(BOTTOM_RIGHT));
-
-				Neighbour node = Neighbour::getNeighbour(parent, BOTTOM);
-				if (node.terrainQuad == NULL || node.terrainQuad->isLeaf()) {
-					return node;
-				}
-
-				if (qi == BOTTOM_LEFT) node.terrainQuad = node.terrainQuad->getChild(node.rotation[TOP_LEFT]);
-				if (qi == BOTTOM_RIGHT) node.terrainQuad = node.terrainQuad->getChild(node.rotation[TOP_RIGHT]);
-				return node;
-			}
-			else if (index == TOP) {
-				if (qi == BOTTOM_LEFT) return Neighbour(parent->getChild(TOP_LEFT));
-				if (qi == BOTTOM_RIGHT) return Neighbour(parent->getChild(TOP_RIGHT));
-
-				Neighbour node = Neighbour::getNeighbour(parent, TOP);
-				if (node.terrainQuad == NULL || node.terrainQuad->isLeaf()) {
-					return node;
-				}
-
-				if (qi == TOP_LEFT) node.terrainQuad = node.terrainQuad->getChild(node.rotation[BOTTOM_LEFT]);
-				if (qi == TOP_RIGHT) node.terrainQuad = node.terrainQuad->getChild(node.rotation[BOTTOM_RIGHT]);
-				return node;
-			}
-			else {
-				return Neighbour(NULL); // invalid
-			}
+		if (!child.isSubtreeIdle()) {
+			return false;
 		}
-	};
+	}
 
-	constexpr int top_left = 0;
-	constexpr int top_right = 1;
-	constexpr int bottom_left = 3;
-	constexpr int bottom_right = 2;
+	return true;
+}
 
-	TerrainQuad* left = Neighbour::getNeighbour(this, LEFT).getTerrainQuad(this->depth);
-	this->neighbours[LEFT] = left;
-	if (left != NULL) left->neighbours[RIGHT] = this;
+void TerrainQuad::merge() {
+	if (this->children != NULL) {
+		this->children[TOP_LEFT].merge();
+		this->children[TOP_RIGHT].merge();
+		this->children[BOTTOM_LEFT].merge();
+		this->children[BOTTOM_RIGHT].merge();
+
+		this->children[TOP_LEFT].~TerrainQuad();
+		this->children[TOP_RIGHT].~TerrainQuad();
+		this->children[BOTTOM_LEFT].~TerrainQuad();
+		this->children[BOTTOM_RIGHT].~TerrainQuad();
+		this->planet->quadPool->release(this->children);
+		this->children = NULL;
+		this->mergeTime = 0.0;
 
-	TerrainQuad* right = Neighbour::getNeighbour(this, RIGHT).getTerrainQuad(this->depth);
-	this->neighbours[RIGHT] = right;
-	if (right != NULL) right->neighbours[LEFT] = this;
+		this->planet->terrainRenderer->onLeafAdded(this);
+		this->notifyNeighbours();
 
-	TerrainQuad* bottom = Neighbour::getNeighbour(this, BOTTOM).getTerrainQuad(this->depth);
-	this->neighbours[BOTTOM] = bottom;
-	if (bottom != NULL) bottom->neighbours[TOP] = this;
+		this->changed = true;
+	}
+}
 
-	TerrainQuad* top = Neighbour::getNeighbour(this, TOP).getTerrainQuad(this->depth);
-	this->neighbours[TOP] = top;
-	if (top != NULL) top->neighbours[BOTTOM] = this;
+void TerrainQuad::updateNeighbours() {
+	const LinearQuadTree* linearQuadTree = this->planet->linearQuadTree;
+
+	for (int i = 0; i < 4; i++) {
+		const NeighbourIndex direction = (NeighbourIndex)i;
+		TerrainQuad* neighbour = linearQuadTree->findNeighbour(this, direction);
+		this->neighbours[direction] = neighbour;
+
+		// A coarser neighbour borders other quads along the same edge, so it keeps its own link. Across a cube edge,
+		// the neighbour's edge facing this quad is not the opposite one.
+		if (neighbour != NULL && neighbour->depth == this->depth) {
+			neighbour->neighbours[linearQuadTree->getReverseEdge(this, neighbour, direction)] = this;
+			this->planet->terrainRenderer->onLeafChanged(neighbour);
+		}
+	}
+
+	this->planet->terrainRenderer->onLeafChanged(this);
 }
 
 void TerrainQuad::deleteNeighbours() {
-	constexpr bool allowInternal = true;
-	if (this->neighbours != NULL) {
-		if (allowInternal || (this->quadIndex == TOP_LEFT || this->quadIndex == BOTTOM_LEFT)) {
-			if (this->neighbours[LEFT] != NULL && this->neighbours[LEFT]->neighbours != NULL) {
-				this->neighbours[LEFT]->neighbours[RIGHT] = NULL;
-				this->neighbours[LEFT]->neighbourChanged = true;
-			}
-		}
+	const LinearQuadTree* linearQuadTree = this->planet->linearQuadTree;
 
-		if (allowInternal || (this->quadIndex == TOP_LEFT || this->quadIndex == TOP_RIGHT)) {
-			if (this->neighbours[TOP] != NULL && this->neighbours[TOP]->neighbours != NULL) {
-				this->neighbours[TOP]->neighbours[BOTTOM] = NULL;
-				this->neighbours[TOP]->neighbourChanged = true;
-			}
-		}
+	for (int i = 0; i < 4; i++) {
+		const NeighbourIndex direction = (NeighbourIndex)i;
+		TerrainQuad* neighbour = this->neighbours[direction];
 
-		if (allowInternal || (this->quadIndex == TOP_RIGHT || this->quadIndex == BOTTOM_RIGHT)) {
-			if (this->neighbours[RIGHT] != NULL && this->neighbours[RIGHT]->neighbours != NULL) {
-				this->neighbours[RIGHT]->neighbours[LEFT] = NULL;
-				this->neighbours[RIGHT]->neighbourChanged = true;
-			}
-		}
+		if (neighbour != NULL) {
+			const NeighbourIndex reverse = linearQuadTree->getReverseEdge(this, neighbour, direction);
 
-		if (allowInternal || (this->quadIndex == BOTTOM_LEFT || this->quadIndex == BOTTOM_RIGHT)) {
-			if (this->neighbours[BOTTOM] != NULL && this->neighbours[BOTTOM]->neighbours != NULL) {
-				this->neighbours[BOTTOM]->neighbours[TOP] = NULL;
-				this->neighbours[BOTTOM]->neighbourChanged = true;
+			if (neighbour->neighbours[reverse] == this) {
+				neighbour->neighbours[reverse] = NULL;
+				neighbour->neighbourChanged = true;
+				this->planet->terrainRenderer->onLeafChanged(neighbour);
 			}
 		}
 
-		//delete[] this->neighbours;
-		this->neighbours = NULL;
+		this->neighbours[direction] = NULL;
 	}
 }
 
 void TerrainQuad::notifyNeighbours() {
-	if (this->neighbours != NULL) {
-		this->updateNeighbours();
+	this->updateNeighbours();
 
-		if (this->neighbours[LEFT] != NULL) {
-			this->neighbours[LEFT]->updateNeighbours();
-		}
-		if (this->neighbours[TOP] != NULL) {
-			this->neighbours[TOP]->updateNeighbours();
-		}
-		if (this->neighbours[RIGHT] != NULL) {
-			this->neighbours[RIGHT]->updateNeighbours();
-		}
-		if (this->neighbours[BOTTOM] != NULL) {
-			this->neighbours[BOTTOM]->updateNeighbours();
-		}
+	if (this->neighbours[LEFT] != NULL) {
+		this->neighbours[LEFT]->updateNeighbours();
+	}
+	if (this->neighbours[TOP] != NULL) {
+		this->neighbours[TOP]->updateNeighbours();
+	}
+	if (this->neighbours[RIGHT] != NULL) {
+		this->neighbours[RIGHT]->updateNeighbours();
+	}
+	if (this->neighbours[BOTTOM] != NULL) {
+		this->neighbours[BOTTOM]->updateNeighbours();
 	}
 }
 
@@ -537,15 +416,15 @@ bool TerrainQuad::isRenderLeaf() {
 }
 
 bool TerrainQuad::isRenderable() {
-	return this->getTileData() != NULL && this->tileData->isGenerated() && !this->tileData->isAwaitingReadback();
+	return this->tileData != NULL && this->tileData->isGenerated() && !this->tileData->isAwaitingHeightRange();
 }
 
-AxisAlignedBB TerrainQuad::getBoundingBox() const {
-	return *this->faceBounds;
+const AxisAlignedBB& TerrainQuad::getBoundingBox() const {
+	return this->faceBounds;
 }
 
-Frustum TerrainQuad::getDeformedBoundingBox() const {
-	return *this->deformedBounds;
+const Frustum& TerrainQuad::getDeformedBoundingBox() const {
+	return this->deformedBounds;
 }
 
 Planet* TerrainQuad::getPlanet() const {
@@ -562,18 +441,14 @@ TerrainQuad* TerrainQuad::getParent() const {
 
 TerrainQuad* TerrainQuad::getChild(QuadIndex index) const {
 	if (this->children != NULL) {
-		return this->children[index];
+		return &this->children[index];
 	}
 
 	return NULL;
 }
 
 TerrainQuad* TerrainQuad::getNeighbour(NeighbourIndex index) const {
-	if (this->neighbours != NULL) {
-		return this->neighbours[index];
-	}
-
-	return NULL;
+	return this->neighbours[index];
 }
 
 TerrainQuad* TerrainQuad::getTerrainQuadUnder(dvec2 facePoint) {
@@ -581,21 +456,8 @@ TerrainQuad* TerrainQuad::getTerrainQuadUnder(dvec2 facePoint) {
 		return this;
 	}
 
-	if (facePoint.x < this->facePosition.x) {
-		if (facePoint.y < this->facePosition.y) {
-			return this->getChild(TOP_LEFT)->getTerrainQuadUnder(facePoint);
-		} else {
-			return this->getChild(BOTTOM_LEFT)->getTerrainQuadUnder(facePoint);
-		}
-	} else {
-		if (facePoint.y < this->facePosition.y) {
-			return this->getChild(TOP_RIGHT)->getTerrainQuadUnder(facePoint);
-		} else {
-			return this->getChild(BOTTOM_RIGHT)->getTerrainQuadUnder(facePoint);
-		}
-	}
-
-	return NULL;
+	const dvec2 position = (facePoint - this->facePosition) / this->size + 0.5;
+	return this->planet->linearQuadTree->findDeepest(this, position);
 }
 
 QuadIndex TerrainQuad::getQuadIndex() const {
@@ -670,20 +532,34 @@ dvec3 TerrainQuad::getLocalPosition() const {
 	return this->localPosition;
 }
 
+void TerrainQuad::getChildTileInfo(QuadIndex index, uvec3* treePosition, dmat4* worldNormals) const {
+	// The same placement as the children created by split.
+	const uvec2 offset = uvec2(index & 1, index >> 1);
+	const double h = this->size * 0.25;
+	const dvec2 facePosition = this->facePosition + dvec2(offset.x ? +h : -h, offset.y ? +h : -h);
+
+	const uvec3 p = this->getTreePosition(true);
+	*treePosition = uvec3(uvec2(p) * uint32(2) + offset, p.z + 1);
+	*worldNormals = this->getSphereNormals(facePosition, this->size * 0.5);
+}
+
 uvec3 TerrainQuad::getTreePosition(bool planetaryUnique) const {
-	return uvec3(this->treePosition, this->depth + (planetaryUnique ? this->face * this->planet->getMaxSplitDepth() : 0));
+	// Depths run from 0 to the max split depth inclusive, so each face needs one more level than the split depth.
+	return uvec3(this->treePosition, this->depth + (planetaryUnique ? this->face * (this->planet->getMaxSplitDepth() + 1) : 0));
 }
 
-TileData* TerrainQuad::getTileData(fvec2* tilePosition, fvec2* tileSize, bool useParent) {
-	TileData* tile = this->tileData;
+TileData* TerrainQuad::getTileData(fvec2* tilePosition, fvec2* tileSize, bool useParent, bool acquire) {
+	if (acquire) {
+		if (this->tileData == NULL) {
+			this->planet->tileSupplier->getTileData(this, &this->tileData);
+		}
 
-	if (this->tileData == NULL) {
-		this->planet->tileSupplier->getTileData(this, &this->tileData);
+		if (this->tileData != NULL) {
+			this->tileData->onUsed();
+		}
 	}
 
-	if (this->tileData != NULL) {
-		this->tileData->onUsed();
-	}
+	TileData* tile = this->tileData;
 
 	if (useParent) {
 		if ((this->tileData == NULL || !this->tileData->isGenerated()) && this->parent != NULL) {
@@ -715,26 +591,16 @@ double TerrainQuad::getSize() const {
 
 double TerrainQuad::getElevation(dvec2 position) {
 	if (position.x >= 0.0 && position.y >= 0.0 && position.x < 1.0 && position.y < 1.0) {
+		TerrainQuad* leaf = this;
+
 		if (this->children != NULL) {
-			if (position.x < 0.5) {
-				if (position.y < 0.5) {
-					return this->children[TOP_LEFT]->getElevation(position * 2.0 - dvec2(0.0, 0.0)); // top left
-				} else {
-					return this->children[BOTTOM_LEFT]->getElevation(position * 2.0 - dvec2(0.0, 1.0)); // bottom left
-				}
-			} else {
-				if (position.y < 0.5) { 
-					return this->children[TOP_RIGHT]->getElevation(position * 2.0 - dvec2(1.0, 0.0)); // top right
-				} else {
-					return this->children[BOTTOM_RIGHT]->getElevation(position * 2.0 - dvec2(1.0, 1.0)); // bottom right
-				}
-			}
-		} else {
-			TileData* tile = this->getTileData();
+			leaf = this->planet->linearQuadTree->findDeepest(this, position, &position);
+		}
 
-			if (tile != NULL) {
-				return tile->getInterpolatedTextureData(position).w;
-			}
+		TileData* tile = leaf->getTileData();
+
+		if (tile != NULL) {
+			return tile->getInterpolatedTextureData(position).w;
 		}
 	}
 	return 0.0;
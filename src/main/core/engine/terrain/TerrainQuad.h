@@ -1,9 +1,8 @@
 #pragma once
 
 #include "core/Core.h"
+#include "core/engine/scene/bounding/BoundingVolume.h"
 
-class AxisAlignedBB;
-class Frustum;
 class Planet;
 class TileData;
 enum CubeFace;
@@ -25,18 +24,18 @@ typedef enum NeighbourIndex {
 class TerrainQuad {
 private:
 	friend class Planet;
-
-	static const QuadIndex faceRotations[6][4][4];
+	friend class TerrainSnapshot;
+	friend class TerrainRenderer;
 
 	Planet* planet; // The planet that this terrain quad belongs to.
 	CubeFace face; // The face of the planet that this quad is on. planet->getCubeFace(face) should return the root quad for this node.
 	TerrainQuad* parent; // The parent of this terrain quad, or null if this is the root.
-	TerrainQuad** children; // The 4 child nodes of this quad.
-	TerrainQuad** neighbours; // The 4 neighbours of this quad.
+	TerrainQuad* children; // The 4 child nodes of this quad, contiguous in one block of the planet's quad pool. NULL if this is a leaf.
+	TerrainQuad* neighbours[4]; // The 4 neighbours of this quad.
 
 	QuadIndex quadIndex; // The quad index within its parent.
-	AxisAlignedBB* faceBounds; // The bounding box around this quad in un-deformed face space.
-	Frustum* deformedBounds; // The bounding frustum around this quad after it has been deformed to the surface of a sphere.
+	AxisAlignedBB faceBounds; // The bounding box around this quad in un-deformed face space.
+	Frustum deformedBounds; // The bounding frustum around this quad after it has been deformed to the surface of a sphere.
 
 	dmat4 worldNormals; // The 4 normals of this quad stored in matrix columns, in world space.
 	dmat4 worldCorners; // The 4 corners of this quad stored in matrix columns, in world space.
@@ -59,9 +58,29 @@ private:
 	bool changed; // True if this quad changed in the previous frame, and needs to be re-rendered
 	bool neighbourChanged; // True when one of the neighbours of this quad changed.
 	bool renderLeaf; // True if this node is a leaf in the renderable portion of the tree. If a node does not yet have fully generated TileData, it should not be rendered.
+	double mergeTime; // The number of seconds this quad has continuously been outside the merge threshold.
+	int32 leafSlot; // The slot of this leaf in the terrain renderer's leaf set, or -1. Assigned and released by the renderer as this quad is split and merged.
 
 	void setNeighbours(TerrainQuad* left, TerrainQuad* top, TerrainQuad* right, TerrainQuad* bottom);
 
+	/**
+	 * The four corners of the square on this quad's face, projected onto the unit sphere and stored in matrix columns.
+	 */
+	dmat4 getSphereNormals(dvec2 facePosition, double size) const;
+
+	/**
+	 * Returns true once the children can be merged without losing any work, which is when this quad has its own
+	 * renderable tile, and no tile below it is still being generated. Acquires this quad's tile if needed.
+	 */
+	bool canMerge();
+
+	/**
+	 * Reset the merge timer, and release the tile acquired by canMerge if this quad still has children.
+	 */
+	void cancelMerge();
+
+	bool isSubtreeIdle() const;
+
 	int buildRenderTree();
 
 	TerrainQuad(Planet* planet, CubeFace face, TerrainQuad* parent, QuadIndex quadIndex, dvec2 facePosition, uvec2 treePosition, float minHeight, float maxHeight, bool occluded);
@@ -93,9 +112,9 @@ public:
 
 	bool isRenderable();
 
-	AxisAlignedBB getBoundingBox() const;
+	const AxisAlignedBB& getBoundingBox() const;
 
-	Frustum getDeformedBoundingBox() const;
+	const Frustum& getDeformedBoundingBox() const;
 
 	Planet* getPlanet() const;
 
@@ -105,6 +124,12 @@ public:
 
 	TerrainQuad* getChild(QuadIndex index) const;
 
+	/**
+	 * The planetary unique tree position, and the world normals, that the child at the index will have when this quad
+	 * splits. Lets the tile of a child be prefetched before the child exists.
+	 */
+	void getChildTileInfo(QuadIndex index, uvec3* treePosition, dmat4* worldNormals) const;
+
 	TerrainQuad* getNeighbour(NeighbourIndex index) const;
 
 	TerrainQuad* getTerrainQuadUnder(dvec2 facePoint);
@@ -129,7 +154,11 @@ public:
 
 	uvec3 getTreePosition(bool planetaryUnique = false) const;
 
-	TileData* getTileData(fvec2* tilePosition = NULL, fvec2* tileSize = NULL, bool useParent = true);
+	/**
+	 * Get the tile to draw this quad with, which is the parent's while this quad's tile is not generated. Unless
+	 * acquire is false, this quad's tile is requested if it has none, and is marked as used.
+	 */
+	TileData* getTileData(fvec2* tilePosition = NULL, fvec2* tileSize = NULL, bool useParent = true, bool acquire = true);
 
 	double getMinHeight() const;
 
@@ -0,0 +1,98 @@
+#include "TerrainQuadPool.h"
+#include "core/application/Application.h"
+
+TerrainQuadPool::TerrainQuadPool(uint32 blocksPerChunk):
+	blocksPerChunk(blocksPerChunk), freeList(NULL), numUsedBlocks(0), peakUsedBlocks(0), numAllocations(0), numReleases(0) {
+	assert(blocksPerChunk > 0);
+}
+
+TerrainQuadPool::~TerrainQuadPool() {
+	if (this->numUsedBlocks > 0) {
+		logError("Terrain quad pool deleted while %d quads are still alive", this->getNumNodes());
+	}
+
+	for (int i = 0; i < this->chunks.size(); i++) {
+		delete[] this->chunks[i];
+	}
+
+	this->chunks.clear();
+	this->freeList = NULL;
+}
+
+void TerrainQuadPool::allocateChunk() {
+	Block* chunk = new Block[this->blocksPerChunk];
+	this->chunks.push_back(chunk);
+
+	// Thread the new blocks onto the free list, so they are handed out in address order.
+	for (int i = this->blocksPerChunk - 1; i >= 0; i--) {
+		chunk[i].nextFree = this->freeList;
+		this->freeList = &chunk[i];
+	}
+}
+
+TerrainQuad* TerrainQuadPool::allocate() {
+	if (this->freeList == NULL) {
+		this->allocateChunk();
+	}
+
+	Block* block = this->freeList;
+	this->freeList = block->nextFree;
+
+	this->numUsedBlocks++;
+	this->peakUsedBlocks = glm::max(this->peakUsedBlocks, this->numUsedBlocks);
+	this->numAllocations++;
+
+	return reinterpret_cast<TerrainQuad*>(block->storage);
+}
+
+void TerrainQuadPool::release(TerrainQuad* quads) {
+	if (quads == NULL) {
+		return;
+	}
+
+	assert(this->numUsedBlocks > 0);
+
+	// Most recently released blocks are reused first, since they are most likely still in the cache.
+	Block* block = reinterpret_cast<Block*>(quads);
+	block->nextFree = this->freeList;
+	this->freeList = block;
+
+	this->numUsedBlocks--;
+	this->numReleases++;
+}
+
+uint32 TerrainQuadPool::getNumNodes() const {
+	return this->numUsedBlocks * 4;
+}
+
+uint32 TerrainQuadPool::getNumUsedBlocks() const {
+	return this->numUsedBlocks;
+}
+
+uint32 TerrainQuadPool::getNumFreeBlocks() const {
+	return this->chunks.size() * this->blocksPerChunk - this->numUsedBlocks;
+}
+
+uint32 TerrainQuadPool::getPeakUsedBlocks() const {
+	return this->peakUsedBlocks;
+}
+
+uint32 TerrainQuadPool::getNumChunks() const {
+	return this->chunks.size();
+}
+
+uint64 TerrainQuadPool::getReservedMemory() const {
+	return (uint64) this->chunks.size() * this->blocksPerChunk * sizeof(Block);
+}
+
+uint64 TerrainQuadPool::getUsedMemory() const {
+	return (uint64) this->numUsedBlocks * sizeof(Block);
+}
+
+uint64 TerrainQuadPool::getNumAllocations() const {
+	return this->numAllocations;
+}
+
+uint64 TerrainQuadPool::getNumReleases() const {
+	return this->numReleases;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "core/Core.h"
+#include "core/engine/terrain/TerrainQuad.h"
+
+/**
+ * Allocates the four children of a terrain quad as one contiguous block. Blocks are carved out of larger
+ * chunks, and released blocks are kept on a free list for the next split, so once the pool has grown to the
+ * working set of the quad tree, splitting and merging quads no longer touches the heap.
+ */
+class TerrainQuadPool {
+private:
+	union Block {
+		Block* nextFree; // The next free block, while this block is on the free list.
+		alignas(TerrainQuad) uint8 storage[sizeof(TerrainQuad) * 4];
+	};
+
+	uint32 blocksPerChunk; // The number of blocks allocated from the heap at once.
+	std::vector<Block*> chunks; // Every chunk allocated by the pool. They are only freed when the pool is deleted.
+	Block* freeList; // The most recently released block, or NULL if every block is in use.
+
+	uint32 numUsedBlocks; // The number of blocks currently holding the children of a quad.
+	uint32 peakUsedBlocks; // Debug info
+	uint64 numAllocations; // Debug info
+	uint64 numReleases; // Debug info
+
+	void allocateChunk();
+
+public:
+	TerrainQuadPool(uint32 blocksPerChunk = 256);
+
+	/**
+	 * Frees every chunk. Every block must have been released.
+	 */
+	~TerrainQuadPool();
+
+	// Deleted copy constructor and assignment function
+	TerrainQuadPool(const TerrainQuadPool&) = delete;
+	TerrainQuadPool& operator=(const TerrainQuadPool&) = delete;
+
+	/**
+	 * Get uninitialized storage for four contiguous terrain quads, which must be constructed with placement new.
+	 */
+	TerrainQuad* allocate();
+
+	/**
+	 * Return storage obtained from allocate. The four quads must already have been destroyed.
+	 */
+	void release(TerrainQuad* quads);
+
+	/**
+	 * The number of pooled quads currently alive. The root quads of the cube faces are not pooled.
+	 */
+	uint32 getNumNodes() const;
+
+	uint32 getNumUsedBlocks() const;
+
+	uint32 getNumFreeBlocks() const;
+
+	uint32 getPeakUsedBlocks() const;
+
+	uint32 getNumChunks() const;
+
+	/**
+	 * The number of bytes allocated from the heap for all chunks.
+	 */
+	uint64 getReservedMemory() const;
+
+	/**
+	 * The number of bytes of the blocks holding live quads.
+	 */
+	uint64 getUsedMemory() const;
+
+	uint64 getNumAllocations() const;
+
+	uint64 getNumReleases() const;
+};
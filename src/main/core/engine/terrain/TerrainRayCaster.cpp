@@ -0,0 +1,388 @@
+#include "TerrainRayCaster.h"
+#include "core/application/Application.h"
+#include "core/engine/terrain/Planet.h"
+#include "core/engine/terrain/LinearQuadTree.h"
+#include "core/engine/scene/bounding/BoundingVolume.h"
+
+// The ray direction is always normalized, so the quadratic simplifies.
+static bool intersectSphere(const Ray& ray, double radius, double* t0, double* t1) {
+	const double b = dot(ray.orig, ray.dir);
+	const double c = dot(ray.orig, ray.orig) - radius * radius;
+	const double discr = b * b - c;
+
+	if (discr < 0.0) {
+		return false;
+	}
+
+	const double s = sqrt(discr);
+	*t0 = -b - s;
+	*t1 = -b + s;
+	return true;
+}
+
+TerrainRayCaster::TerrainRayCaster(std::shared_ptr<const TerrainSnapshot> snapshot):
+	snapshot(snapshot) {
+	assert(snapshot != NULL);
+}
+
+TerrainRayCaster::~TerrainRayCaster() {
+
+}
+
+bool TerrainRayCaster::clipQuad(const Ray& ray, int32 face, int32 depth, uvec2 treePosition, fvec2 heightRange, Interval* interval) const {
+	const dmat3& r = this->snapshot->faceOrientations[face];
+	const double n = double(uint32(1) << depth);
+	const dvec2 lo = dvec2(treePosition) / n * 2.0 - 1.0;
+	const dvec2 hi = dvec2(treePosition + uvec2(1)) / n * 2.0 - 1.0;
+
+	// The quad is projected from the center of the planet, so the space below it is bounded by four planes through
+	// the origin. Points inside have a positive dot product with each of these normals.
+	const dvec3 planes[4] = {
+		r[0] - lo.x * r[1],
+		hi.x * r[1] - r[0],
+		r[2] - lo.y * r[1],
+		hi.y * r[1] - r[2],
+	};
+
+	double t0 = interval->t0;
+	double t1 = interval->t1;
+
+	for (int i = 0; i < 4; i++) {
+		const double num = dot(ray.orig, planes[i]);
+		const double den = dot(ray.dir, planes[i]);
+
+		if (abs(den) < 1e-15) {
+			if (num < 0.0) {
+				return false;
+			}
+			continue;
+		}
+
+		const double t = -num / den;
+		if (den > 0.0) {
+			t0 = glm::max(t0, t);
+		} else {
+			t1 = glm::min(t1, t);
+		}
+	}
+
+	if (t0 > t1) {
+		return false;
+	}
+
+	// The spheres are padded slightly, so that the heightfield is strictly between them.
+	const double radius = this->snapshot->radius;
+	const double elevationScale = this->snapshot->elevationScale;
+	const double epsilon = radius * 1e-6;
+
+	double s0, s1;
+	if (!intersectSphere(ray, radius + elevationScale * heightRange.y + epsilon, &s0, &s1)) {
+		return false;
+	}
+
+	t0 = glm::max(t0, s0);
+	t1 = glm::min(t1, s1);
+
+	// Everything inside the inner sphere is below the terrain, so the ray must hit before reaching it.
+	if (intersectSphere(ray, radius + elevationScale * heightRange.x - epsilon, &s0, &s1) && s0 >= t0) {
+		t1 = glm::min(t1, s0);
+	}
+
+	if (t0 > t1) {
+		return false;
+	}
+
+	interval->t0 = t0;
+	interval->t1 = t1;
+	return true;
+}
+
+bool TerrainRayCaster::castQuad(const Ray& ray, int32 face, int32 depth, uvec2 treePosition, const TerrainSnapshot::Node* node, Interval interval, TerrainRayHit* hit) const {
+	if (node->leaf) {
+		return this->castLeaf(ray, face, depth, treePosition, node, interval, hit);
+	}
+
+	struct Child {
+		const TerrainSnapshot::Node* node;
+		uvec2 treePosition;
+		Interval interval;
+	};
+
+	Child children[4];
+	int32 count = 0;
+
+	for (int i = 0; i < 4; i++) {
+		Child child;
+		child.treePosition = treePosition * uint32(2) + uvec2(i & 1, i >> 1);
+		child.node = this->snapshot->findNode(face, depth + 1, child.treePosition);
+		child.interval = interval;
+
+		if (child.node != NULL && this->clipQuad(ray, face, depth + 1, child.treePosition, child.node->heightRange, &child.interval)) {
+			children[count++] = child;
+		}
+	}
+
+	// The children do not overlap, so the first hit in the order the ray enters them is the closest.
+	std::sort(children, children + count, [](const Child& a, const Child& b) {
+		return a.interval.t0 < b.interval.t0;
+	});
+
+	for (int i = 0; i < count; i++) {
+		if (this->castQuad(ray, face, depth + 1, children[i].treePosition, children[i].node, children[i].interval, hit)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool TerrainRayCaster::castLeaf(const Ray& ray, int32 face, int32 depth, uvec2 treePosition, const TerrainSnapshot::Node* node, Interval interval, TerrainRayHit* hit) const {
+	const double radius = this->snapshot->radius;
+	const double elevationScale = this->snapshot->elevationScale;
+
+	if (node->tileIndex < 0) {
+		if (node->missIndex >= 0) {
+			this->snapshot->missed[node->missIndex].store(true, std::memory_order_relaxed);
+		}
+
+		// Without texture data, the best guess is the sphere halfway through the quad's height range.
+		const double surfaceRadius = radius + elevationScale * 0.5 * (node->heightRange.x + node->heightRange.y);
+
+		double t = interval.t0;
+		if (length(ray.orig + ray.dir * t) > surfaceRadius) {
+			double s0, s1;
+			if (!intersectSphere(ray, surfaceRadius, &s0, &s1) || s0 < interval.t0 || s0 > interval.t1) {
+				return false;
+			}
+			t = s0;
+		}
+
+		hit->position = ray.orig + ray.dir * t;
+		hit->normal = fvec3(normalize(hit->position));
+		hit->distance = t;
+		hit->facePosition = this->getFacePosition(face, hit->position);
+		hit->face = face;
+		hit->depth = depth;
+		hit->hit = true;
+		hit->exact = false;
+		return true;
+	}
+
+	const TerrainSnapshotTile* tile = this->snapshot->tiles[node->tileIndex].get();
+	const dmat3& r = this->snapshot->faceOrientations[face];
+	const int32 size = tile->size;
+	const double n = double(uint32(1) << depth);
+
+	// The signed distance of the ray above the bilinearly filtered heightfield.
+	auto evaluate = [&](double t, fvec4* texel) -> double {
+		const dvec3 point = ray.orig + ray.dir * t;
+		const dvec2 quadPosition = this->getFacePosition(face, point) * n - dvec2(treePosition);
+		*texel = TerrainSnapshot::sampleTexels(tile, TerrainSnapshot::getTexelPosition(tile, quadPosition));
+		return length(point) - (radius + elevationScale * texel->w);
+	};
+
+	auto getTexelCoord = [&](double t) -> dvec2 {
+		const dvec2 quadPosition = this->getFacePosition(face, ray.orig + ray.dir * t) * n - dvec2(treePosition);
+		return (1.0 - quadPosition) * double(size);
+	};
+
+	// The texel grid lines are also planes through the origin. The ray crosses texel column k where the face
+	// coordinate is sk, which is where it intersects the plane with the normal r0 - sk * r1.
+	auto getCrossing = [&](int32 axis, int32 k) -> double {
+		const double facePosition = (1.0 - double(k) / size + (axis == 0 ? treePosition.x : treePosition.y)) / n * 2.0 - 1.0;
+		const dvec3 plane = r[axis == 0 ? 0 : 2] - facePosition * r[1];
+		const double den = dot(ray.dir, plane);
+		return abs(den) < 1e-15 ? INFINITY : -dot(ray.orig, plane) / den;
+	};
+
+	const dvec2 texelStart = getTexelCoord(interval.t0);
+	const dvec2 texelEnd = getTexelCoord(interval.t1);
+	const ivec2 step = ivec2(glm::sign(texelEnd - texelStart));
+
+	ivec2 cell = glm::clamp(ivec2(glm::floor(texelStart)), ivec2(0), ivec2(size - 1));
+
+	// The next grid line crossed on each axis. Leaving the tile is handled by the end of the interval.
+	auto getNextCrossing = [&](int32 axis) -> double {
+		const int32 k = step[axis] > 0 ? cell[axis] + 1 : cell[axis];
+		if (step[axis] == 0 || (step[axis] > 0 && k >= size) || (step[axis] < 0 && k <= 0)) {
+			return INFINITY;
+		}
+		return getCrossing(axis, k);
+	};
+
+	double nextX = getNextCrossing(0);
+	double nextY = getNextCrossing(1);
+
+	double t0 = interval.t0;
+	fvec4 texel;
+	double f0 = evaluate(t0, &texel);
+	double hitDistance = -1.0;
+
+	if (f0 <= 0.0) {
+		hitDistance = t0; // The ray starts below the surface.
+	}
+
+	const int32 subdivisions = 4;
+	const float* texels = tile->texels.data();
+
+	for (int i = 0; hitDistance < 0.0 && t0 < interval.t1 && i < size * 4; i++) {
+		const double t1 = glm::min(interval.t1, glm::min(nextX, nextY));
+
+		// The bilinear patch of this texel cell lies between its four corner heights.
+		const int32 x1 = glm::min(cell.x + 1, size - 1);
+		const int32 y1 = glm::min(cell.y + 1, size - 1);
+		const float maxHeight = glm::max(
+			glm::max(texels[(cell.x + cell.y * size) * 4 + 3], texels[(x1 + cell.y * size) * 4 + 3]),
+			glm::max(texels[(cell.x + y1 * size) * 4 + 3], texels[(x1 + y1 * size) * 4 + 3]));
+
+		const double closest = glm::clamp(-dot(ray.orig, ray.dir), t0, t1);
+		const bool mayHit = length(ray.orig + ray.dir * closest) <= radius + elevationScale * maxHeight;
+
+		if (mayHit) {
+			// March the cell in a few steps, and bisect the first step that crosses below the surface.
+			for (int j = 1; j <= subdivisions; j++) {
+				const double ta = t0 + (t1 - t0) * (j - 1) / subdivisions;
+				const double tb = t0 + (t1 - t0) * j / subdivisions;
+
+				if (evaluate(tb, &texel) <= 0.0) {
+					double above = ta;
+					double below = tb;
+
+					for (int k = 0; k < 24; k++) {
+						const double mid = (above + below) * 0.5;
+						if (evaluate(mid, &texel) <= 0.0) {
+							below = mid;
+						} else {
+							above = mid;
+						}
+					}
+
+					hitDistance = below;
+					break;
+				}
+			}
+		}
+
+		if (t1 >= nextX) {
+			cell.x += step.x;
+			nextX = getNextCrossing(0);
+		}
+
+		if (t1 >= nextY) {
+			cell.y += step.y;
+			nextY = getNextCrossing(1);
+		}
+
+		t0 = t1;
+	}
+
+	if (hitDistance < 0.0) {
+		return false;
+	}
+
+	evaluate(hitDistance, &texel);
+
+	hit->position = ray.orig + ray.dir * hitDistance;
+	hit->normal = fvec3(texel);
+	if (glm::length(hit->normal) > 1e-6F) {
+		hit->normal = normalize(hit->normal);
+	} else {
+		hit->normal = fvec3(normalize(hit->position));
+	}
+	hit->distance = hitDistance;
+	hit->facePosition = this->getFacePosition(face, hit->position);
+	hit->face = face;
+	hit->depth = depth;
+	hit->hit = true;
+	hit->exact = true;
+	return true;
+}
+
+dvec2 TerrainRayCaster::getFacePosition(int32 face, dvec3 point) const {
+	const dmat3& r = this->snapshot->faceOrientations[face];
+	return dvec2(dot(point, r[0]), dot(point, r[2])) / dot(point, r[1]) * 0.5 + 0.5;
+}
+
+bool TerrainRayCaster::castRay(const Ray& localRay, TerrainRayHit* hit, double maxDistance) const {
+	hit->hit = false;
+
+	struct Root {
+		int32 face;
+		const TerrainSnapshot::Node* node;
+		Interval interval;
+	};
+
+	Root roots[6];
+	int32 count = 0;
+
+	for (int i = 0; i < 6; i++) {
+		Root root;
+		root.face = i;
+		root.node = this->snapshot->findNode(i, 0, uvec2(0));
+		root.interval.t0 = 0.0;
+		root.interval.t1 = maxDistance;
+
+		if (root.node != NULL && this->clipQuad(localRay, i, 0, uvec2(0), root.node->heightRange, &root.interval)) {
+			roots[count++] = root;
+		}
+	}
+
+	std::sort(roots, roots + count, [](const Root& a, const Root& b) {
+		return a.interval.t0 < b.interval.t0;
+	});
+
+	for (int i = 0; i < count; i++) {
+		if (this->castQuad(localRay, roots[i].face, 0, uvec2(0), roots[i].node, roots[i].interval, hit)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void TerrainRayCaster::castRays(int32 count, const Ray* localRays, TerrainRayHit* hits, double maxDistance) const {
+	const double boundingRadius = this->snapshot->radius + this->snapshot->elevationScale;
+
+	// Key each ray by the point where it enters the planet's bounding sphere, in the same order as the linear quad
+	// tree, so that rays entering nearby quads are cast one after another.
+	std::vector<std::pair<uint64, int32>> order(count);
+
+	for (int i = 0; i < count; i++) {
+		const Ray& ray = localRays[i];
+		uint64 key = ~uint64(0); // Rays missing the planet entirely go last.
+
+		double t0, t1;
+		if (intersectSphere(ray, boundingRadius, &t0, &t1) && t1 >= 0.0) {
+			const dvec3 entry = ray.orig + ray.dir * glm::max(t0, 0.0);
+
+			int32 face = 0;
+			double faceDot = -INFINITY;
+			for (int j = 0; j < 6; j++) {
+				const double d = dot(entry, this->snapshot->faceOrientations[j][1]);
+				if (d > faceDot) {
+					faceDot = d;
+					face = j;
+				}
+			}
+
+			const int32 depth = 16;
+			const uint32 cells = uint32(1) << depth;
+			const dvec2 position = this->getFacePosition(face, entry);
+			const uvec2 cell = uvec2(glm::clamp(ivec2(glm::floor(position * double(cells))), ivec2(0), ivec2(cells - 1)));
+			key = LinearQuadTree::getKey((CubeFace)face, depth, cell);
+		}
+
+		order[i] = std::make_pair(key, i);
+	}
+
+	std::sort(order.begin(), order.end());
+
+	for (int i = 0; i < count; i++) {
+		const int32 index = order[i].second;
+		this->castRay(localRays[index], &hits[index], maxDistance);
+	}
+}
+
+std::shared_ptr<const TerrainSnapshot> TerrainRayCaster::getSnapshot() const {
+	return this->snapshot;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "core/Core.h"
+#include "core/engine/terrain/TerrainSnapshot.h"
+
+struct Ray;
+
+/**
+ * The result of casting one ray against the terrain.
+ */
+struct TerrainRayHit {
+	dvec3 position; // The point the ray hit, in local planet space.
+	fvec3 normal; // The surface normal at the hit point, in local planet space.
+	double distance; // The distance along the ray to the hit point.
+	dvec2 facePosition; // The hit point, normalized to [0, 1] over the cube face it is on.
+	int32 face; // The CubeFace of the quad that was hit.
+	int32 depth; // The depth of the quad that was hit.
+	bool hit; // False if the ray did not hit the terrain within the maximum distance. Nothing else is set in that case.
+	bool exact; // False if the hit quad had no texture data on the CPU, and the ray was intersected with its mid-height sphere instead.
+};
+
+/**
+ * Casts rays against the heightfield of a terrain snapshot. Rays descend the quad tree front to back, skipping every
+ * quad whose conservative height range the ray misses. At the leaves, the ray walks the texels of the tile it crosses,
+ * and the first crossing of the bilinear heightfield is refined by bisection. Like the snapshot, this is thread safe.
+ */
+class TerrainRayCaster {
+private:
+	struct Interval {
+		double t0;
+		double t1;
+	};
+
+	std::shared_ptr<const TerrainSnapshot> snapshot; // Kept alive for as long as the caster is.
+
+	/**
+	 * Clip the interval to the part of the ray inside the pyramid below the quad, and between the spheres bounding its
+	 * height range. Returns false if nothing is left.
+	 */
+	bool clipQuad(const Ray& ray, int32 face, int32 depth, uvec2 treePosition, fvec2 heightRange, Interval* interval) const;
+
+	/**
+	 * Cast the ray through the children of the quad in the order the ray enters them, stopping at the first hit. The
+	 * interval must already be clipped to the quad.
+	 */
+	bool castQuad(const Ray& ray, int32 face, int32 depth, uvec2 treePosition, const TerrainSnapshot::Node* node, Interval interval, TerrainRayHit* hit) const;
+
+	/**
+	 * Walk the texels of the leaf's tile along the ray, and bisect the first crossing of the heightfield.
+	 */
+	bool castLeaf(const Ray& ray, int32 face, int32 depth, uvec2 treePosition, const TerrainSnapshot::Node* node, Interval interval, TerrainRayHit* hit) const;
+
+	/**
+	 * The projection of the point onto the face, as a position normalized to [0, 1] over the face.
+	 */
+	dvec2 getFacePosition(int32 face, dvec3 point) const;
+
+public:
+	TerrainRayCaster(std::shared_ptr<const TerrainSnapshot> snapshot);
+
+	~TerrainRayCaster();
+
+	/**
+	 * Cast the ray, in local planet space, against the terrain. Returns true and fills in the hit if the terrain was hit
+	 * within the maximum distance.
+	 */
+	bool castRay(const Ray& localRay, TerrainRayHit* hit, double maxDistance = INFINITY) const;
+
+	/**
+	 * Cast every ray, in local planet space. The rays are cast in the order of the quads they first enter, so that
+	 * consecutive rays descend the same part of the tree and read the same tiles.
+	 */
+	void castRays(int32 count, const Ray* localRays, TerrainRayHit* hits, double maxDistance = INFINITY) const;
+
+	std::shared_ptr<const TerrainSnapshot> getSnapshot() const;
+};
@@ -8,14 +8,21 @@
 #include "core/engine/renderer/Camera.h"
 #include "core/engine/renderer/DebugRenderer.h"
 #include "core/engine/renderer/GLMesh.h"
+#include "core/engine/renderer/ReadbackBuffer.h"
 #include "core/engine/renderer/ShaderProgram.h"
 #include "core/application/Application.h"
 #include "core/util/Time.h"
 #include "core/util/InputHandler.h"
+#include "core/util/ThreadPool.h"
 #include <GL/glew.h>
 
+#define MAX_LEAF_FEEDBACK_READBACKS 3 // Feedback is skipped while this many frames are still being read back.
+
 TerrainQuad* pickedQuad = NULL;
 
+static_assert(offsetof(PatchInfo, quadCorners) == 14 * sizeof(float) && offsetof(PatchInfo, quadNormals) == 30 * sizeof(float), "PatchInfo must match writePatch in cullComp.glsl");
+static_assert(sizeof(TerrainLeaf) == 512, "TerrainLeaf must match the std430 layout in cullComp.glsl");
+
 TerrainRenderer::TerrainRenderer(int terrainResolution):
 	terrainResolution(terrainResolution) {
 
@@ -29,6 +36,7 @@ TerrainRenderer::TerrainRenderer(int terrainResolution):
 	this->terrainProgram->addAttribute(4, "vs_textureCoords");
 	this->terrainProgram->addAttribute(5, "vs_quadCorners");
 	this->terrainProgram->addAttribute(9, "vs_quadNormals");
+	this->terrainProgram->addAttribute(13, "vs_heightRange");
 	this->terrainProgram->completeProgram();
 
 	this->waterProgram = new ShaderProgram();
@@ -41,9 +49,12 @@ TerrainRenderer::TerrainRenderer(int terrainResolution):
 	this->waterProgram->addAttribute(4, "vs_textureCoords");
 	this->waterProgram->addAttribute(5, "vs_quadCorners");
 	this->waterProgram->addAttribute(9, "vs_quadNormals");
+	this->waterProgram->addAttribute(13, "vs_heightRange");
 	this->waterProgram->completeProgram();
 
 	this->terrainMesh = new GLMesh(this->createTerrainTileMesh(), TERRAIN_VERTEX_LAYOUT);
+	// Triple buffered, so the patches of this frame can be written while the GPU is still drawing the last two. Every
+	// planet rendered in a frame reserves its own range of the frame.
 	this->terrainInstanceBuffer = new InstanceBuffer(sizeof(PatchInfo), 4096, 1, {
 
 		InstanceAttribute(1, 3, GL_FLOAT, offsetof(PatchInfo, debug)),
@@ -60,20 +71,32 @@ TerrainRenderer::TerrainRenderer(int terrainResolution):
 		InstanceAttribute(10, 4, GL_FLOAT, offsetof(PatchInfo, quadNormals) + sizeof(vec4) * 1),
 		InstanceAttribute(11, 4, GL_FLOAT, offsetof(PatchInfo, quadNormals) + sizeof(vec4) * 2),
 		InstanceAttribute(12, 4, GL_FLOAT, offsetof(PatchInfo, quadNormals) + sizeof(vec4) * 3),
-	});
+
+		InstanceAttribute(13, 2, GL_FLOAT, offsetof(PatchInfo, heightRange)),
+	}, 3);
 
 	int32 maxAttribs;
 	glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &maxAttribs);
 
 	logInfo("Maximum allowed vertex attribute locations is %d", maxAttribs);
 
-	uint32 threadCount = 1;
+	this->instanceFrameIndex = UINT64_MAX;
+	this->frameBaseInstance = 0;
 
-	for (int i = 0; i < threadCount; i++) {
-		this->threads[i] = std::thread(&TerrainRenderer::threadProc, this, i);
-		inputBuffers[i] = std::deque<TerrainRenderTask>();
-		outputBuffer[i] = std::vector<PatchInfo>();
-	}
+	this->threadPool = new ThreadPool();
+	this->numRenderTasks = 0;
+	this->numTerrainInstances = 0;
+	this->numWaterInstances = 0;
+	this->waterInstanceOffset = 0;
+	this->taskDepth = 2;
+
+	this->cullingProgram = new ShaderProgram();
+	this->cullingProgram->addShader(GL_COMPUTE_SHADER, "simpleTerrain/cullComp.glsl");
+	this->cullingProgram->completeProgram();
+
+	glCreateBuffers(1, &this->drawCommandBuffer);
+	glNamedBufferData(this->drawCommandBuffer, sizeof(DrawElementsIndirectCommand) * 2, NULL, GL_DYNAMIC_DRAW);
+	this->gpuCullingEnabled = false;
 }
 
 TerrainRenderer::~TerrainRenderer() {
@@ -81,11 +104,104 @@ TerrainRenderer::~TerrainRenderer() {
 	delete this->terrainProgram;
 	delete this->terrainProgram;
 	delete this->terrainInstanceBuffer;
+	delete this->threadPool;
+	delete this->cullingProgram;
+
+	for (auto it = this->leafSets.begin(); it != this->leafSets.end(); it++) {
+		this->deleteLeafSet(it->second);
+	}
+	this->leafSets.clear();
+
+	glDeleteBuffers(1, &this->drawCommandBuffer);
+}
+
+void TerrainRenderer::removePlanet(const Planet* planet) {
+	auto it = this->leafSets.find(planet);
+
+	if (it != this->leafSets.end()) {
+		this->deleteLeafSet(it->second);
+		this->leafSets.erase(it);
+	}
+}
+
+static ivec4 getNeighbourDivisions(const TerrainQuad* terrainQuad) {
+	ivec4 neighbourDivisions = ivec4(-1);
+
+	for (int i = 0; i < 4; i++) {
+		TerrainQuad* neighbourQuad = terrainQuad->getNeighbour((NeighbourIndex)i);
+		if (neighbourQuad != NULL) {
+			neighbourDivisions[i] = neighbourQuad->getDepth() - terrainQuad->getDepth();
+			// -1 if neighbour is lower detail, +1 if neighbour is higher detail.
+		}
+	}
+
+	return neighbourDivisions;
+}
+
+// The slot of a quad is only valid while the slot still refers to the quad, since slots are reused.
+static bool hasLeafSlot(const TerrainLeafSet* leafSet, const TerrainQuad* terrainQuad, int32 slot) {
+	return slot >= 0 && slot < leafSet->slotQuads.size() && leafSet->slotQuads[slot] == terrainQuad;
+}
+
+void TerrainRenderer::onLeafAdded(TerrainQuad* terrainQuad) {
+	TerrainLeafSet* leafSet = this->getLeafSet(terrainQuad->getPlanet());
+
+	if (leafSet == NULL || hasLeafSlot(leafSet, terrainQuad, terrainQuad->leafSlot)) {
+		return;
+	}
+
+	int32 slot = -1;
+
+	// Slots past the end of the leaves were dropped when the leaves were trimmed, and are skipped.
+	while (slot < 0 && !leafSet->freeSlots.empty()) {
+		const int32 freeSlot = leafSet->freeSlots.back();
+		leafSet->freeSlots.pop_back();
+
+		if (freeSlot < leafSet->slotQuads.size() && leafSet->slotQuads[freeSlot] == NULL) {
+			slot = freeSlot;
+		}
+	}
+
+	if (slot < 0) {
+		slot = leafSet->leaves.size();
+		leafSet->leaves.emplace_back();
+		leafSet->slotQuads.push_back(NULL);
+		leafSet->slotFrames.push_back(0);
+	}
+
+	leafSet->slotQuads[slot] = terrainQuad;
+	leafSet->slotFrames[slot] = leafSet->frame + 1; // The frame this quad is first culled in.
+	leafSet->leaves[slot].used = 0;
+	leafSet->staleSlots.push_back(slot);
+	terrainQuad->leafSlot = slot;
+}
+
+void TerrainRenderer::onLeafRemoved(TerrainQuad* terrainQuad) {
+	TerrainLeafSet* leafSet = this->getLeafSet(terrainQuad->getPlanet());
+	const int32 slot = terrainQuad->leafSlot;
+	terrainQuad->leafSlot = -1;
+
+	if (leafSet == NULL || !hasLeafSlot(leafSet, terrainQuad, slot)) {
+		return;
+	}
+
+	leafSet->slotQuads[slot] = NULL;
+	leafSet->leaves[slot].used = 0;
+	leafSet->freeSlots.push_back(slot);
+	leafSet->dirtySlots.push_back(slot);
+}
+
+void TerrainRenderer::onLeafChanged(TerrainQuad* terrainQuad) {
+	TerrainLeafSet* leafSet = this->getLeafSet(terrainQuad->getPlanet());
+
+	if (leafSet != NULL && hasLeafSlot(leafSet, terrainQuad, terrainQuad->leafSlot)) {
+		leafSet->staleSlots.push_back(terrainQuad->leafSlot);
+	}
 }
 
 int debug = 0;
 
-void TerrainRenderer::render(Planet* planet, CubeFace face, TerrainQuad* terrainQuad, double partialTicks, double dt) {
+void TerrainRenderer::render(Planet* planet, double partialTicks, double dt) {
 
 	uint64 t0 = Time::now();
 
@@ -93,69 +209,31 @@ void TerrainRenderer::render(Planet* planet, CubeFace face, TerrainQuad* terrain
 	int32 w, h; Application::getWindowSize(&w, &h);
 	fvec2 mouse = (INPUT_HANDLER.getMousePosition() / fvec2(w, h)) * 2.0F - 1.0F;
 
-	if (face == 0 && INPUT_HANDLER.keyPressed(KEY_N)) {
+	if (INPUT_HANDLER.keyPressed(KEY_N)) {
 		debug = (debug + 1) % 3;
 		logInfo("Debug: %d", debug);
 	}
 	pickedQuad = planet->getRayPickTerrainQuad(camera->getPickingRay(mouse));
-	//
-	//if (pickedQuad != NULL) {
-	//	logInfo("%s",
-	//		pickedQuad->getCubeFace() == X_NEG ? "X_NEG" :
-	//		pickedQuad->getCubeFace() == X_POS ? "X_POS" :
-	//		pickedQuad->getCubeFace() == Y_NEG ? "Y_NEG" :
-	//		pickedQuad->getCubeFace() == Y_POS ? "Y_POS" :
-	//		pickedQuad->getCubeFace() == Z_NEG ? "Z_NEG" :
-	//		pickedQuad->getCubeFace() == Z_POS ? "Z_POS" : "UNKNOWN_FACE"
-	//	);
-	//
-	//	//uint64 a = Time::now();
-	//	//pickedQuad->updateNeighbours();
-	//	//uint64 b = Time::now();
-	//	//
-	//	//logInfo("Took %f ms to update neighbours", (b - a) / 1000000.0);
-	//}
 
-	dmat4 faceTransformation = terrainQuad->getFaceTransformation();
 	dmat4 localToScreen = camera->getViewProjectionMatrix() * planet->getViewerTransformation(camera->getPosition(true));
-	dvec2 cameraFacePosition = planet->cubeFaceToLocalPoint(face, planet->worldToLocalPoint(camera->getPosition()));
-
-	std::vector<PatchInfo> terrainInstances = {};
-	std::vector<PatchInfo> waterInstances = {};
-
-	//if (false) {//terrainQuad->isLeaf()) {
-		DEBUG_RENDERER.begin(GL_LINES);
-		DEBUG_RENDERER.setLightingEnabled(false);
-		this->doRender(terrainQuad, 0, planet->getRadius() * Planet::scaleFactor, cameraFacePosition, localToScreen, faceTransformation, terrainInstances, waterInstances);
-		DEBUG_RENDERER.finish();
-	//} else {
-	//	TerrainRenderTask renderTask;
-	//	renderTask.terrainQuad = terrainQuad;
-	//	renderTask.planet = planet;
-	//	renderTask.faceTransformation = faceTransformation;
-	//	renderTask.cameraToScreen = cameraToScreen;
-	//	renderTask.cameraFacePosition = cameraFacePosition;
-	//
-	//	logInfo("Adding render task to thread queue");
-	//
-	//	this->inputBuffers[0].push_back(renderTask);
-	//	this->threadInput.notify_one();
-	//	{
-	//		logInfo("Waiting for processing result");
-	//		std::unique_lock<std::mutex> lock(mut);
-	//		this->threadOutput.wait(lock, [&] {
-	//			return !this->outputBuffer[0].empty();
-	//		});
-	//
-	//		logInfo("Received %d quads", this->outputBuffer[0].size());
-	//	}
-	//}
+	const double scaleFactor = camera->getScaleFactor();
 
-	uint64 t1 = Time::now();
+	// The ring of the instance buffer advances once per frame, however many planets share this renderer.
+	if (this->instanceFrameIndex != Application::getFrameIndex()) {
+		this->instanceFrameIndex = Application::getFrameIndex();
+		this->terrainInstanceBuffer->beginFrame();
+	}
 
-	//logInfo("%f ms spent testing visibility", visibilietTestTime);
+	if (this->gpuCullingEnabled) {
+		this->cullOnGpu(planet, localToScreen, scaleFactor);
+	} else {
+		this->cullOnCpu(planet, localToScreen, scaleFactor);
+	}
 
-	if (!terrainInstances.empty()) {
+	uint64 t1 = Time::now();
+
+	// With GPU culling the instance counts are only known on the GPU, so both draws are always issued.
+	if (this->gpuCullingEnabled || this->numTerrainInstances > 0) {
 		fvec3 viewerPosition = camera->getPosition();
 		this->terrainProgram->useProgram(true);
 
@@ -166,14 +244,12 @@ void TerrainRenderer::render(Planet* planet, CubeFace face, TerrainQuad* terrain
 		this->terrainProgram->setUniform("localCameraPosition", planet->getLocalCameraPosition());
 		this->terrainProgram->setUniform("screenToLocal", inverse(localToScreen));
 		this->terrainProgram->setUniform("localToScreen", localToScreen);
-		this->terrainProgram->setUniform("faceTransformation", faceTransformation);
 		this->terrainProgram->setUniform("viewerTransformation", planet->getViewerTransformation(viewerPosition));
 		this->terrainProgram->setUniform("debugInt", debug);
 
-		this->terrainInstanceBuffer->uploadInstanceData(0, sizeof(PatchInfo) * terrainInstances.size(), static_cast<void*>(&terrainInstances[0]));
-		this->terrainMesh->draw(terrainInstances.size(), 0, 0, this->terrainInstanceBuffer);
+		this->drawInstances(false);
 	}
-	if (!waterInstances.empty()) {
+	if (this->gpuCullingEnabled || this->numWaterInstances > 0) {
 		fvec3 viewerPosition = camera->getPosition();
 		this->waterProgram->useProgram(true);
 
@@ -185,52 +261,402 @@ void TerrainRenderer::render(Planet* planet, CubeFace face, TerrainQuad* terrain
 		this->waterProgram->setUniform("localCameraPosition", planet->getLocalCameraPosition());
 		this->waterProgram->setUniform("screenToLocal", inverse(localToScreen));
 		this->waterProgram->setUniform("localToScreen", localToScreen);
-		this->waterProgram->setUniform("faceTransformation", faceTransformation);
 		this->waterProgram->setUniform("viewerTransformation", planet->getViewerTransformation(viewerPosition));
 		this->waterProgram->setUniform("debugInt", debug);
 
 		glDisable(GL_CULL_FACE);
-		this->terrainInstanceBuffer->uploadInstanceData(0, sizeof(PatchInfo) * waterInstances.size(), static_cast<void*>(&waterInstances[0]));
-		this->terrainMesh->draw(waterInstances.size(), 0, 0, this->terrainInstanceBuffer);
+		this->drawInstances(true);
 		glEnable(GL_CULL_FACE);
 	}
+
+	this->terrainInstanceBuffer->endFrame(); // Fences this planet's draws, along with those of the planets before it.
 	uint64 t2 = Time::now();
 
 	//double renderTime = (t2 - t0) / 1000000.0;
 	//double instanceTime = (t1 - t0) / 1000000.0;
-	//logInfo("(FPS = %f) Took %f ms to render %d terrain tiles. %f ms to setup instances, %f ms for visibility, %f ms for setup", 1.0 / dt, renderTime, instances.size(), instanceTime);
+	//logInfo("(FPS = %f) Took %f ms to render %d terrain tiles over %d tasks. %f ms to setup instances", 1.0 / dt, renderTime, this->numTerrainInstances, this->numRenderTasks, instanceTime);
 }
 
-PatchInfo TerrainRenderer::createPatch(TerrainQuad* terrainQuad, dmat4 localToScreen) {
+void TerrainRenderer::cullRenderTasks(Planet* planet, dmat4 localToScreen, double scaleFactor) {
+	// Split the faces into sub-trees, so that the face closest to the camera, which has most of the visible
+	// quads, is spread across the workers too.
+	this->numRenderTasks = 0;
+	for (int i = 0; i < 6; i++) {
+		const CubeFace face = (CubeFace) i;
+		dvec2 cameraFacePosition = planet->cubeFaceToLocalPoint(face, planet->getLocalCameraPosition());
+		this->addRenderTasks(planet->faces[face], 0, cameraFacePosition);
+	}
+
+	DEBUG_RENDERER.begin(GL_LINES);
+	DEBUG_RENDERER.setLightingEnabled(false);
+
+	auto cullTask = [&](uint32 index) {
+		TerrainRenderTask& task = this->renderTasks[index];
+		task.instances.clear();
+		this->doRender(task.terrainQuad, this->taskDepth, task.cameraFacePosition, localToScreen, scaleFactor, task.instances);
+	};
+
+	if (planet->renderDebugQuadBounds) {
+		for (int i = 0; i < this->numRenderTasks; i++) {
+			cullTask(i); // The debug bounds are drawn with the debug renderer during culling, which is not thread safe.
+		}
+	} else {
+		this->threadPool->parallelFor(this->numRenderTasks, cullTask, 1);
+	}
+
+	DEBUG_RENDERER.finish();
+}
+
+void TerrainRenderer::cullOnCpu(Planet* planet, dmat4 localToScreen, double scaleFactor) {
+	this->cullRenderTasks(planet, localToScreen, scaleFactor);
+
+	int32 numPatches = 0;
+	for (int i = 0; i < this->numRenderTasks; i++) {
+		numPatches += this->renderTasks[i].instances.size();
+	}
+
+	// The terrain patches of every face are written to the start of the planet's range of the instance buffer,
+	// and the water patches after them, so that each is drawn with a single instanced draw.
+	PatchInfo* frameInstances = reinterpret_cast<PatchInfo*>(this->terrainInstanceBuffer->reserveInstances(numPatches * 2, &this->frameBaseInstance));
+	this->numTerrainInstances = 0;
+	this->numWaterInstances = 0;
+	this->waterInstanceOffset = numPatches;
+
+	// Tiles are acquired serially, since the tile supplier is only used from the render thread.
+	for (int i = 0; i < this->numRenderTasks; i++) {
+		std::vector<PatchInfo>& instances = this->renderTasks[i].instances;
+
+		for (int j = 0; j < instances.size(); j++) {
+			PatchInfo& patch = instances[j];
+			this->applyTileData(patch);
+
+			frameInstances[this->numTerrainInstances++] = patch;
+
+			if (patch.quad->getMinHeight() <= 0.0) {
+				frameInstances[this->waterInstanceOffset + this->numWaterInstances++] = patch;
+			}
+		}
+	}
+}
+
+void TerrainRenderer::cullOnGpu(Planet* planet, dmat4 localToScreen, double scaleFactor) {
+	TerrainLeafSet* leafSet = this->getLeafSet(planet);
+
+	if (leafSet == NULL) {
+		leafSet = this->createLeafSet(planet);
+	}
+
+	leafSet->frame++;
+
+	this->readLeafFeedback(leafSet);
+	this->updateLeaves(leafSet);
+
+	const uint32 leafCount = leafSet->leaves.size();
+
+	// Every leaf may be visible, and may be drawn as both terrain and water.
+	this->terrainInstanceBuffer->reserveInstances(leafCount * 2, &this->frameBaseInstance);
+	const uint32 baseInstance = this->frameBaseInstance;
+
+	DrawElementsIndirectCommand commands[2];
+	commands[0] = { (uint32) this->terrainMesh->getIndexCount(), 0, 0, 0, baseInstance };
+	commands[1] = { (uint32) this->terrainMesh->getIndexCount(), 0, 0, 0, baseInstance + leafCount };
+	glNamedBufferSubData(this->drawCommandBuffer, 0, sizeof(commands), commands);
+
+	if (leafCount == 0) {
+		return;
+	}
+
+	if (leafCount > leafSet->feedbackBufferCapacity) {
+		leafSet->feedbackBufferCapacity = glm::max(leafCount, leafSet->feedbackBufferCapacity * 2);
+		glNamedBufferData(leafSet->feedbackBuffer, (leafSet->feedbackBufferCapacity + 1) * sizeof(uint32), NULL, GL_DYNAMIC_COPY);
+	}
+
+	const uint32 visibleCount = 0;
+	glNamedBufferSubData(leafSet->feedbackBuffer, 0, sizeof(uint32), &visibleCount);
+
+	this->cullingProgram->useProgram(true);
+
+	// The transformation is applied in double precision, like on the CPU.
+	glUniformMatrix4dv(this->cullingProgram->getUniform("localToScreen"), 1, GL_FALSE, glm::value_ptr(localToScreen));
+	glUniform3dv(this->cullingProgram->getUniform("localCameraPosition"), 1, glm::value_ptr(planet->getLocalCameraPosition()));
+	glUniform1d(this->cullingProgram->getUniform("invHorizonRadius"), planet->invHorizonRadius);
+	glUniform1d(this->cullingProgram->getUniform("scaleFactor"), scaleFactor);
+	this->cullingProgram->setUniform("leafCount", (int32) leafCount);
+	this->cullingProgram->setUniform("instanceStride", (int32) (sizeof(PatchInfo) / sizeof(float)));
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, leafSet->leafBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, this->terrainInstanceBuffer->getBuffer());
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, this->drawCommandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, leafSet->feedbackBuffer);
+
+	glDispatchCompute((leafCount + 63) / 64, 1, 1);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, 0);
+
+	this->cullingProgram->useProgram(false);
+
+	// The instances are read as vertex attributes, the commands by the indirect draws, and the feedback is copied.
+	glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	this->submitLeafFeedback(leafSet, leafCount);
+}
+
+TerrainLeafSet* TerrainRenderer::getLeafSet(const Planet* planet) const {
+	auto it = this->leafSets.find(planet);
+	return it != this->leafSets.end() ? it->second : NULL;
+}
+
+TerrainLeafSet* TerrainRenderer::createLeafSet(Planet* planet) {
+	TerrainLeafSet* leafSet = new TerrainLeafSet();
+	glCreateBuffers(1, &leafSet->leafBuffer);
+	glCreateBuffers(1, &leafSet->feedbackBuffer);
+	leafSet->leafBufferCapacity = 0;
+	leafSet->feedbackBufferCapacity = 0;
+	leafSet->frame = 0;
+	this->leafSets[planet] = leafSet;
+
+	// From here on the quads report their changes, so the tree is only walked once.
+	for (int i = 0; i < 6; i++) {
+		this->addLeaves(planet->faces[i]);
+	}
+
+	return leafSet;
+}
+
+void TerrainRenderer::deleteLeafSet(TerrainLeafSet* leafSet) {
+	for (int i = 0; i < leafSet->feedback.size(); i++) {
+		READBACK_BUFFER.release(leafSet->feedback[i].region);
+	}
+
+	glDeleteBuffers(1, &leafSet->leafBuffer);
+	glDeleteBuffers(1, &leafSet->feedbackBuffer);
+	delete leafSet;
+}
+
+void TerrainRenderer::addLeaves(TerrainQuad* terrainQuad) {
+	if (terrainQuad == NULL) {
+		return;
+	}
+
+	if (terrainQuad->isLeaf()) {
+		this->onLeafAdded(terrainQuad);
+	} else {
+		this->addLeaves(terrainQuad->getChild(TOP_LEFT));
+		this->addLeaves(terrainQuad->getChild(TOP_RIGHT));
+		this->addLeaves(terrainQuad->getChild(BOTTOM_LEFT));
+		this->addLeaves(terrainQuad->getChild(BOTTOM_RIGHT));
+	}
+}
+
+void TerrainRenderer::readLeafFeedback(TerrainLeafSet* leafSet) {
+	TerrainLeafFeedback feedback = { NULL, 0 };
+
+	while (!leafSet->feedback.empty() && READBACK_BUFFER.isReady(leafSet->feedback.front().region)) {
+		if (feedback.region != NULL) {
+			READBACK_BUFFER.release(feedback.region);
+		}
+
+		feedback = leafSet->feedback.front();
+		leafSet->feedback.pop_front();
+	}
+
+	if (feedback.region == NULL) {
+		return;
+	}
+
+	const uint32* data = reinterpret_cast<const uint32*>(READBACK_BUFFER.getData(feedback.region));
+	const uint32 count = glm::min(data[0], (uint32) (feedback.region->size / sizeof(uint32) - 1));
+
+	// Tiles are acquired serially, since the tile supplier is only used from the render thread. The tiles of leaves
+	// out of view are not marked as used, so they expire, leaving room in the tile supplier for the ones in view.
+	for (int i = 0; i < count; i++) {
+		const int32 slot = data[i + 1];
+
+		// The slot may have been released, or given to another quad, since the leaves were culled.
+		if (slot >= leafSet->slotQuads.size() || leafSet->slotQuads[slot] == NULL || leafSet->slotFrames[slot] > feedback.frame) {
+			continue;
+		}
+
+		TerrainQuad* terrainQuad = leafSet->slotQuads[slot];
+
+		if (terrainQuad->tileData != NULL) {
+			terrainQuad->tileData->onUsed();
+		} else {
+			terrainQuad->getTileData();
+
+			if (terrainQuad->tileData != NULL) {
+				this->writeLeaf(leafSet, slot);
+			}
+		}
+	}
+
+	READBACK_BUFFER.release(feedback.region);
+}
+
+void TerrainRenderer::submitLeafFeedback(TerrainLeafSet* leafSet, uint32 leafCount) {
+	if (leafSet->feedback.size() >= MAX_LEAF_FEEDBACK_READBACKS) {
+		return;
+	}
+
+	const uint64 size = (leafCount + 1) * sizeof(uint32);
+	ReadbackRegion* region = READBACK_BUFFER.allocate(size);
+
+	if (region == NULL) {
+		return; // The readback buffer is full, try again next frame.
+	}
+
+	glCopyNamedBufferSubData(leafSet->feedbackBuffer, READBACK_BUFFER.getBuffer(), 0, region->offset, size);
+	READBACK_BUFFER.submit();
+
+	leafSet->feedback.push_back({ region, leafSet->frame });
+}
+
+void TerrainRenderer::updateLeaves(TerrainLeafSet* leafSet) {
+	std::vector<int32>& staleSlots = leafSet->staleSlots;
+	std::sort(staleSlots.begin(), staleSlots.end());
+	staleSlots.erase(std::unique(staleSlots.begin(), staleSlots.end()), staleSlots.end());
+
+	// A stale slot may have been released since.
+	for (int i = 0; i < staleSlots.size(); i++) {
+		if (staleSlots[i] < leafSet->slotQuads.size() && leafSet->slotQuads[staleSlots[i]] != NULL) {
+			this->writeLeaf(leafSet, staleSlots[i]);
+		}
+	}
+
+	staleSlots.clear();
+
+	// Unused slots at the end are dropped, so the culling shader only runs over the slots in use. Their indices are
+	// left in the free and dirty lists, and skipped there.
+	while (!leafSet->slotQuads.empty() && leafSet->slotQuads.back() == NULL) {
+		leafSet->leaves.pop_back();
+		leafSet->slotQuads.pop_back();
+		leafSet->slotFrames.pop_back();
+	}
+
+	this->uploadLeaves(leafSet);
+}
+
+void TerrainRenderer::writeLeaf(TerrainLeafSet* leafSet, int32 slot) {
+	TerrainQuad* terrainQuad = leafSet->slotQuads[slot];
+	const Frustum& bounds = terrainQuad->getDeformedBoundingBox();
+
+	PatchInfo patch;
+	patch.quad = terrainQuad;
+	patch.debug = fvec3(0.0, 0.0, 0.0);
+	patch.textureIndex = 0;
+	patch.textureCoords = fvec4(0.0);
+	patch.heightRange = fvec2(0.0);
+	this->applyTileData(patch, false);
+
+	TerrainLeaf leaf;
+	leaf.quadCorners = terrainQuad->getWorldCorners(); // Scaled by the compute shader, since the scale factor changes every frame.
+	leaf.quadNormals = terrainQuad->getWorldNormals();
+
+	for (int i = 0; i < 8; i++) {
+		leaf.boundCorners[i] = dvec4(bounds.getCorner((FrustumCorner) i), 1.0);
+	}
+
+	leaf.textureCoords = patch.textureCoords;
+	leaf.neighbourDivisions = getNeighbourDivisions(terrainQuad);
+	leaf.debug = patch.debug;
+	leaf.textureIndex = patch.textureIndex;
+	leaf.heightRange = patch.heightRange;
+	leaf.minHeight = (float) terrainQuad->getMinHeight();
+	leaf.used = 1;
+
+	TerrainLeaf& current = leafSet->leaves[slot];
+
+	if (memcmp(&leaf, &current, sizeof(TerrainLeaf)) != 0) {
+		current = leaf;
+		leafSet->dirtySlots.push_back(slot);
+	}
+}
+
+void TerrainRenderer::uploadLeaves(TerrainLeafSet* leafSet) {
+	const uint32 leafCount = leafSet->leaves.size();
+
+	if (leafCount > leafSet->leafBufferCapacity) {
+		leafSet->leafBufferCapacity = glm::max(leafCount, leafSet->leafBufferCapacity * 2);
+		glNamedBufferData(leafSet->leafBuffer, leafSet->leafBufferCapacity * sizeof(TerrainLeaf), NULL, GL_DYNAMIC_DRAW);
+
+		// The old contents are discarded, so every slot is uploaded.
+		glNamedBufferSubData(leafSet->leafBuffer, 0, leafCount * sizeof(TerrainLeaf), &leafSet->leaves[0]);
+		leafSet->dirtySlots.clear();
+		return;
+	}
+
+	std::vector<int32>& dirtySlots = leafSet->dirtySlots;
+	std::sort(dirtySlots.begin(), dirtySlots.end());
+
+	int i = 0;
+	while (i < dirtySlots.size() && dirtySlots[i] < leafCount) {
+		const int32 first = dirtySlots[i];
+		int32 last = first;
+
+		// Adjacent and repeated slots are merged into one range.
+		while (++i < dirtySlots.size() && dirtySlots[i] <= last + 1 && dirtySlots[i] < leafCount) {
+			last = dirtySlots[i];
+		}
+
+		glNamedBufferSubData(leafSet->leafBuffer, first * sizeof(TerrainLeaf), (last - first + 1) * sizeof(TerrainLeaf), &leafSet->leaves[first]);
+	}
+
+	dirtySlots.clear();
+}
+
+void TerrainRenderer::drawInstances(bool water) {
+	if (this->gpuCullingEnabled) {
+		this->terrainMesh->drawIndirect(this->drawCommandBuffer, water ? sizeof(DrawElementsIndirectCommand) : 0, 1, this->terrainInstanceBuffer);
+	} else {
+		const int32 first = water ? this->waterInstanceOffset : 0;
+		const int32 count = water ? this->numWaterInstances : this->numTerrainInstances;
+		const int32 baseInstance = this->frameBaseInstance + first;
+		this->terrainMesh->draw(count, 0, 0, this->terrainInstanceBuffer, baseInstance);
+	}
+}
+
+bool TerrainRenderer::isGpuCullingEnabled() const {
+	return this->gpuCullingEnabled;
+}
+
+int TerrainRenderer::getTerrainResolution() const {
+	return this->terrainResolution;
+}
+
+void TerrainRenderer::setGpuCullingEnabled(bool enabled) {
+	this->gpuCullingEnabled = enabled;
+
+	if (!enabled) {
+		// The quads' changes are not tracked while the CPU culls them, so the leaf sets are rebuilt when enabled again.
+		for (auto it = this->leafSets.begin(); it != this->leafSets.end(); it++) {
+			this->deleteLeafSet(it->second);
+		}
+		this->leafSets.clear();
+	}
+}
+
+PatchInfo TerrainRenderer::createPatch(TerrainQuad* terrainQuad, dmat4 localToScreen, double scaleFactor) {
 	PatchInfo patch;
 
 	patch.quad = terrainQuad;
 
 	const dmat4 normals = terrainQuad->getWorldNormals();
 	dmat4 corners = terrainQuad->getWorldCorners();
-	corners[0] *= dvec4(dvec3(Planet::scaleFactor), 1.0);
-	corners[1] *= dvec4(dvec3(Planet::scaleFactor), 1.0);
-	corners[2] *= dvec4(dvec3(Planet::scaleFactor), 1.0);
-	corners[3] *= dvec4(dvec3(Planet::scaleFactor), 1.0);
-
-	fvec2 tilePosition = fvec2(0.0, 0.0);
-	fvec2 tileSize = fvec2(1.0, 1.0);
-	TileData* tileData = terrainQuad->getTileData(&tilePosition, &tileSize);
+	corners[0] *= dvec4(dvec3(scaleFactor), 1.0);
+	corners[1] *= dvec4(dvec3(scaleFactor), 1.0);
+	corners[2] *= dvec4(dvec3(scaleFactor), 1.0);
+	corners[3] *= dvec4(dvec3(scaleFactor), 1.0);
 
 	//info.position = terrainQuad->getFacePosition();
 	//info.size = terrainQuad->getSize();
 	patch.debug = fvec3(0.0, 0.0, 0.0);
 	patch.textureIndex = 0;
-	patch.neighbourDivisions = ivec4(-1);
+	patch.neighbourDivisions = getNeighbourDivisions(terrainQuad);
 	patch.textureCoords = fvec4(0.0);
-
-	for (int i = 0; i < 4; i++) {
-		TerrainQuad* neighbourQuad = terrainQuad->getNeighbour((NeighbourIndex)i);
-		if (neighbourQuad != NULL) {
-			patch.neighbourDivisions[i] = neighbourQuad->getDepth() - terrainQuad->getDepth();
-			// -1 if neighbour is lower detail, +1 if neighbour is higher detail.
-		}
-	}
+	patch.heightRange = fvec2(0.0);
 
 	//if (pickedQuad != NULL) {
 	//	if (terrainQuad == pickedQuad) {
@@ -246,6 +672,17 @@ PatchInfo TerrainRenderer::createPatch(TerrainQuad* terrainQuad, dmat4 localToSc
 	//	}
 	//}
 
+	patch.quadCorners = localToScreen * corners;
+	patch.quadNormals = localToScreen * normals;
+
+	return patch;
+}
+
+void TerrainRenderer::applyTileData(PatchInfo& patch, bool acquire) {
+	fvec2 tilePosition = fvec2(0.0, 0.0);
+	fvec2 tileSize = fvec2(1.0, 1.0);
+	TileData* tileData = patch.quad->getTileData(&tilePosition, &tileSize, true, acquire);
+
 	if (tileData != NULL) {
 		double tileTimeCreated = (Time::now() - tileData->getTimeCreated()) / 1000000000.0;
 		double tileTimeGenerated = (Time::now() - tileData->getTimeGenerated()) / 1000000000.0;
@@ -259,19 +696,41 @@ PatchInfo TerrainRenderer::createPatch(TerrainQuad* terrainQuad, dmat4 localToSc
 
 		patch.textureIndex = tileData->getTextureIndex();
 		patch.textureCoords = fvec4(tilePosition, tileSize);
+		patch.heightRange = fvec2(tileData->getMinHeight(), tileData->getMaxHeight());
 	}
 
 	// set terrain quad tile active when in frustum.
 	// upload tile uniforms
 	//terrainQuad->getPlanet()->tileStorage->getTile(terrainQuad);
+}
 
-	patch.quadCorners = localToScreen * corners;
-	patch.quadNormals = localToScreen * normals;
+void TerrainRenderer::addRenderTasks(TerrainQuad* terrainQuad, int depth, dvec2 cameraFacePosition) {
+	if (terrainQuad == NULL) {
+		return;
+	}
 
-	return patch;
+	if (depth < this->taskDepth && !terrainQuad->isLeaf()) {
+		QuadIndex order[4] = { TOP_LEFT, TOP_RIGHT, BOTTOM_LEFT, BOTTOM_RIGHT };
+
+		terrainQuad->getNearFarOrdering(cameraFacePosition, order);
+
+		this->addRenderTasks(terrainQuad->getChild(order[0]), depth + 1, cameraFacePosition);
+		this->addRenderTasks(terrainQuad->getChild(order[1]), depth + 1, cameraFacePosition);
+		this->addRenderTasks(terrainQuad->getChild(order[2]), depth + 1, cameraFacePosition);
+		this->addRenderTasks(terrainQuad->getChild(order[3]), depth + 1, cameraFacePosition);
+		return;
+	}
+
+	if (this->numRenderTasks == this->renderTasks.size()) {
+		this->renderTasks.emplace_back();
+	}
+
+	TerrainRenderTask& task = this->renderTasks[this->numRenderTasks++];
+	task.terrainQuad = terrainQuad;
+	task.cameraFacePosition = cameraFacePosition;
 }
 
-void TerrainRenderer::doRender(TerrainQuad* terrainQuad, int depth, double r, dvec2 cameraFacePosition, dmat4 localToScreen, dmat4 faceTransformation, std::vector<PatchInfo>& terrainInstances, std::vector<PatchInfo>& waterInstances) {
+void TerrainRenderer::doRender(TerrainQuad* terrainQuad, int depth, dvec2 cameraFacePosition, dmat4 localToScreen, double scaleFactor, std::vector<PatchInfo>& terrainInstances) {
 
 	if (terrainQuad != NULL) {
 		Frustum bb = terrainQuad->getDeformedBoundingBox();
@@ -280,56 +739,21 @@ void TerrainRenderer::doRender(TerrainQuad* terrainQuad, int depth, double r, dv
 
 		if (visible) {
 			if (terrainQuad->isLeaf()) {
-				PatchInfo terrainPatch = this->createPatch(terrainQuad, localToScreen);
-
-				terrainInstances.push_back(terrainPatch);
-
-				if (terrainQuad->getMinHeight() <= 0.0) {
-					waterInstances.push_back(terrainPatch);
-				}
-
+				terrainInstances.push_back(this->createPatch(terrainQuad, localToScreen, scaleFactor));
 			} else {
 				QuadIndex order[4] = { TOP_LEFT, TOP_RIGHT, BOTTOM_LEFT, BOTTOM_RIGHT };
 
 				terrainQuad->getNearFarOrdering(cameraFacePosition, order);
 
-				this->doRender(terrainQuad->getChild(order[0]), depth + 1, r, cameraFacePosition, localToScreen, faceTransformation, terrainInstances, waterInstances);
-				this->doRender(terrainQuad->getChild(order[1]), depth + 1, r, cameraFacePosition, localToScreen, faceTransformation, terrainInstances, waterInstances);
-				this->doRender(terrainQuad->getChild(order[2]), depth + 1, r, cameraFacePosition, localToScreen, faceTransformation, terrainInstances, waterInstances);
-				this->doRender(terrainQuad->getChild(order[3]), depth + 1, r, cameraFacePosition, localToScreen, faceTransformation, terrainInstances, waterInstances);
+				this->doRender(terrainQuad->getChild(order[0]), depth + 1, cameraFacePosition, localToScreen, scaleFactor, terrainInstances);
+				this->doRender(terrainQuad->getChild(order[1]), depth + 1, cameraFacePosition, localToScreen, scaleFactor, terrainInstances);
+				this->doRender(terrainQuad->getChild(order[2]), depth + 1, cameraFacePosition, localToScreen, scaleFactor, terrainInstances);
+				this->doRender(terrainQuad->getChild(order[3]), depth + 1, cameraFacePosition, localToScreen, scaleFactor, terrainInstances);
 			}
 		}
 	}
 }
 
-void TerrainRenderer::threadProc(int32 id) {
-
-	//do {
-	//	logInfo("Thread waiting for terrain quads to process.");
-	//	std::unique_lock<std::mutex> lock(mut);
-	//	threadInput.wait(lock, [&] {
-	//		return !this->inputBuffers[id].empty();
-	//	});
-	//
-	//	if (!this->inputBuffers[id].empty()) {
-	//		TerrainRenderTask task = this->inputBuffers[id].front();
-	//		this->inputBuffers[id].pop_front();
-	//
-	//		logInfo("Received terrain quad");
-	//
-	//		std::vector<PatchInfo> instances = {};
-	//		this->doRender(task.terrainQuad, 0, task.planet->getRadius() * Planet::scaleFactor, task.cameraFacePosition, task.cameraToScreen, task.faceTransformation, instances);
-	//
-	//		logInfo("Thread created %d terrain instances", instances.size());
-	//
-	//		this->outputBuffer[id] = instances;
-	//	}
-	//
-	//	lock.unlock();
-	//	this->threadOutput.notify_all();
-	//} while (true);
-}
-
 
 MeshData* TerrainRenderer::createTerrainTileMesh() {
 	return MeshHelper::createPlane(fvec2(0.0F), fvec2(1.0F), ivec2(this->terrainResolution), mat3(1.0F), true, NULL, TERRAIN_VERTEX_LAYOUT);
@@ -1,9 +1,6 @@
 #pragma once
 
 #include "core/Core.h"
-#include <thread>
-#include <mutex>
-#include <condition_variable>
 
 class GLMesh;
 class MeshData;
@@ -11,31 +8,84 @@ class ShaderProgram;
 class Planet;
 class TerrainQuad;
 class InstanceBuffer;
+class ThreadPool;
 struct VertexLayout;
+struct ReadbackRegion;
 enum CubeFace;
 
 #define TERRAIN_VERTEX_LAYOUT VertexLayout(8, {        \
 	VertexAttribute(0, 2, 0),					       \
 }, [](Vertex v) -> std::vector<float> { return std::vector<float> {float(v.position.x), float(v.position.z)}; })
 
+// The offsets of the instance attributes must match writePatch in cullComp.glsl
 struct PatchInfo {
-	TerrainQuad* quad;
 	fvec3 debug;
 	int32 textureIndex;
 	ivec4 neighbourDivisions;
 	fvec4 textureCoords;
+	fvec2 heightRange; // The height range of the tile texture, needed to decode packed texels.
 
 	fmat4 quadCorners;
 	fmat4 quadNormals;
+
+	TerrainQuad* quad; // Last, so the attribute offsets are the same for 32 and 64 bit builds.
+};
+
+/**
+ * A leaf of the terrain quad tree, as stored in the leaf buffer for GPU culling. Must match the std430 layout of
+ * TerrainLeaf in cullComp.glsl
+ */
+struct TerrainLeaf {
+	dmat4 quadCorners; // Unscaled, in local planet space.
+	fmat4 quadNormals;
+	dvec4 boundCorners[8]; // The deformed bounding box in local planet space, in FrustumCorner order.
+	fvec4 textureCoords;
+	ivec4 neighbourDivisions;
+	fvec3 debug;
+	int32 textureIndex;
+	fvec2 heightRange;
+	float minHeight; // Leaves below sea level are also drawn as water.
+	int32 used; // Zero for an unused slot, which the culling shader skips.
+};
+
+/**
+ * The slots of the leaves the culling shader found visible in one frame, read back to acquire and keep alive their
+ * tiles. The region holds the number of visible slots, followed by the slots.
+ */
+struct TerrainLeafFeedback {
+	ReadbackRegion* region;
+	uint64 frame; // The frame the leaves were culled in.
+};
+
+/**
+ * Every leaf of one planet's quad tree, and the buffer they are uploaded to for GPU culling. The quads report when
+ * they become or stop being leaves, and when anything their leaf is built from changes, so the leaves are kept up to
+ * date without walking the tree. Only the slots that changed are uploaded. Kept per planet, since the slots are
+ * stored in the planet's quads.
+ */
+struct TerrainLeafSet {
+	std::vector<TerrainLeaf> leaves; // The contents of the leaf buffer, indexed by slot.
+	std::vector<TerrainQuad*> slotQuads; // The leaf in each slot, or NULL if the slot is unused.
+	std::vector<uint64> slotFrames; // The first frame each slot is culled with its quad, so older feedback is ignored.
+	std::vector<int32> freeSlots; // Unused slots below the end of the leaves, reused before the leaves grow.
+	std::vector<int32> staleSlots; // The slots whose quad changed, which are rewritten before the next cull.
+	std::vector<int32> dirtySlots; // The slots changed this frame, which are uploaded.
+	std::deque<TerrainLeafFeedback> feedback; // The visibility readbacks in flight, oldest first.
+	uint32 leafBuffer; // Every slot of the leaves.
+	uint32 leafBufferCapacity; // The number of leaves that fit in the leaf buffer.
+	uint32 feedbackBuffer; // The visible slots written by the culling shader, preceded by their count.
+	uint32 feedbackBufferCapacity; // The number of slots that fit in the feedback buffer.
+	uint64 frame; // Incremented every frame the leaves are culled.
 };
 
+/**
+ * A sub-tree of one cube face, culled and turned into patches by a worker thread. The patches have no tile
+ * data yet, since tiles can only be acquired on the render thread.
+ */
 struct TerrainRenderTask {
 	TerrainQuad* terrainQuad;
-	Planet* planet;
-
-	dmat4 faceTransformation;
-	dmat4 cameraToScreen;
 	dvec2 cameraFacePosition;
+	std::vector<PatchInfo> instances; // The patches of the visible leaves of the sub-tree, in near to far order.
 };
 
 class TerrainRenderer {
@@ -43,28 +93,153 @@ private:
 	GLMesh* terrainMesh;
 	ShaderProgram* terrainProgram;
 	ShaderProgram* waterProgram;
-	InstanceBuffer* terrainInstanceBuffer;
+	InstanceBuffer* terrainInstanceBuffer; // Persistently mapped, triple buffered patches of all six faces of every planet.
+	uint64 instanceFrameIndex; // The application frame the instance buffer was last advanced in.
+	int32 frameBaseInstance; // The first instance of the range reserved for the planet being rendered.
 
-	std::thread threads[4];
-	std::deque<TerrainRenderTask> inputBuffers[4];
-	std::vector<PatchInfo> outputBuffer[4];
-	std::condition_variable threadInput;
-	std::condition_variable threadOutput;
-	std::mutex mut;
+	ThreadPool* threadPool; // Workers that cull the render tasks in parallel.
+	std::vector<TerrainRenderTask> renderTasks; // The sub-trees of all six faces. Kept between frames so the instance vectors keep their capacity.
+	uint32 numRenderTasks; // The number of render tasks used this frame.
+	int32 taskDepth; // The depth of the sub-trees that are culled as separate tasks. Each face is split into up to 4^taskDepth tasks.
 
-	int terrainResolution;
+	int32 numTerrainInstances; // The number of patches of every task written this frame.
+	int32 numWaterInstances; // The number of those patches that are below sea level.
+	int32 waterInstanceOffset; // The index of the first water patch in the planet's range of the instance buffer.
+
+	bool gpuCullingEnabled; // True if the leaves are culled by a compute shader and drawn indirectly, instead of culled on the CPU.
+	ShaderProgram* cullingProgram; // The compute shader that culls the leaves and writes the patches and draw commands.
+	uint32 drawCommandBuffer; // The terrain and water indirect draw commands, with instance counts written by the culling shader.
+	std::unordered_map<const Planet*, TerrainLeafSet*> leafSets; // The leaves of each planet rendered with GPU culling.
 
-	PatchInfo createPatch(TerrainQuad* terrainQuad, dmat4 localToScreen);
+	int terrainResolution;
 
-	void doRender(TerrainQuad* terrainQuad, int depth, double r, dvec2 cameraFacePosition, dmat4 localToScreen, dmat4 faceTransformation, std::vector<PatchInfo>& terrainInstances, std::vector<PatchInfo>& waterInstances);
+	/**
+	 * Create the patch for the terrain quad, without any tile data, with its corners scaled by the view's scale
+	 * factor. Safe to call from a worker thread.
+	 */
+	PatchInfo createPatch(TerrainQuad* terrainQuad, dmat4 localToScreen, double scaleFactor);
+
+	/**
+	 * Fill in the tile data of the patch from its terrain quad's tile. If acquire is true, the tile is acquired if the
+	 * quad has none, and marked as used. Must be called on the render thread, since it can modify the tile supplier.
+	 */
+	void applyTileData(PatchInfo& patch, bool acquire = true);
+
+	/**
+	 * Add a render task for every sub-tree at the task depth below the terrain quad, in near to far order.
+	 */
+	void addRenderTasks(TerrainQuad* terrainQuad, int depth, dvec2 cameraFacePosition);
+
+	void doRender(TerrainQuad* terrainQuad, int depth, dvec2 cameraFacePosition, dmat4 localToScreen, double scaleFactor, std::vector<PatchInfo>& terrainInstances);
+
+	/**
+	 * Cull the quads of all six faces on the worker threads, leaving the patches of the visible leaves, without tile
+	 * data, in the render tasks.
+	 */
+	void cullRenderTasks(Planet* planet, dmat4 localToScreen, double scaleFactor);
+
+	/**
+	 * Cull the quads of all six faces on the worker threads, and write the visible patches to the instance buffer.
+	 */
+	void cullOnCpu(Planet* planet, dmat4 localToScreen, double scaleFactor);
+
+	/**
+	 * Cull the leaves with the compute shader, which writes the visible patches to the instance buffer and the
+	 * instance counts to the draw commands, and the visible slots to the feedback buffer. Nothing is culled on the CPU.
+	 */
+	void cullOnGpu(Planet* planet, dmat4 localToScreen, double scaleFactor);
+
+	/**
+	 * The leaf set of the planet, or NULL if it has none.
+	 */
+	TerrainLeafSet* getLeafSet(const Planet* planet) const;
+
+	/**
+	 * Create the leaf set of the planet, with a slot for every current leaf. This is the only time the tree is walked.
+	 */
+	TerrainLeafSet* createLeafSet(Planet* planet);
+
+	/**
+	 * Release the buffers and readbacks of the leaf set, and delete it.
+	 */
+	void deleteLeafSet(TerrainLeafSet* leafSet);
+
+	/**
+	 * Add every leaf below the quad to its planet's leaf set.
+	 */
+	void addLeaves(TerrainQuad* terrainQuad);
+
+	/**
+	 * Acquire the tiles of the leaves in the newest visibility feedback that is ready, and mark them as used, so the
+	 * tiles of leaves out of view expire. Earlier feedback that is ready is discarded.
+	 */
+	void readLeafFeedback(TerrainLeafSet* leafSet);
+
+	/**
+	 * Copy the visible slots written by the culling shader into the readback buffer, unless too many readbacks are
+	 * still in flight.
+	 */
+	void submitLeafFeedback(TerrainLeafSet* leafSet, uint32 leafCount);
+
+	/**
+	 * Rewrite the stale leaves, and upload the slots that changed.
+	 */
+	void updateLeaves(TerrainLeafSet* leafSet);
+
+	/**
+	 * Write the leaf of the quad in the slot, from the tile the quad already has, without acquiring one. Marks the
+	 * slot dirty if the leaf changed.
+	 */
+	void writeLeaf(TerrainLeafSet* leafSet, int32 slot);
+
+	/**
+	 * Upload the dirty slots of the leaf set, with one upload for each contiguous range.
+	 */
+	void uploadLeaves(TerrainLeafSet* leafSet);
+
+	/**
+	 * Draw this frame's terrain or water patches with the currently bound shader.
+	 */
+	void drawInstances(bool water);
 
-	void threadProc(int32 id);
 public:
 	TerrainRenderer(int terrainResolution);
 
 	~TerrainRenderer();
 
-	void render(Planet* planet, CubeFace face, TerrainQuad* terrainQuad, double partialTicks, double dt);
+	/**
+	 * Render all six cube faces of the planet. The faces are culled and turned into patches in parallel, then
+	 * drawn with one instanced draw per shader. Any number of planets may be rendered with the same renderer, at the
+	 * scale factor of the scene's camera.
+	 */
+	void render(Planet* planet, double partialTicks, double dt);
+
+	/**
+	 * Release everything kept for the planet between frames. Called when a planet sharing this renderer is deleted.
+	 */
+	void removePlanet(const Planet* planet);
+
+	/**
+	 * Called by a quad when it becomes a leaf, so it is given a slot in its planet's leaf set.
+	 */
+	void onLeafAdded(TerrainQuad* terrainQuad);
+
+	/**
+	 * Called by a quad when it is split or deleted, so its slot is released.
+	 */
+	void onLeafRemoved(TerrainQuad* terrainQuad);
+
+	/**
+	 * Called when the bounds, neighbours or tile of a quad change, so its leaf is rewritten before the next cull.
+	 * Ignored if the quad is not a leaf.
+	 */
+	void onLeafChanged(TerrainQuad* terrainQuad);
+
+	bool isGpuCullingEnabled() const;
+
+	void setGpuCullingEnabled(bool enabled);
+
+	int getTerrainResolution() const;
 
 	MeshData* createTerrainTileMesh();
 };
@@ -0,0 +1,302 @@
+#include "TerrainSnapshot.h"
+#include "core/application/Application.h"
+#include "core/engine/terrain/Planet.h"
+#include "core/engine/terrain/TerrainQuad.h"
+#include "core/engine/terrain/LinearQuadTree.h"
+#include "core/engine/terrain/TileSupplier.h"
+#include "core/util/Time.h"
+#include <xmmintrin.h>
+
+TerrainSnapshot::TerrainSnapshot(Planet* planet, const TerrainSnapshot* previous):
+	missed(NULL), radius(planet->getRadius()), elevationScale(planet->getElevationScale()), maxDepth(planet->getMaxSplitDepth()), timeCreated(Time::now()) {
+
+	for (int i = 0; i < 6; i++) {
+		this->faceOrientations[i] = planet->getFaceOrientation((CubeFace)i);
+	}
+
+	if (previous != NULL) {
+		this->nodes.reserve(previous->nodes.size());
+		this->tiles.reserve(previous->tiles.size());
+
+		// Read back the tiles that were wanted since the previous snapshot, if they still belong to the same quad.
+		for (int i = 0; i < previous->missedQuads.size(); i++) {
+			if (!previous->missed[i].load(std::memory_order_relaxed)) {
+				continue;
+			}
+
+			const MissedQuad& missedQuad = previous->missedQuads[i];
+			TerrainQuad* terrainQuad = planet->getLinearQuadTree()->find((CubeFace)missedQuad.face, missedQuad.depth, missedQuad.treePosition);
+
+			if (terrainQuad != NULL && terrainQuad->tileData != NULL) {
+				TileData* tile = terrainQuad->tileData;
+
+				if (tile->id == missedQuad.tileId && tile->generated && !tile->textureDataValid && !tile->awaitingReadbackResponse) {
+					tile->requestAsyncReadback();
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < 6; i++) {
+		this->addQuad(planet->getCubeFace((CubeFace)i), previous);
+	}
+
+	this->missed = new std::atomic<bool>[this->missedQuads.size()];
+	for (int i = 0; i < this->missedQuads.size(); i++) {
+		this->missed[i].store(false, std::memory_order_relaxed);
+	}
+}
+
+TerrainSnapshot::~TerrainSnapshot() {
+	delete[] this->missed;
+}
+
+fvec2 TerrainSnapshot::addQuad(const TerrainQuad* terrainQuad, const TerrainSnapshot* previous) {
+	Node node;
+	node.tileIndex = -1;
+	node.missIndex = -1;
+	node.heightRange = fvec2(-1.0F, +1.0F); // The whole range of the tile generator, until the tile's range is known.
+	node.leaf = terrainQuad->children == NULL;
+
+	const TileData* tile = terrainQuad->tileData;
+
+	if (tile != NULL && tile->generated && !tile->awaitingHeightRange) {
+		node.heightRange = fvec2(tile->minHeight, tile->maxHeight);
+
+		if (tile->textureDataValid) {
+			auto it = this->tileIndices.find(tile->id);
+
+			if (it != this->tileIndices.end()) {
+				node.tileIndex = it->second;
+			} else {
+				std::shared_ptr<const TerrainSnapshotTile> snapshotTile = NULL;
+
+				if (previous != NULL) {
+					auto prev = previous->tileIndices.find(tile->id);
+					if (prev != previous->tileIndices.end() && previous->tiles[prev->second]->textureDataVersion == tile->textureDataVersion) {
+						snapshotTile = previous->tiles[prev->second];
+					}
+				}
+
+				if (snapshotTile == NULL) {
+					TerrainSnapshotTile* copy = new TerrainSnapshotTile();
+					copy->id = tile->id;
+					copy->textureDataVersion = tile->textureDataVersion;
+					copy->size = tile->supplier->getTileSize();
+					copy->texels.resize(copy->size * copy->size * 4);
+
+					const int32 texelCount = copy->size * copy->size;
+					if (tile->supplier->isPackedTexels()) {
+						const uint16* packed = reinterpret_cast<const uint16*>(tile->textureData);
+						for (int i = 0; i < texelCount; i++) {
+							const fvec4 texel = fvec4(TileData::unpackTexel(packed + i * 3, tile->minHeight, tile->maxHeight));
+							memcpy(&copy->texels[i * 4], &texel[0], sizeof(float) * 4);
+						}
+					} else {
+						memcpy(&copy->texels[0], tile->textureData, sizeof(float) * 4 * texelCount);
+					}
+
+					snapshotTile = std::shared_ptr<const TerrainSnapshotTile>(copy);
+				}
+
+				node.tileIndex = this->tiles.size();
+				this->tileIndices[tile->id] = node.tileIndex;
+				this->tiles.push_back(snapshotTile);
+			}
+		} else {
+			MissedQuad missedQuad;
+			missedQuad.face = terrainQuad->face;
+			missedQuad.depth = terrainQuad->depth;
+			missedQuad.treePosition = terrainQuad->treePosition;
+			missedQuad.tileId = tile->id;
+
+			node.missIndex = this->missedQuads.size();
+			this->missedQuads.push_back(missedQuad);
+		}
+	}
+
+	if (terrainQuad->children != NULL) {
+		// The children together cover the quad at a finer resolution, which may reach past the range of its own tile.
+		node.heightRange = fvec2(+INFINITY, -INFINITY);
+
+		for (int i = 0; i < 4; i++) {
+			const fvec2 childRange = this->addQuad(&terrainQuad->children[i], previous);
+			node.heightRange.x = glm::min(node.heightRange.x, childRange.x);
+			node.heightRange.y = glm::max(node.heightRange.y, childRange.y);
+		}
+	}
+
+	this->nodes[LinearQuadTree::getKey(terrainQuad->face, terrainQuad->depth, terrainQuad->treePosition)] = node;
+	return node.heightRange;
+}
+
+const TerrainSnapshot::Node* TerrainSnapshot::findNode(int32 face, int32 depth, uvec2 treePosition) const {
+	auto it = this->nodes.find(LinearQuadTree::getKey((CubeFace)face, depth, treePosition));
+	return it != this->nodes.end() ? &it->second : NULL;
+}
+
+fvec4 TerrainSnapshot::sampleTexels(const TerrainSnapshotTile* tile, fvec2 texelPosition) {
+	const int32 size = tile->size;
+
+	const int32 x0 = glm::min((int32) texelPosition.x, size - 1);
+	const int32 y0 = glm::min((int32) texelPosition.y, size - 1);
+	const int32 x1 = glm::min(x0 + 1, size - 1);
+	const int32 y1 = glm::min(y0 + 1, size - 1);
+	const __m128 fx = _mm_set1_ps(texelPosition.x - x0);
+	const __m128 fy = _mm_set1_ps(texelPosition.y - y0);
+
+	// Each texel is one vector of normal xyz and height w, so all four channels are filtered at once.
+	const float* texels = tile->texels.data();
+	const __m128 t00 = _mm_loadu_ps(&texels[(x0 + y0 * size) * 4]);
+	const __m128 t10 = _mm_loadu_ps(&texels[(x1 + y0 * size) * 4]);
+	const __m128 t01 = _mm_loadu_ps(&texels[(x0 + y1 * size) * 4]);
+	const __m128 t11 = _mm_loadu_ps(&texels[(x1 + y1 * size) * 4]);
+
+	const __m128 t0 = _mm_add_ps(t00, _mm_mul_ps(_mm_sub_ps(t10, t00), fx));
+	const __m128 t1 = _mm_add_ps(t01, _mm_mul_ps(_mm_sub_ps(t11, t01), fx));
+	const __m128 t = _mm_add_ps(t0, _mm_mul_ps(_mm_sub_ps(t1, t0), fy));
+
+	alignas(16) float texel[4];
+	_mm_store_ps(texel, t);
+	return fvec4(texel[0], texel[1], texel[2], texel[3]);
+}
+
+fvec2 TerrainSnapshot::getTexelPosition(const TerrainSnapshotTile* tile, dvec2 quadPosition) {
+	const float size = (float) tile->size;
+	return glm::clamp(fvec2(1.0 - quadPosition) * size, fvec2(0.0F), fvec2(size - 1.0F));
+}
+
+const TerrainSnapshot::Node* TerrainSnapshot::findNode(dvec3 sphereVector, int32* depth, dvec2* quadPosition) const {
+	// Project onto the face the vector points at most directly, the same way quads are deformed onto the sphere.
+	int32 face = 0;
+	double faceDot = -INFINITY;
+	for (int i = 0; i < 6; i++) {
+		const double d = dot(sphereVector, this->faceOrientations[i][1]);
+		if (d > faceDot) {
+			faceDot = d;
+			face = i;
+		}
+	}
+
+	const dmat3& r = this->faceOrientations[face];
+	const dvec2 position = dvec2(dot(sphereVector, r[0]), dot(sphereVector, r[2])) / faceDot * 0.5 + 0.5;
+
+	// The cell containing the point at the maximum depth. Every quad containing the point is one of its ancestors,
+	// and every ancestor of a quad in the snapshot is also in the snapshot, so the deepest can be binary searched.
+	const uint32 n = uint32(1) << this->maxDepth;
+	const uvec2 cell = uvec2(glm::clamp(ivec2(glm::floor(position * double(n))), ivec2(0), ivec2(n - 1)));
+
+	auto find = [&](int32 d) -> const Node* {
+		const uint32 shift = this->maxDepth - d;
+		return this->findNode(face, d, uvec2(cell.x >> shift, cell.y >> shift));
+	};
+
+	int32 lo = 0;
+	int32 hi = this->maxDepth;
+	while (lo < hi) {
+		const int32 mid = (lo + hi + 1) / 2;
+
+		if (find(mid) != NULL) {
+			lo = mid;
+		} else {
+			hi = mid - 1;
+		}
+	}
+
+	const Node* node = find(lo);
+
+	if (node != NULL) {
+		const uint32 shift = this->maxDepth - lo;
+		*depth = lo;
+		*quadPosition = position * double(uint32(1) << lo) - dvec2(uvec2(cell.x >> shift, cell.y >> shift));
+	}
+
+	return node;
+}
+
+void TerrainSnapshot::sampleSphereVectors(int32 count, const dvec3* sphereVectors, TerrainSample* samples) const {
+	struct Lookup {
+		int32 tileIndex;
+		int32 sampleIndex;
+		fvec2 texelPosition;
+	};
+
+	std::vector<Lookup> lookups;
+	lookups.reserve(count);
+
+	for (int i = 0; i < count; i++) {
+		TerrainSample& sample = samples[i];
+		sample.normal = fvec3(normalize(sphereVectors[i]));
+		sample.elevation = 0.0F;
+		sample.depth = -1;
+		sample.valid = false;
+
+		int32 depth;
+		dvec2 quadPosition;
+		const Node* node = this->findNode(sphereVectors[i], &depth, &quadPosition);
+
+		if (node == NULL) {
+			continue;
+		}
+
+		sample.depth = depth;
+
+		if (node->tileIndex < 0) {
+			if (node->missIndex >= 0) {
+				this->missed[node->missIndex].store(true, std::memory_order_relaxed);
+			}
+			continue;
+		}
+
+		Lookup lookup;
+		lookup.tileIndex = node->tileIndex;
+		lookup.sampleIndex = i;
+		lookup.texelPosition = getTexelPosition(this->tiles[node->tileIndex].get(), quadPosition);
+		lookups.push_back(lookup);
+	}
+
+	// Sample one tile at a time, so its texels stay in the cache.
+	std::sort(lookups.begin(), lookups.end(), [](const Lookup& a, const Lookup& b) {
+		return a.tileIndex < b.tileIndex;
+	});
+
+	for (int i = 0; i < lookups.size(); i++) {
+		const Lookup& lookup = lookups[i];
+		const fvec4 texel = sampleTexels(this->tiles[lookup.tileIndex].get(), lookup.texelPosition);
+
+		if (isnan(texel[3])) {
+			continue;
+		}
+
+		TerrainSample& sample = samples[lookup.sampleIndex];
+		const fvec3 normal = fvec3(texel[0], texel[1], texel[2]);
+		const float length = glm::length(normal);
+		if (length > 1e-6F) {
+			sample.normal = normal / length;
+		}
+		sample.elevation = texel[3];
+		sample.valid = true;
+	}
+}
+
+void TerrainSnapshot::sampleLocalPoints(int32 count, const dvec3* localPoints, TerrainSample* samples) const {
+	std::vector<dvec3> sphereVectors(count);
+
+	for (int i = 0; i < count; i++) {
+		sphereVectors[i] = normalize(localPoints[i]);
+	}
+
+	this->sampleSphereVectors(count, sphereVectors.data(), samples);
+}
+
+uint32 TerrainSnapshot::getNodeCount() const {
+	return this->nodes.size();
+}
+
+uint32 TerrainSnapshot::getTileCount() const {
+	return this->tiles.size();
+}
+
+uint64 TerrainSnapshot::getTimeCreated() const {
+	return this->timeCreated;
+}
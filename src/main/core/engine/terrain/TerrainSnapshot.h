@@ -0,0 +1,121 @@
+#pragma once
+
+#include "core/Core.h"
+#include <atomic>
+#include <memory>
+
+class Planet;
+class TerrainQuad;
+
+/**
+ * The surface of a planet at one point, as returned by a batched surface query.
+ */
+struct TerrainSample {
+	fvec3 normal; // The surface normal in local planet space. Points straight up if the sample is not valid.
+	float elevation; // The elevation of the surface, in the same units as Planet::getElevation. Zero if the sample is not valid.
+	int32 depth; // The depth of the quad the sample was taken from, which is the level of detail of the sample.
+	bool valid; // False if the tile of the quad containing the point had no texture data on the CPU.
+};
+
+/**
+ * A decoded copy of the texture data of one tile, shared between snapshots for as long as the tile data is unchanged.
+ */
+struct TerrainSnapshotTile {
+	uvec3 id; // The id of the tile the data was copied from.
+	uint32 textureDataVersion; // The version of the tile data that was copied.
+	int32 size; // The width and height of the tile in texels.
+	std::vector<float> texels; // RGBA32F texels, normal xyz and height w, decoded from packed texels if necessary.
+};
+
+/**
+ * A read-only copy of a planet's quad tree, and of the texture data of its tiles that is available on the CPU. A
+ * snapshot is built on the main thread at the end of a planet update, after which it never changes. Any number of
+ * threads may query it concurrently, while the planet carries on splitting and merging quads and evicting tiles.
+ */
+class TerrainSnapshot {
+private:
+	friend class TerrainRayCaster;
+
+	struct Node {
+		int32 tileIndex; // The index of the quad's tile data in the tiles array, or -1 if it has none on the CPU.
+		int32 missIndex; // The index of the quad in the missed array, or -1 if it has no generated tile to read back.
+		fvec2 heightRange; // Conservative min and max elevation of the quad and everything below it.
+		bool leaf; // True if the quad had no children.
+	};
+
+	struct MissedQuad {
+		int32 face; // The CubeFace of the quad.
+		int32 depth;
+		uvec2 treePosition;
+		uvec3 tileId;
+	};
+
+	std::unordered_map<uint64, Node> nodes; // Every quad of the tree, keyed as in LinearQuadTree.
+	std::vector<std::shared_ptr<const TerrainSnapshotTile>> tiles;
+	std::unordered_map<uvec3, int32> tileIndices; // The index of every tile in the tiles array, by tile id.
+
+	std::vector<MissedQuad> missedQuads; // The quads whose tile was generated, but not read back when the snapshot was built.
+	std::atomic<bool>* missed; // Set by queries that wanted the texture data of the corresponding missed quad.
+
+	dmat3 faceOrientations[6];
+	double radius;
+	double elevationScale;
+	int32 maxDepth;
+	uint64 timeCreated;
+
+	/**
+	 * Add the quad and everything below it, returning the height range of the subtree.
+	 */
+	fvec2 addQuad(const TerrainQuad* terrainQuad, const TerrainSnapshot* previous);
+
+	const Node* findNode(int32 face, int32 depth, uvec2 treePosition) const;
+
+	/**
+	 * Bilinearly filter the four channels of the tile at the texel position, with SSE.
+	 */
+	static fvec4 sampleTexels(const TerrainSnapshotTile* tile, fvec2 texelPosition);
+
+	/**
+	 * The texel position in the tile of a position normalized over its quad. Texel (x, y) is generated at the tile
+	 * position (x, y) / size, and tile positions are flipped relative to positions within the quad.
+	 */
+	static fvec2 getTexelPosition(const TerrainSnapshotTile* tile, dvec2 quadPosition);
+
+	/**
+	 * Find the deepest quad containing the sphere vector, returning its node, depth, and the position of the
+	 * point normalized over the quad.
+	 */
+	const Node* findNode(dvec3 sphereVector, int32* depth, dvec2* quadPosition) const;
+
+public:
+	/**
+	 * Build a snapshot of the planet's quad tree on the main thread. Tile copies are taken from the previous snapshot
+	 * wherever the tile data did not change. Texture readbacks are requested for the tiles that queries against the
+	 * previous snapshot needed but could not sample.
+	 */
+	TerrainSnapshot(Planet* planet, const TerrainSnapshot* previous);
+
+	~TerrainSnapshot();
+
+	// Deleted copy constructor and assignment function
+	TerrainSnapshot(const TerrainSnapshot&) = delete;
+	TerrainSnapshot& operator=(const TerrainSnapshot&) = delete;
+
+	/**
+	 * Sample the height and normal of the surface at each of the normalized sphere vectors. The samples are grouped by
+	 * tile, and each is bilinearly filtered with SSE. This is thread safe.
+	 */
+	void sampleSphereVectors(int32 count, const dvec3* sphereVectors, TerrainSample* samples) const;
+
+	/**
+	 * Sample the height and normal of the surface directly below or above each of the points in local planet space.
+	 * This is thread safe.
+	 */
+	void sampleLocalPoints(int32 count, const dvec3* localPoints, TerrainSample* samples) const;
+
+	uint32 getNodeCount() const;
+
+	uint32 getTileCount() const;
+
+	uint64 getTimeCreated() const;
+};
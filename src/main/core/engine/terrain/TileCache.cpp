@@ -0,0 +1,328 @@
+#include "TileCache.h"
+#include "core/application/Application.h"
+#include "core/util/MappedFile.h"
+#include "core/util/ThreadPool.h"
+#include <chrono>
+
+#define TILE_CACHE_MAGIC 0x31435450 // "PTC1"
+#define TILE_CACHE_RECORD_MAGIC 0x444C4954 // "TILD"
+#define TILE_CACHE_FORMAT_VERSION 3
+#define TILE_CACHE_TOUCH_INTERVAL 3600 // The last used time of a record read more often than this, in seconds, is only updated once.
+
+static uint32 getCurrentTime() {
+	return (uint32) std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+TileCache::TileCache(std::string directory, uint32 seed, uint32 tileSize, uint32 texelSize, uint32 generatorVersion, uint64 maxSize) {
+	this->file = NULL;
+	this->writeThread = NULL;
+	this->tileSize = tileSize;
+	this->texelSize = texelSize;
+	this->dataSize = tileSize * tileSize * texelSize;
+	this->maxSize = maxSize;
+	this->full = false;
+	this->numHits = 0;
+	this->numMisses = 0;
+	this->numWrites = 0;
+	this->bytesRead = 0;
+	this->bytesWritten = 0;
+
+	std::error_code error;
+	std::filesystem::create_directories(directory, error);
+
+	std::stringstream name;
+	name << "tiles_" << seed << "_" << tileSize << "_" << texelSize << "_v" << generatorVersion << ".cache";
+	std::string path = (std::filesystem::path(directory) / name.str()).string();
+
+	this->file = new MappedFile();
+
+	if (!this->file->open(path, true)) {
+		logWarn("Failed to open tile cache \"%s\", generated tiles will not be stored on disk", path.c_str());
+		delete this->file;
+		this->file = NULL;
+		return;
+	}
+
+	TileCacheHeader header = {};
+	header.magic = TILE_CACHE_MAGIC;
+	header.formatVersion = TILE_CACHE_FORMAT_VERSION;
+	header.seed = seed;
+	header.tileSize = tileSize;
+	header.generatorVersion = generatorVersion;
+	header.texelSize = texelSize;
+
+	const uint8* data = this->file->map(sizeof(TileCacheHeader));
+
+	if (data != NULL && memcmp(data, &header, sizeof(TileCacheHeader)) == 0) {
+		this->buildIndex(sizeof(TileCacheHeader));
+
+		if (this->file->getSize() > this->maxSize) {
+			this->compact(header);
+
+			if (!this->file->isOpen()) {
+				logWarn("Failed to reopen tile cache \"%s\", generated tiles will not be stored on disk", path.c_str());
+				delete this->file;
+				this->file = NULL;
+				return;
+			}
+		}
+	} else {
+		if (this->file->getSize() > 0) {
+			logWarn("Tile cache \"%s\" has an invalid header, discarding its contents", path.c_str());
+		}
+
+		this->file->truncate(0);
+		this->file->append(&header, sizeof(TileCacheHeader));
+	}
+
+	logInfo("Opened tile cache \"%s\" containing %d tiles (%.2f MiB)", path.c_str(), this->index.size(), this->file->getSize() / (1024.0 * 1024.0));
+
+	this->writeThread = new ThreadPool(1);
+}
+
+TileCache::~TileCache() {
+	if (this->writeThread != NULL) {
+		delete this->writeThread; // Completes the queued writes before joining.
+	}
+
+	if (this->file != NULL) {
+		logInfo("Closing tile cache: %llu hits, %llu misses, %llu tiles written, %.2f MiB read, %.2f MiB written",
+			(uint64) this->numHits,
+			(uint64) this->numMisses,
+			(uint64) this->numWrites,
+			this->bytesRead / (1024.0 * 1024.0),
+			this->bytesWritten / (1024.0 * 1024.0)
+		);
+
+		delete this->file;
+	}
+}
+
+void TileCache::buildIndex(uint64 headerSize) {
+	const uint64 size = this->file->getSize();
+	const uint8* data = this->file->map(size);
+	const uint64 recordSize = sizeof(TileCacheRecord) + this->dataSize;
+
+	uint64 offset = headerSize;
+
+	if (data != NULL) {
+		while (offset + recordSize <= size) {
+			TileCacheRecord record;
+			memcpy(&record, data + offset, sizeof(TileCacheRecord));
+
+			if (record.magic != TILE_CACHE_RECORD_MAGIC || record.dataSize != this->dataSize) {
+				break;
+			}
+
+			TileCacheEntry& entry = this->index[uvec4(record.key[0], record.key[1], record.key[2], record.key[3])]; // Later records replace earlier ones.
+			entry.offset = offset;
+			entry.lastUsed = record.lastUsed;
+			offset += recordSize;
+		}
+	}
+
+	if (offset != size) {
+		logWarn("Discarding %llu bytes of incomplete records at the end of the tile cache", size - offset);
+		this->file->truncate(offset);
+	}
+}
+
+void TileCache::compact(const TileCacheHeader& header) {
+	const uint64 recordSize = sizeof(TileCacheRecord) + this->dataSize;
+	const uint64 targetSize = this->maxSize / 4 * 3;
+	const uint64 oldSize = this->file->getSize();
+	const std::string path = this->file->getPath();
+	const std::string tempPath = path + ".tmp";
+
+	std::vector<TileCacheEntry> entries;
+	entries.reserve(this->index.size());
+
+	for (auto it = this->index.begin(); it != this->index.end(); it++) {
+		entries.push_back(it->second);
+	}
+
+	std::sort(entries.begin(), entries.end(), [](const TileCacheEntry& a, const TileCacheEntry& b) {
+		return a.lastUsed > b.lastUsed;
+	});
+
+	// Written beside the cache and moved over it once complete, so a failed compaction never loses the cache.
+	MappedFile compacted;
+	bool written = compacted.open(tempPath, true) && compacted.truncate(0);
+	written = written && compacted.append(&header, sizeof(TileCacheHeader));
+
+	std::vector<uint8> record(recordSize);
+	uint32 numKept = 0;
+
+	for (int i = 0; i < entries.size() && written && compacted.getSize() + recordSize <= targetSize; i++) {
+		written = this->file->read(entries[i].offset, record.data(), recordSize) && compacted.append(record.data(), recordSize);
+		numKept++;
+	}
+
+	compacted.close();
+	this->file->close();
+	this->index.clear();
+
+	std::error_code error;
+
+	if (written) {
+		std::filesystem::rename(tempPath, path, error);
+	}
+
+	if (!written || error) {
+		logWarn("Failed to compact tile cache \"%s\"", path.c_str());
+		std::filesystem::remove(tempPath, error);
+	} else {
+		logInfo("Compacted tile cache \"%s\" from %.2f MiB to the %d most recently used tiles", path.c_str(), oldSize / (1024.0 * 1024.0), numKept);
+	}
+
+	if (this->file->open(path, true)) {
+		this->buildIndex(sizeof(TileCacheHeader));
+	}
+}
+
+bool TileCache::contains(uvec4 key) {
+	std::unique_lock<std::mutex> lock(this->indexMutex);
+	return this->index.find(key) != this->index.end();
+}
+
+bool TileCache::read(uvec4 key, void* textureData, double* minHeight, double* maxHeight) {
+	if (this->file == NULL) {
+		this->numMisses++;
+		return false;
+	}
+
+	uint64 offset;
+	bool touch;
+	const uint32 now = getCurrentTime();
+
+	{
+		std::unique_lock<std::mutex> lock(this->indexMutex);
+		auto it = this->index.find(key);
+
+		if (it == this->index.end()) {
+			this->numMisses++;
+			return false;
+		}
+
+		offset = it->second.offset;
+		touch = now - it->second.lastUsed > TILE_CACHE_TOUCH_INTERVAL;
+
+		if (touch) {
+			it->second.lastUsed = now;
+		}
+	}
+
+	// Records are only added to the index after they are completely written, so the file is large enough.
+	TileCacheRecord record;
+
+	if (!this->file->read(offset, &record, sizeof(TileCacheRecord)) || !this->file->read(offset + sizeof(TileCacheRecord), textureData, this->dataSize)) {
+		this->numMisses++;
+		return false;
+	}
+
+	if (touch) {
+		// Written by the write thread, which is the only one writing to the file.
+		this->writeThread->submit([this, offset, now]() {
+			this->file->write(offset + offsetof(TileCacheRecord, lastUsed), &now, sizeof(uint32));
+		});
+	}
+
+	*minHeight = record.minHeight;
+	*maxHeight = record.maxHeight;
+
+	this->numHits++;
+	this->bytesRead += this->dataSize;
+	return true;
+}
+
+void TileCache::write(uvec4 key, const void* textureData, double minHeight, double maxHeight) {
+	if (this->file == NULL) {
+		return;
+	}
+
+	const uint64 recordSize = sizeof(TileCacheRecord) + this->dataSize;
+
+	{
+		std::unique_lock<std::mutex> lock(this->indexMutex);
+		if (this->index.find(key) != this->index.end() || this->pendingWrites.find(key) != this->pendingWrites.end()) {
+			return; // Tile data for a key never changes, so there is no need to write it again.
+		}
+
+		// Queued writes are counted, they are not in the file yet.
+		if (this->file->getSize() + (this->pendingWrites.size() + 1) * recordSize > this->maxSize) {
+			if (!this->full.exchange(true)) {
+				logWarn("Tile cache \"%s\" reached its maximum size of %.2f MiB, it will be compacted when next opened", this->file->getPath().c_str(), this->maxSize / (1024.0 * 1024.0));
+			}
+			return;
+		}
+
+		this->pendingWrites.insert(key);
+	}
+
+	TileCacheRecord record = {};
+	record.magic = TILE_CACHE_RECORD_MAGIC;
+	record.key[0] = key.x;
+	record.key[1] = key.y;
+	record.key[2] = key.z;
+	record.key[3] = key.w;
+	record.minHeight = (float) minHeight;
+	record.maxHeight = (float) maxHeight;
+	record.dataSize = this->dataSize;
+	record.lastUsed = getCurrentTime();
+
+	// Copy now, the caller is about to overwrite the tile.
+	std::shared_ptr<std::vector<uint8>> buffer = std::make_shared<std::vector<uint8>>(recordSize);
+	memcpy(buffer->data(), &record, sizeof(TileCacheRecord));
+	memcpy(buffer->data() + sizeof(TileCacheRecord), textureData, this->dataSize);
+
+	this->writeThread->submit([this, key, buffer, record]() {
+		uint64 offset;
+		bool success = this->file->append(buffer->data(), buffer->size(), &offset);
+
+		std::unique_lock<std::mutex> lock(this->indexMutex);
+		this->pendingWrites.erase(key);
+
+		if (success) {
+			TileCacheEntry& entry = this->index[key];
+			entry.offset = offset;
+			entry.lastUsed = record.lastUsed;
+			this->numWrites++;
+			this->bytesWritten += buffer->size();
+		} else {
+			logError("Failed to write tile [%d, %d, %d] of planet %08x to the tile cache", key.x, key.y, key.z, key.w);
+		}
+	});
+}
+
+bool TileCache::isOpen() const {
+	return this->file != NULL;
+}
+
+uint64 TileCache::getNumHits() const {
+	return this->numHits;
+}
+
+uint64 TileCache::getNumMisses() const {
+	return this->numMisses;
+}
+
+uint64 TileCache::getNumWrites() const {
+	return this->numWrites;
+}
+
+uint64 TileCache::getBytesRead() const {
+	return this->bytesRead;
+}
+
+uint64 TileCache::getBytesWritten() const {
+	return this->bytesWritten;
+}
+
+uint64 TileCache::getFileSize() const {
+	return this->file != NULL ? this->file->getSize() : 0;
+}
+
+uint32 TileCache::getNumTiles() {
+	std::unique_lock<std::mutex> lock(this->indexMutex);
+	return this->index.size();
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "core/Core.h"
+#include <atomic>
+#include <unordered_set>
+
+class MappedFile;
+class ThreadPool;
+
+struct TileCacheHeader {
+	uint32 magic; // Identifies the file as a tile cache.
+	uint32 formatVersion; // The layout of this header and the records.
+	uint32 seed; // The seed of the generator that produced the tiles.
+	uint32 tileSize; // The width and height of every tile in the file.
+	uint32 generatorVersion; // The version of the tile generator that produced the tiles.
+	uint32 texelSize; // The number of bytes per texel.
+};
+
+struct TileCacheRecord {
+	uint32 magic; // Marks the start of a record, to detect a torn write at the end of the file.
+	uint32 key[4]; // The tree position of the tile on its planet, and the identity of the planet.
+	float minHeight;
+	float maxHeight;
+	uint32 dataSize; // The number of bytes of texture data following this record.
+	uint32 lastUsed; // The time, in seconds since the epoch, that the tile was last written or read. Updated in place.
+	uint32 padding;
+};
+
+struct TileCacheEntry {
+	uint64 offset; // The offset of the record in the file.
+	uint32 lastUsed; // The last used time of the record.
+};
+
+/**
+ * Persistent, append-only store of generated tile textures, keyed by tile, generator seed, tile size and
+ * generator version. Every combination of the last three is a separate file in the cache directory, so only
+ * the tile key needs to be indexed. The key is the tile's tree position on its planet and a hash of the planet
+ * parameters its texture depends on, so that planets sharing a file never read each other's tiles. Records
+ * are read through a memory mapping, and written in the background on a dedicated thread. If the same key is
+ * written again, the newest record wins.
+ *
+ * The file is limited to a maximum size. Once it is reached nothing more is written, and the next time the cache
+ * is opened it is compacted to the most recently used records.
+ */
+class TileCache {
+private:
+	MappedFile* file; // The cache file. NULL if it could not be opened.
+	ThreadPool* writeThread; // Single worker thread that appends records to the file.
+
+	std::unordered_map<uvec4, TileCacheEntry> index; // Maps tile keys to their record in the file.
+	std::unordered_set<uvec4> pendingWrites; // Tiles queued to be written, but not yet in the index.
+	std::mutex indexMutex; // Guards the index and the pending writes, which are updated by the write thread.
+
+	uint32 tileSize;
+	uint32 texelSize;
+	uint32 dataSize; // The number of bytes of texture data per tile.
+	uint64 maxSize; // The size the file may grow to before writes are dropped.
+	std::atomic<bool> full; // True once a write was dropped because the file reached the maximum size.
+
+	std::atomic<uint64> numHits; // Debug info
+	std::atomic<uint64> numMisses; // Debug info
+	std::atomic<uint64> numWrites; // Debug info
+	std::atomic<uint64> bytesRead; // Debug info
+	std::atomic<uint64> bytesWritten; // Debug info
+
+	/**
+	 * Scan the records in the file to rebuild the index. If the file ends with an incomplete record
+	 * (for example, the application exited during a write), the file is truncated to the last complete one.
+	 */
+	void buildIndex(uint64 headerSize);
+
+	/**
+	 * Rewrite the file with only the most recently used records, up to three quarters of the maximum size, so that
+	 * it can grow again before it is full. The file is replaced once the new one is complete.
+	 */
+	void compact(const TileCacheHeader& header);
+
+public:
+	TileCache(std::string directory, uint32 seed, uint32 tileSize, uint32 texelSize, uint32 generatorVersion, uint64 maxSize);
+
+	/**
+	 * Waits for queued writes to complete before closing the file.
+	 */
+	~TileCache();
+
+	// Deleted copy constructor and assignment function
+	TileCache(const TileCache&) = delete;
+	TileCache& operator=(const TileCache&) = delete;
+
+	bool contains(uvec4 key);
+
+	/**
+	 * Copy the texture data and height range of the tile into the destination, if the tile is in the
+	 * cache, and mark it as used. Returns false on a cache miss. This is only safe to call from one thread
+	 * at a time.
+	 */
+	bool read(uvec4 key, void* textureData, double* minHeight, double* maxHeight);
+
+	/**
+	 * Copy the texture data, and queue it to be appended to the file in the background. Nothing is
+	 * written if the tile is already stored, or already queued, or if the file is full.
+	 */
+	void write(uvec4 key, const void* textureData, double minHeight, double maxHeight);
+
+	bool isOpen() const;
+
+	uint64 getNumHits() const;
+
+	uint64 getNumMisses() const;
+
+	uint64 getNumWrites() const;
+
+	uint64 getBytesRead() const;
+
+	uint64 getBytesWritten() const;
+
+	uint64 getFileSize() const;
+
+	uint32 getNumTiles();
+};
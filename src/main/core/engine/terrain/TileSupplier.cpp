@@ -1,8 +1,13 @@
 #include "TileSupplier.h"
 #include "core/application/Application.h"
+#include "core/engine/renderer/ReadbackBuffer.h"
 #include "core/engine/renderer/ShaderProgram.h"
 #include "core/engine/terrain/TerrainQuad.h"
 #include "core/engine/terrain/Planet.h"
+#include "core/engine/terrain/CpuTileGenerator.h"
+#include "core/engine/terrain/TileCache.h"
+#include "core/engine/terrain/TerrainLodMetric.h"
+#include "core/engine/scene/bounding/BoundingVolume.h"
 #include "core/util/Logger.h"
 #include "core/util/Time.h"
 #include "core/util/InputHandler.h"
@@ -11,8 +16,23 @@
 
 ////////////////// TileData \\\\\\\\\\\\\\\\\\ 
 
+static uint16 packUnorm16(double value) {
+	return (uint16) glm::round(glm::clamp(value, 0.0, 1.0) * 65535.0);
+}
+
+/**
+ * Decode a height stored by the compute shader in the height range buffer. Heights are stored as their float
+ * bits, remapped so that unsigned integer order matches float order, which allows atomicMin and atomicMax.
+ */
+static float decodeOrderedHeight(uint32 key) {
+	uint32 bits = (key & 0x80000000) != 0 ? (key & 0x7FFFFFFF) : ~key;
+	float height;
+	memcpy(&height, &bits, sizeof(float));
+	return height;
+}
+
 TileData::TileData(TileSupplier* supplier, uint32 textureIndex) :
-	supplier(supplier), textureIndex(textureIndex) {
+	supplier(supplier), planet(NULL), textureIndex(textureIndex) {
 
 	uint64 now = Time::now();
 
@@ -20,6 +40,8 @@ TileData::TileData(TileSupplier* supplier, uint32 textureIndex) :
 	this->quadNormals = dmat4(0.0);
 	this->quadCorners = dmat4(0.0);
 	this->cameraDistance = INFINITY;
+	this->generationQueueIndex = -1;
+	this->readbackQueueIndex = -1;
 	this->timeLastUsed = now;
 	this->timeLastRetrieved = now;
 	this->timeCreated = now;
@@ -28,10 +50,13 @@ TileData::TileData(TileSupplier* supplier, uint32 textureIndex) :
 	this->awaitingGeneration = false;
 	this->awaitingReadbackResponse = false;
 	this->awaitingReadbackRequest = false;
+	this->awaitingHeightRange = false;
+	this->textureDataValid = false;
+	this->prefetched = false;
+	this->textureDataVersion = 0;
 	this->textureData = NULL;
-	this->minHeight = 0.0;
-	this->maxHeight = 0.0;
-	this->textureData = new float[supplier->tileSize * supplier->tileSize * 4];
+	this->setHeightRange(0.0, 0.0);
+	this->textureData = new uint8[supplier->tileSize * supplier->tileSize * supplier->texelSize];
 }
 
 TileData::~TileData() {
@@ -55,37 +80,62 @@ TileData::~TileData() {
 		delete[] this->textureData;
 	}
 
-	// free the texture slot.
+	this->supplier->textureGenerationQueue.remove(this);
+	this->supplier->textureReadbackQueue.remove(this);
+	this->supplier->cancelHeightRange(this);
+	this->supplier->releaseTextureSlot(this->textureIndex);
 }
 
 void TileData::onReadbackReceived() {
+	// The height range is reduced on the GPU and read back separately, so the texture data doesn't need to be scanned.
 	this->timeReadback = Time::now();
+	this->textureDataValid = true;
+	this->textureDataVersion++;
+}
 
-	uint32 invalidPixels = 0;
-	this->minHeight = +INFINITY;
-	this->maxHeight = -INFINITY;
-	for (int i = 0; i < supplier->getTileSize(); i++) {
-		for (int j = 0; j < supplier->getTileSize(); j++) {
-			double h = this->getTextureData(uvec2(i, j)).w;
-	
-			if (isnan(h)) {
-				invalidPixels++;
-			} else {
-				this->minHeight = glm::min(this->minHeight, h);
-				this->maxHeight = glm::max(this->maxHeight, h);
-			}
-		}
+void TileData::setHeightRange(double minHeight, double maxHeight) {
+	this->minHeight = minHeight;
+	this->maxHeight = maxHeight;
+
+	for (int i = 0; i < TILE_HEIGHT_GRID_SIZE * TILE_HEIGHT_GRID_SIZE; i++) {
+		this->heightGrid[i] = fvec2(minHeight, maxHeight);
 	}
-	
-	if (invalidPixels > 0) {
-		logError("Invalid readback result (%d of %d pixels)", invalidPixels, supplier->getTileSize() * supplier->getTileSize());
+}
+
+void TileData::packTexels(int32 count, const float* texels, double minHeight, double maxHeight, uint16* packed) {
+	const double heightRange = maxHeight - minHeight;
+
+	for (int i = 0; i < count; i++) {
+		const float* texel = &texels[i * 4];
+
+		dvec3 normal = dvec3(texel[0], texel[1], texel[2]);
+		const double length = abs(normal.x) + abs(normal.y) + abs(normal.z);
+		normal = length > 0.0 ? normal / length : dvec3(0.0, 0.0, 1.0); // Project onto the octahedron.
+
+		dvec2 octahedral = dvec2(normal.x, normal.y);
+		if (normal.z < 0.0) { // Fold the lower hemisphere over the diagonals.
+			octahedral.x = (1.0 - abs(normal.y)) * (normal.x >= 0.0 ? 1.0 : -1.0);
+			octahedral.y = (1.0 - abs(normal.x)) * (normal.y >= 0.0 ? 1.0 : -1.0);
+		}
+
+		const double height = heightRange > 0.0 && !isnan(texel[3]) ? (texel[3] - minHeight) / heightRange : 0.0;
+
+		packed[i * 3 + 0] = packUnorm16(height);
+		packed[i * 3 + 1] = packUnorm16(octahedral.x * 0.5 + 0.5);
+		packed[i * 3 + 2] = packUnorm16(octahedral.y * 0.5 + 0.5);
 	}
+}
+
+dvec4 TileData::unpackTexel(const uint16* packed, double minHeight, double maxHeight) {
+	const dvec2 octahedral = dvec2(packed[1], packed[2]) / 65535.0 * 2.0 - 1.0;
 
-	//logInfo("Tile minHeight = %f, maxHeight = %f, height range = %f",
-	//	this->minHeight,
-	//	this->maxHeight,
-	//	this->maxHeight - this->minHeight
-	//);
+	dvec3 normal = dvec3(octahedral.x, octahedral.y, 1.0 - abs(octahedral.x) - abs(octahedral.y));
+	const double t = glm::max(-normal.z, 0.0);
+	normal.x += normal.x >= 0.0 ? -t : t;
+	normal.y += normal.y >= 0.0 ? -t : t;
+
+	const double height = minHeight + (maxHeight - minHeight) * (packed[0] / 65535.0);
+	return dvec4(normalize(normal), height);
 }
 
 void TileData::onUsed() {
@@ -99,10 +149,18 @@ void TileData::regenerate() {
 void TileData::requestAsyncReadback() {
 	this->awaitingReadbackResponse = true;
 	this->awaitingReadbackRequest = true;
+	this->supplier->textureReadbackQueue.push(this);
 }
 
 void TileData::setCameraDistance(double cameraDistance) {
-	this->cameraDistance = cameraDistance;
+	if (this->cameraDistance != cameraDistance) {
+		this->cameraDistance = cameraDistance;
+		this->supplier->updateQueuePriority(this);
+	}
+}
+
+double TileData::getCameraDistance() const {
+	return this->cameraDistance;
 }
 
 dvec3 TileData::getSphereVector(dvec2 pos) const {
@@ -153,14 +211,20 @@ dvec4 TileData::getTextureData(uvec2 pos) {
 	const uint32 textureSize = this->supplier->tileSize;
 
 	if (pos.x >= 0 && pos.x < textureSize && pos.y >= 0 && pos.y < textureSize) {
-		if (this->textureData != NULL) {
+		if (this->textureDataValid) {
 			uint32 index = pos.x + pos.y * textureSize;
-			const double x = this->textureData[index * 4 + 0];
-			const double y = this->textureData[index * 4 + 1];
-			const double z = this->textureData[index * 4 + 2];
-			const double w = this->textureData[index * 4 + 3];
+
+			if (this->supplier->packedTexels) {
+				return TileData::unpackTexel(reinterpret_cast<const uint16*>(this->textureData) + index * 3, this->minHeight, this->maxHeight);
+			}
+
+			const float* texel = reinterpret_cast<const float*>(this->textureData) + index * 4;
+			const double x = texel[0];
+			const double y = texel[1];
+			const double z = texel[2];
+			const double w = texel[3];
 			return dvec4(x, y, z, w);
-		} else {
+		} else if (this->generated && !this->awaitingReadbackResponse) {
 			this->requestAsyncReadback();
 		}
 	} else {
@@ -171,7 +235,7 @@ dvec4 TileData::getTextureData(uvec2 pos) {
 }
 
 dvec4 TileData::getInterpolatedTextureData(dvec2 pos) {
-	if (this->textureData != NULL) {
+	if (this->textureDataValid) {
 		const ivec2 p0 = ivec2(pos);
 		if (fabs(pos.x - p0.x) < 1e-9 && fabs(pos.y - p0.y) < 1e-9) {
 			return this->getTextureData(p0);
@@ -190,7 +254,9 @@ dvec4 TileData::getInterpolatedTextureData(dvec2 pos) {
 			return id0 * yInterp + id1 * (1.0 - yInterp);
 		}
 	} else {
-		this->requestAsyncReadback();
+		if (this->generated && !this->awaitingReadbackResponse) {
+			this->requestAsyncReadback();
+		}
 		return fvec4(NAN);
 	}
 }
@@ -211,6 +277,18 @@ bool TileData::isAwaitingReadback() const {
 	return this->awaitingReadbackResponse;
 }
 
+bool TileData::isAwaitingHeightRange() const {
+	return this->awaitingHeightRange;
+}
+
+bool TileData::hasTextureData() const {
+	return this->textureDataValid;
+}
+
+uint32 TileData::getTextureDataVersion() const {
+	return this->textureDataVersion;
+}
+
 bool TileData::isActive() const {
 	return !this->references.empty(); // Active for as long as there are any references to this tile.
 }
@@ -223,13 +301,48 @@ double TileData::getMinHeight() const {
 	return this->minHeight;
 }
 
+dvec2 TileData::getHeightRange(dvec2 tilePosition, dvec2 tileSize) const {
+	const int32 n = TILE_HEIGHT_GRID_SIZE;
+	const ivec2 c0 = glm::clamp(ivec2(glm::floor(tilePosition * (double) n)), ivec2(0), ivec2(n - 1));
+	const ivec2 c1 = glm::clamp(ivec2(glm::ceil((tilePosition + tileSize) * (double) n)) - 1, c0, ivec2(n - 1));
+
+	dvec2 range = dvec2(+INFINITY, -INFINITY);
+	for (int y = c0.y; y <= c1.y; y++) {
+		for (int x = c0.x; x <= c1.x; x++) {
+			range.x = glm::min(range.x, (double) this->heightGrid[x + y * n].x);
+			range.y = glm::max(range.y, (double) this->heightGrid[x + y * n].y);
+		}
+	}
+
+	return range;
+}
+
+
+
+bool TilePriorityComparator::operator()(const TileData* t0, const TileData* t1) const {
+	const bool active0 = t0->isActive();
+	const bool active1 = t1->isActive();
+
+	if (active0 != active1) {
+		return active0; // Tiles that are being rendered come first.
+	}
+
+	return t0->getCameraDistance() < t1->getCameraDistance();
+}
+
 
 
 ////////////////// TileData \\\\\\\\\\\\\\\\\\ 
 
 //uint32 timerQuery;
-TileSupplier::TileSupplier(Planet* planet, uint32 seed, uint32 textureCapacity, uint32 textureSize) {
-	this->planet = planet;
+TileSupplier::TileSupplier(uint32 seed, uint32 textureCapacity, uint32 textureSize, bool packedTexels) :
+	textureGenerationQueue(&TileData::generationQueueIndex),
+	textureReadbackQueue(&TileData::readbackQueueIndex) {
+
+	this->nextPlanetIdOffset = 0;
+	this->seed = seed;
+	this->packedTexels = packedTexels;
+	this->texelSize = packedTexels ? sizeof(uint16) * 3 : sizeof(float) * 4;
 
 	if (textureCapacity == 0) {
 		int32 layers;
@@ -243,18 +356,31 @@ TileSupplier::TileSupplier(Planet* planet, uint32 seed, uint32 textureCapacity,
 	this->tileSize = textureSize;
 
 	this->timeLastCleanupCycle = Time::now();
-	this->timeLastGenerationCheck = Time::now();
 	this->cleanupFrequency = 1.0; // Every X second, we go through and cleanup the active tiles list.
-	this->generationCheckFrequency = 0.5; // Every X seconds we check if we need to generate textures, and sort tiles by statance to the viewer.
 
 	this->overlayDebug = false;
 	this->showDebug = false;
 
 	this->maxGenerationTime = 10.0;
-
-	this->availableTextures = new bool[this->capacity];
-	for (int i = 0; i < this->capacity; i++) {
-		this->availableTextures[i] = true;
+	this->generationBatchSize = 8;
+
+	this->cpuTileGenerator = NULL;
+	this->maxCpuGenerationRequests = 0;
+	this->cpuGenerationEnabled = false;
+	this->tileStateVersion = 0;
+
+	this->prefetchEnabled = true;
+	this->prefetchTime = 0.5;
+	this->maxPrefetchesPerUpdate = 16;
+	this->minPrefetchEvictionAge = 5.0;
+	this->numPrefetched = 0;
+	this->numPrefetchHits = 0;
+	this->numPrefetchLate = 0;
+	this->numPrefetchWasted = 0;
+
+	this->freeTextureSlots.reserve(this->capacity);
+	for (int i = this->capacity - 1; i >= 0; i--) {
+		this->freeTextureSlots.push_back(i);
 	}
 
 	this->maxAsyncReadbacks = 10;
@@ -274,20 +400,35 @@ TileSupplier::TileSupplier(Planet* planet, uint32 seed, uint32 textureCapacity,
 	}
 	glPixelStorei(GL_UNPACK_ROW_LENGTH, this->tileSize);
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1); // Packed texel rows are not a multiple of 4 bytes for odd tile sizes.
 
+	// Packed texels use the alpha channel for nothing, there is no 48 bit format that supports image load/store.
 	glBindTextureUnit(0, this->textureArray);
-	glTextureStorage3D(this->textureArray, 1, GL_RGBA32F, this->tileSize, this->tileSize, this->capacity);
+	glTextureStorage3D(this->textureArray, 1, this->packedTexels ? GL_RGBA16 : GL_RGBA32F, this->tileSize, this->tileSize, this->capacity);
+	// Packed texels are fetched and filtered after decoding by the shaders (see simpleTerrain/tile.glsl), since
+	// octahedral normals can not be interpolated. The filter only applies to unpacked texels.
 	glTextureParameteri(this->textureArray, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTextureParameteri(this->textureArray, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTextureParameteri(this->textureArray, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTextureParameteri(this->textureArray, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-	// Initialize pixel transfer buffer
+	this->scratchTexture = 0;
+	this->heightRangeBuffer = 0;
+	this->tileBatchBuffer = 0;
+	this->tilePackingProgram = NULL;
 
-	glGenBuffers(1, &this->pixelTransferBuffer);
-	glBindBuffer(GL_PIXEL_PACK_BUFFER, this->pixelTransferBuffer);
-	glBufferData(GL_PIXEL_PACK_BUFFER, this->tileSize * this->tileSize * this->maxAsyncReadbacks * sizeof(float) * 4, NULL, GL_STREAM_COPY);
-	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	this->allocateGenerationBatch();
+
+	glCreateBuffers(1, &this->heightRangeBuffer);
+	glNamedBufferData(this->heightRangeBuffer, this->capacity * sizeof(TileHeightRange), NULL, GL_DYNAMIC_COPY);
+
+	if (this->packedTexels) {
+		// The height range of a tile is only known once all of it is generated, so it is generated unpacked into
+		// the scratch texture first, and packed into the texture array by a second dispatch.
+		this->tilePackingProgram = new ShaderProgram();
+		this->tilePackingProgram->addShader(GL_COMPUTE_SHADER, "simpleTerrain/packComp.glsl");
+		this->tilePackingProgram->completeProgram();
+	}
 
 
 	// Initialize compute shader.
@@ -295,31 +436,195 @@ TileSupplier::TileSupplier(Planet* planet, uint32 seed, uint32 textureCapacity,
 	this->tileGeneratorProgram = new ShaderProgram();
 	this->tileGeneratorProgram->addShader(GL_COMPUTE_SHADER, "simpleTerrain/heightComp.glsl");
 	this->tileGeneratorProgram->completeProgram();
+
+	this->tileCache = new TileCache("cache", this->seed, this->tileSize, this->texelSize, TILE_GENERATOR_VERSION, TILE_CACHE_MAX_SIZE);
+	if (!this->tileCache->isOpen()) {
+		delete this->tileCache;
+		this->tileCache = NULL;
+	}
+
+	this->textureReadbackEnabled = this->tileCache != NULL;
 }
 
 TileSupplier::~TileSupplier() {
 	// Nullify all references to all tiles, and delete all tiles.
 	// destroy OpenGL texture array
 
+	if (this->cpuTileGenerator != NULL) {
+		delete this->cpuTileGenerator; // Waits for in-progress requests, so they can be released safely.
+
+		for (int i = 0; i < this->cpuGenerationRequests.size(); i++) {
+			delete[] this->cpuGenerationRequests[i]->textureData;
+			delete this->cpuGenerationRequests[i];
+		}
+		this->cpuGenerationRequests.clear();
+	}
+
+	if (this->tileCache != NULL) {
+		delete this->tileCache;
+	}
+
+	// The readback buffer is shared, so in-flight regions must be returned to it.
+	for (int i = 0; i < this->maxAsyncReadbacks; i++) {
+		if (this->asyncReadbackSlots[i] != NULL) {
+			this->releaseReadbackSlot(i);
+		}
+	}
+	delete[] this->asyncReadbackSlots;
+
+	for (int i = 0; i < this->heightRangeReadbacks.size(); i++) {
+		READBACK_BUFFER.release(this->heightRangeReadbacks[i]->region);
+		delete this->heightRangeReadbacks[i];
+	}
+	this->heightRangeReadbacks.clear();
+
 	//TODO
 	// (this isn't really a problematic memory leak, since planets are only being created once at the application start and never again... but this should still be implemented)
 }
 
 
-void TileSupplier::generateTexture(TileData* tile) {
+void TileSupplier::addPlanet(Planet* planet) {
+	if (this->getSuppliedPlanet(planet) != NULL) {
+		logWarn("Planet was already added to the tile supplier");
+		return;
+	}
+
+	// The parameters are passed to the generator as floats, so the identity is made from the same values.
+	const float parameters[2] = { (float) planet->getRadius(), (float) planet->getElevationScale() };
+	uint32 identity = 2166136261u; // FNV-1a
+
+	for (int i = 0; i < sizeof(parameters); i++) {
+		identity = (identity ^ reinterpret_cast<const uint8*>(parameters)[i]) * 16777619u;
+	}
+
+	TileSupplierPlanet suppliedPlanet;
+	suppliedPlanet.planet = planet;
+	suppliedPlanet.idOffset = this->nextPlanetIdOffset;
+	suppliedPlanet.identity = identity;
+	suppliedPlanet.tileStateVersion = 0;
+	this->planets.push_back(suppliedPlanet);
+
+	// Quads reach one level past the split depth, on each of the six faces.
+	this->nextPlanetIdOffset += 6 * (planet->getMaxSplitDepth() + 1);
+}
+
+void TileSupplier::removePlanet(Planet* planet) {
+	for (int i = 0; i < this->planets.size(); i++) {
+		if (this->planets[i].planet == planet) {
+			this->planets.erase(this->planets.begin() + i);
+			break;
+		}
+	}
+
+	// The planet's tiles are all idle by now, but some may still be waiting to be generated.
+	for (auto it = this->lruList.begin(); it != this->lruList.end(); it++) {
+		TileData* tile = *it;
+
+		if (tile->planet == planet) {
+			if (this->textureGenerationQueue.remove(tile)) {
+				tile->awaitingGeneration = false;
+			}
+			tile->planet = NULL;
+		}
+	}
+
+	for (auto it = this->activeTiles.begin(); it != this->activeTiles.end(); it++) {
+		if (it->second->planet == planet) {
+			logError("Planet removed from the tile supplier while tile [%d, %d, %d] is still in use", it->first.x, it->first.y, it->first.z);
+		}
+	}
+}
+
+uvec3 TileSupplier::getTileId(TerrainQuad* terrainQuad) const {
+	return this->getTileId(terrainQuad->getPlanet(), terrainQuad->getTreePosition(true));
+}
+
+uvec3 TileSupplier::getTileId(const Planet* planet, uvec3 treePosition) const {
+	const TileSupplierPlanet* suppliedPlanet = this->getSuppliedPlanet(planet);
+
+	if (suppliedPlanet == NULL) {
+		assert(false && "Tile requested for a planet that was not added to the tile supplier");
+		return treePosition;
+	}
 
-	this->numTexturesGenerated++;
+	return uvec3(treePosition.x, treePosition.y, treePosition.z + suppliedPlanet->idOffset);
+}
+
+const TileSupplierPlanet* TileSupplier::getSuppliedPlanet(const Planet* planet) const {
+	for (int i = 0; i < this->planets.size(); i++) {
+		if (this->planets[i].planet == planet) {
+			return &this->planets[i];
+		}
+	}
+
+	return NULL;
+}
+
+bool TileSupplier::getCacheKey(const TileData* tile, uvec4* key) const {
+	const TileSupplierPlanet* suppliedPlanet = this->getSuppliedPlanet(tile->planet);
+
+	if (tile->planet == NULL || suppliedPlanet == NULL) {
+		return false;
+	}
+
+	*key = uvec4(tile->id.x, tile->id.y, tile->id.z - suppliedPlanet->idOffset, suppliedPlanet->identity);
+	return true;
+}
+
+void TileSupplier::onTileStateChanged(const TileData* tile) {
+	this->tileStateVersion++;
+
+	// Tiles of a removed planet have no planet.
+	for (int i = 0; i < this->planets.size(); i++) {
+		if (this->planets[i].planet == tile->planet) {
+			this->planets[i].tileStateVersion++;
+			this->planets[i].planet->onTileChanged(uvec3(tile->id.x, tile->id.y, tile->id.z - this->planets[i].idOffset));
+			break;
+		}
+	}
+}
+
+void TileSupplier::generateTextures(const std::vector<TileData*>& tiles) {
+	assert(!tiles.empty() && tiles.size() <= this->generationBatchSize);
+
+	// The whole batch is generated with the radius and elevation scale of one planet.
+	const Planet* planet = tiles[0]->planet;
+	assert(planet != NULL);
+
+	this->numTexturesGenerated += tiles.size();
+
+	std::vector<TileGenerationInfo> batch(tiles.size());
+	for (int i = 0; i < tiles.size(); i++) {
+		batch[i].quadNormals = fmat4(tiles[i]->getQuadNormals());
+		batch[i].quadCorners = fmat4(tiles[i]->getQuadCorners());
+		batch[i].textureIndex = tiles[i]->textureIndex;
+	}
+
+	glNamedBufferSubData(this->tileBatchBuffer, 0, batch.size() * sizeof(TileGenerationInfo), &batch[0]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, this->tileBatchBuffer);
 
 	this->tileGeneratorProgram->useProgram(true);
-	glBindImageTexture(0, this->textureArray, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+
+	// The height range of the whole tile and of each grid cell is reduced with atomics, so it starts empty.
+	const uvec2 emptyRange = uvec2(0xFFFFFFFF, 0x00000000);
+	for (int i = 0; i < tiles.size(); i++) {
+		glClearNamedBufferSubData(this->heightRangeBuffer, GL_RG32UI, tiles[i]->textureIndex * sizeof(TileHeightRange), sizeof(TileHeightRange), GL_RG_INTEGER, GL_UNSIGNED_INT, &emptyRange[0]);
+	}
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, this->heightRangeBuffer);
+
+	if (this->packedTexels) {
+		glBindImageTexture(1, this->scratchTexture, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+	} else {
+		glBindImageTexture(0, this->textureArray, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+	}
 
 	this->tileGeneratorProgram->setUniform("computePointBuffers", false);
+	this->tileGeneratorProgram->setUniform("packedTexels", this->packedTexels);
 	this->tileGeneratorProgram->setUniform("tileTexture", 0);
-	this->tileGeneratorProgram->setUniform("textureIndex", (int32)tile->textureIndex);
-	this->tileGeneratorProgram->setUniform("planetRadius", (float)this->planet->getRadius());
-	this->tileGeneratorProgram->setUniform("elevationScale", (float)this->planet->getElevationScale());
-	this->tileGeneratorProgram->setUniform("quadNormals", tile->getQuadNormals());
-	this->tileGeneratorProgram->setUniform("quadCorners", tile->getQuadCorners());
+	this->tileGeneratorProgram->setUniform("scratchTexture", 1);
+	this->tileGeneratorProgram->setUniform("planetRadius", (float)planet->getRadius());
+	this->tileGeneratorProgram->setUniform("elevationScale", (float)planet->getElevationScale());
 	this->tileGeneratorProgram->setUniform("textureSize", (int32)this->tileSize);
 	
 	int textureSize = this->tileSize;
@@ -329,8 +634,26 @@ void TileSupplier::generateTexture(TileData* tile) {
 	int yGroups = ceil((float)textureSize / localSizeY);
 
 	//glBeginQuery(GL_TIME_ELAPSED, timerQuery);
-	glDispatchCompute(xGroups, yGroups, 1);
-	glMemoryBarrier(GL_ALL_BARRIER_BITS);
+	glDispatchCompute(xGroups, yGroups, tiles.size()); // One layer of work groups per tile.
+
+	if (this->packedTexels) {
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+		this->tilePackingProgram->useProgram(true);
+		glBindImageTexture(0, this->textureArray, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16);
+		glBindImageTexture(1, this->scratchTexture, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA32F);
+		this->tilePackingProgram->setUniform("tileTexture", 0);
+		this->tilePackingProgram->setUniform("scratchTexture", 1);
+		this->tilePackingProgram->setUniform("textureSize", (int32)this->tileSize);
+		glDispatchCompute(xGroups, yGroups, tiles.size());
+	}
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, 0);
+
+	// The results are only sampled by the renderer, read back with glGetTextureSubImage, or have their height
+	// range copied out of the SSBO.
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
 	//glEndQuery(GL_TIME_ELAPSED);
 
 	//uint64 elapsed = 0;
@@ -338,18 +661,428 @@ void TileSupplier::generateTexture(TileData* tile) {
 
 	//logInfo("Took %f ms to execute compute shader", elapsed / 1000000.0);
 
-	tile->requestAsyncReadback();
-
 	this->tileGeneratorProgram->useProgram(false);
 
+	uint64 now = Time::now();
+
+	for (int i = 0; i < tiles.size(); i++) {
+		TileData* tile = tiles[i];
+		this->cancelHeightRange(tile); // A range still in flight from a previous generation would be stale.
+		this->heightRangeQueue.push_back(tile);
+
+		tile->awaitingHeightRange = true;
+		tile->textureDataValid = false;
+
+		if (this->textureReadbackEnabled) {
+			tile->requestAsyncReadback();
+		}
+
+		tile->generated = true;
+		tile->awaitingGeneration = false;
+		tile->timeGenerated = now;
+		this->onTileStateChanged(tile);
+	}
+}
+
+void TileSupplier::allocateGenerationBatch() {
+	if (this->tileBatchBuffer == 0) {
+		glCreateBuffers(1, &this->tileBatchBuffer);
+	}
+
+	glNamedBufferData(this->tileBatchBuffer, this->generationBatchSize * sizeof(TileGenerationInfo), NULL, GL_DYNAMIC_DRAW);
+
+	if (this->packedTexels) {
+		if (this->scratchTexture != 0) {
+			glDeleteTextures(1, &this->scratchTexture); // Immutable storage can't be resized.
+		}
+
+		glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &this->scratchTexture);
+		glTextureStorage3D(this->scratchTexture, 1, GL_RGBA32F, this->tileSize, this->tileSize, this->generationBatchSize);
+	}
+}
+
+void TileSupplier::releaseReadbackSlot(int32 index) {
+	AsyncReadbackRequest* request = this->asyncReadbackSlots[index];
+	this->asyncReadbackSlots[index] = NULL;
+
+	READBACK_BUFFER.release(request->region);
+	delete request;
+}
+
+void TileSupplier::requestHeightRanges() {
+	if (this->heightRangeQueue.empty()) {
+		return;
+	}
+
+	ReadbackRegion* region = READBACK_BUFFER.allocate(this->heightRangeQueue.size() * sizeof(TileHeightRange));
+
+	if (region == NULL) {
+		return; // The readback buffer is full, try again next frame. The ranges stay in the SSBO until the slot is regenerated.
+	}
+
+	HeightRangeReadback* readback = new HeightRangeReadback();
+	readback->region = region;
+	readback->tiles.swap(this->heightRangeQueue);
+
+	for (int i = 0; i < readback->tiles.size(); i++) {
+		const uint32 textureIndex = readback->tiles[i]->textureIndex;
+		glCopyNamedBufferSubData(this->heightRangeBuffer, READBACK_BUFFER.getBuffer(), textureIndex * sizeof(TileHeightRange), region->offset + i * sizeof(TileHeightRange), sizeof(TileHeightRange));
+	}
+
+	READBACK_BUFFER.submit();
+	this->heightRangeReadbacks.push_back(readback);
+}
+
+void TileSupplier::processHeightRanges() {
+	// Readbacks complete in submission order, so stop at the first one that isn't ready.
+	while (!this->heightRangeReadbacks.empty() && READBACK_BUFFER.isReady(this->heightRangeReadbacks.front()->region)) {
+		HeightRangeReadback* readback = this->heightRangeReadbacks.front();
+		this->heightRangeReadbacks.erase(this->heightRangeReadbacks.begin());
+
+		const TileHeightRange* ranges = reinterpret_cast<const TileHeightRange*>(READBACK_BUFFER.getData(readback->region));
+
+		for (int i = 0; i < readback->tiles.size(); i++) {
+			TileData* tile = readback->tiles[i];
+
+			if (tile == NULL) {
+				continue; // Cancelled
+			}
+
+			const TileHeightRange& range = ranges[i];
+
+			if (range.range.x > range.range.y) { // Every texel was NaN.
+				logError("Invalid height range read back for tile [%d, %d, %d]", tile->id.x, tile->id.y, tile->id.z);
+				tile->setHeightRange(0.0, 0.0);
+			} else {
+				tile->minHeight = decodeOrderedHeight(range.range.x);
+				tile->maxHeight = decodeOrderedHeight(range.range.y);
+
+				for (int j = 0; j < TILE_HEIGHT_GRID_SIZE * TILE_HEIGHT_GRID_SIZE; j++) {
+					const uvec2 cell = range.grid[j];
+					tile->heightGrid[j] = cell.x > cell.y ? fvec2(tile->minHeight, tile->maxHeight) : fvec2(decodeOrderedHeight(cell.x), decodeOrderedHeight(cell.y));
+				}
+			}
+
+			tile->awaitingHeightRange = false;
+			this->onTileStateChanged(tile);
+		}
+
+		READBACK_BUFFER.release(readback->region);
+		delete readback;
+	}
+}
+
+void TileSupplier::cancelHeightRange(TileData* tile) {
+	if (!tile->awaitingHeightRange) {
+		return;
+	}
+
+	tile->awaitingHeightRange = false;
+
+	auto it = std::find(this->heightRangeQueue.begin(), this->heightRangeQueue.end(), tile);
+	if (it != this->heightRangeQueue.end()) {
+		this->heightRangeQueue.erase(it);
+		return;
+	}
+
+	for (int i = 0; i < this->heightRangeReadbacks.size(); i++) {
+		std::vector<TileData*>& tiles = this->heightRangeReadbacks[i]->tiles;
+		std::replace(tiles.begin(), tiles.end(), tile, (TileData*) NULL);
+	}
+}
+
+void TileSupplier::requestCpuGeneration(TileData* tile) {
+	CpuTileRequest* request = new CpuTileRequest();
+	request->tile = tile;
+	request->id = tile->id;
+	request->quadNormals = tile->quadNormals;
+	request->tileSize = this->tileSize;
+	request->planetRadius = (float)tile->planet->getRadius();
+	request->elevationScale = (float)tile->planet->getElevationScale();
+	request->packedTexels = this->packedTexels;
+	request->textureData = new uint8[this->tileSize * this->tileSize * this->texelSize];
+	request->requestTime = Time::now();
+
+	tile->awaitingGeneration = false; // The tile is in progress, so the generation check pass must not queue it again.
+
+	this->cpuGenerationRequests.push_back(request);
+	this->cpuTileGenerator->submit(request);
+}
+
+void TileSupplier::processCpuGenerationRequests() {
+	for (auto it = this->cpuGenerationRequests.begin(); it != this->cpuGenerationRequests.end();) {
+		CpuTileRequest* request = *it;
+
+		if (!request->completed) {
+			it++;
+			continue;
+		}
+
+		TileData* tile = request->tile;
+
+		if (tile->id == request->id) {
+			std::swap(tile->textureData, request->textureData); // Adopt the generated buffer rather than copying it.
+			tile->setHeightRange(request->minHeight, request->maxHeight);
+			tile->textureDataValid = true;
+			tile->textureDataVersion++;
+			this->cancelHeightRange(tile);
+			this->uploadTextureData(tile);
+
+			uint64 now = Time::now();
+			tile->generated = true;
+			tile->timeGenerated = now;
+			tile->timeReadback = now;
+			this->numTexturesGenerated++;
+			this->onTileStateChanged(tile);
+		}
+
+		delete[] request->textureData;
+		delete request;
+		it = this->cpuGenerationRequests.erase(it);
+	}
+}
+
+bool TileSupplier::loadCachedTile(TileData* tile) {
+	double minHeight, maxHeight;
+	uvec4 key;
+	if (this->tileCache == NULL || !this->getCacheKey(tile, &key) || !this->tileCache->read(key, tile->textureData, &minHeight, &maxHeight)) {
+		return false;
+	}
+
+	tile->setHeightRange(minHeight, maxHeight); // The height grid is not cached, the whole tile range is used for every cell.
+	tile->textureDataValid = true;
+	tile->textureDataVersion++;
+	this->cancelHeightRange(tile);
+	this->uploadTextureData(tile);
+
+	if (tile->awaitingReadbackResponse) { // A readback for the previous id would overwrite the cached data.
+		for (int i = 0; i < this->maxAsyncReadbacks; i++) {
+			AsyncReadbackRequest* request = this->asyncReadbackSlots[i];
+			if (request != NULL && request->tile == tile) {
+				request->cancelled = true;
+			}
+		}
+	}
+
+	uint64 now = Time::now();
+	this->textureGenerationQueue.remove(tile);
+	this->textureReadbackQueue.remove(tile);
+
 	tile->generated = true;
 	tile->awaitingGeneration = false;
-	tile->timeGenerated = Time::now();
+	tile->awaitingReadbackRequest = false;
+	tile->timeGenerated = now;
+	tile->timeReadback = now;
+	this->onTileStateChanged(tile);
+	return true;
+}
+
+bool TileSupplier::allocateTextureSlot(uint32* textureIndex) {
+	if (this->freeTextureSlots.empty()) {
+		return false;
+	}
+
+	*textureIndex = this->freeTextureSlots.back();
+	this->freeTextureSlots.pop_back();
+	return true;
+}
+
+void TileSupplier::releaseTextureSlot(uint32 textureIndex) {
+	assert(textureIndex < this->capacity);
+	assert(this->freeTextureSlots.size() < this->capacity);
+	this->freeTextureSlots.push_back(textureIndex);
+}
+
+void TileSupplier::uploadTextureData(TileData* tile) {
+	const uint32 format = this->packedTexels ? GL_RGB : GL_RGBA;
+	const uint32 type = this->packedTexels ? GL_UNSIGNED_SHORT : GL_FLOAT;
+	glTextureSubImage3D(this->textureArray, 0, 0, 0, tile->textureIndex, this->tileSize, this->tileSize, 1, format, type, tile->textureData);
+}
+
+uint32 TileSupplier::getReadbackSize() const {
+	uint32 size = this->tileSize * this->tileSize * this->texelSize;
+
+	if (this->packedTexels) {
+		size += sizeof(uvec2); // The encoded height range follows the texture data.
+	}
+
+	return (size + 15) & ~15; // Keep every slot aligned for the buffer copy.
+}
+
+void TileSupplier::updateQueuePriority(TileData* tile) {
+	this->textureGenerationQueue.update(tile);
+	this->textureReadbackQueue.update(tile);
+}
+
+TileData* TileSupplier::reallocateIdleTile() {
+	assert(!this->lruList.empty());
+
+	LRUIterator lit = this->lruList.begin();
+	TileData* tile = *lit;
+	assert(tile != NULL); // Should not be in the unused list if it is null or has references.
+	assert(tile->references.empty());
+
+	this->lruList.erase(lit);
+	this->idleTiles.erase(tile->id);
+
+	this->storeCachedTile(tile); // Evicted from the texture array, keep it on disk.
+
+	if (tile->prefetched) {
+		tile->prefetched = false;
+		this->numPrefetchWasted++;
+	}
+
+	return tile;
+}
+
+void TileSupplier::storeCachedTile(TileData* tile) {
+	if (this->tileCache == NULL) {
+		return;
+	}
+
+	// The texture data must match the generated texture, and packed texels are decoded with the height range, so a
+	// stale range would corrupt the cached tile.
+	if (!tile->generated || !tile->textureDataValid || tile->awaitingReadbackRequest || tile->awaitingReadbackResponse || tile->awaitingHeightRange) {
+		return;
+	}
+
+	uvec4 key;
+	if (this->getCacheKey(tile, &key)) {
+		this->tileCache->write(key, tile->textureData, tile->minHeight, tile->maxHeight);
+	}
+}
+
+void TileSupplier::assignTile(TileData* tile, Planet* planet, uvec3 id, dmat4 quadNormals, dmat4 quadCorners) {
+	tile->id = id;
+	tile->planet = planet;
+
+	tile->quadNormals = quadNormals;
+	tile->quadCorners = quadCorners;
+	tile->generated = false; // Texture should not be read if this is false.
+	tile->textureDataValid = false;
+	this->cancelHeightRange(tile);
+
+	if (!this->loadCachedTile(tile)) {
+		this->markForGeneration(tile); // Mark the tile for texture generation for the new ID
+	}
+}
+
+void TileSupplier::prefetch(Planet* planet) {
+	if (!this->prefetchEnabled) {
+		return;
+	}
+
+	const dvec3 velocity = planet->getLocalCameraVelocity();
+
+	if (dot(velocity, velocity) < 1e-12) {
+		return; // Everything the camera needs at rest is already requested by rendering.
+	}
+
+	const dvec3 predictedCameraPosition = planet->getLocalCameraPosition() + velocity * this->prefetchTime;
+
+	std::vector<std::pair<double, TerrainQuad*>> candidates;
+	for (int i = 0; i < 6; i++) {
+		this->addPrefetchCandidates(planet->getCubeFace((CubeFace) i), predictedCameraPosition, candidates);
+	}
+
+	// The quads closest to where the camera is heading are prefetched first.
+	std::sort(candidates.begin(), candidates.end(), [](const std::pair<double, TerrainQuad*>& a, const std::pair<double, TerrainQuad*>& b) {
+		return a.first < b.first;
+	});
+
+	uint32 numPrefetched = 0;
+
+	for (int i = 0; i < candidates.size() && numPrefetched < this->maxPrefetchesPerUpdate; i++) {
+		for (int j = 0; j < 4 && numPrefetched < this->maxPrefetchesPerUpdate; j++) {
+			uvec3 treePosition;
+			dmat4 quadNormals;
+			candidates[i].second->getChildTileInfo((QuadIndex) j, &treePosition, &quadNormals);
+
+			if (this->prefetchTile(planet, treePosition, quadNormals, candidates[i].first)) {
+				numPrefetched++;
+			}
+		}
+	}
+}
+
+void TileSupplier::addPrefetchCandidates(TerrainQuad* terrainQuad, dvec3 predictedCameraPosition, std::vector<std::pair<double, TerrainQuad*>>& candidates) {
+	if (!terrainQuad->isLeaf()) {
+		for (int i = 0; i < 4; i++) {
+			this->addPrefetchCandidates(terrainQuad->getChild((QuadIndex) i), predictedCameraPosition, candidates);
+		}
+		return;
+	}
+
+	Planet* planet = terrainQuad->getPlanet();
+
+	if (terrainQuad->getDepth() >= planet->getMaxSplitDepth()) {
+		return;
+	}
+
+	// The same distance the quad is split by, measured from the predicted camera position.
+	const Frustum& bounds = terrainQuad->getDeformedBoundingBox();
+	double distanceSq = INFINITY;
+	for (int i = 0; i < 8; i++) {
+		distanceSq = glm::min(distanceSq, glm::distance2(bounds.getCorner((FrustumCorner) i), predictedCameraPosition));
+	}
+
+	if (planet->getLodMetric()->getRelativeError(terrainQuad, distanceSq) > 1.0) {
+		candidates.push_back(std::make_pair(distanceSq, terrainQuad));
+	}
+}
+
+bool TileSupplier::prefetchTile(Planet* planet, uvec3 treePosition, dmat4 quadNormals, double cameraDistance) {
+	const uvec3 id = this->getTileId(planet, treePosition);
+
+	if (this->activeTiles.find(id) != this->activeTiles.end()) {
+		return false;
+	}
+
+	IdleCacheIterator ici = this->idleTiles.find(id);
+	if (ici != this->idleTiles.end()) {
+		TileData* tile = *ici->second;
+
+		if (tile->awaitingGeneration && cameraDistance < tile->cameraDistance) {
+			tile->setCameraDistance(cameraDistance); // Still wanted, and sooner than when it was prefetched.
+		}
+		return false;
+	}
+
+	TileData* tile = NULL;
+	uint32 textureIndex;
+
+	if (this->allocateTextureSlot(&textureIndex)) {
+		tile = new TileData(this, textureIndex);
+	} else if (!this->lruList.empty()) {
+		// Only tiles that have not been used for a while are given up for a tile that may never be needed.
+		const double idleTime = Time::time_cast<Time::time_unit, Time::seconds, double>((double) (Time::now() - this->lruList.front()->timeLastUsed));
+
+		if (idleTime >= this->minPrefetchEvictionAge) {
+			tile = this->reallocateIdleTile();
+		}
+	}
+
+	if (tile == NULL) {
+		return false;
+	}
+
+	tile->cameraDistance = cameraDistance;
+	tile->prefetched = true;
+	this->assignTile(tile, planet, id, quadNormals, quadNormals * planet->getRadius());
+	tile->quadCorners[0][3] = 1.0;
+	tile->quadCorners[1][3] = 1.0;
+	tile->quadCorners[2][3] = 1.0;
+	tile->quadCorners[3][3] = 1.0;
+
+	// The tile has no references, so it joins the idle cache as the most recently used.
+	this->idleTiles[id] = this->lruList.insert(this->lruList.end(), tile);
+	this->numPrefetched++;
+	return true;
 }
 
 void TileSupplier::markForGeneration(TileData* tile) {
 	tile->awaitingGeneration = true;
-	this->textureGenerationQueue.push_back(tile);
+	this->textureGenerationQueue.push(tile);
 }
 
 void TileSupplier::markIdle(TileData* tile) {
@@ -366,6 +1099,7 @@ void TileSupplier::markIdle(TileData* tile) {
 		}
 
 		tile->references.clear();
+		this->onTileStateChanged(tile);
 	}
 
 	// TODO: pass iterators if they are known, since they are known before calling this functin in some cases.
@@ -387,16 +1121,19 @@ void TileSupplier::markIdle(TileData* tile) {
 		this->activeTiles.erase(aci); // Tile is no longer active, remove it from the active cache.
 		this->idleTiles[tile->id] = this->lruList.insert(this->lruList.end(), tile); // Add the tile to the idle cache, and to the end of the LRU list.
 	//}
+
+	this->updateQueuePriority(tile); // Idle tiles are generated after all active tiles.
+
 }
 
 void TileSupplier::update() {
 	uint64 now = Time::now();
 
 	const double elapsedSinceLastCleanup = Time::time_cast<Time::time_unit, Time::seconds, double>(now - this->timeLastCleanupCycle);
-	const double elapsedSinceLastGenerationCheck = Time::time_cast<Time::time_unit, Time::seconds, double>(now - this->timeLastGenerationCheck);
 
-	// Either perform a cleanup pass, a generation check / sorting pass, or a texture generation pass.
-	// Don't perform multiple in the same frame to avoid a larger than usual frame spike.
+	// Either perform a cleanup pass, or a texture generation pass. Don't perform both in the same frame to
+	// avoid a larger than usual frame spike. The generation and readback queues are kept in priority order as
+	// tiles are added and camera distances change, so they never need to be sorted.
 
 	if (elapsedSinceLastCleanup >= this->cleanupFrequency) { // cleanup pass
 		this->timeLastCleanupCycle = now;
@@ -409,16 +1146,20 @@ void TileSupplier::update() {
 			}
 		}
 
-		//logInfo("%d tiles exist, %d active tiles, %d idle tiles. %d textures generated, %d textures remaining, %d tiles expired, %d async readbacks, %d pending readbacks",
-		//	this->activeTiles.size() + this->idleTiles.size(),
-		//	this->activeTiles.size(),
-		//	this->idleTiles.size(),
-		//	this->numTexturesGenerated,
-		//	this->textureGenerationQueue.size(),
-		//	this->numTilesExpired,
-		//	this->textureReadbackQueue.size(),
-		//	pendingReadbacks
-		//);
+		if (this->overlayDebug || this->showDebug) {
+			logInfo("Texture slots: %d used (%d active, %d idle), %d free of %d. %d textures generated, %d textures remaining, %d tiles expired, %d async readbacks, %d pending readbacks",
+				this->capacity - this->freeTextureSlots.size(),
+				this->activeTiles.size(),
+				this->idleTiles.size(),
+				this->freeTextureSlots.size(),
+				this->capacity,
+				this->numTexturesGenerated,
+				this->textureGenerationQueue.size(),
+				this->numTilesExpired,
+				this->textureReadbackQueue.size(),
+				pendingReadbacks
+			);
+		}
 
 		this->numTexturesGenerated = 0;
 		this->numTilesExpired = 0;
@@ -459,77 +1200,52 @@ void TileSupplier::update() {
 		for (auto it = expiredTiles.begin(); it != expiredTiles.end(); it++) {
 			this->markIdle(*it);
 		}
-	} else if (elapsedSinceLastGenerationCheck >= this->generationCheckFrequency) { // generation check / sorting pass
-		this->timeLastGenerationCheck = now;
-		this->textureGenerationQueue.clear();
-		this->textureReadbackQueue.clear();
-
-		struct TileProcessor {
-			static void process(std::vector<TileData*>& textureGenerationQueue, std::vector<TileData*>& textureReadbackQueue, uvec3 id, TileData* tile) {
-				if (tile != NULL) {
-					assert(tile->id == id);
-
-					if (tile->awaitingGeneration) {
-						textureGenerationQueue.push_back(tile);
-					}
+	} else { // actual generation pass
+		if (!this->textureGenerationQueue.empty() && this->cpuGenerationEnabled) {
+			while (!this->textureGenerationQueue.empty() && this->cpuGenerationRequests.size() < this->maxCpuGenerationRequests) {
+				TileData* tile = this->textureGenerationQueue.pop();
+				assert(tile->awaitingGeneration);
 
-					if (tile->awaitingReadbackRequest) {
-						textureReadbackQueue.push_back(tile);
-					}
-				}
+				this->requestCpuGeneration(tile); // The closest tiles are submitted first.
 			}
-		};
-
-		for (IdleCacheIterator ici = this->idleTiles.begin(); ici != this->idleTiles.end(); ici++) {
-			uvec3 id = ici->first;
-			TileData* tile = *ici->second;
-			TileProcessor::process(this->textureGenerationQueue, this->textureReadbackQueue, id, tile);
-		}
-
-		const uint32 idleEndGenerationIndex = this->textureGenerationQueue.size();
-		const uint32 idleEndReadbackIndex = this->textureReadbackQueue.size();
-
-		for (ActiveCacheIterator aci = this->activeTiles.begin(); aci != this->activeTiles.end(); aci++) {
-			uvec3 id = aci->first;
-			TileData* tile = aci->second;
-			TileProcessor::process(this->textureGenerationQueue, this->textureReadbackQueue, id, tile);
-		}
+		} else if (!this->textureGenerationQueue.empty()) {
+			uint64 start = Time::now();
+			std::vector<TileData*> batch;
+			batch.reserve(this->generationBatchSize);
 
-		auto comparator = [](const TileData* t0, const TileData* t1) {
-			return t1->cameraDistance < t0->cameraDistance;
-		};
+			while (!this->textureGenerationQueue.empty()) {
+				batch.clear();
 
-		std::sort(this->textureGenerationQueue.begin(), this->textureGenerationQueue.begin() + idleEndGenerationIndex, comparator);
-		std::sort(this->textureGenerationQueue.begin() + idleEndGenerationIndex, this->textureGenerationQueue.end(), comparator);
+				while (!this->textureGenerationQueue.empty() && batch.size() < this->generationBatchSize) {
+					if (!batch.empty() && this->textureGenerationQueue.top()->planet != batch[0]->planet) {
+						break; // Tiles of another planet are generated in the next batch.
+					}
 
-		std::sort(this->textureReadbackQueue.begin(), this->textureReadbackQueue.begin() + idleEndReadbackIndex, comparator);
-		std::sort(this->textureReadbackQueue.begin() + idleEndReadbackIndex, this->textureReadbackQueue.end(), comparator);
+					TileData* tile = this->textureGenerationQueue.pop();
+					assert(tile->awaitingGeneration);
+					batch.push_back(tile);
+				}
 
-		if (!this->textureGenerationQueue.empty()) {
-			logInfo("Found %d tiles that need generation", this->textureGenerationQueue.size());
-		}
-	} else { // actual generation pass
-		if (!this->textureGenerationQueue.empty()) {
-			uint64 start = Time::now();
+				this->generateTextures(batch); // Generate the current closest tiles to the viewer.
 
-			while (!this->textureGenerationQueue.empty()) {
 				now = Time::now();
-				TileData* tile = this->textureGenerationQueue.back();
-				this->textureGenerationQueue.pop_back();
-
-				if (tile != NULL) {
-					this->generateTexture(tile); // Generate the current closest tile to the viewer.
-
-					const double elapsedGenerationTime = Time::time_cast<Time::time_unit, Time::milliseconds, double>(now - start);
-					if (elapsedGenerationTime >= this->maxGenerationTime) {
-						break; // If the time spent generating textures exceeds the time limit per frame, break and let the next frame pick up more textures.
-					}
+				const double elapsedGenerationTime = Time::time_cast<Time::time_unit, Time::milliseconds, double>(now - start);
+				if (elapsedGenerationTime >= this->maxGenerationTime) {
+					break; // If the time spent generating textures exceeds the time limit per frame, break and let the next frame pick up more textures.
 				}
 			}
 		}
 
-		// process asynchronous texture readback requests
+		this->processCpuGenerationRequests();
+
+		// Height ranges are read back for every tile generated on the GPU, long before any texture data.
+		this->requestHeightRanges();
+		this->processHeightRanges();
+
+		// process asynchronous texture readback requests. All readbacks issued this frame share one fence.
 		if (!this->textureReadbackQueue.empty()) {
+			bool issued = false;
+
 			while (!this->textureReadbackQueue.empty()) {
 				int readbackIndex = -1;
 				for (int i = 0; i < this->maxAsyncReadbacks; i++) {
@@ -542,30 +1258,47 @@ void TileSupplier::update() {
 				if (readbackIndex == -1) {
 					break;
 				}
+
+				ReadbackRegion* region = READBACK_BUFFER.allocate(this->getReadbackSize());
+
+				if (region == NULL) {
+					break; // The readback buffer is full, try again next frame.
+				}
 		
-				TileData* tile = this->textureReadbackQueue.back();
-				this->textureReadbackQueue.pop_back();
-				if (tile != NULL && tile->awaitingReadbackRequest) {
-					tile->awaitingReadbackRequest = false;
-					tile->awaitingReadbackResponse = true;
-		
-					int32 err = 0;
-		
-					uint32 readSize = this->tileSize * this->tileSize * sizeof(float) * 4;
-					uint32 offset = readbackIndex * readSize;
-					glBindBuffer(GL_PIXEL_PACK_BUFFER, this->pixelTransferBuffer);
-					glBindTextureUnit(0, this->textureArray);
-					glGetTextureSubImage(this->textureArray, 0, 0, 0, tile->textureIndex, this->tileSize, this->tileSize, 1, GL_RGBA, GL_FLOAT, readSize, (char*) offset);
-		
-					AsyncReadbackRequest* request = new AsyncReadbackRequest();
+				TileData* tile = this->textureReadbackQueue.pop();
+				assert(tile->awaitingReadbackRequest);
 
-					request->requestTime = Time::now();
-					request->tile = tile;
-					request->sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
-					request->cancelled = false;
+				tile->awaitingReadbackRequest = false;
+				tile->awaitingReadbackResponse = true;
+	
+				int32 err = 0;
 	
-					this->asyncReadbackSlots[readbackIndex] = request;
+				uint32 textureSize = this->tileSize * this->tileSize * this->texelSize;
+				uint64 offset = region->offset;
+				glBindBuffer(GL_PIXEL_PACK_BUFFER, READBACK_BUFFER.getBuffer());
+				glBindTextureUnit(0, this->textureArray);
+
+				if (this->packedTexels) {
+					glGetTextureSubImage(this->textureArray, 0, 0, 0, tile->textureIndex, this->tileSize, this->tileSize, 1, GL_RGB, GL_UNSIGNED_SHORT, textureSize, (char*) offset);
+					glCopyNamedBufferSubData(this->heightRangeBuffer, READBACK_BUFFER.getBuffer(), tile->textureIndex * sizeof(TileHeightRange), offset + textureSize, sizeof(uvec2));
+				} else {
+					glGetTextureSubImage(this->textureArray, 0, 0, 0, tile->textureIndex, this->tileSize, this->tileSize, 1, GL_RGBA, GL_FLOAT, textureSize, (char*) offset);
 				}
+	
+				AsyncReadbackRequest* request = new AsyncReadbackRequest();
+
+				request->requestTime = Time::now();
+				request->tile = tile;
+				request->region = region;
+				request->cancelled = false;
+
+				this->asyncReadbackSlots[readbackIndex] = request;
+				issued = true;
+			}
+
+			if (issued) {
+				glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+				READBACK_BUFFER.submit();
 			}
 		}
 		
@@ -574,43 +1307,34 @@ void TileSupplier::update() {
 			if (request != NULL) {
 				if (request->cancelled) {
 					request->tile->awaitingReadbackResponse = false;
-					glDeleteSync(request->sync);
-					delete request;
-					this->asyncReadbackSlots[i] = NULL;
+					this->releaseReadbackSlot(i);
 				} else {
-					int32 result;
-					glGetSynciv(request->sync, GL_SYNC_STATUS, sizeof(result), NULL, &result);
-
-					if (result == GL_SIGNALED) {
-
-						glBindBuffer(GL_PIXEL_PACK_BUFFER, this->pixelTransferBuffer);
-						uint32 readSize = this->tileSize * this->tileSize * sizeof(float) * 4;
-						uint32 offset = i * readSize;
-						float* data = static_cast<float*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, offset, readSize, GL_MAP_READ_BIT));
-
-						if (request->tile->textureData == NULL) {
-							request->tile->textureData = new float[this->tileSize * this->tileSize * 4];
+					if (READBACK_BUFFER.isReady(request->region)) {
+						// The readback buffer is persistently mapped, the data can be read in place.
+						uint32 textureSize = this->tileSize * this->tileSize * this->texelSize;
+						const uint8* data = READBACK_BUFFER.getData(request->region);
+
+						std::memcpy(request->tile->textureData, data, textureSize);
+
+						if (this->packedTexels) {
+							uvec2 heightRange;
+							std::memcpy(&heightRange, data + textureSize, sizeof(uvec2));
+							request->tile->minHeight = decodeOrderedHeight(heightRange.x);
+							request->tile->maxHeight = decodeOrderedHeight(heightRange.y);
 						}
 
-						std::memcpy(request->tile->textureData, data, readSize);
-
 						//// ================= REMOVE THIS =================
 						//glTextureSubImage3D(this->textureArray, 0, 0, 0, request->tile->textureIndex, this->getTileSize(), this->getTileSize(), 1, GL_RGBA, GL_FLOAT, data); // debug test
 						//// ===============================================
 
 						request->tile->onReadbackReceived();
-						glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
 
 						request->tile->awaitingReadbackResponse = false;
-						glDeleteSync(request->sync);
-						delete request;
-						this->asyncReadbackSlots[i] = NULL;
+						this->releaseReadbackSlot(i);
 					} else {
 						if (Time::time_cast<Time::time_unit, Time::seconds, double>(Time::now() - request->requestTime) > this->asyncReadbackTimeout) {
 							request->tile->awaitingReadbackResponse = false;
-							glDeleteSync(request->sync);
-							delete request;
-							this->asyncReadbackSlots[i] = NULL;
+							this->releaseReadbackSlot(i);
 
 							logInfo("Async texture readback timed out");
 							// maybe notify the tile of the cancelled request?
@@ -622,14 +1346,20 @@ void TileSupplier::update() {
 	}
 }
 
-void TileSupplier::computePointData(int32 count, fvec3* points, fvec4* data) {
+void TileSupplier::computePointData(Planet* planet, int32 count, fvec3* points, fvec4* data) {
+	this->finishPointData(this->beginPointData(planet, count, points), data);
+}
+
+PointDataRequest* TileSupplier::beginPointData(Planet* planet, int32 count, const fvec3* points) {
+	PointDataRequest* request = new PointDataRequest();
+	request->count = count;
 
 	this->tileGeneratorProgram->useProgram(true);
 
 	fvec4* p = new fvec4[count];
 	std::transform(points, points + count, p, [](fvec3 point) { return fvec4(point, 0.0F); });
 
-	uint32* ssbo = new uint32[2];
+	uint32* ssbo = request->buffers;
 	glGenBuffers(2, ssbo);
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo[0]);
 	glBufferData(GL_SHADER_STORAGE_BUFFER, count * sizeof(fvec4), p, GL_DYNAMIC_DRAW);
@@ -644,8 +1374,8 @@ void TileSupplier::computePointData(int32 count, fvec3* points, fvec4* data) {
 	this->tileGeneratorProgram->setUniform("computePointBuffers", true);
 	this->tileGeneratorProgram->setUniform("pointBufferSize", count);
 	this->tileGeneratorProgram->setUniform("tileTexture", 0);
-	this->tileGeneratorProgram->setUniform("planetRadius", (float)this->planet->getRadius());
-	this->tileGeneratorProgram->setUniform("elevationScale", (float)this->planet->getElevationScale());
+	this->tileGeneratorProgram->setUniform("planetRadius", (float)planet->getRadius());
+	this->tileGeneratorProgram->setUniform("elevationScale", (float)planet->getElevationScale());
 	this->tileGeneratorProgram->setUniform("textureSize", (int32)this->tileSize);
 	
 	int localSizeX = 16;
@@ -662,17 +1392,28 @@ void TileSupplier::computePointData(int32 count, fvec3* points, fvec4* data) {
 	
 	this->tileGeneratorProgram->useProgram(false);
 
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo[1]);
-	fvec4* mappedData = static_cast<fvec4*>(glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(fvec4), GL_MAP_READ_BIT));
-	memcpy(data, mappedData, count * sizeof(fvec4));
+	request->sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush(); // Start the dispatch now, rather than when the results are waited for.
+
+	return request;
+}
+
+void TileSupplier::finishPointData(PointDataRequest* request, fvec4* data) {
+	glClientWaitSync(request->sync, GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+	glDeleteSync(request->sync);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, request->buffers[1]);
+	fvec4* mappedData = static_cast<fvec4*>(glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, request->count * sizeof(fvec4), GL_MAP_READ_BIT));
+	memcpy(data, mappedData, request->count * sizeof(fvec4));
 
 	glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
 
-	glDeleteBuffers(2, ssbo);
+	glDeleteBuffers(2, request->buffers);
+	delete request;
 }
 
 void TileSupplier::getTileData(TerrainQuad* terrainQuad, TileData** store) {
-	uvec3 id = terrainQuad->getTreePosition(true);
+	uvec3 id = this->getTileId(terrainQuad);
 	TileData* tile = NULL;
 
 	ActiveCacheIterator aci = this->activeTiles.find(id);
@@ -682,37 +1423,18 @@ void TileSupplier::getTileData(TerrainQuad* terrainQuad, TileData** store) {
 		if (ici == this->idleTiles.end()) { // The tile is not in the idle cache
 			// The tile is not in either cache, so must be created or reallocated from an existing tile.
 
-			// TODO: dont iterate this every time... find faster method.
-			int nextAvailableTextureIndex = -1;
-			for (int i = 0; i < this->capacity; i++) {
-				if (this->availableTextures[i]) {
-					nextAvailableTextureIndex = i;
-					break;
-				}
-			}
+			uint32 textureIndex;
 
-			if (nextAvailableTextureIndex != -1) { // A texture slot is available and unused.
-				tile = new TileData(this, nextAvailableTextureIndex);
-				this->availableTextures[nextAvailableTextureIndex] = false;
-			} else if (!this->idleTiles.empty()) { // No textures are available. Find least recently used tile to overwrite.
-				LRUIterator lit = this->lruList.begin();
-				tile = *lit;
-				assert(tile != NULL); // Should not be in the unused list if it is null or has references.
-				assert(tile->references.empty());
-
-				this->lruList.erase(lit);
-				this->idleTiles.erase(tile->id);
+			if (this->allocateTextureSlot(&textureIndex)) { // A texture slot is available and unused.
+				tile = new TileData(this, textureIndex);
+			} else if (!this->idleTiles.empty()) { // No textures are available. Find least recently used tile to overwrite. It keeps its texture slot.
+				tile = this->reallocateIdleTile();
 			} else { // No idle tiles are available to overwrite.
 				tile = NULL;
 			}
 
 			if (tile != NULL) {
-				tile->id = id;
-
-				tile->quadNormals = terrainQuad->getWorldNormals();
-				tile->quadCorners = terrainQuad->getWorldCorners();
-				tile->generated = false; // Texture should not be read if this is false.
-				this->markForGeneration(tile); // Mark the tile for texture generation for the new ID
+				this->assignTile(tile, terrainQuad->getPlanet(), id, terrainQuad->getWorldNormals(), terrainQuad->getWorldCorners());
 			}
 
 		} else { // Tile was found in the idle cache. It is no longer idle, so remove it from the cache.
@@ -724,6 +1446,16 @@ void TileSupplier::getTileData(TerrainQuad* terrainQuad, TileData** store) {
 
 			this->idleTiles.erase(ici);
 			this->lruList.erase(lit);
+
+			if (tile->prefetched) {
+				tile->prefetched = false;
+
+				if (tile->generated) {
+					this->numPrefetchHits++;
+				} else {
+					this->numPrefetchLate++; // Still queued, but it will now be generated before any idle tile.
+				}
+			}
 		}
 
 		if (tile != NULL) { // Tile is now active.
@@ -737,7 +1469,13 @@ void TileSupplier::getTileData(TerrainQuad* terrainQuad, TileData** store) {
 	}
 
 	if (tile != NULL) { // Tile may be null if it could not be generated
+		const bool activated = tile->references.empty();
 		tile->references.insert(store);
+
+		if (activated) {
+			this->updateQueuePriority(tile); // Active tiles are generated before idle tiles.
+		}
+
 		tile->timeLastRetrieved = Time::now();
 		//tile->sphereVectors = terrainQuad->getWorldNormals();
 	}
@@ -752,22 +1490,6 @@ bool TileSupplier::putTileData(TileData** store) {
 		TileData* tile = *store;
 
 		if (tile != NULL) {
-			if (tile->awaitingGeneration) {
-				auto it = std::find(this->textureGenerationQueue.begin(), this->textureGenerationQueue.end(), tile);
-				if (it != this->textureGenerationQueue.end()) {
-					this->textureGenerationQueue.erase(it);
-					//logInfo("Released tile erased from texture generation queue");
-				}
-			}
-
-			if (tile->awaitingReadbackRequest) {
-				auto it = std::find(this->textureReadbackQueue.begin(), this->textureReadbackQueue.end(), tile);
-				if (it != this->textureReadbackQueue.end()) {
-					this->textureReadbackQueue.erase(it);
-					//logInfo("Released tile erased from texture readback queue");
-				}
-			}
-
 			if (tile->awaitingReadbackResponse) {
 				bool flag = false;
 				for (int i = 0; i < this->maxAsyncReadbacks; i++) {
@@ -813,12 +1535,55 @@ void TileSupplier::applyUniforms(ShaderProgram* program) {
 	program->setUniform("overlayDebug", this->overlayDebug);
 	program->setUniform("showDebug", this->showDebug);
 	program->setUniform("textureSize", (int32) this->tileSize);
+	program->setUniform("packedTexels", this->packedTexels);
+}
+
+uint32 TileSupplier::getSeed() const {
+	return this->seed;
+}
+
+uint32 TileSupplier::getPlanetIdentity(const Planet* planet) const {
+	const TileSupplierPlanet* suppliedPlanet = this->getSuppliedPlanet(planet);
+	return suppliedPlanet != NULL ? suppliedPlanet->identity : 0;
 }
 
 uint32 TileSupplier::getTileSize() const {
 	return this->tileSize;
 }
 
+uint32 TileSupplier::getTexelSize() const {
+	return this->texelSize;
+}
+
+uint32 TileSupplier::getCapacity() const {
+	return this->capacity;
+}
+
+uint32 TileSupplier::getNumActiveTiles() const {
+	return this->activeTiles.size();
+}
+
+uint32 TileSupplier::getNumIdleTiles() const {
+	return this->idleTiles.size();
+}
+
+uint32 TileSupplier::getNumFreeTextureSlots() const {
+	return this->freeTextureSlots.size();
+}
+
+uint64 TileSupplier::getTileStateVersion() const {
+	return this->tileStateVersion;
+}
+
+uint64 TileSupplier::getTileStateVersion(const Planet* planet) const {
+	const TileSupplierPlanet* suppliedPlanet = this->getSuppliedPlanet(planet);
+	return suppliedPlanet != NULL ? suppliedPlanet->tileStateVersion : 0;
+}
+
+bool TileSupplier::isPackedTexels() const {
+	return this->packedTexels;
+}
+
 bool TileSupplier::isShowDebug() const {
 	return this->showDebug;
 }
@@ -834,3 +1599,92 @@ void TileSupplier::setShowDebug(bool show) {
 void TileSupplier::setOverlayDebug(bool show) {
 	this->overlayDebug = show;
 }
+
+bool TileSupplier::isCpuGenerationEnabled() const {
+	return this->cpuGenerationEnabled;
+}
+
+void TileSupplier::setCpuGenerationEnabled(bool enabled) {
+	if (enabled && this->cpuTileGenerator == NULL) {
+		this->cpuTileGenerator = new CpuTileGenerator();
+		this->maxCpuGenerationRequests = this->cpuTileGenerator->getThreadCount() * 2; // Keep every worker busy while the results of the last batch are uploaded.
+
+		logInfo("Created CPU tile generator with %d worker threads, %d-wide SIMD", this->cpuTileGenerator->getThreadCount(), CpuTileGenerator::getSimdWidth());
+	}
+
+	this->cpuGenerationEnabled = enabled;
+}
+
+CpuTileGenerator* TileSupplier::getCpuTileGenerator() const {
+	return this->cpuTileGenerator;
+}
+
+uint32 TileSupplier::getGenerationBatchSize() const {
+	return this->generationBatchSize;
+}
+
+void TileSupplier::setGenerationBatchSize(uint32 batchSize) {
+	batchSize = glm::clamp(batchSize, (uint32) 1, this->capacity);
+
+	if (batchSize != this->generationBatchSize) {
+		this->generationBatchSize = batchSize;
+		this->allocateGenerationBatch();
+	}
+}
+
+TileCache* TileSupplier::getTileCache() const {
+	return this->tileCache;
+}
+
+bool TileSupplier::isTextureReadbackEnabled() const {
+	return this->textureReadbackEnabled;
+}
+
+void TileSupplier::setTextureReadbackEnabled(bool enabled) {
+	this->textureReadbackEnabled = enabled;
+}
+
+bool TileSupplier::isPrefetchEnabled() const {
+	return this->prefetchEnabled;
+}
+
+void TileSupplier::setPrefetchEnabled(bool enabled) {
+	this->prefetchEnabled = enabled;
+}
+
+double TileSupplier::getPrefetchTime() const {
+	return this->prefetchTime;
+}
+
+void TileSupplier::setPrefetchTime(double prefetchTime) {
+	this->prefetchTime = prefetchTime;
+}
+
+uint32 TileSupplier::getMaxPrefetchesPerUpdate() const {
+	return this->maxPrefetchesPerUpdate;
+}
+
+void TileSupplier::setMaxPrefetchesPerUpdate(uint32 maxPrefetchesPerUpdate) {
+	this->maxPrefetchesPerUpdate = maxPrefetchesPerUpdate;
+}
+
+uint64 TileSupplier::getNumPrefetched() const {
+	return this->numPrefetched;
+}
+
+uint64 TileSupplier::getNumPrefetchHits() const {
+	return this->numPrefetchHits;
+}
+
+uint64 TileSupplier::getNumPrefetchLate() const {
+	return this->numPrefetchLate;
+}
+
+uint64 TileSupplier::getNumPrefetchWasted() const {
+	return this->numPrefetchWasted;
+}
+
+double TileSupplier::getPrefetchHitRate() const {
+	const uint64 resolved = this->numPrefetchHits + this->numPrefetchLate + this->numPrefetchWasted;
+	return resolved > 0 ? double(this->numPrefetchHits) / resolved : 0.0;
+}
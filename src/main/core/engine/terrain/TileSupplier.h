@@ -1,18 +1,36 @@
 #pragma once
 
 #include "core/Core.h"
+#include "core/util/IndexedHeap.h"
 
 class TerrainQuad;
 class Planet;
 class TileData;
 class TileSupplier;
 class ShaderProgram;
+class CpuTileGenerator;
+class TileCache;
+struct CpuTileRequest;
+
+typedef struct __GLsync* GLsync;
+
+// Increment whenever the output of the tile generator (heightComp.glsl and CpuTileGenerator) changes, so
+// that tiles stored in the on-disk tile cache by an older version are not used.
+#define TILE_GENERATOR_VERSION 2
+
+// The size the on-disk tile cache may grow to, in bytes. A full cache is compacted the next time it is opened.
+#define TILE_CACHE_MAX_SIZE (4ull * 1024 * 1024 * 1024)
+
+// The width and height of the grid of height ranges reduced over each tile by the compute shader.
+#define TILE_HEIGHT_GRID_SIZE 4
 
 class TileData {
 private:
 	friend class TileSupplier;
+	friend class TerrainSnapshot;
 
 	TileSupplier* supplier; // The TileSupplier which owns this TileData.
+	Planet* planet; // The planet of the quad this tile was last allocated for. Its radius and elevation scale are needed for texture generation.
 	uint32 textureIndex; // The index within the OpenGL texture array that this tile uses.
 	std::set<TileData**> references; // The tracked references to this tile.
 
@@ -20,6 +38,8 @@ private:
 	dmat4 quadNormals; // The four corner vectors of this tile on the surface of a sphere. Needed for texture generation.
 	dmat4 quadCorners; // The four corner points of this tile on the surface of a sphere. Needed for texture generation.
 	double cameraDistance; // The distance between the TerrainQuad using this tile, and the world camera. This is updated externally, and initialized as infinity.
+	int32 generationQueueIndex; // The position of this tile in the supplier's texture generation queue, or -1 if it is not queued.
+	int32 readbackQueueIndex; // The position of this tile in the supplier's texture readback queue, or -1 if it is not queued.
 
 	uint64 timeLastUsed; // The time that this tile was last used. If the tile remains unused for too long, it will be automatically freed.
 	uint64 timeLastRetrieved; // The time that this tile was last retrieved from the TileSupplier via getTileData. (debug purposes)
@@ -31,10 +51,15 @@ private:
 	bool awaitingGeneration; // True if the texture of this tile is currently waiting in the texture generation queue.
 	bool awaitingReadbackResponse; // True if the tile has requested an asynchronous texture readback from video memory, but is still waiting for the response.
 	bool awaitingReadbackRequest; // Flag to let the TileSupplier update pass know if an asynchronous request is needed.
+	bool awaitingHeightRange; // True if the texture was generated on the GPU, but its height range has not been read back yet.
+	bool textureDataValid; // True if textureData holds the current texture. Texture data is only read back on demand, unless the supplier reads back every tile.
+	bool prefetched; // True if the tile was allocated by the prefetcher, and no quad has used it yet.
+	uint32 textureDataVersion; // Incremented whenever new texture data becomes valid, so copies of it can tell when they are stale.
 
-	float* textureData; // The texture data read back to the CPU after generation.
+	uint8* textureData; // The texture data read back to the CPU, in the texel format of the supplier (see TileSupplier::packedTexels).
 	double maxHeight; // The maximum elevation value within this tile data.
 	double minHeight; // The minimum elevation value within this tile data.
+	fvec2 heightGrid[TILE_HEIGHT_GRID_SIZE * TILE_HEIGHT_GRID_SIZE]; // The min and max elevation within each cell of a grid over the tile, row major.
 
 	TileData(TileSupplier* supplier, uint32 textureIndex);
 
@@ -46,7 +71,24 @@ private:
 
 	void onReadbackReceived();
 
+	/**
+	 * Set the height range of the tile, and of every cell of the height grid, for textures whose height grid is unknown.
+	 */
+	void setHeightRange(double minHeight, double maxHeight);
+
 public:
+	/**
+	 * Encode RGBA32F texels (normal xyz, height w) as packed texels. The height is normalized to the range
+	 * [minHeight, maxHeight] and the normal is octahedral encoded, each as a 16 bit unsigned normalized value,
+	 * giving three uint16 per texel. NaN heights are stored as zero.
+	 */
+	static void packTexels(int32 count, const float* texels, double minHeight, double maxHeight, uint16* packed);
+
+	/**
+	 * Decode a single packed texel written by packTexels, back to (normal xyz, height w).
+	 */
+	static dvec4 unpackTexel(const uint16* packed, double minHeight, double maxHeight);
+
 	/**
 	 * Function to call for every frame that this tile is used for rendering. If the tile has remained
 	 * unused for a certain length of time, it will be automatically deactivated, and its references
@@ -70,9 +112,12 @@ public:
 	/**
 	 * Set the distance of this tile to the camera. This is down to the object using this tile to update.
 	 * The default value is infinity, resulting in this tile having the lowest priority for texture generation.
+	 * If the tile is queued for generation or readback, its position in the queue is updated immediately.
 	 */
 	void setCameraDistance(double cameraDistance);
 
+	double getCameraDistance() const;
+
 	dvec3 getSphereVector(dvec2 pos) const;
 
 	dmat4 getQuadNormals() const;
@@ -103,22 +148,97 @@ public:
 
 	bool isAwaitingReadback() const;
 
+	/**
+	 * True if the height range of the generated texture is not known yet. The tile should not be rendered until
+	 * it is, since the bounds of the terrain quad, and the decoding of packed texels, depend on it.
+	 */
+	bool isAwaitingHeightRange() const;
+
+	/**
+	 * True if the texture data is available on the CPU. If not, getTextureData requests it to be read back.
+	 */
+	bool hasTextureData() const;
+
+	uint32 getTextureDataVersion() const;
+
 	bool isActive() const;
 
 	double getMaxHeight() const;
 
 	double getMinHeight() const;
+
+	/**
+	 * Get the min and max elevation within the region of the tile, in normalized texture coordinates, from the
+	 * height grid. The range is conservative, covering every grid cell the region overlaps.
+	 */
+	dvec2 getHeightRange(dvec2 tilePosition, dvec2 tileSize) const;
 };
 
-typedef struct __GLsync* GLsync;
+/**
+ * Orders tiles for texture generation and readback. Active tiles come before idle tiles, and within each, the
+ * tiles closest to the camera come first.
+ */
+struct TilePriorityComparator {
+	bool operator()(const TileData* t0, const TileData* t1) const;
+};
+
+struct ReadbackRegion;
 
 struct AsyncReadbackRequest {
 	uint64 requestTime;
 	TileData* tile;
-	GLsync sync;
+	ReadbackRegion* region; // The region of the shared readback buffer that the texture data is transferred to.
 	bool cancelled;
 };
 
+/**
+ * A batch of height range copies from the height range SSBO, sharing one region of the readback buffer.
+ * Tiles that are regenerated, reallocated or deleted before it completes are set to NULL.
+ */
+struct HeightRangeReadback {
+	ReadbackRegion* region;
+	std::vector<TileData*> tiles;
+};
+
+/**
+ * A terrain evaluation at a list of points, dispatched to the GPU but not yet read back.
+ */
+struct PointDataRequest {
+	uint32 buffers[2]; // The point and result SSBOs.
+	int32 count; // The number of points.
+	GLsync sync; // The fence signalled once the results are written.
+};
+
+/**
+ * A planet sharing a tile supplier.
+ */
+struct TileSupplierPlanet {
+	Planet* planet;
+	uint32 idOffset; // Added to the depth of the planet's tile ids, so that they are unique across planets.
+	uint32 identity; // A hash of the planet parameters that its tile textures depend on, which keys its tiles in the tile cache.
+	uint64 tileStateVersion; // Incremented whenever one of the planet's tiles changes state.
+};
+
+/**
+ * The height range of one texture array layer, accumulated by heightComp.glsl as ordered height encodings.
+ * Matches the std430 layout of TileHeightRange in heightComp.glsl and packComp.glsl.
+ */
+struct TileHeightRange {
+	uvec2 range;
+	uvec2 grid[TILE_HEIGHT_GRID_SIZE * TILE_HEIGHT_GRID_SIZE];
+};
+
+/**
+ * The parameters of one tile in a batched generation dispatch. Matches the std430 layout of
+ * TileGenerationInfo in heightComp.glsl and packComp.glsl.
+ */
+struct TileGenerationInfo {
+	fmat4 quadNormals;
+	fmat4 quadCorners;
+	int32 textureIndex;
+	int32 padding[3];
+};
+
 class TileSupplier {
 private:
 	friend class TileData;
@@ -130,41 +250,144 @@ private:
 	std::unordered_map<uvec3, TileData*> activeTiles; // Map of currenrly active tiles. These tiles cannot be reallocated.
 	std::unordered_map<uvec3, LRUIterator> idleTiles; // Map of idle tiles in the LRU list, which may be reallocated or reactivated
 	std::list<TileData*> lruList; // "Least recently used" sorted list of tiles. Tiles at the beginning of this list are the first to be reallocated.
-	std::vector<TileData*> textureGenerationQueue; // List of textures to be generated, sorted by distance to the viewer. Closest textures get generated first.
-	std::vector<TileData*> textureReadbackQueue; // List of textures to be read back to system memory, sorted by distance to the viewer. Closest textures get requested first.
+	IndexedHeap<TileData, TilePriorityComparator> textureGenerationQueue; // Queue of textures to be generated, ordered by TilePriorityComparator. Closest textures get generated first.
+	IndexedHeap<TileData, TilePriorityComparator> textureReadbackQueue; // Queue of textures to be read back to system memory, ordered by TilePriorityComparator. Closest textures get requested first.
 
-	Planet* planet; // The planet that this tile supplier is for.
+	std::vector<TileSupplierPlanet> planets; // The planets sharing this supplier.
+	uint32 nextPlanetIdOffset; // The id offset of the next planet added. Offsets are never reused, so a removed planet's tiles are never mistaken for another's.
+	TileCache* tileCache; // Second level cache on disk, behind the idle LRU list. Tiles are written when reallocated, and read before generating. NULL if unavailable.
+	uint32 seed; // The seed of the tile generator.
 	uint32 capacity; // The capacity, or number of tiles, which can be stored.
 	uint32 tileSize; // The width and height of each tile texture in the array.
 	uint32 textureArray; // The OpenGL texture array handle.
-	uint32 pixelTransferBuffer; // The OpenGL pixel buffer object used to transfer texture data asynchronously back to system memory.
-	bool* availableTextures; // Array to identify which textures are available and unused. The first true index in this array identifies the first available texture.
+	uint32 texelSize; // The number of bytes per texel of the tile texture data stored on the CPU.
+	bool packedTexels; // True if tiles are stored as a 16 bit height relative to the tile's height range plus a 2x16 bit octahedral normal, rather than RGBA32F.
+	uint32 scratchTexture; // Packed texels only. RGBA32F texture array, one layer per tile in a batch, that the compute shader writes the unpacked tiles to, before they are packed into the texture array.
+	uint32 tileBatchBuffer; // SSBO of the TileGenerationInfo for each tile in the current generation batch.
+	uint32 generationBatchSize; // The maximum number of tiles generated by a single compute dispatch.
+	uint32 heightRangeBuffer; // SSBO of the TileHeightRange of each texture array layer, accumulated by the compute shader.
+	std::vector<uint32> freeTextureSlots; // Stack of the texture array layers that are not used by any tile. Popped from the back, so the lowest layers are handed out first.
 
 	uint32 maxAsyncReadbacks; // The maximum number of concurrent asynchronous texture readbacks.
-	AsyncReadbackRequest** asyncReadbackSlots; // The available asynchronous readback slots are NULL. Used ones contain the OpenGL sync object.
+	AsyncReadbackRequest** asyncReadbackSlots; // The available asynchronous readback slots are NULL.
 	double asyncReadbackTimeout; // The maximum amount of time an asynchronous readback request is allowed to remain unresolved for. The request wil be cancelled after this.
+	bool textureReadbackEnabled; // True if the texture data of every generated tile is read back, rather than only on demand. Needed by the tile cache.
+
+	std::vector<TileData*> heightRangeQueue; // Tiles generated on the GPU whose height range still needs to be copied to the readback buffer.
+	std::vector<HeightRangeReadback*> heightRangeReadbacks; // The height range copies waiting for the GPU, in submission order.
 
 	ShaderProgram* tileGeneratorProgram; // The compute shader used to generate terrain tiles on the GPU.
+	ShaderProgram* tilePackingProgram; // Packed texels only. The compute shader that packs the generated tile into the texture array.
+
+	CpuTileGenerator* cpuTileGenerator; // Generates tile textures on worker threads instead of the compute shader. NULL until CPU generation is first enabled.
+	std::vector<CpuTileRequest*> cpuGenerationRequests; // The requests currently being generated by the CPU tile generator.
+	uint32 maxCpuGenerationRequests; // The maximum number of tiles being generated on the CPU at once.
+	bool cpuGenerationEnabled; // True if tile textures are generated on the CPU rather than by the compute shader.
+
+	uint64 tileStateVersion; // Incremented whenever a tile of any planet is generated, receives its height range, or loses its references.
 
 	uint32 numTexturesGenerated; // Debug info
 	uint32 numTilesExpired; // Debug info
 
+	bool prefetchEnabled; // True if the tiles of quads the camera is heading towards are generated before they are needed.
+	double prefetchTime; // The number of seconds the camera's motion is extrapolated ahead, to find the quads that will split.
+	uint32 maxPrefetchesPerUpdate; // The maximum number of tiles queued by the prefetcher in one update.
+	double minPrefetchEvictionAge; // The number of seconds an idle tile must have been unused before the prefetcher may reallocate it.
+	uint64 numPrefetched; // Debug info
+	uint64 numPrefetchHits; // Debug info. Prefetched tiles that were generated when a quad first used them.
+	uint64 numPrefetchLate; // Debug info. Prefetched tiles that a quad used before they were generated.
+	uint64 numPrefetchWasted; // Debug info. Prefetched tiles that were reallocated without ever being used.
+
 	bool overlayDebug; // Overlay the texture generation time
 	bool showDebug; // Show texture generation, retrieve and use time as the texture RGB components.
 
 	uint64 timeLastCleanupCycle; // The time that we last went through and removed expired tiles that have been unused for too long.
-	uint64 timeLastGenerationCheck; // The time at which we last went through and checked if we need to initiate a generation burst.
 	double cleanupFrequency; // The frequency at which we go through and remove expired tiles.
-	double generationCheckFrequency; // The frequency at which we go through and mark textures that need generation, and sort tiles in order of distance to the viewer.
 
 	double maxGenerationTime; // The maximum amount of time in milliseconds that is allowed to be spent in a single frame generating textures.
 
 	/**
-	 * Generate the texture data for the specified tile. This will not happen asynchronously,
-	 * and will cause slowdowns if too many textures are generated at once. After this function
-	 * returns, the tiles texture will be fully generated.
+	 * Generate the texture data for the specified tiles, with one compute dispatch for all of them. This
+	 * will not happen asynchronously, and will cause slowdowns if too many textures are generated at once.
+	 * After this function returns, the tiles textures will be fully generated. At most generationBatchSize
+	 * tiles may be passed.
+	 */
+	void generateTextures(const std::vector<TileData*>& tiles);
+
+	/**
+	 * (Re)allocate the batch SSBO and the scratch texture for the current generation batch size.
 	 */
-	void generateTexture(TileData* tile);
+	void allocateGenerationBatch();
+
+	/**
+	 * Delete the readback request in the slot, and return its region to the readback buffer.
+	 */
+	void releaseReadbackSlot(int32 index);
+
+	/**
+	 * Copy the height ranges of the queued tiles to one region of the readback buffer. If the readback buffer
+	 * is full, they stay queued until the next frame.
+	 */
+	void requestHeightRanges();
+
+	/**
+	 * Apply the height ranges of any completed height range readbacks to their tiles.
+	 */
+	void processHeightRanges();
+
+	/**
+	 * Discard the queued or in-progress height range readback of the tile, if it has one.
+	 */
+	void cancelHeightRange(TileData* tile);
+
+	/**
+	 * Submit the tile to the CPU tile generator. The tile is not marked as generated until the request
+	 * completes, and processCpuGenerationRequests uploads the result to the texture array. No readback is
+	 * needed, since the generator writes the texture data and height range directly.
+	 */
+	void requestCpuGeneration(TileData* tile);
+
+	/**
+	 * Upload the results of any completed CPU generation requests, and release them. Results for tiles
+	 * that were reallocated to a different id while the request was in progress are discarded.
+	 */
+	void processCpuGenerationRequests();
+
+	/**
+	 * Try to load the texture for the tile's current id from the tile cache, and upload it to the texture
+	 * array. Returns true if the tile was found, in which case it is immediately marked as generated.
+	 */
+	bool loadCachedTile(TileData* tile);
+
+	/**
+	 * Take an unused layer of the texture array. Returns false if every layer is in use.
+	 */
+	bool allocateTextureSlot(uint32* textureIndex);
+
+	/**
+	 * Return a layer of the texture array to the free list, after the tile using it is deleted.
+	 */
+	void releaseTextureSlot(uint32 textureIndex);
+
+	/**
+	 * Upload the tile's CPU texture data to its layer of the texture array.
+	 */
+	void uploadTextureData(TileData* tile);
+
+	/**
+	 * The number of bytes of the readback buffer used by one asynchronous readback.
+	 */
+	uint32 getReadbackSize() const;
+
+	/**
+	 * Restore the order of the generation and readback queues after the priority of the tile changed.
+	 */
+	void updateQueuePriority(TileData* tile);
+
+	/**
+	 * The tile id of the terrain quad, which is unique across every planet sharing this supplier.
+	 */
+	uvec3 getTileId(TerrainQuad* terrainQuad) const;
 
 	/**
 	 * Add the tile to the texture generation queue. The tile texture will be generated at some
@@ -179,18 +402,100 @@ private:
 	 */
 	void markIdle(TileData* tile);
 
+	/**
+	 * Take the least recently used idle tile out of the idle cache, so that it can be reallocated to another id. Its
+	 * texture is written to the tile cache first, if it has one.
+	 */
+	TileData* reallocateIdleTile();
+
+	/**
+	 * Give a new or reallocated tile its id and geometry, and load its texture from the tile cache, or queue it for
+	 * generation.
+	 */
+	void assignTile(TileData* tile, Planet* planet, uvec3 id, dmat4 quadNormals, dmat4 quadCorners);
+
+	/**
+	 * The tile id of a planetary unique tree position, which is unique across every planet sharing this supplier.
+	 */
+	uvec3 getTileId(const Planet* planet, uvec3 treePosition) const;
+
+	/**
+	 * The entry of a planet sharing this supplier, or NULL if it was not added.
+	 */
+	const TileSupplierPlanet* getSuppliedPlanet(const Planet* planet) const;
+
+	/**
+	 * The key of the tile in the tile cache, which is its tree position on its own planet and the identity of the
+	 * planet. Tile ids can't be used, since they depend on the order the planets were added. Returns false if the tile
+	 * has no planet.
+	 */
+	bool getCacheKey(const TileData* tile, uvec4* key) const;
+
+	/**
+	 * Write the tile to the tile cache, if its texture data and height range are complete and current. Tiles that
+	 * were never read back, or are still waiting for a readback or height range, are not written.
+	 */
+	void storeCachedTile(TileData* tile);
+
+	/**
+	 * Increment the tile state version, and that of the tile's planet.
+	 */
+	void onTileStateChanged(const TileData* tile);
+
+	/**
+	 * Add the leaves below the quad that would split if the camera were at the predicted position.
+	 */
+	void addPrefetchCandidates(TerrainQuad* terrainQuad, dvec3 predictedCameraPosition, std::vector<std::pair<double, TerrainQuad*>>& candidates);
+
+	/**
+	 * Allocate an idle tile for the id, and queue it for generation behind every active tile. Returns false if the
+	 * tile already exists, or no tile could be allocated without evicting a recently used one.
+	 */
+	bool prefetchTile(Planet* planet, uvec3 treePosition, dmat4 quadNormals, double cameraDistance);
+
 public:
-	TileSupplier(Planet* planet, uint32 seed = 1337, uint32 textureCapacity = 0, uint32 textureSize = 128);
+	/**
+	 * Create a tile supplier, which may be shared by any number of planets, so that they all use one texture array and
+	 * one set of generation resources. If packedTexels is true, tile textures are stored with 8 bytes per texel in
+	 * video memory and 6 bytes per texel in system memory and the tile cache, instead of 16 bytes. The heights are
+	 * quantized to 1/65535 of each tile's height range.
+	 */
+	TileSupplier(uint32 seed = 1337, uint32 textureCapacity = 0, uint32 textureSize = 128, bool packedTexels = false);
 
 	~TileSupplier();
 
+	/**
+	 * Start supplying tiles to the planet. Every planet must be added before it requests any tiles.
+	 */
+	void addPlanet(Planet* planet);
+
+	/**
+	 * Stop supplying tiles to the planet, once all of its quads have released their tiles. Its idle tiles stay in the
+	 * cache until they are reallocated, but are no longer generated.
+	 */
+	void removePlanet(Planet* planet);
+
 	/**
 	 * Update function called every tick to perform periodic cleanup routines, primarily automatically
 	 * freeing active tiles which have not been used for too long.
 	 */
 	void update();
 
-	void computePointData(int32 count, fvec3* points, fvec4* data);
+	/**
+	 * Compute the terrain normal and height at each of the points on the unit sphere, and wait for the results.
+	 */
+	void computePointData(Planet* planet, int32 count, fvec3* points, fvec4* data);
+
+	/**
+	 * Dispatch the terrain evaluation at each of the points without waiting for it, so that other work can be done
+	 * while the GPU runs. The points are copied, so they may be changed straight away.
+	 */
+	PointDataRequest* beginPointData(Planet* planet, int32 count, const fvec3* points);
+
+	/**
+	 * Copy the results of the request to data, waiting for the GPU if it has not finished, and delete the request.
+	 */
+	void finishPointData(PointDataRequest* request, fvec4* data);
 
 	/**
 	 * Gets the TileData corresponding to the specified TerrainQuad, and stores it in the storage
@@ -229,8 +534,49 @@ public:
 	 */
 	void applyUniforms(ShaderProgram* program);
 
+	uint32 getSeed() const;
+
+	/**
+	 * A hash of the parameters of the planet that its tile textures depend on, other than the seed. Zero if the planet
+	 * was not added.
+	 */
+	uint32 getPlanetIdentity(const Planet* planet) const;
+
 	uint32 getTileSize() const;
 
+	uint32 getTexelSize() const;
+
+	uint32 getCapacity() const;
+
+	/**
+	 * The number of texture array layers in use by active tiles.
+	 */
+	uint32 getNumActiveTiles() const;
+
+	/**
+	 * The number of texture array layers in use by idle tiles, which may be reallocated.
+	 */
+	uint32 getNumIdleTiles() const;
+
+	/**
+	 * The number of texture array layers not used by any tile.
+	 */
+	uint32 getNumFreeTextureSlots() const;
+
+	/**
+	 * Changes whenever the renderable state of any tile changes, so that anything caching tile data, such as the
+	 * texture index or height range of each terrain quad, knows when to refresh it.
+	 */
+	uint64 getTileStateVersion() const;
+
+	/**
+	 * Changes whenever the renderable state of one of the planet's tiles changes. Unlike getTileStateVersion, this is
+	 * not affected by the other planets sharing this supplier.
+	 */
+	uint64 getTileStateVersion(const Planet* planet) const;
+
+	bool isPackedTexels() const;
+
 	bool isShowDebug() const;
 
 	bool isOverlayDebug() const;
@@ -238,4 +584,66 @@ public:
 	void setShowDebug(bool show);
 
 	void setOverlayDebug(bool show);
+
+	bool isCpuGenerationEnabled() const;
+
+	/**
+	 * Switch between generating tile textures with the compute shader, and on the CPU tile generator's
+	 * worker threads. Requests already in progress on the CPU are still completed after disabling it.
+	 */
+	void setCpuGenerationEnabled(bool enabled);
+
+	CpuTileGenerator* getCpuTileGenerator() const;
+
+	uint32 getGenerationBatchSize() const;
+
+	/**
+	 * Extrapolate the camera's motion relative to the planet, and queue the tiles of the children of every leaf that
+	 * will need to split once the camera gets there. Prefetched tiles are idle, so they are only generated once every
+	 * tile being rendered is, and they are the first to be reallocated if they turn out not to be needed.
+	 */
+	void prefetch(Planet* planet);
+
+	bool isPrefetchEnabled() const;
+
+	void setPrefetchEnabled(bool enabled);
+
+	double getPrefetchTime() const;
+
+	void setPrefetchTime(double prefetchTime);
+
+	uint32 getMaxPrefetchesPerUpdate() const;
+
+	void setMaxPrefetchesPerUpdate(uint32 maxPrefetchesPerUpdate);
+
+	uint64 getNumPrefetched() const;
+
+	uint64 getNumPrefetchHits() const;
+
+	uint64 getNumPrefetchLate() const;
+
+	uint64 getNumPrefetchWasted() const;
+
+	/**
+	 * The fraction of prefetched tiles that were ready by the time a quad first used them, out of every prefetched
+	 * tile that was either used or wasted.
+	 */
+	double getPrefetchHitRate() const;
+
+	/**
+	 * Set the maximum number of tiles generated by a single compute dispatch. Larger batches have less
+	 * per-dispatch overhead, but the per-frame generation time limit is only checked between batches.
+	 */
+	void setGenerationBatchSize(uint32 batchSize);
+
+	TileCache* getTileCache() const;
+
+	bool isTextureReadbackEnabled() const;
+
+	/**
+	 * Set whether the texture data of every generated tile is read back to the CPU. If disabled, only the height
+	 * range is read back, and the texture data is only read back for tiles that are queried with getTextureData.
+	 * Enabled by default if the tile cache is available, since tiles can only be written to it with their texture data.
+	 */
+	void setTextureReadbackEnabled(bool enabled);
 };
\ No newline at end of file
@@ -0,0 +1,157 @@
+#pragma once
+
+#include "core/Core.h"
+
+/**
+ * Binary heap of object pointers, where every object stores its own position in the heap. This allows
+ * an object to be found, removed or have its priority changed in O(log n), without searching the heap.
+ * Compare is a functor returning true if the first object should be popped before the second.
+ *
+ * An object may only be in one IndexedHeap per index member at a time. The index member is -1 while the
+ * object is not in the heap, and must be initialized to -1 by the object.
+ */
+template<typename T, typename Compare>
+class IndexedHeap {
+private:
+	std::vector<T*> heap;
+	int32 T::* heapIndex; // The member of T that stores the position of the object in the heap.
+	Compare compare;
+
+	void set(uint32 index, T* item) {
+		this->heap[index] = item;
+		item->*this->heapIndex = index;
+	}
+
+	void siftUp(uint32 index) {
+		T* item = this->heap[index];
+
+		while (index > 0) {
+			uint32 parent = (index - 1) / 2;
+			if (!this->compare(item, this->heap[parent])) {
+				break;
+			}
+
+			this->set(index, this->heap[parent]);
+			index = parent;
+		}
+
+		this->set(index, item);
+	}
+
+	void siftDown(uint32 index) {
+		T* item = this->heap[index];
+		const uint32 size = this->heap.size();
+
+		while (true) {
+			uint32 child = index * 2 + 1;
+			if (child >= size) {
+				break;
+			}
+
+			if (child + 1 < size && this->compare(this->heap[child + 1], this->heap[child])) {
+				child++; // Right child has the higher priority.
+			}
+
+			if (!this->compare(this->heap[child], item)) {
+				break;
+			}
+
+			this->set(index, this->heap[child]);
+			index = child;
+		}
+
+		this->set(index, item);
+	}
+
+public:
+	IndexedHeap(int32 T::* heapIndex, Compare compare = Compare()) :
+		heapIndex(heapIndex), compare(compare) {}
+
+	/**
+	 * Add the object to the heap. If it is already in the heap, its position is updated instead.
+	 */
+	void push(T* item) {
+		if (this->contains(item)) {
+			this->update(item);
+			return;
+		}
+
+		this->heap.push_back(item);
+		this->siftUp(this->heap.size() - 1);
+	}
+
+	/**
+	 * Remove and return the highest priority object.
+	 */
+	T* pop() {
+		assert(!this->heap.empty());
+
+		T* top = this->heap[0];
+		this->remove(top);
+		return top;
+	}
+
+	T* top() const {
+		assert(!this->heap.empty());
+		return this->heap[0];
+	}
+
+	/**
+	 * Remove the object from the heap. Returns false if it was not in the heap.
+	 */
+	bool remove(T* item) {
+		if (!this->contains(item)) {
+			return false;
+		}
+
+		const uint32 index = item->*this->heapIndex;
+		T* last = this->heap.back();
+		this->heap.pop_back();
+		item->*this->heapIndex = -1;
+
+		if (last != item) {
+			this->set(index, last);
+			this->update(last);
+		}
+
+		return true;
+	}
+
+	/**
+	 * Restore the heap order after the priority of the object changed. Does nothing if it is not in the heap.
+	 */
+	void update(T* item) {
+		if (!this->contains(item)) {
+			return;
+		}
+
+		const uint32 index = item->*this->heapIndex;
+
+		if (index > 0 && this->compare(item, this->heap[(index - 1) / 2])) {
+			this->siftUp(index);
+		} else {
+			this->siftDown(index);
+		}
+	}
+
+	bool contains(T* item) const {
+		const int32 index = item->*this->heapIndex;
+		return index >= 0 && index < this->heap.size() && this->heap[index] == item;
+	}
+
+	void clear() {
+		for (int i = 0; i < this->heap.size(); i++) {
+			this->heap[i]->*this->heapIndex = -1;
+		}
+
+		this->heap.clear();
+	}
+
+	bool empty() const {
+		return this->heap.empty();
+	}
+
+	uint32 size() const {
+		return this->heap.size();
+	}
+};
@@ -0,0 +1,296 @@
+#include "MappedFile.h"
+#include "core/application/Application.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+MappedFile::MappedFile() {
+#ifdef _WIN32
+	this->fileHandle = INVALID_HANDLE_VALUE;
+	this->mappingHandle = NULL;
+#else
+	this->fileDescriptor = -1;
+#endif
+
+	this->mappedData = NULL;
+	this->mappedSize = 0;
+	this->fileSize = 0;
+	this->writable = false;
+}
+
+MappedFile::~MappedFile() {
+	this->close();
+}
+
+bool MappedFile::open(std::string path, bool writable) {
+	this->close();
+
+	this->path = path;
+	this->writable = writable;
+
+#ifdef _WIN32
+	DWORD access = writable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ;
+	DWORD creation = writable ? OPEN_ALWAYS : OPEN_EXISTING;
+	this->fileHandle = CreateFileA(path.c_str(), access, FILE_SHARE_READ, NULL, creation, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (this->fileHandle == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(this->fileHandle, &size)) {
+		this->close();
+		return false;
+	}
+
+	this->fileSize = size.QuadPart;
+#else
+	this->fileDescriptor = ::open(path.c_str(), writable ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+
+	if (this->fileDescriptor < 0) {
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(this->fileDescriptor, &info) != 0) {
+		this->close();
+		return false;
+	}
+
+	this->fileSize = info.st_size;
+#endif
+
+	return true;
+}
+
+void MappedFile::close() {
+	this->unmap();
+
+#ifdef _WIN32
+	if (this->fileHandle != INVALID_HANDLE_VALUE) {
+		CloseHandle(this->fileHandle);
+		this->fileHandle = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (this->fileDescriptor >= 0) {
+		::close(this->fileDescriptor);
+		this->fileDescriptor = -1;
+	}
+#endif
+
+	this->fileSize = 0;
+}
+
+void MappedFile::unmap() {
+	if (this->mappedData != NULL) {
+#ifdef _WIN32
+		UnmapViewOfFile(this->mappedData);
+#else
+		munmap((void*) this->mappedData, this->mappedSize);
+#endif
+	}
+
+#ifdef _WIN32
+	if (this->mappingHandle != NULL) {
+		CloseHandle(this->mappingHandle);
+		this->mappingHandle = NULL;
+	}
+#endif
+
+	this->mappedData = NULL;
+	this->mappedSize = 0;
+}
+
+bool MappedFile::append(const void* data, uint64 size, uint64* offset) {
+	if (!this->isOpen() || !this->writable) {
+		return false;
+	}
+
+	const uint64 writeOffset = this->fileSize;
+
+#ifdef _WIN32
+	OVERLAPPED overlapped = {};
+	overlapped.Offset = (DWORD) (writeOffset & 0xFFFFFFFF);
+	overlapped.OffsetHigh = (DWORD) (writeOffset >> 32);
+
+	DWORD written = 0;
+	if (!WriteFile(this->fileHandle, data, (DWORD) size, &written, &overlapped) || written != size) {
+		return false;
+	}
+#else
+	const uint8* bytes = static_cast<const uint8*>(data);
+	uint64 written = 0;
+	while (written < size) {
+		ssize_t result = pwrite(this->fileDescriptor, bytes + written, size - written, writeOffset + written);
+		if (result <= 0) {
+			return false;
+		}
+		written += result;
+	}
+#endif
+
+	if (offset != NULL) {
+		*offset = writeOffset;
+	}
+
+	this->fileSize = writeOffset + size; // Published last, so readers never see a size covering a partial write.
+	return true;
+}
+
+bool MappedFile::write(uint64 offset, const void* data, uint64 size) {
+	if (!this->isOpen() || !this->writable || offset + size > this->fileSize) {
+		return false;
+	}
+
+#ifdef _WIN32
+	OVERLAPPED overlapped = {};
+	overlapped.Offset = (DWORD) (offset & 0xFFFFFFFF);
+	overlapped.OffsetHigh = (DWORD) (offset >> 32);
+
+	DWORD written = 0;
+	if (!WriteFile(this->fileHandle, data, (DWORD) size, &written, &overlapped) || written != size) {
+		return false;
+	}
+#else
+	const uint8* bytes = static_cast<const uint8*>(data);
+	uint64 written = 0;
+	while (written < size) {
+		ssize_t result = pwrite(this->fileDescriptor, bytes + written, size - written, offset + written);
+		if (result <= 0) {
+			return false;
+		}
+		written += result;
+	}
+#endif
+
+	return true;
+}
+
+bool MappedFile::read(uint64 offset, void* data, uint64 size) {
+	if (!this->isOpen() || offset + size > this->fileSize) {
+		return false;
+	}
+
+	if (offset + size > this->mappedSize && this->fileSize >= this->mappedSize * 2) {
+		this->map(this->fileSize);
+	}
+
+	if (this->mappedData != NULL && offset + size <= this->mappedSize) {
+		memcpy(data, this->mappedData + offset, size);
+		return true;
+	}
+
+#ifdef _WIN32
+	OVERLAPPED overlapped = {};
+	overlapped.Offset = (DWORD) (offset & 0xFFFFFFFF);
+	overlapped.OffsetHigh = (DWORD) (offset >> 32);
+
+	DWORD read = 0;
+	if (!ReadFile(this->fileHandle, data, (DWORD) size, &read, &overlapped) || read != size) {
+		return false;
+	}
+#else
+	uint8* bytes = static_cast<uint8*>(data);
+	uint64 read = 0;
+	while (read < size) {
+		ssize_t result = pread(this->fileDescriptor, bytes + read, size - read, offset + read);
+		if (result <= 0) {
+			return false;
+		}
+		read += result;
+	}
+#endif
+
+	return true;
+}
+
+bool MappedFile::truncate(uint64 size) {
+	if (!this->isOpen() || !this->writable) {
+		return false;
+	}
+
+	this->unmap(); // Windows does not allow truncating a mapped file.
+
+#ifdef _WIN32
+	LARGE_INTEGER position;
+	position.QuadPart = size;
+	if (!SetFilePointerEx(this->fileHandle, position, NULL, FILE_BEGIN) || !SetEndOfFile(this->fileHandle)) {
+		return false;
+	}
+#else
+	if (ftruncate(this->fileDescriptor, size) != 0) {
+		return false;
+	}
+#endif
+
+	this->fileSize = size;
+	return true;
+}
+
+const uint8* MappedFile::map(uint64 requiredSize) {
+	if (!this->isOpen()) {
+		return NULL;
+	}
+
+	const uint64 size = this->fileSize;
+
+	if (requiredSize > size) {
+		return NULL;
+	}
+
+	if (this->mappedData != NULL && requiredSize <= this->mappedSize) {
+		return this->mappedData; // Current view already covers the requested range.
+	}
+
+	this->unmap();
+
+	if (size == 0) {
+		return NULL; // Empty files can't be mapped.
+	}
+
+#ifdef _WIN32
+	this->mappingHandle = CreateFileMappingA(this->fileHandle, NULL, PAGE_READONLY, (DWORD) (size >> 32), (DWORD) (size & 0xFFFFFFFF), NULL);
+	if (this->mappingHandle == NULL) {
+		logError("Failed to create file mapping for \"%s\"", this->path.c_str());
+		return NULL;
+	}
+
+	this->mappedData = static_cast<const uint8*>(MapViewOfFile(this->mappingHandle, FILE_MAP_READ, 0, 0, (SIZE_T) size));
+#else
+	void* data = mmap(NULL, size, PROT_READ, MAP_SHARED, this->fileDescriptor, 0);
+	this->mappedData = data != MAP_FAILED ? static_cast<const uint8*>(data) : NULL;
+#endif
+
+	if (this->mappedData == NULL) {
+		logError("Failed to map %llu bytes of \"%s\"", size, this->path.c_str());
+		this->unmap();
+		return NULL;
+	}
+
+	this->mappedSize = size;
+	return this->mappedData;
+}
+
+uint64 MappedFile::getSize() const {
+	return this->fileSize;
+}
+
+bool MappedFile::isOpen() const {
+#ifdef _WIN32
+	return this->fileHandle != INVALID_HANDLE_VALUE;
+#else
+	return this->fileDescriptor >= 0;
+#endif
+}
+
+std::string MappedFile::getPath() const {
+	return this->path;
+}
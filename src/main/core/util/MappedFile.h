@@ -0,0 +1,83 @@
+#pragma once
+
+#include "core/Core.h"
+#include <atomic>
+
+/**
+ * A file which is read through a read-only memory mapping, and optionally written by appending to
+ * the end. Appending is safe from one thread while another thread reads through the mapping, as long
+ * as the reader only accesses bytes that were appended before it called map.
+ */
+class MappedFile {
+private:
+	std::string path; // The path that the file was opened with.
+
+#ifdef _WIN32
+	void* fileHandle; // The Win32 file HANDLE.
+	void* mappingHandle; // The Win32 file mapping HANDLE for the current view.
+#else
+	int32 fileDescriptor;
+#endif
+
+	const uint8* mappedData; // The currently mapped view of the file, or NULL if nothing is mapped.
+	uint64 mappedSize; // The number of bytes visible through the current view.
+	std::atomic<uint64> fileSize; // The current size of the file, including appended data that may not yet be mapped.
+	bool writable;
+
+	void unmap();
+
+public:
+	MappedFile();
+
+	~MappedFile();
+
+	// Deleted copy constructor and assignment function
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	/**
+	 * Open the file at the specified path. If the file is writable, it is created if it does not exist.
+	 * Returns false if the file could not be opened.
+	 */
+	bool open(std::string path, bool writable);
+
+	void close();
+
+	/**
+	 * Write the data to the end of the file, and store the offset that it was written at. Only one
+	 * thread may append at a time. Returns false if the write failed, in which case the file size
+	 * is unchanged.
+	 */
+	bool append(const void* data, uint64 size, uint64* offset = NULL);
+
+	/**
+	 * Overwrite bytes that are already in the file, without changing its size. Only one thread may write at a time.
+	 */
+	bool write(uint64 offset, const void* data, uint64 size);
+
+	/**
+	 * Copy bytes from the file. Bytes covered by the current view are copied from the mapping, and bytes appended
+	 * since are read from the file, so that reading recent appends does not remap the whole file every time. The view
+	 * is only remapped once the file has doubled in size since it was mapped. Returns false if the range is not in the
+	 * file. Invalidates pointers returned by map if the file is remapped.
+	 */
+	bool read(uint64 offset, void* data, uint64 size);
+
+	/**
+	 * Shrink the file to the specified size, discarding anything after it. The current mapping is released.
+	 */
+	bool truncate(uint64 size);
+
+	/**
+	 * Get a pointer to the start of the file, making sure that at least the first requiredSize bytes are
+	 * mapped. The file is remapped if it grew beyond the current view, which invalidates pointers returned
+	 * by previous calls. Returns NULL if the file is smaller than requiredSize, or could not be mapped.
+	 */
+	const uint8* map(uint64 requiredSize = 0);
+
+	uint64 getSize() const;
+
+	bool isOpen() const;
+
+	std::string getPath() const;
+};
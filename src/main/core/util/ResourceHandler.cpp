@@ -113,6 +113,62 @@ bool ResourceHandler::loadFileAttemptPaths(std::vector<std::string> paths, std::
 	return false;
 }
 
+std::vector<std::string> ResourceHandler::getShaderPaths(std::string file) const {
+	return {
+		file,
+		file + ".glsl",
+		this->workingDirectory + "/" + file,
+		this->workingDirectory + "/" + file + ".glsl",
+		this->workingDirectory + "/" + this->resourceDirectory + "/" + file,
+		this->workingDirectory + "/" + this->resourceDirectory + "/" + file + ".glsl",
+		this->workingDirectory + "/" + this->shaderDirectory + "/" + file,
+		this->workingDirectory + "/" + this->shaderDirectory + "/" + file + ".glsl",
+	};
+}
+
+bool ResourceHandler::expandShaderIncludes(std::string& source, std::string file, int32 depth) const {
+	if (depth > 8) {
+		logError("Shader includes are nested too deeply in %s, there may be a cycle", file.c_str());
+		return false;
+	}
+
+	std::stringstream input(source);
+	std::string expanded;
+	std::string line;
+	int32 lineNumber = 0;
+
+	while (std::getline(input, line)) {
+		lineNumber++;
+
+		size_t start = line.find_first_not_of(" \t");
+		if (start == std::string::npos || line.compare(start, 8, "#include") != 0) {
+			expanded.append(line + "\n");
+			continue;
+		}
+
+		size_t open = line.find('"', start);
+		size_t close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+		if (close == std::string::npos) {
+			logError("Invalid include on line %d of shader %s: %s", lineNumber, file.c_str(), line.c_str());
+			return false;
+		}
+
+		std::string includeFile = line.substr(open + 1, close - open - 1);
+		std::string included;
+
+		if (!loadFileAttemptPaths(this->getShaderPaths(includeFile), included) || !this->expandShaderIncludes(included, includeFile, depth + 1)) {
+			logError("Failed to include %s in shader %s", includeFile.c_str(), file.c_str());
+			return false;
+		}
+
+		expanded.append(included);
+		expanded.append("#line " + std::to_string(lineNumber + 1) + "\n");
+	}
+
+	source = expanded;
+	return true;
+}
+
 Shader* ResourceHandler::loadShader(uint32 type, std::string file) const {
 	logInfo("Loading shader file %s", file.c_str());
 	if (type != GL_VERTEX_SHADER
@@ -131,18 +187,8 @@ Shader* ResourceHandler::loadShader(uint32 type, std::string file) const {
 	int logLength;
 
 	std::string fileRaw;
-	std::vector<std::string> paths = {
-		file,
-		file + ".glsl",
-		this->workingDirectory + "/" + file,
-		this->workingDirectory + "/" + file + ".glsl",
-		this->workingDirectory + "/" + this->resourceDirectory + "/" + file,
-		this->workingDirectory + "/" + this->resourceDirectory + "/" + file + ".glsl",
-		this->workingDirectory + "/" + this->shaderDirectory + "/" + file,
-		this->workingDirectory + "/" + this->shaderDirectory + "/" + file + ".glsl",
-	};
 
-	if (!loadFileAttemptPaths(paths, fileRaw)) {
+	if (!loadFileAttemptPaths(this->getShaderPaths(file), fileRaw) || !this->expandShaderIncludes(fileRaw, file)) {
 		logWarn("An error occurred while loading this shader, this may cause errors");
 		return nullptr;
 	}
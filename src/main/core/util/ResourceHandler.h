@@ -17,6 +17,18 @@ private:
 	std::string resourceDirectory;
 	std::string shaderDirectory;
 
+	/**
+	 * The paths a shader file is searched for in, in order.
+	 */
+	std::vector<std::string> getShaderPaths(std::string file) const;
+
+	/**
+	 * Replace every #include "file" line in the shader source with the contents of the file, which is found the same
+	 * way as the shader itself. Included files may include others, up to a fixed depth. A #line directive follows
+	 * each include, so compile errors still report the line in the including file.
+	 */
+	bool expandShaderIncludes(std::string& source, std::string file, int32 depth = 0) const;
+
 public:
 	ResourceHandler(char* exec);
 
@@ -0,0 +1,140 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(uint32 threadCount) {
+	if (threadCount == 0) {
+		uint32 hardwareThreads = std::thread::hardware_concurrency();
+		threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+	}
+
+	this->runningTasks = 0;
+	this->running = true;
+
+	for (int i = 0; i < threadCount; i++) {
+		this->workers.push_back(std::thread(&ThreadPool::workerProc, this));
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->running = false;
+	}
+
+	this->taskCondition.notify_all();
+
+	for (int i = 0; i < this->workers.size(); i++) {
+		this->workers[i].join();
+	}
+}
+
+void ThreadPool::workerProc() {
+	while (true) {
+		Task task;
+
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->taskCondition.wait(lock, [this]() { return !this->running || !this->tasks.empty(); });
+
+			if (this->tasks.empty()) {
+				return; // Not running, and there is nothing left to do.
+			}
+
+			task = std::move(this->tasks.front());
+			this->tasks.pop_front();
+			this->runningTasks++;
+		}
+
+		task();
+
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->runningTasks--;
+		}
+
+		this->idleCondition.notify_all();
+	}
+}
+
+void ThreadPool::submit(Task task) {
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->tasks.push_back(std::move(task));
+	}
+
+	this->taskCondition.notify_one();
+}
+
+void ThreadPool::parallelFor(uint32 count, std::function<void(uint32)> function, uint32 chunkSize) {
+	if (count == 0) {
+		return;
+	}
+
+	const uint32 numThreads = this->workers.size() + 1; // Workers plus the calling thread.
+
+	if (chunkSize == 0) {
+		chunkSize = glm::max(1u, count / (numThreads * 4)); // A few chunks per thread, so that uneven work balances out.
+	}
+
+	// Shared between the calling thread and the helper tasks. Helper tasks may only get picked up after
+	// this function returned, so the state must outlive this stack frame.
+	struct ParallelForState {
+		std::function<void(uint32)> function;
+		std::atomic<uint32> nextChunk;
+		std::atomic<uint32> completedChunks;
+		uint32 numChunks;
+		uint32 chunkSize;
+		uint32 count;
+		std::mutex mutex;
+		std::condition_variable condition;
+
+		void process() {
+			uint32 chunk;
+			while ((chunk = this->nextChunk++) < this->numChunks) {
+				uint32 begin = chunk * this->chunkSize;
+				uint32 end = glm::min(begin + this->chunkSize, this->count);
+
+				for (uint32 i = begin; i < end; i++) {
+					this->function(i);
+				}
+
+				if (++this->completedChunks == this->numChunks) {
+					std::unique_lock<std::mutex> lock(this->mutex);
+					this->condition.notify_all();
+				}
+			}
+		}
+	};
+
+	std::shared_ptr<ParallelForState> state = std::make_shared<ParallelForState>();
+	state->function = function;
+	state->nextChunk = 0;
+	state->completedChunks = 0;
+	state->numChunks = (count + chunkSize - 1) / chunkSize;
+	state->chunkSize = chunkSize;
+	state->count = count;
+
+	const uint32 numHelpers = glm::min(state->numChunks - 1, (uint32) this->workers.size());
+
+	for (int i = 0; i < numHelpers; i++) {
+		this->submit([state]() { state->process(); });
+	}
+
+	state->process();
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->condition.wait(lock, [&state]() { return state->completedChunks == state->numChunks; });
+}
+
+void ThreadPool::waitIdle() {
+	std::unique_lock<std::mutex> lock(this->mutex);
+	this->idleCondition.wait(lock, [this]() { return this->tasks.empty() && this->runningTasks == 0; });
+}
+
+uint32 ThreadPool::getThreadCount() const {
+	return this->workers.size();
+}
+
+uint32 ThreadPool::getPendingTaskCount() {
+	std::unique_lock<std::mutex> lock(this->mutex);
+	return this->tasks.size() + this->runningTasks;
+}
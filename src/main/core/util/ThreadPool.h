@@ -0,0 +1,59 @@
+#pragma once
+
+#include "core/Core.h"
+#include <deque>
+#include <atomic>
+#include <condition_variable>
+
+class ThreadPool {
+	using Task = std::function<void()>;
+
+private:
+	std::vector<std::thread> workers; // The persistent worker threads.
+	std::deque<Task> tasks; // Queue of tasks waiting to be picked up by a worker.
+	std::mutex mutex; // Guards the task queue and the running counter.
+	std::condition_variable taskCondition; // Notified when a task is queued, or when the pool is shutting down.
+	std::condition_variable idleCondition; // Notified when a worker finishes a task, used to wait for the pool to drain.
+
+	uint32 runningTasks; // The number of tasks currently being executed by a worker.
+	bool running; // False when the pool is shutting down.
+
+	void workerProc();
+
+public:
+	/**
+	 * Create a pool with the specified number of worker threads. If the thread count is zero, one
+	 * thread less than the hardware concurrency is used, leaving a core free for the main thread.
+	 */
+	ThreadPool(uint32 threadCount = 0);
+
+	/**
+	 * Finishes all queued tasks, then joins the worker threads.
+	 */
+	~ThreadPool();
+
+	// Deleted copy constructor and assignment function
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	/**
+	 * Queue a task to be executed on one of the worker threads. This function is thread safe.
+	 */
+	void submit(Task task);
+
+	/**
+	 * Split the range [0, count) into chunks, and invoke the function for every index on the worker
+	 * threads. The calling thread also processes chunks, and this function returns once every index
+	 * has been processed.
+	 */
+	void parallelFor(uint32 count, std::function<void(uint32)> function, uint32 chunkSize = 0);
+
+	/**
+	 * Block the calling thread until the task queue is empty, and no tasks are running.
+	 */
+	void waitIdle();
+
+	uint32 getThreadCount() const;
+
+	uint32 getPendingTaskCount();
+};
@@ -86,7 +86,7 @@ void render(double partialTicks, double dt) {
 		double elapsed = Time::time_cast<Time::time_unit, Time::seconds, double>(now - lastTime);
 
 		if (elapsed >= 1.0) {
-			logInfo("%d fps, %.3f GL/km, %.4f km altitude, move speed = %f", fps, Planet::scaleFactor, planet->getAltitude(planet->worldToLocalPoint(camera->getPosition())), viewerMoveSpeed);
+			logInfo("%d fps, %.3f GL/km, %.4f km altitude, move speed = %f", fps, camera->getScaleFactor(), planet->getAltitude(planet->worldToLocalPoint(camera->getPosition())), viewerMoveSpeed);
 			fps = 0;
 			lastTime = now;
 		}
@@ -189,7 +189,7 @@ void render(double partialTicks, double dt) {
 	}
 
 	if (length2(moveVector) > 1e-9) {
-		camera->move(normalize(moveVector) * dt * viewerMoveSpeed / Planet::scaleFactor);
+		camera->move(normalize(moveVector) * dt * viewerMoveSpeed / camera->getScaleFactor());
 	}
 
 	if (INPUT_HANDLER.keyPressed(KEY_F1)) SCENE_GRAPH.toggleWireframeMode();